@@ -194,24 +194,28 @@ class Message:
             utils.add_separator(cfile, 'Message (Query)', self.fullname);
             self._emit_message_creator(hfile, cfile, 'query', self.query, self.query_since)
             self._emit_message_printable(cfile, 'query', self.query)
+            self._emit_message_json(cfile, 'query', self.query)
 
         if self.has_set:
             utils.add_separator(hfile, 'Message (Set)', self.fullname);
             utils.add_separator(cfile, 'Message (Set)', self.fullname);
             self._emit_message_creator(hfile, cfile, 'set', self.set, self.set_since)
             self._emit_message_printable(cfile, 'set', self.set)
+            self._emit_message_json(cfile, 'set', self.set)
 
         if self.has_response:
             utils.add_separator(hfile, 'Message (Response)', self.fullname);
             utils.add_separator(cfile, 'Message (Response)', self.fullname);
             self._emit_message_parser(hfile, cfile, 'response', self.response, self.response_since)
             self._emit_message_printable(cfile, 'response', self.response)
+            self._emit_message_json(cfile, 'response', self.response)
 
         if self.has_notification:
             utils.add_separator(hfile, 'Message (Notification)', self.fullname);
             utils.add_separator(cfile, 'Message (Notification)', self.fullname);
             self._emit_message_parser(hfile, cfile, 'notification', self.notification, self.notification_since)
             self._emit_message_printable(cfile, 'notification', self.notification)
+            self._emit_message_json(cfile, 'notification', self.notification)
 
 
     """
@@ -260,6 +264,8 @@ class Message:
                 inner_template = (' * @${field}: (in): the \'${name}\' field, given as a string.\n')
             elif field['format'] == 'string-array':
                 inner_template = (' * @${field}: (in)(type GStrv): the \'${name}\' field, given as an array of strings.\n')
+            elif field['format'] == 'guint32-array':
+                inner_template = (' * @${field}: (in)(element-type guint32): the \'${name}\' field, given as an array of #guint32 values.\n')
             elif field['format'] == 'struct':
                 inner_template = (' * @${field}: (in): the \'${name}\' field, given as a #${struct}.\n')
             elif field['format'] == 'ms-struct':
@@ -326,6 +332,8 @@ class Message:
                 inner_template = ('    const gchar *${field},\n')
             elif field['format'] == 'string-array':
                 inner_template = ('    const gchar *const *${field},\n')
+            elif field['format'] == 'guint32-array':
+                inner_template = ('    const guint32 *${field},\n')
             elif field['format'] == 'struct':
                 inner_template = ('    const ${struct} *${field},\n')
             elif field['format'] == 'ms-struct':
@@ -391,6 +399,8 @@ class Message:
                 inner_template = ('    const gchar *${field},\n')
             elif field['format'] == 'string-array':
                 inner_template = ('    const gchar *const *${field},\n')
+            elif field['format'] == 'guint32-array':
+                inner_template = ('    const guint32 *${field},\n')
             elif field['format'] == 'struct':
                 inner_template = ('    const ${struct} *${field},\n')
             elif field['format'] == 'ms-struct':
@@ -471,6 +481,8 @@ class Message:
                 inner_template += ('        _mbim_message_command_builder_append_string (builder, ${field});\n')
             elif field['format'] == 'string-array':
                 inner_template += ('        _mbim_message_command_builder_append_string_array (builder, ${field}, ${array_size_field});\n')
+            elif field['format'] == 'guint32-array':
+                inner_template += ('        _mbim_message_command_builder_append_guint32_array (builder, ${field}, ${array_size_field});\n')
             elif field['format'] == 'struct':
                 inner_template += ('        _mbim_message_command_builder_append_${struct_underscore}_struct (builder, ${field});\n')
             elif field['format'] == 'ms-struct':
@@ -555,6 +567,8 @@ class Message:
                 inner_template = (' * @out_${field}: (out)(optional)(transfer full): return location for a newly allocated string, or %NULL if the \'${name}\' field is not needed. Free the returned value with g_free().\n')
             elif field['format'] == 'string-array':
                 inner_template = (' * @out_${field}: (out)(optional)(transfer full)(type GStrv): return location for a newly allocated array of strings, or %NULL if the \'${name}\' field is not needed. Free the returned value with g_strfreev().\n')
+            elif field['format'] == 'guint32-array':
+                inner_template = (' * @out_${field}: (out)(optional)(transfer full)(element-type guint32): return location for a newly allocated array of #guint32 values, or %NULL if the \'${name}\' field is not needed. Free the returned value with g_free().\n')
             elif field['format'] == 'struct':
                 inner_template = (' * @out_${field}: (out)(optional)(transfer full): return location for a newly allocated #${struct}, or %NULL if the \'${name}\' field is not needed. Free the returned value with ${struct_underscore}_free().\n')
             elif field['format'] == 'ms-struct':
@@ -621,6 +635,8 @@ class Message:
                 inner_template = ('    gchar **out_${field},\n')
             elif field['format'] == 'string-array':
                 inner_template = ('    gchar ***out_${field},\n')
+            elif field['format'] == 'guint32-array':
+                inner_template = ('    guint32 **out_${field},\n')
             elif field['format'] == 'struct':
                 inner_template = ('    ${struct} **out_${field},\n')
             elif field['format'] == 'ms-struct':
@@ -687,6 +703,8 @@ class Message:
                 inner_template = ('    gchar **out_${field},\n')
             elif field['format'] == 'string-array':
                 inner_template = ('    gchar ***out_${field},\n')
+            elif field['format'] == 'guint32-array':
+                inner_template = ('    guint32 **out_${field},\n')
             elif field['format'] == 'struct':
                 inner_template = ('    ${struct} **out_${field},\n')
             elif field['format'] == 'ms-struct':
@@ -742,6 +760,9 @@ class Message:
             elif field['format'] == 'string-array':
                 count_allocated_variables += 1
                 inner_template = ('    gchar **_${field} = NULL;\n')
+            elif field['format'] == 'guint32-array':
+                count_allocated_variables += 1
+                inner_template = ('    guint32 *_${field} = NULL;\n')
             elif field['format'] == 'struct':
                 count_allocated_variables += 1
                 inner_template = ('    ${struct} *_${field} = NULL;\n')
@@ -855,6 +876,7 @@ class Message:
                         '            *out_${field} = NULL;\n')
                 elif field['format'] == 'string' or \
                      field['format'] == 'string-array' or \
+                     field['format'] == 'guint32-array' or \
                      field['format'] == 'struct' or \
                      field['format'] == 'ms-struct' or \
                      field['format'] == 'struct-array' or \
@@ -1002,6 +1024,11 @@ class Message:
                     '        if ((out_${field} != NULL) && !_mbim_message_read_string_array (message, _${array_size_field}, 0, offset, ${encoding}, &_${field}, error))\n'
                     '            goto out;\n'
                     '        offset += (8 * _${array_size_field});\n')
+            elif field['format'] == 'guint32-array':
+                inner_template += (
+                    '        if ((out_${field} != NULL) && !_mbim_message_read_guint32_array (message, _${array_size_field}, offset, &_${field}, error))\n'
+                    '            goto out;\n'
+                    '        offset += (4 * _${array_size_field});\n')
             elif field['format'] == 'struct':
                 inner_template += (
                     '        ${struct_type} *tmp;\n'
@@ -1139,6 +1166,7 @@ class Message:
                    field['format'] == 'struct-array' or \
                    field['format'] == 'ref-struct-array' or \
                    field['format'] == 'ms-struct-array' or \
+                   field['format'] == 'guint32-array' or \
                    field['format'] == 'ipv4-array' or \
                    field['format'] == 'ipv6-array' or \
                    field['format'] == 'tlv' or \
@@ -1157,6 +1185,7 @@ class Message:
                 inner_template = ''
                 if field['format'] == 'string' or \
                    field['format'] == 'ipv4-array' or \
+                   field['format'] == 'guint32-array' or \
                    field['format'] == 'ipv6-array' or \
                    field['format'] == 'tlv-string' or \
                    field['format'] == 'tlv-guint16-array':
@@ -1201,13 +1230,13 @@ class Message:
                          'message_type_upper' : message_type.upper() }
         template = (
             '\n'
-            'static gchar *\n'
-            '${underscore}_${message_type}_get_printable (\n'
+            'static gboolean\n'
+            '${underscore}_${message_type}_write_printable (\n'
             '    const MbimMessage *message,\n'
+            '    MbimPrintableSink *sink,\n'
             '    const gchar *line_prefix,\n'
             '    GError **error)\n'
-            '{\n'
-            '    GString *str;\n')
+            '{\n')
 
         if fields != []:
             template += (
@@ -1233,21 +1262,17 @@ class Message:
                 template += (
                     '\n'
                     '    if (!mbim_message_command_get_raw_information_buffer (message, NULL))\n'
-                    '        return NULL;\n')
+                    '        return TRUE;\n')
             elif message_type == 'response':
                 template += (
                     '\n'
                     '    if (!mbim_message_command_done_get_raw_information_buffer (message, NULL))\n'
-                    '        return NULL;\n')
+                    '        return TRUE;\n')
             elif message_type == 'notification':
                 template += (
                     '\n'
                     '    if (!mbim_message_indicate_status_get_raw_information_buffer (message, NULL))\n'
-                    '        return NULL;\n')
-
-        template += (
-            '\n'
-            '    str = g_string_new ("");\n')
+                    '        return TRUE;\n')
 
         for field in fields:
             translations['field']                   = utils.build_underscore_name_from_camelcase(field['name'])
@@ -1267,7 +1292,7 @@ class Message:
 
             inner_template = (
                 '\n'
-                '    g_string_append_printf (str, "%s  ${field_name} = ", line_prefix);\n')
+                '    _mbim_printable_sink_append_printf (sink, "%s  ${field_name} = ", line_prefix);\n')
 
             if 'available-if' in field:
                 condition = field['available-if']
@@ -1286,7 +1311,7 @@ class Message:
                     '            goto out;\n'
                     '        offset += 4;\n'
                     '        ${if_show_field}{\n'
-                    '            g_string_append_printf (str, "\'%" G_GUINT32_FORMAT "\'", _${field});\n'
+                    '            _mbim_printable_sink_append_printf (sink, "\'%" G_GUINT32_FORMAT "\'", _${field});\n'
                     '        }\n')
 
             elif field['format'] == 'byte-array' or \
@@ -1331,10 +1356,10 @@ class Message:
 
                 inner_template += (
                     '        ${if_show_field}{\n'
-                    '            g_string_append (str, "\'");\n'
+                    '            _mbim_printable_sink_append (sink, "\'");\n'
                     '            for (i = 0; i  < tmpsize; i++)\n'
-                    '                g_string_append_printf (str, "%02x%s", tmp[i], (i == (tmpsize - 1)) ? "" : ":" );\n'
-                    '            g_string_append (str, "\'");\n'
+                    '                _mbim_printable_sink_append_printf (sink, "%02x%s", tmp[i], (i == (tmpsize - 1)) ? "" : ":" );\n'
+                    '            _mbim_printable_sink_append (sink, "\'");\n'
                     '        }\n')
 
             elif field['format'] == 'uuid':
@@ -1347,7 +1372,7 @@ class Message:
                     '        offset += 16;\n'
                     '        tmpstr = mbim_uuid_get_printable (&tmp);\n'
                     '        ${if_show_field}{\n'
-                    '            g_string_append_printf (str, "\'%s\'", tmpstr);\n'
+                    '            _mbim_printable_sink_append_printf (sink, "\'%s\'", tmpstr);\n'
                     '        }\n')
 
             elif field['format'] == 'guint16' or \
@@ -1376,7 +1401,7 @@ class Message:
                     if field['public-format'] == 'gboolean':
                         inner_template += (
                             '        ${if_show_field}{\n'
-                            '            g_string_append_printf (str, "\'%s\'", tmp ? "true" : "false");\n'
+                            '            _mbim_printable_sink_append_printf (sink, "\'%s\'", tmp ? "true" : "false");\n'
                             '        }\n'
                             '\n')
                     else:
@@ -1385,12 +1410,12 @@ class Message:
                         inner_template += (
                             '        ${if_show_field}{\n'
                             '#if defined __${public_underscore_upper}_IS_ENUM__\n'
-                            '            g_string_append_printf (str, "\'%s\'", ${public_underscore}_get_string ((${public})tmp));\n'
+                            '            _mbim_printable_sink_append_printf (sink, "\'%s\'", ${public_underscore}_get_string ((${public})tmp));\n'
                             '#elif defined __${public_underscore_upper}_IS_FLAGS__\n'
                             '            g_autofree gchar *tmpstr = NULL;\n'
                             '\n'
                             '            tmpstr = ${public_underscore}_build_string_from_mask ((${public})tmp);\n'
-                            '            g_string_append_printf (str, "\'%s\'", tmpstr);\n'
+                            '            _mbim_printable_sink_append_printf (sink, "\'%s\'", tmpstr);\n'
                             '#else\n'
                             '# error neither enum nor flags\n'
                             '#endif\n'
@@ -1400,17 +1425,17 @@ class Message:
                 elif field['format'] == 'guint16':
                     inner_template += (
                         '        ${if_show_field}{\n'
-                        '            g_string_append_printf (str, "\'%" G_GUINT16_FORMAT "\'", tmp);\n'
+                        '            _mbim_printable_sink_append_printf (sink, "\'%" G_GUINT16_FORMAT "\'", tmp);\n'
                         '        }\n')
                 elif field['format'] == 'guint32':
                     inner_template += (
                         '        ${if_show_field}{\n'
-                        '            g_string_append_printf (str, "\'%" G_GUINT32_FORMAT "\'", tmp);\n'
+                        '            _mbim_printable_sink_append_printf (sink, "\'%" G_GUINT32_FORMAT "\'", tmp);\n'
                         '        }\n')
                 elif field['format'] == 'guint64':
                     inner_template += (
                         '        ${if_show_field}{\n'
-                        '            g_string_append_printf (str, "\'%" G_GUINT64_FORMAT "\'", tmp);\n'
+                        '            _mbim_printable_sink_append_printf (sink, "\'%" G_GUINT64_FORMAT "\'", tmp);\n'
                         '        }\n')
 
             elif field['format'] == 'string':
@@ -1422,7 +1447,7 @@ class Message:
                     '            goto out;\n'
                     '        offset += 8;\n'
                     '        ${if_show_field}{\n'
-                    '            g_string_append_printf (str, "\'%s\'", tmp);\n'
+                    '            _mbim_printable_sink_append_printf (sink, "\'%s\'", tmp);\n'
                     '        }\n')
 
             elif field['format'] == 'string-array':
@@ -1436,13 +1461,29 @@ class Message:
                     '        offset += (8 * _${array_size_field});\n'
                     '\n'
                     '        ${if_show_field}{\n'
-                    '            g_string_append (str, "\'");\n'
+                    '            _mbim_printable_sink_append (sink, "\'");\n'
                     '            for (i = 0; i < _${array_size_field}; i++) {\n'
-                    '                g_string_append (str, tmp[i]);\n'
+                    '                _mbim_printable_sink_append (sink, tmp[i]);\n'
                     '                if (i < (_${array_size_field} - 1))\n'
-                    '                    g_string_append (str, ", ");\n'
+                    '                    _mbim_printable_sink_append (sink, ", ");\n'
                     '            }\n'
-                    '            g_string_append (str, "\'");\n'
+                    '            _mbim_printable_sink_append (sink, "\'");\n'
+                    '        }\n')
+
+            elif field['format'] == 'guint32-array':
+                inner_template += (
+                    '        g_autofree guint32 *tmp = NULL;\n'
+                    '        guint i;\n'
+                    '\n'
+                    '        if (!_mbim_message_read_guint32_array (message, _${array_size_field}, offset, &tmp, &inner_error))\n'
+                    '            goto out;\n'
+                    '        offset += (4 * _${array_size_field});\n'
+                    '\n'
+                    '        ${if_show_field}{\n'
+                    '            _mbim_printable_sink_append (sink, "\'");\n'
+                    '            for (i = 0; i < _${array_size_field}; i++)\n'
+                    '                _mbim_printable_sink_append_printf (sink, "%" G_GUINT32_FORMAT "%s", tmp[i], (i == (_${array_size_field} - 1)) ? "" : ",");\n'
+                    '            _mbim_printable_sink_append (sink, "\'");\n'
                     '        }\n')
 
             elif field['format'] == 'struct':
@@ -1456,13 +1497,11 @@ class Message:
                     '        offset += bytes_read;\n'
                     '        ${if_show_field}{\n'
                     '            g_autofree gchar *new_line_prefix = NULL;\n'
-                    '            g_autofree gchar *struct_str = NULL;\n'
                     '\n'
-                    '            g_string_append (str, "{\\n");\n'
+                    '            _mbim_printable_sink_append (sink, "{\\n");\n'
                     '            new_line_prefix = g_strdup_printf ("%s    ", line_prefix);\n'
-                    '            struct_str = _mbim_message_print_${struct_name}_struct (tmp, new_line_prefix);\n'
-                    '            g_string_append (str, struct_str);\n'
-                    '            g_string_append_printf (str, "%s  }", line_prefix);\n'
+                    '            _mbim_message_print_${struct_name}_struct (tmp, sink, new_line_prefix);\n'
+                    '            _mbim_printable_sink_append_printf (sink, "%s  }", line_prefix);\n'
                     '        }\n')
 
             elif field['format'] == 'ms-struct':
@@ -1475,14 +1514,11 @@ class Message:
                     '        ${if_show_field}{\n'
                     '            g_autofree gchar *new_line_prefix = NULL;\n'
                     '\n'
-                    '            g_string_append (str, "{\\n");\n'
+                    '            _mbim_printable_sink_append (sink, "{\\n");\n'
                     '            new_line_prefix = g_strdup_printf ("%s    ", line_prefix);\n'
-                    '            if (tmp) {\n'
-                    '                g_autofree gchar *struct_str = NULL;\n'
-                    '                struct_str = _mbim_message_print_${struct_name}_struct (tmp, new_line_prefix);\n'
-                    '                g_string_append (str, struct_str);\n'
-                    '            }\n'
-                    '            g_string_append_printf (str, "%s  }", line_prefix);\n'
+                    '            if (tmp)\n'
+                    '                _mbim_message_print_${struct_name}_struct (tmp, sink, new_line_prefix);\n'
+                    '            _mbim_printable_sink_append_printf (sink, "%s  }", line_prefix);\n'
                     '        }\n')
 
             elif field['format'] == 'struct-array' or field['format'] == 'ref-struct-array' or field['format'] == 'ms-struct-array':
@@ -1516,7 +1552,7 @@ class Message:
                     '            g_autofree gchar *new_line_prefix = NULL;\n'
                     '\n'
                     '            new_line_prefix = g_strdup_printf ("%s        ", line_prefix);\n'
-                    '            g_string_append (str, "\'{\\n");\n')
+                    '            _mbim_printable_sink_append (sink, "\'{\\n");\n')
 
                 if field['format'] == 'ms-struct-array':
                     inner_template += (
@@ -1526,14 +1562,11 @@ class Message:
                         '            for (i = 0; i < _${array_size_field}; i++) {\n')
 
                 inner_template += (
-                    '                g_autofree gchar *struct_str = NULL;\n'
-                    '\n'
-                    '                g_string_append_printf (str, "%s    [%u] = {\\n", line_prefix, i);\n'
-                    '                struct_str = _mbim_message_print_${struct_name}_struct (tmp[i], new_line_prefix);\n'
-                    '                g_string_append (str, struct_str);\n'
-                    '                g_string_append_printf (str, "%s    },\\n", line_prefix);\n'
+                    '                _mbim_printable_sink_append_printf (sink, "%s    [%u] = {\\n", line_prefix, i);\n'
+                    '                _mbim_message_print_${struct_name}_struct (tmp[i], sink, new_line_prefix);\n'
+                    '                _mbim_printable_sink_append_printf (sink, "%s    },\\n", line_prefix);\n'
                     '            }\n'
-                    '            g_string_append_printf (str, "%s  }\'", line_prefix);\n'
+                    '            _mbim_printable_sink_append_printf (sink, "%s  }\'", line_prefix);\n'
                     '        }\n')
 
             elif field['format'] == 'ref-ipv4' or \
@@ -1585,7 +1618,7 @@ class Message:
 
                 inner_template += (
                     '        ${if_show_field}{\n'
-                    '            g_string_append (str, "\'");\n'
+                    '            _mbim_printable_sink_append (sink, "\'");\n'
                     '            if (tmp) {\n'
                     '                for (i = 0; i < array_size; i++) {\n'
                     '                    g_autoptr(GInetAddress)  addr = NULL;\n'
@@ -1603,12 +1636,12 @@ class Message:
 
                 inner_template += (
                     '                    tmpstr = g_inet_address_to_string (addr);\n'
-                    '                    g_string_append_printf (str, "%s", tmpstr);\n'
+                    '                    _mbim_printable_sink_append_printf (sink, "%s", tmpstr);\n'
                     '                    if (i < (array_size - 1))\n'
-                    '                        g_string_append (str, ", ");\n'
+                    '                        _mbim_printable_sink_append (sink, ", ");\n'
                     '                }\n'
                     '            }\n'
-                    '            g_string_append (str, "\'");\n'
+                    '            _mbim_printable_sink_append (sink, "\'");\n'
                     '        }\n')
 
             elif field['format'] == 'tlv' or \
@@ -1628,7 +1661,7 @@ class Message:
                     '\n'
                     '            new_line_prefix = g_strdup_printf ("%s  ", line_prefix);\n'
                     '            tlv_str = _mbim_tlv_print (tmp, new_line_prefix);\n'
-                    '            g_string_append_printf (str, "\'%s\'", tlv_str);\n'
+                    '            _mbim_printable_sink_append_printf (sink, "\'%s\'", tlv_str);\n'
                     '        }\n')
 
             elif field['format'] == 'tlv-list':
@@ -1645,14 +1678,14 @@ class Message:
                     '            GList *walker = NULL;\n'
                     '\n'
                     '            new_line_prefix = g_strdup_printf ("%s    ", line_prefix);\n'
-                    '            g_string_append (str, "\'[ ");\n'
+                    '            _mbim_printable_sink_append (sink, "\'[ ");\n'
                     '            for (walker = tmp; walker; walker = g_list_next (walker)) {\n'
                     '                g_autofree gchar *tlv_str = NULL;\n'
                     '\n'
                     '                tlv_str = _mbim_tlv_print ((MbimTlv *)walker->data, new_line_prefix);\n'
-                    '                g_string_append_printf (str, "%s,", tlv_str);\n'
+                    '                _mbim_printable_sink_append_printf (sink, "%s,", tlv_str);\n'
                     '            }\n'
-                    '            g_string_append_printf (str, "\\n%s  ]\'", line_prefix);\n'
+                    '            _mbim_printable_sink_append_printf (sink, "\\n%s  ]\'", line_prefix);\n'
                     '        }\n'
                     '        g_list_free_full (tmp, (GDestroyNotify)mbim_tlv_unref);\n')
 
@@ -1662,11 +1695,11 @@ class Message:
             if 'personal-info' in field:
                 inner_template += (
                     '        if (!show_field)\n'
-                    '           g_string_append (str, "\'###\'");\n')
+                    '           _mbim_printable_sink_append (sink, "\'###\'");\n')
 
             inner_template += (
                 '    }\n'
-                '    g_string_append (str, "\\n");\n')
+                '    _mbim_printable_sink_append (sink, "\\n");\n')
 
             template += (string.Template(inner_template).substitute(translations))
 
@@ -1675,13 +1708,499 @@ class Message:
                 '\n'
                 ' out:\n'
                 '    if (inner_error) {\n'
-                '        g_string_append_printf (str, "n/a: %s", inner_error->message);\n'
+                '        _mbim_printable_sink_append_printf (sink, "n/a: %s", inner_error->message);\n'
                 '        g_clear_error (&inner_error);\n'
-                '    }\n')
+                '    }\n'
+                '\n')
 
         template += (
+            '    return TRUE;\n'
+            '}\n')
+        cfile.write(string.Template(template).substitute(translations))
+
+
+    """
+    Emit the message JSON writer
+    """
+    def _emit_message_json(self, cfile, message_type, fields):
+        translations = { 'message'            : self.name,
+                         'service'            : self.service,
+                         'underscore'         : utils.build_underscore_name (self.fullname),
+                         'message_type'       : message_type,
+                         'message_type_upper' : message_type.upper() }
+        template = (
             '\n'
-            '    return g_string_free (str, FALSE);\n'
+            'static gboolean\n'
+            '${underscore}_${message_type}_write_json (\n'
+            '    const MbimMessage *message,\n'
+            '    MbimPrintableSink *sink,\n'
+            '    GError **error)\n'
+            '{\n')
+
+        if fields != []:
+            template += (
+                '    GError *inner_error = NULL;\n'
+                '    guint32 offset = 0;\n')
+
+        for field in fields:
+            if 'always-read' in field:
+                translations['field'] = utils.build_underscore_name_from_camelcase(field['name'])
+                inner_template = ('    guint32 _${field};\n')
+                template += (string.Template(inner_template).substitute(translations))
+
+        for field in fields:
+            if 'personal-info' in field:
+                template += (
+                    '    gboolean show_field;\n'
+                    '\n'
+                    '    show_field = mbim_utils_get_show_personal_info ();\n')
+                break
+
+        if fields != []:
+            if message_type == 'set' or message_type == 'query':
+                template += (
+                    '\n'
+                    '    if (!mbim_message_command_get_raw_information_buffer (message, NULL))\n'
+                    '        return TRUE;\n')
+            elif message_type == 'response':
+                template += (
+                    '\n'
+                    '    if (!mbim_message_command_done_get_raw_information_buffer (message, NULL))\n'
+                    '        return TRUE;\n')
+            elif message_type == 'notification':
+                template += (
+                    '\n'
+                    '    if (!mbim_message_indicate_status_get_raw_information_buffer (message, NULL))\n'
+                    '        return TRUE;\n')
+
+        first = True
+        for field in fields:
+            translations['field']                   = utils.build_underscore_name_from_camelcase(field['name'])
+            translations['field_format']            = field['format']
+            translations['public']                  = field['public-format'] if 'public-format' in field else field['format']
+            translations['field_name']              = field['name']
+            translations['array_size_field']        = utils.build_underscore_name_from_camelcase(field['array-size-field']) if 'array-size-field' in field else ''
+            translations['struct_name']             = utils.build_underscore_name_from_camelcase(field['struct-type']) if 'struct-type' in field else ''
+            translations['struct_type']             = field['struct-type'] if 'struct-type' in field else ''
+            translations['array_size']              = field['array-size'] if 'array-size' in field else ''
+            translations['separator']               = '' if first else ','
+            first = False
+
+            if 'personal-info' in field:
+                translations['if_show_field'] = 'if (show_field) '
+            else:
+                translations['if_show_field'] = ''
+
+            inner_template = (
+                '\n'
+                '    _mbim_printable_sink_append (sink, "${separator}\\"${field_name}\\":");\n')
+
+            if 'available-if' in field:
+                condition = field['available-if']
+                translations['condition_field'] = utils.build_underscore_name_from_camelcase(condition['field'])
+                translations['condition_operation'] = condition['operation']
+                translations['condition_value'] = condition['value']
+                inner_template += (
+                    '    if (!(_${condition_field} ${condition_operation} ${condition_value}))\n'
+                    '        _mbim_printable_sink_append (sink, "null");\n'
+                    '    else {\n')
+            else:
+                inner_template += (
+                    '    {\n')
+
+            if 'always-read' in field:
+                inner_template += (
+                    '        if (!_mbim_message_read_guint32 (message, offset, &_${field}, &inner_error))\n'
+                    '            goto out;\n'
+                    '        offset += 4;\n'
+                    '        ${if_show_field}{\n'
+                    '            _mbim_printable_sink_append_printf (sink, "%" G_GUINT32_FORMAT, _${field});\n'
+                    '        }\n')
+
+            elif field['format'] == 'byte-array' or \
+                 field['format'] == 'unsized-byte-array' or \
+                 field['format'] == 'ref-byte-array' or \
+                 field['format'] == 'uicc-ref-byte-array' or \
+                 field['format'] == 'ref-byte-array-no-offset':
+                inner_template += (
+                    '        const guint8 *tmp;\n'
+                    '        guint32 tmpsize;\n'
+                    '\n')
+                if field['format'] == 'byte-array':
+                    inner_template += (
+                        '        if (!_mbim_message_read_byte_array (message, 0, offset, FALSE, FALSE, ${array_size}, &tmp, NULL, &inner_error, FALSE))\n'
+                        '            goto out;\n'
+                        '        tmpsize = ${array_size};\n'
+                        '        offset += ${array_size};\n')
+                elif field['format'] == 'unsized-byte-array':
+                    inner_template += (
+                        '        if (!_mbim_message_read_byte_array (message, 0, offset, FALSE, FALSE, 0, &tmp, &tmpsize, &inner_error, FALSE))\n'
+                        '            goto out;\n'
+                        '        offset += tmpsize;\n')
+                elif field['format'] == 'ref-byte-array':
+                    inner_template += (
+                        '        if (!_mbim_message_read_byte_array (message, 0, offset, TRUE, TRUE, 0, &tmp, &tmpsize, &inner_error, FALSE))\n'
+                        '            goto out;\n'
+                        '        offset += 8;\n')
+                elif field['format'] == 'uicc-ref-byte-array':
+                    inner_template += (
+                        '        if (!_mbim_message_read_byte_array (message, 0, offset, TRUE, TRUE, 0, &tmp, &tmpsize, &inner_error, TRUE))\n'
+                        '            goto out;\n'
+                        '        offset += 8;\n')
+                elif field['format'] == 'ref-byte-array-no-offset':
+                    inner_template += (
+                        '        if (!_mbim_message_read_byte_array (message, 0, offset, FALSE, TRUE, 0, &tmp, &tmpsize, &inner_error, FALSE))\n'
+                        '            goto out;\n'
+                        '        offset += 4;\n')
+
+                inner_template += (
+                    '        ${if_show_field}{\n'
+                    '            _mbim_json_write_hex (sink, tmp, tmpsize);\n'
+                    '        }\n')
+
+            elif field['format'] == 'uuid':
+                inner_template += (
+                    '        MbimUuid          tmp;\n'
+                    '        g_autofree gchar *tmpstr = NULL;\n'
+                    '\n'
+                    '        if (!_mbim_message_read_uuid (message, offset, NULL, &tmp, &inner_error))\n'
+                    '            goto out;\n'
+                    '        offset += 16;\n'
+                    '        tmpstr = mbim_uuid_get_printable (&tmp);\n'
+                    '        ${if_show_field}{\n'
+                    '            _mbim_json_write_string (sink, tmpstr);\n'
+                    '        }\n')
+
+            elif field['format'] == 'guint16' or \
+                 field['format'] == 'guint32' or \
+                 field['format'] == 'guint64':
+                inner_template += (
+                    '        ${field_format} tmp;\n'
+                    '\n')
+                if field['format'] == 'guint16' :
+                    inner_template += (
+                        '        if (!_mbim_message_read_guint16 (message, offset, &tmp, &inner_error))\n'
+                        '            goto out;\n'
+                        '        offset += 2;\n')
+                elif field['format'] == 'guint32' :
+                    inner_template += (
+                        '        if (!_mbim_message_read_guint32 (message, offset, &tmp, &inner_error))\n'
+                        '            goto out;\n'
+                        '        offset += 4;\n')
+                elif field['format'] == 'guint64' :
+                    inner_template += (
+                        '        if (!_mbim_message_read_guint64 (message, offset, &tmp, &inner_error))\n'
+                        '            goto out;\n'
+                        '        offset += 8;\n')
+
+                if 'public-format' in field:
+                    if field['public-format'] == 'gboolean':
+                        inner_template += (
+                            '        ${if_show_field}{\n'
+                            '            _mbim_printable_sink_append (sink, tmp ? "true" : "false");\n'
+                            '        }\n')
+                    else:
+                        translations['public_underscore']       = utils.build_underscore_name_from_camelcase(field['public-format'])
+                        translations['public_underscore_upper'] = utils.build_underscore_name_from_camelcase(field['public-format']).upper()
+                        inner_template += (
+                            '        ${if_show_field}{\n'
+                            '#if defined __${public_underscore_upper}_IS_ENUM__\n'
+                            '            _mbim_json_write_enum (sink, ${public_underscore}_get_string ((${public})tmp), (guint64)tmp);\n'
+                            '#elif defined __${public_underscore_upper}_IS_FLAGS__\n'
+                            '            g_autofree gchar *tmpstr = NULL;\n'
+                            '\n'
+                            '            tmpstr = ${public_underscore}_build_string_from_mask ((${public})tmp);\n'
+                            '            _mbim_json_write_string (sink, tmpstr);\n'
+                            '#else\n'
+                            '# error neither enum nor flags\n'
+                            '#endif\n'
+                            '        }\n')
+
+                elif field['format'] == 'guint16':
+                    inner_template += (
+                        '        ${if_show_field}{\n'
+                        '            _mbim_printable_sink_append_printf (sink, "%" G_GUINT16_FORMAT, tmp);\n'
+                        '        }\n')
+                elif field['format'] == 'guint32':
+                    inner_template += (
+                        '        ${if_show_field}{\n'
+                        '            _mbim_printable_sink_append_printf (sink, "%" G_GUINT32_FORMAT, tmp);\n'
+                        '        }\n')
+                elif field['format'] == 'guint64':
+                    inner_template += (
+                        '        ${if_show_field}{\n'
+                        '            _mbim_printable_sink_append_printf (sink, "%" G_GUINT64_FORMAT, tmp);\n'
+                        '        }\n')
+
+            elif field['format'] == 'string':
+                translations['encoding'] = 'MBIM_STRING_ENCODING_UTF8' if 'encoding' in field and field['encoding'] == 'utf-8' else 'MBIM_STRING_ENCODING_UTF16'
+                inner_template += (
+                    '        g_autofree gchar *tmp = NULL;\n'
+                    '\n'
+                    '        if (!_mbim_message_read_string (message, 0, offset, ${encoding}, &tmp, NULL, &inner_error))\n'
+                    '            goto out;\n'
+                    '        offset += 8;\n'
+                    '        ${if_show_field}{\n'
+                    '            _mbim_json_write_string (sink, tmp);\n'
+                    '        }\n')
+
+            elif field['format'] == 'string-array':
+                translations['encoding'] = 'MBIM_STRING_ENCODING_UTF8' if 'encoding' in field and field['encoding'] == 'utf-8' else 'MBIM_STRING_ENCODING_UTF16'
+                inner_template += (
+                    '        g_auto(GStrv) tmp = NULL;\n'
+                    '        guint i;\n'
+                    '\n'
+                    '        if (!_mbim_message_read_string_array (message, _${array_size_field}, 0, offset, ${encoding}, &tmp, &inner_error))\n'
+                    '            goto out;\n'
+                    '        offset += (8 * _${array_size_field});\n'
+                    '\n'
+                    '        ${if_show_field}{\n'
+                    '            _mbim_printable_sink_append (sink, "[");\n'
+                    '            for (i = 0; i < _${array_size_field}; i++) {\n'
+                    '                if (i)\n'
+                    '                    _mbim_printable_sink_append (sink, ",");\n'
+                    '                _mbim_json_write_string (sink, tmp[i]);\n'
+                    '            }\n'
+                    '            _mbim_printable_sink_append (sink, "]");\n'
+                    '        }\n')
+
+            elif field['format'] == 'guint32-array':
+                inner_template += (
+                    '        g_autofree guint32 *tmp = NULL;\n'
+                    '        guint i;\n'
+                    '\n'
+                    '        if (!_mbim_message_read_guint32_array (message, _${array_size_field}, offset, &tmp, &inner_error))\n'
+                    '            goto out;\n'
+                    '        offset += (4 * _${array_size_field});\n'
+                    '\n'
+                    '        ${if_show_field}{\n'
+                    '            _mbim_printable_sink_append (sink, "[");\n'
+                    '            for (i = 0; i < _${array_size_field}; i++)\n'
+                    '                _mbim_printable_sink_append_printf (sink, "%s%" G_GUINT32_FORMAT, i ? "," : "", tmp[i]);\n'
+                    '            _mbim_printable_sink_append (sink, "]");\n'
+                    '        }\n')
+
+            elif field['format'] == 'struct':
+                inner_template += (
+                    '        g_autoptr(${struct_type}) tmp = NULL;\n'
+                    '        guint32 bytes_read = 0;\n'
+                    '\n'
+                    '        tmp = _mbim_message_read_${struct_name}_struct (message, offset, &bytes_read, &inner_error);\n'
+                    '        if (!tmp)\n'
+                    '            goto out;\n'
+                    '        offset += bytes_read;\n'
+                    '        ${if_show_field}{\n'
+                    '            _mbim_message_json_${struct_name}_struct (tmp, sink);\n'
+                    '        }\n')
+
+            elif field['format'] == 'ms-struct':
+                inner_template += (
+                    '        g_autoptr(${struct_type}) tmp = NULL;\n'
+                    '\n'
+                    '        if (!_mbim_message_read_${struct_name}_ms_struct (message, offset, &tmp, &inner_error))\n'
+                    '            goto out;\n'
+                    '        offset += 8;\n'
+                    '        ${if_show_field}{\n'
+                    '            if (tmp)\n'
+                    '                _mbim_message_json_${struct_name}_struct (tmp, sink);\n'
+                    '            else\n'
+                    '                _mbim_printable_sink_append (sink, "null");\n'
+                    '        }\n')
+
+            elif field['format'] == 'struct-array' or field['format'] == 'ref-struct-array' or field['format'] == 'ms-struct-array':
+                inner_template += (
+                    '        g_autoptr(${struct_type}Array) tmp = NULL;\n')
+                if field['format'] == 'ms-struct-array':
+                    inner_template += (
+                        '        guint32 tmp_count = 0;\n')
+                inner_template += (
+                    '\n')
+
+                if field['format'] == 'struct-array':
+                    inner_template += (
+                    '        if (!_mbim_message_read_${struct_name}_struct_array (message, _${array_size_field}, offset, &tmp, &inner_error))\n'
+                    '            goto out;\n'
+                    '        offset += 4;\n')
+                elif field['format'] == 'ref-struct-array':
+                    inner_template += (
+                    '        if (!_mbim_message_read_${struct_name}_ref_struct_array (message, _${array_size_field}, offset, &tmp, &inner_error))\n'
+                    '            goto out;\n'
+                    '        offset += (8 * _${array_size_field});\n')
+                elif field['format'] == 'ms-struct-array':
+                    inner_template += (
+                    '        if (!_mbim_message_read_${struct_name}_ms_struct_array (message, offset, &tmp_count, &tmp, &inner_error))\n'
+                    '            goto out;\n'
+                    '        offset += 8;\n')
+
+                inner_template += (
+                    '        ${if_show_field}{\n'
+                    '            guint i;\n'
+                    '\n'
+                    '            _mbim_printable_sink_append (sink, "[");\n')
+
+                if field['format'] == 'ms-struct-array':
+                    inner_template += (
+                        '            for (i = 0; i < tmp_count; i++) {\n')
+                else:
+                    inner_template += (
+                        '            for (i = 0; i < _${array_size_field}; i++) {\n')
+
+                inner_template += (
+                    '                if (i)\n'
+                    '                    _mbim_printable_sink_append (sink, ",");\n'
+                    '                _mbim_message_json_${struct_name}_struct (tmp[i], sink);\n'
+                    '            }\n'
+                    '            _mbim_printable_sink_append (sink, "]");\n'
+                    '        }\n')
+
+            elif field['format'] == 'ref-ipv4' or \
+                 field['format'] == 'ipv4-array' or \
+                 field['format'] == 'ref-ipv6' or \
+                 field['format'] == 'ipv6-array':
+                if field['format'] == 'ref-ipv4':
+                    inner_template += (
+                        '        const MbimIPv4 *tmp;\n')
+                elif field['format'] == 'ipv4-array':
+                    inner_template += (
+                        '        g_autofree MbimIPv4 *tmp = NULL;\n')
+                elif field['format'] == 'ref-ipv6':
+                    inner_template += (
+                        '        const MbimIPv6 *tmp;\n')
+                elif field['format'] == 'ipv6-array':
+                    inner_template += (
+                        '        g_autofree MbimIPv6 *tmp = NULL;\n')
+
+                inner_template += (
+                    '        guint array_size;\n'
+                    '        guint i;\n'
+                    '\n')
+
+                if field['format'] == 'ref-ipv4':
+                    inner_template += (
+                        '        array_size = 1;\n'
+                        '        if (!_mbim_message_read_ipv4 (message, offset, TRUE, &tmp, NULL, &inner_error))\n'
+                        '            goto out;\n'
+                        '        offset += 4;\n')
+                elif field['format'] == 'ipv4-array':
+                    inner_template += (
+                        '        array_size = _${array_size_field};\n'
+                        '        if (!_mbim_message_read_ipv4_array (message, _${array_size_field}, offset, &tmp, &inner_error))\n'
+                        '            goto out;\n'
+                        '        offset += 4;\n')
+                elif field['format'] == 'ref-ipv6':
+                    inner_template += (
+                        '        array_size = 1;\n'
+                        '        if (!_mbim_message_read_ipv6 (message, offset, TRUE, &tmp, NULL, &inner_error))\n'
+                        '            goto out;\n'
+                        '        offset += 4;\n')
+                elif field['format'] == 'ipv6-array':
+                    inner_template += (
+                        '        array_size = _${array_size_field};\n'
+                        '        if (!_mbim_message_read_ipv6_array (message, _${array_size_field}, offset, &tmp, &inner_error))\n'
+                        '            goto out;\n'
+                        '        offset += 4;\n')
+
+                if field['format'] == 'ref-ipv4' or \
+                   field['format'] == 'ipv4-array':
+                    translations['family'] = 'G_SOCKET_FAMILY_IPV4'
+                else:
+                    translations['family'] = 'G_SOCKET_FAMILY_IPV6'
+
+                # Single references are written as a plain (nullable) string,
+                # arrays as a JSON array of strings
+                if field['format'] == 'ref-ipv4' or \
+                   field['format'] == 'ref-ipv6':
+                    translations['open'] = ''
+                    translations['close'] = ''
+                else:
+                    translations['open'] = '['
+                    translations['close'] = ']'
+
+                inner_template += (
+                    '        ${if_show_field}{\n'
+                    '            if (!tmp)\n'
+                    '                _mbim_printable_sink_append (sink, "${open}null${close}");\n'
+                    '            else {\n'
+                    '                _mbim_printable_sink_append (sink, "${open}");\n'
+                    '                for (i = 0; i < array_size; i++) {\n'
+                    '                    g_autoptr(GInetAddress)  addr = NULL;\n'
+                    '                    g_autofree gchar        *tmpstr = NULL;\n'
+                    '\n'
+                    '                    addr = g_inet_address_new_from_bytes ((guint8 *)&(tmp[i].addr), ${family});\n'
+                    '                    tmpstr = g_inet_address_to_string (addr);\n'
+                    '                    if (i)\n'
+                    '                        _mbim_printable_sink_append (sink, ",");\n'
+                    '                    _mbim_json_write_string (sink, tmpstr);\n'
+                    '                }\n'
+                    '                _mbim_printable_sink_append (sink, "${close}");\n'
+                    '            }\n'
+                    '        }\n')
+
+            elif field['format'] == 'tlv' or \
+                 field['format'] == 'tlv-string' or \
+                 field['format'] == 'tlv-guint16-array':
+                inner_template += (
+                    '        g_autoptr(MbimTlv) tmp = NULL;\n'
+                    '        guint32 bytes_read = 0;\n'
+                    '\n'
+                    '        if (!_mbim_message_read_tlv (message, offset, &tmp, &bytes_read, &inner_error))\n'
+                    '            goto out;\n'
+                    '        offset += bytes_read;\n'
+                    '\n'
+                    '        ${if_show_field}{\n'
+                    '            _mbim_json_write_tlv (sink, tmp);\n'
+                    '        }\n')
+
+            elif field['format'] == 'tlv-list':
+                inner_template += (
+                    '        GList *tmp = NULL;\n'
+                    '        guint32 bytes_read = 0;\n'
+                    '\n'
+                    '        if (!_mbim_message_read_tlv_list (message, offset, &tmp, &bytes_read, &inner_error))\n'
+                    '            goto out;\n'
+                    '        offset += bytes_read;\n'
+                    '\n'
+                    '        ${if_show_field}{\n'
+                    '            GList *walker = NULL;\n'
+                    '\n'
+                    '            _mbim_printable_sink_append (sink, "[");\n'
+                    '            for (walker = tmp; walker; walker = g_list_next (walker)) {\n'
+                    '                if (walker != tmp)\n'
+                    '                    _mbim_printable_sink_append (sink, ",");\n'
+                    '                _mbim_json_write_tlv (sink, (MbimTlv *)walker->data);\n'
+                    '            }\n'
+                    '            _mbim_printable_sink_append (sink, "]");\n'
+                    '        }\n'
+                    '        g_list_free_full (tmp, (GDestroyNotify)mbim_tlv_unref);\n')
+
+            else:
+                raise ValueError('Field format \'%s\' not serializable to JSON' % field['format'])
+
+            if 'personal-info' in field:
+                inner_template += (
+                    '        if (!show_field)\n'
+                    '           _mbim_printable_sink_append (sink, "\\"###\\"");\n')
+
+            inner_template += (
+                '    }\n')
+
+            template += (string.Template(inner_template).substitute(translations))
+
+        if fields != []:
+            template += (
+                '\n'
+                ' out:\n'
+                '    /* The field being read is left as null, and the error is\n'
+                '     * reported once for the whole message */\n'
+                '    if (inner_error) {\n'
+                '        _mbim_printable_sink_append (sink, "null");\n'
+                '        g_propagate_error (error, inner_error);\n'
+                '        return FALSE;\n'
+                '    }\n'
+                '\n')
+
+        template += (
+            '    return TRUE;\n'
             '}\n')
         cfile.write(string.Template(template).substitute(translations))
 
@@ -96,25 +96,31 @@ class ObjectList:
 
 
     """
-    Emit support for printing messages in a single service
+    Emit support for writing message fields in a single service, either as
+    printable text ('printable') or as JSON ('json')
     """
-    def emit_printable_service(self, hfile, cfile, service):
+    def emit_writer_service(self, hfile, cfile, service, writer):
         translations = { 'service_underscore' : utils.build_underscore_name(service),
-                         'service'            : service }
+                         'service'            : service,
+                         'writer'             : writer,
+                         'callbacks'          : 'WritePrintableCallbacks' if writer == 'printable' else 'WriteJsonCallbacks',
+                         'line_prefix_param'  : '    const gchar *line_prefix,\n' if writer == 'printable' else '',
+                         'line_prefix_arg'    : ' line_prefix,' if writer == 'printable' else '' }
 
         template = (
             '\n'
             'G_GNUC_INTERNAL\n'
-            'gchar *\n'
-            '__mbim_message_${service_underscore}_get_printable_fields (\n'
+            'gboolean\n'
+            '__mbim_message_${service_underscore}_write_${writer}_fields (\n'
             '    const MbimMessage *message,\n'
-            '    const gchar *line_prefix,\n'
+            '    MbimPrintableSink *sink,\n'
+            '${line_prefix_param}'
             '    GError **error);\n')
         hfile.write(string.Template(template).substitute(translations))
 
         template = (
             '\n'
-            'static const GetPrintableCallbacks ${service_underscore}_get_printable_callbacks[] = {\n')
+            'static const ${callbacks} ${service_underscore}_write_${writer}_callbacks[] = {\n')
 
         for item in self.command_list:
             if item.service == service:
@@ -124,16 +130,16 @@ class ObjectList:
                     '    [${cid}] = {\n')
                 if item.has_query:
                     inner_template += (
-                        '        .query_cb = ${message}_query_get_printable,\n')
+                        '        .query_cb = ${message}_query_write_${writer},\n')
                 if item.has_set:
                     inner_template += (
-                        '        .set_cb = ${message}_set_get_printable,\n')
+                        '        .set_cb = ${message}_set_write_${writer},\n')
                 if item.has_response:
                     inner_template += (
-                        '        .response_cb = ${message}_response_get_printable,\n')
+                        '        .response_cb = ${message}_response_write_${writer},\n')
                 if item.has_notification:
                     inner_template += (
-                        '        .notification_cb = ${message}_notification_get_printable,\n')
+                        '        .notification_cb = ${message}_notification_write_${writer},\n')
                 inner_template += (
                     '    },\n')
                 template += (string.Template(inner_template).substitute(translations))
@@ -141,10 +147,11 @@ class ObjectList:
         template += (
             '};\n'
             '\n'
-            'gchar *\n'
-            '__mbim_message_${service_underscore}_get_printable_fields (\n'
+            'gboolean\n'
+            '__mbim_message_${service_underscore}_write_${writer}_fields (\n'
             '    const MbimMessage *message,\n'
-            '    const gchar *line_prefix,\n'
+            '    MbimPrintableSink *sink,\n'
+            '${line_prefix_param}'
             '    GError **error)\n'
             '{\n'
             '    guint32 cid;\n'
@@ -152,15 +159,15 @@ class ObjectList:
             '    switch (mbim_message_get_message_type (message)) {\n'
             '        case MBIM_MESSAGE_TYPE_COMMAND: {\n'
             '            cid = mbim_message_command_get_cid (message);\n'
-            '            if (cid < G_N_ELEMENTS (${service_underscore}_get_printable_callbacks)) {\n'
+            '            if (cid < G_N_ELEMENTS (${service_underscore}_write_${writer}_callbacks)) {\n'
             '                switch (mbim_message_command_get_command_type (message)) {\n'
             '                    case MBIM_MESSAGE_COMMAND_TYPE_QUERY:\n'
-            '                        if (${service_underscore}_get_printable_callbacks[cid].query_cb)\n'
-            '                            return ${service_underscore}_get_printable_callbacks[cid].query_cb (message, line_prefix, error);\n'
+            '                        if (${service_underscore}_write_${writer}_callbacks[cid].query_cb)\n'
+            '                            return ${service_underscore}_write_${writer}_callbacks[cid].query_cb (message, sink,${line_prefix_arg} error);\n'
             '                        break;\n'
             '                    case MBIM_MESSAGE_COMMAND_TYPE_SET:\n'
-            '                        if (${service_underscore}_get_printable_callbacks[cid].set_cb)\n'
-            '                            return ${service_underscore}_get_printable_callbacks[cid].set_cb (message, line_prefix, error);\n'
+            '                        if (${service_underscore}_write_${writer}_callbacks[cid].set_cb)\n'
+            '                            return ${service_underscore}_write_${writer}_callbacks[cid].set_cb (message, sink,${line_prefix_arg} error);\n'
             '                        break;\n'
             '                    case MBIM_MESSAGE_COMMAND_TYPE_UNKNOWN:\n'
             '                    default:\n'
@@ -168,7 +175,7 @@ class ObjectList:
             '                                     MBIM_CORE_ERROR,\n'
             '                                     MBIM_CORE_ERROR_INVALID_MESSAGE,\n'
             '                                     \"Invalid command type\");\n'
-            '                        return NULL;\n'
+            '                        return FALSE;\n'
             '                }\n'
             '            }\n'
             '            break;\n'
@@ -176,17 +183,17 @@ class ObjectList:
             '\n'
             '        case MBIM_MESSAGE_TYPE_COMMAND_DONE:\n'
             '            cid = mbim_message_command_done_get_cid (message);\n'
-            '            if (cid < G_N_ELEMENTS (${service_underscore}_get_printable_callbacks)) {\n'
-            '                if (${service_underscore}_get_printable_callbacks[cid].response_cb)\n'
-            '                    return ${service_underscore}_get_printable_callbacks[cid].response_cb (message, line_prefix, error);\n'
+            '            if (cid < G_N_ELEMENTS (${service_underscore}_write_${writer}_callbacks)) {\n'
+            '                if (${service_underscore}_write_${writer}_callbacks[cid].response_cb)\n'
+            '                    return ${service_underscore}_write_${writer}_callbacks[cid].response_cb (message, sink,${line_prefix_arg} error);\n'
             '            }\n'
             '            break;\n'
             '\n'
             '        case MBIM_MESSAGE_TYPE_INDICATE_STATUS:\n'
             '            cid = mbim_message_indicate_status_get_cid (message);\n'
-            '            if (cid < G_N_ELEMENTS (${service_underscore}_get_printable_callbacks)) {\n'
-            '                if (${service_underscore}_get_printable_callbacks[cid].notification_cb)\n'
-            '                    return ${service_underscore}_get_printable_callbacks[cid].notification_cb (message, line_prefix, error);\n'
+            '            if (cid < G_N_ELEMENTS (${service_underscore}_write_${writer}_callbacks)) {\n'
+            '                if (${service_underscore}_write_${writer}_callbacks[cid].notification_cb)\n'
+            '                    return ${service_underscore}_write_${writer}_callbacks[cid].notification_cb (message, sink,${line_prefix_arg} error);\n'
             '            }\n'
             '            break;\n'
             '\n'
@@ -202,40 +209,50 @@ class ObjectList:
             '                         MBIM_CORE_ERROR,\n'
             '                         MBIM_CORE_ERROR_INVALID_MESSAGE,\n'
             '                         \"No contents expected in this message type\");\n'
-            '            return NULL;\n'
+            '            return FALSE;\n'
             '    }\n'
             '\n'
             '    g_set_error (error,\n'
             '                 MBIM_CORE_ERROR,\n'
             '                 MBIM_CORE_ERROR_UNSUPPORTED,\n'
             '                 \"Unsupported message\");\n'
-            '    return NULL;\n'
+            '    return FALSE;\n'
             '}\n')
 
         cfile.write(string.Template(template).substitute(translations))
 
-    def emit_printable(self, hfile, cfile):
+    def emit_writers(self, hfile, cfile):
 
         template = (
             '\n'
             '/*****************************************************************************/\n'
-            '/* Service helpers for printable fields */\n'
+            '/* Service helpers for printable and JSON fields */\n'
             '\n'
-            '#if defined (LIBMBIM_GLIB_COMPILATION)\n')
+            '#if defined (LIBMBIM_GLIB_COMPILATION)\n'
+            '\n'
+            '#include "mbim-message-private.h"\n')
         hfile.write(template)
 
         template = (
             '\n'
             'typedef struct {\n'
-            '  gchar * (* query_cb)        (const MbimMessage *message, const gchar *line_prefix, GError **error);\n'
-            '  gchar * (* set_cb)          (const MbimMessage *message, const gchar *line_prefix, GError **error);\n'
-            '  gchar * (* response_cb)     (const MbimMessage *message, const gchar *line_prefix, GError **error);\n'
-            '  gchar * (* notification_cb) (const MbimMessage *message, const gchar *line_prefix, GError **error);\n'
-            '} GetPrintableCallbacks;\n')
+            '  gboolean (* query_cb)        (const MbimMessage *message, MbimPrintableSink *sink, const gchar *line_prefix, GError **error);\n'
+            '  gboolean (* set_cb)          (const MbimMessage *message, MbimPrintableSink *sink, const gchar *line_prefix, GError **error);\n'
+            '  gboolean (* response_cb)     (const MbimMessage *message, MbimPrintableSink *sink, const gchar *line_prefix, GError **error);\n'
+            '  gboolean (* notification_cb) (const MbimMessage *message, MbimPrintableSink *sink, const gchar *line_prefix, GError **error);\n'
+            '} WritePrintableCallbacks;\n'
+            '\n'
+            'typedef struct {\n'
+            '  gboolean (* query_cb)        (const MbimMessage *message, MbimPrintableSink *sink, GError **error);\n'
+            '  gboolean (* set_cb)          (const MbimMessage *message, MbimPrintableSink *sink, GError **error);\n'
+            '  gboolean (* response_cb)     (const MbimMessage *message, MbimPrintableSink *sink, GError **error);\n'
+            '  gboolean (* notification_cb) (const MbimMessage *message, MbimPrintableSink *sink, GError **error);\n'
+            '} WriteJsonCallbacks;\n')
         cfile.write(template)
 
         for service in self.service_list:
-            self.emit_printable_service(hfile, cfile, service)
+            self.emit_writer_service(hfile, cfile, service, 'printable')
+            self.emit_writer_service(hfile, cfile, service, 'json')
 
         template = (
             '\n'
@@ -317,26 +317,22 @@ class Struct:
 
         template = (
             '\n'
-            'static gchar *\n'
+            'static void\n'
             '_mbim_message_print_${name_underscore}_struct (\n'
             '    const ${name} *self,\n'
+            '    MbimPrintableSink *sink,\n'
             '    const gchar *line_prefix)\n'
-            '{\n'
-            '    GString *str;\n')
+            '{\n')
 
         for field in self.contents:
             if 'personal-info' in field:
                 template += (
                     '    gboolean show_field;\n'
                     '\n'
-                    '    show_field = mbim_utils_get_show_personal_info ();\n')
+                    '    show_field = mbim_utils_get_show_personal_info ();\n'
+                    '\n')
                 break
 
-        template += (
-            '\n'
-            '    str = g_string_new ("");\n'
-            '\n')
-
         for field in self.contents:
             translations['field_name']              = field['name']
             translations['field_name_underscore']   = utils.build_underscore_name_from_camelcase(field['name'])
@@ -350,7 +346,7 @@ class Struct:
                 translations['if_show_field'] = ''
 
             inner_template = (
-                '    g_string_append_printf (str, "%s  ${field_name} = ", line_prefix);\n'
+                '    _mbim_printable_sink_append_printf (sink, "%s  ${field_name} = ", line_prefix);\n'
                 '    {\n')
 
             if field['format'] == 'uuid':
@@ -359,7 +355,7 @@ class Struct:
                     '            g_autofree gchar *tmpstr = NULL;\n'
                     '\n'
                     '            tmpstr = mbim_uuid_get_printable (&(self->${field_name_underscore}));\n'
-                    '            g_string_append_printf (str, "\'%s\'", tmpstr);\n'
+                    '            _mbim_printable_sink_append_printf (sink, "\'%s\'", tmpstr);\n'
                     '        }\n')
 
             elif field['format'] in ['byte-array', 'ref-byte-array', 'ref-byte-array-no-offset', 'unsized-byte-array']:
@@ -382,10 +378,10 @@ class Struct:
                         '            array_size = self->${field_name_underscore}_size;\n')
 
                 inner_template += (
-                    '            g_string_append (str, "\'");\n'
+                    '            _mbim_printable_sink_append (sink, "\'");\n'
                     '            for (i = 0; i < array_size; i++)\n'
-                    '                g_string_append_printf (str, "%02x%s", self->${field_name_underscore}[i], (i == (array_size - 1)) ? "" : ":" );\n'
-                    '            g_string_append (str, "\'");\n'
+                    '                _mbim_printable_sink_append_printf (sink, "%02x%s", self->${field_name_underscore}[i], (i == (array_size - 1)) ? "" : ":" );\n'
+                    '            _mbim_printable_sink_append (sink, "\'");\n'
                     '        }\n')
 
             elif field['format'] in ['guint16', 'guint32', 'guint64']:
@@ -393,19 +389,19 @@ class Struct:
                     if field['public-format'] == 'gboolean':
                         inner_template += (
                             '        ${if_show_field}{\n'
-                            '            g_string_append_printf (str, "\'%s\'", (${public})self->${field_name_underscore} ? "true" : "false");\n'
+                            '            _mbim_printable_sink_append_printf (sink, "\'%s\'", (${public})self->${field_name_underscore} ? "true" : "false");\n'
                             '        }\n'
                             '\n')
                     else:
                         inner_template += (
                             '        ${if_show_field}{\n'
                             '#if defined __${public_underscore_upper}_IS_ENUM__\n'
-                            '            g_string_append_printf (str, "\'%s\'", ${public_underscore}_get_string ((${public})self->${field_name_underscore}));\n'
+                            '            _mbim_printable_sink_append_printf (sink, "\'%s\'", ${public_underscore}_get_string ((${public})self->${field_name_underscore}));\n'
                             '#elif defined __${public_underscore_upper}_IS_FLAGS__\n'
                             '            g_autofree gchar *tmpstr = NULL;\n'
                             '\n'
                             '            tmpstr = ${public_underscore}_build_string_from_mask ((${public})self->${field_name_underscore});\n'
-                            '            g_string_append_printf (str, "\'%s\'", tmpstr);\n'
+                            '            _mbim_printable_sink_append_printf (sink, "\'%s\'", tmpstr);\n'
                             '#else\n'
                             '# error neither enum nor flags\n'
                             '#endif\n'
@@ -415,22 +411,22 @@ class Struct:
                 elif field['format'] == 'guint16':
                     inner_template += (
                         '        ${if_show_field}{\n'
-                        '            g_string_append_printf (str, "\'%" G_GUINT16_FORMAT "\'", self->${field_name_underscore});\n'
+                        '            _mbim_printable_sink_append_printf (sink, "\'%" G_GUINT16_FORMAT "\'", self->${field_name_underscore});\n'
                         '        }\n')
                 elif field['format'] == 'guint32':
                     inner_template += (
                         '        ${if_show_field}{\n'
-                        '            g_string_append_printf (str, "\'%" G_GUINT32_FORMAT "\'", self->${field_name_underscore});\n'
+                        '            _mbim_printable_sink_append_printf (sink, "\'%" G_GUINT32_FORMAT "\'", self->${field_name_underscore});\n'
                         '        }\n')
                 elif field['format'] == 'guint64':
                     inner_template += (
                         '        ${if_show_field}{\n'
-                        '            g_string_append_printf (str, "\'%" G_GUINT64_FORMAT "\'", self->${field_name_underscore});\n'
+                        '            _mbim_printable_sink_append_printf (sink, "\'%" G_GUINT64_FORMAT "\'", self->${field_name_underscore});\n'
                         '        }\n')
             elif field['format'] == 'gint32':
                 inner_template += (
                     '        ${if_show_field}{\n'
-                    '            g_string_append_printf (str, "\'%" G_GINT32_FORMAT "\'", self->${field_name_underscore});\n'
+                    '            _mbim_printable_sink_append_printf (sink, "\'%" G_GINT32_FORMAT "\'", self->${field_name_underscore});\n'
                     '        }\n')
             elif field['format'] == 'guint32-array':
                 translations['array_size_field_name_underscore'] = utils.build_underscore_name_from_camelcase(field['array-size-field'])
@@ -438,16 +434,16 @@ class Struct:
                     '        ${if_show_field}{\n'
                     '            guint i;\n'
                     '\n'
-                    '            g_string_append (str, "\'");\n'
+                    '            _mbim_printable_sink_append (sink, "\'");\n'
                     '            for (i = 0; i < self->${array_size_field_name_underscore}; i++)\n'
-                    '                g_string_append_printf (str, "%" G_GUINT32_FORMAT "%s", self->${field_name_underscore}[i], (i == (self->${array_size_field_name_underscore} - 1)) ? "" : "," );\n'
-                    '            g_string_append (str, "\'");\n'
+                    '                _mbim_printable_sink_append_printf (sink, "%" G_GUINT32_FORMAT "%s", self->${field_name_underscore}[i], (i == (self->${array_size_field_name_underscore} - 1)) ? "" : "," );\n'
+                    '            _mbim_printable_sink_append (sink, "\'");\n'
                     '        }\n')
 
             elif field['format'] == 'string':
                 inner_template += (
                     '        ${if_show_field}{\n'
-                    '            g_string_append_printf (str, "\'%s\'", self->${field_name_underscore});\n'
+                    '            _mbim_printable_sink_append_printf (sink, "\'%s\'", self->${field_name_underscore});\n'
                     '        }\n')
 
             elif field['format'] == 'string-array':
@@ -456,10 +452,10 @@ class Struct:
                     '        ${if_show_field}{\n'
                     '            guint i;\n'
                     '\n'
-                    '            g_string_append (str, "\'");\n'
+                    '            _mbim_printable_sink_append (sink, "\'");\n'
                     '            for (i = 0; i < self->${array_size_field_name_underscore}; i++)\n'
-                    '                g_string_append_printf (str, "%s%s", self->${field_name_underscore}[i], (i == (self->${array_size_field_name_underscore} - 1)) ? "" : "," );\n'
-                    '            g_string_append (str, "\'");\n'
+                    '                _mbim_printable_sink_append_printf (sink, "%s%s", self->${field_name_underscore}[i], (i == (self->${array_size_field_name_underscore} - 1)) ? "" : "," );\n'
+                    '            _mbim_printable_sink_append (sink, "\'");\n'
                     '        }\n')
 
             elif field['format'] == 'ipv4' or \
@@ -479,7 +475,7 @@ class Struct:
 
                 inner_template += (
                     '            tmpstr = g_inet_address_to_string (addr);\n'
-                    '            g_string_append_printf (str, "\'%s\'", tmpstr);\n'
+                    '            _mbim_printable_sink_append_printf (sink, "\'%s\'", tmpstr);\n'
                     '        }\n')
 
             else:
@@ -488,15 +484,193 @@ class Struct:
             if 'personal-info' in field:
                 inner_template += (
                     '        if (!show_field)\n'
-                    '           g_string_append (str, "\'###\'");\n')
+                    '           _mbim_printable_sink_append (sink, "\'###\'");\n')
 
             inner_template += (
                 '    }\n'
-                '    g_string_append (str, "\\n");\n')
+                '    _mbim_printable_sink_append (sink, "\\n");\n')
+            template += (string.Template(inner_template).substitute(translations))
+
+        template += (
+            '}\n')
+        cfile.write(string.Template(template).substitute(translations))
+
+    """
+    Emit the type's JSON writer
+    """
+    def _emit_json(self, cfile):
+        translations = { 'name'            : self.name,
+                         'name_underscore' : utils.build_underscore_name_from_camelcase(self.name) }
+
+        template = (
+            '\n'
+            'static void\n'
+            '_mbim_message_json_${name_underscore}_struct (\n'
+            '    const ${name} *self,\n'
+            '    MbimPrintableSink *sink)\n'
+            '{\n')
+
+        for field in self.contents:
+            if 'personal-info' in field:
+                template += (
+                    '    gboolean show_field;\n'
+                    '\n'
+                    '    show_field = mbim_utils_get_show_personal_info ();\n'
+                    '\n')
+                break
+
+        template += (
+            '    _mbim_printable_sink_append (sink, "{");\n')
+
+        first = True
+        for field in self.contents:
+            translations['field_name']              = field['name']
+            translations['field_name_underscore']   = utils.build_underscore_name_from_camelcase(field['name'])
+            translations['public']                  = field['public-format'] if 'public-format' in field else field['format']
+            translations['public_underscore']       = utils.build_underscore_name_from_camelcase(field['public-format']) if 'public-format' in field else ''
+            translations['public_underscore_upper'] = utils.build_underscore_name_from_camelcase(field['public-format']).upper() if 'public-format' in field else ''
+            translations['separator']               = '' if first else ','
+            first = False
+
+            if 'personal-info' in field:
+                translations['if_show_field'] = 'if (show_field) '
+            else:
+                translations['if_show_field'] = ''
+
+            inner_template = (
+                '    _mbim_printable_sink_append (sink, "${separator}\\"${field_name}\\":");\n'
+                '    {\n')
+
+            if field['format'] == 'uuid':
+                inner_template += (
+                    '        ${if_show_field}{\n'
+                    '            g_autofree gchar *tmpstr = NULL;\n'
+                    '\n'
+                    '            tmpstr = mbim_uuid_get_printable (&(self->${field_name_underscore}));\n'
+                    '            _mbim_json_write_string (sink, tmpstr);\n'
+                    '        }\n')
+
+            elif field['format'] in ['byte-array', 'ref-byte-array', 'ref-byte-array-no-offset', 'unsized-byte-array']:
+                if field['format'] == 'byte-array':
+                    translations['array_size'] = field['array-size']
+                elif 'array-size-field' in field:
+                    translations['array_size'] = 'self->' + utils.build_underscore_name_from_camelcase(field['array-size-field'])
+                else:
+                    translations['array_size'] = 'self->${field_name_underscore}_size'
+                inner_template += (
+                    '        ${if_show_field}{\n'
+                    '            _mbim_json_write_hex (sink, self->${field_name_underscore}, ' + translations['array_size'] + ');\n'
+                    '        }\n')
+
+            elif field['format'] in ['guint16', 'guint32', 'guint64']:
+                if 'public-format' in field:
+                    if field['public-format'] == 'gboolean':
+                        inner_template += (
+                            '        ${if_show_field}{\n'
+                            '            _mbim_printable_sink_append (sink, (${public})self->${field_name_underscore} ? "true" : "false");\n'
+                            '        }\n')
+                    else:
+                        inner_template += (
+                            '        ${if_show_field}{\n'
+                            '#if defined __${public_underscore_upper}_IS_ENUM__\n'
+                            '            _mbim_json_write_enum (sink, ${public_underscore}_get_string ((${public})self->${field_name_underscore}), (guint64)self->${field_name_underscore});\n'
+                            '#elif defined __${public_underscore_upper}_IS_FLAGS__\n'
+                            '            g_autofree gchar *tmpstr = NULL;\n'
+                            '\n'
+                            '            tmpstr = ${public_underscore}_build_string_from_mask ((${public})self->${field_name_underscore});\n'
+                            '            _mbim_json_write_string (sink, tmpstr);\n'
+                            '#else\n'
+                            '# error neither enum nor flags\n'
+                            '#endif\n'
+                            '        }\n')
+
+                elif field['format'] == 'guint16':
+                    inner_template += (
+                        '        ${if_show_field}{\n'
+                        '            _mbim_printable_sink_append_printf (sink, "%" G_GUINT16_FORMAT, self->${field_name_underscore});\n'
+                        '        }\n')
+                elif field['format'] == 'guint32':
+                    inner_template += (
+                        '        ${if_show_field}{\n'
+                        '            _mbim_printable_sink_append_printf (sink, "%" G_GUINT32_FORMAT, self->${field_name_underscore});\n'
+                        '        }\n')
+                elif field['format'] == 'guint64':
+                    inner_template += (
+                        '        ${if_show_field}{\n'
+                        '            _mbim_printable_sink_append_printf (sink, "%" G_GUINT64_FORMAT, self->${field_name_underscore});\n'
+                        '        }\n')
+            elif field['format'] == 'gint32':
+                inner_template += (
+                    '        ${if_show_field}{\n'
+                    '            _mbim_printable_sink_append_printf (sink, "%" G_GINT32_FORMAT, self->${field_name_underscore});\n'
+                    '        }\n')
+            elif field['format'] == 'guint32-array':
+                translations['array_size_field_name_underscore'] = utils.build_underscore_name_from_camelcase(field['array-size-field'])
+                inner_template += (
+                    '        ${if_show_field}{\n'
+                    '            guint i;\n'
+                    '\n'
+                    '            _mbim_printable_sink_append (sink, "[");\n'
+                    '            for (i = 0; i < self->${array_size_field_name_underscore}; i++)\n'
+                    '                _mbim_printable_sink_append_printf (sink, "%s%" G_GUINT32_FORMAT, i ? "," : "", self->${field_name_underscore}[i]);\n'
+                    '            _mbim_printable_sink_append (sink, "]");\n'
+                    '        }\n')
+
+            elif field['format'] == 'string':
+                inner_template += (
+                    '        ${if_show_field}{\n'
+                    '            _mbim_json_write_string (sink, self->${field_name_underscore});\n'
+                    '        }\n')
+
+            elif field['format'] == 'string-array':
+                translations['array_size_field_name_underscore'] = utils.build_underscore_name_from_camelcase(field['array-size-field'])
+                inner_template += (
+                    '        ${if_show_field}{\n'
+                    '            guint i;\n'
+                    '\n'
+                    '            _mbim_printable_sink_append (sink, "[");\n'
+                    '            for (i = 0; i < self->${array_size_field_name_underscore}; i++) {\n'
+                    '                if (i)\n'
+                    '                    _mbim_printable_sink_append (sink, ",");\n'
+                    '                _mbim_json_write_string (sink, self->${field_name_underscore}[i]);\n'
+                    '            }\n'
+                    '            _mbim_printable_sink_append (sink, "]");\n'
+                    '        }\n')
+
+            elif field['format'] == 'ipv4' or \
+                 field['format'] == 'ipv6':
+                inner_template += (
+                    '        ${if_show_field}{\n'
+                    '            g_autoptr(GInetAddress)  addr = NULL;\n'
+                    '            g_autofree gchar        *tmpstr = NULL;\n'
+                    '\n')
+
+                if field['format'] == 'ipv4':
+                    inner_template += (
+                        '            addr = g_inet_address_new_from_bytes ((guint8 *)&(self->${field_name_underscore}.addr), G_SOCKET_FAMILY_IPV4);\n')
+                elif field['format'] == 'ipv6':
+                    inner_template += (
+                        '            addr = g_inet_address_new_from_bytes ((guint8 *)&(self->${field_name_underscore}.addr), G_SOCKET_FAMILY_IPV6);\n')
+
+                inner_template += (
+                    '            tmpstr = g_inet_address_to_string (addr);\n'
+                    '            _mbim_json_write_string (sink, tmpstr);\n'
+                    '        }\n')
+
+            else:
+                raise ValueError('Cannot handle format \'%s\' in struct' % field['format'])
+
+            if 'personal-info' in field:
+                inner_template += (
+                    '        if (!show_field)\n'
+                    '           _mbim_printable_sink_append (sink, "\\"###\\"");\n')
+
+            inner_template += (
+                '    }\n')
             template += (string.Template(inner_template).substitute(translations))
 
         template += (
-            '    return g_string_free (str, FALSE);\n'
+            '    _mbim_printable_sink_append (sink, "}");\n'
             '}\n')
         cfile.write(string.Template(template).substitute(translations))
 
@@ -1119,6 +1293,8 @@ class Struct:
         self._emit_read(cfile)
         # Emit type's print
         self._emit_print(cfile)
+        # Emit type's JSON writer
+        self._emit_json(cfile)
         # Emit type's append
         self._emit_append(cfile)
 
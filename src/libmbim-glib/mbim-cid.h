@@ -240,6 +240,7 @@ typedef enum { /*< since=1.26 >*/
  * @MBIM_CID_PROXY_CONTROL_UNKNOWN: Unknown command.
  * @MBIM_CID_PROXY_CONTROL_CONFIGURATION: Configuration.
  * @MBIM_CID_PROXY_CONTROL_VERSION: MBIM and MBIMEx Version reporting.
+ * @MBIM_CID_PROXY_CONTROL_STATISTICS: Proxy runtime statistics. Since 1.30.
  *
  * MBIM commands in the %MBIM_SERVICE_PROXY_CONTROL service.
  *
@@ -249,6 +250,7 @@ typedef enum { /*< since=1.10 >*/
     MBIM_CID_PROXY_CONTROL_UNKNOWN       = 0,
     MBIM_CID_PROXY_CONTROL_CONFIGURATION = 1,
     MBIM_CID_PROXY_CONTROL_VERSION       = 2,
+    MBIM_CID_PROXY_CONTROL_STATISTICS    = 3,
 } MbimCidProxyControl;
 
 /**
@@ -0,0 +1,60 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * libmbim-glib -- GLib/GIO based library to control MBIM devices
+ *
+ * This is a private non-installed header
+ */
+
+#ifndef _LIBMBIM_GLIB_MBIM_DEVICE_PRIVATE_H_
+#define _LIBMBIM_GLIB_MBIM_DEVICE_PRIVATE_H_
+
+#if !defined (LIBMBIM_GLIB_COMPILATION)
+#error "This is a private header!!"
+#endif
+
+#include <glib.h>
+
+#include "mbim-device.h"
+
+G_BEGIN_DECLS
+
+/*****************************************************************************/
+/* Hand off of the open device to another process, e.g. on proxy restarts */
+
+/* TRUE if there are no transactions ongoing and no partial message read */
+gboolean _mbim_device_is_idle   (MbimDevice  *self);
+
+/* Returns a duplicate of the file descriptor of the idle open device, which is
+ * left closed without sending any close request; or -1 on error */
+gint     _mbim_device_steal_fd  (MbimDevice  *self,
+                                 GError     **error);
+
+/* Sets up the device as open with the given file descriptor of an already
+ * open device, without sending any open request. Takes ownership of fd. */
+gboolean _mbim_device_adopt_fd  (MbimDevice  *self,
+                                 gint         fd,
+                                 GError     **error);
+
+/*****************************************************************************/
+/* Device profile, for the tests */
+
+/* Binds the device profile to the given identity instead of the one read from
+ * sysfs, which simulated devices don't have */
+void     _mbim_device_set_profile_identity (MbimDevice  *self,
+                                            const gchar *identity);
+
+/* Forgets the device info cached in the process, as if it was a new one */
+void     _mbim_device_info_cache_clear     (void);
+
+/*****************************************************************************/
+/* Proxy spawn, for the tests */
+
+/* Spawns the given proxy program instead of the installed one, if the proxy
+ * isn't running when the device is opened with MBIM_DEVICE_OPEN_FLAGS_PROXY */
+void     _mbim_device_set_proxy_path       (MbimDevice  *self,
+                                            const gchar *path);
+
+G_END_DECLS
+
+#endif /* _LIBMBIM_GLIB_MBIM_DEVICE_PRIVATE_H_ */
@@ -22,7 +22,9 @@
 #include <unistd.h>
 #include <gio/gio.h>
 #include <gio/gunixsocketaddress.h>
+#include <glib-unix.h>
 #include <sys/ioctl.h>
+#include <sys/stat.h>
 #define IOCTL_WDM_MAX_COMMAND _IOR('H', 0xA0, guint16)
 
 #define OPEN_RETRY_TIMEOUT_SECS 5
@@ -31,8 +33,10 @@
 #include "mbim-common.h"
 #include "mbim-utils.h"
 #include "mbim-device.h"
+#include "mbim-device-private.h"
 #include "mbim-message.h"
 #include "mbim-message-private.h"
+#include "mbim-probes-private.h"
 #include "mbim-error-types.h"
 #include "mbim-enum-types.h"
 #include "mbim-helpers.h"
@@ -59,6 +63,8 @@ enum {
     PROP_TRANSACTION_ID,
     PROP_IN_SESSION,
     PROP_CONSECUTIVE_TIMEOUTS,
+    PROP_PROFILE_DIR,
+    PROP_HEALTH_PROBE_INTERVAL,
     PROP_LAST
 };
 
@@ -68,6 +74,8 @@ enum {
     SIGNAL_INDICATE_STATUS,
     SIGNAL_ERROR,
     SIGNAL_REMOVED,
+    SIGNAL_REOPENED,
+    SIGNAL_HEALTH_CHANGED,
     SIGNAL_LAST
 };
 
@@ -106,6 +114,9 @@ struct _MbimDevicePrivate {
     GSocketClient *socket_client;
     GSocketConnection *socket_connection;
 
+    /* Proxy program spawned if not running, overridden in the tests */
+    gchar *proxy_path;
+
     /* HT to keep track of ongoing host/function transactions
      *  Host transactions:  created by us
      *  Modem transactions: modem-created indications with multiple fragments
@@ -130,15 +141,66 @@ struct _MbimDevicePrivate {
 
     /* Number of consecutive timeouts detected */
     guint consecutive_timeouts;
+
+    /* Time taken by each step of the last open operation */
+    guint64 open_step_time[MBIM_DEVICE_OPEN_STEP_LAST];
+
+    /* Device profile storage */
+    gchar        *profile_dir;
+    gchar        *profile_identity;
+    GCancellable *profile_refresh_cancellable;
+
+    /* Setup of the last successful open, and state to replay when reopening */
+    MbimDeviceOpenFlags  open_flags;
+    guint                open_timeout;
+    MbimMessage         *subscribe_list_request;
+
+    /* Automatic reopen */
+    gboolean      recovering;
+    guint         recovery_attempts;
+    GSource      *recovery_source;
+    GCancellable *recovery_cancellable;
+    gint64        recovery_start;
+    guint64       recovery_time;
+
+    /* Receive time of the indication being emitted */
+    gint64 indication_rx_time;
+
+    /* Health probe */
+    guint     health_probe_interval;
+    GSource  *health_probe_source;
+    gboolean  health_probe_pending;
+    gboolean  healthy;
+    gint64    last_response_time;
 };
 
 #define MAX_SPAWN_RETRIES             10
+#define SPAWN_RETRY_TIMEOUT_MS        100
+#define PROXY_READY_TIMEOUT_MS        5000
 #define MAX_CONTROL_TRANSFER          4096
 #define MAX_TIME_BETWEEN_FRAGMENTS_MS 1250
+#define RECOVERY_INITIAL_DELAY_MS     250
+#define RECOVERY_MAX_DELAY_MS         8000
+#define RECOVERY_MAX_ATTEMPTS         15
+#define HEALTH_PROBE_TIMEOUT_SECS     3
 
 static void device_report_error (MbimDevice   *self,
                                  guint32       transaction_id,
                                  const GError *error);
+static void device_command      (MbimDevice          *self,
+                                 MbimMessage         *message,
+                                 guint                timeout,
+                                 GCancellable        *cancellable,
+                                 GAsyncReadyCallback  callback,
+                                 gpointer             user_data,
+                                 gboolean             internal);
+static void device_recovery_start (MbimDevice  *self,
+                                   const gchar *reason);
+static void device_recovery_stop  (MbimDevice  *self);
+static void device_health_probe       (MbimDevice  *self);
+static void device_health_probe_setup (MbimDevice  *self);
+static void device_set_healthy        (MbimDevice  *self,
+                                       gboolean     healthy);
 
 /*****************************************************************************/
 /* Message transactions (private) */
@@ -157,6 +219,13 @@ typedef struct {
     GCancellable           *cancellable;
     gulong                  cancellable_id;
     TransactionWaitContext *wait_ctx;
+    /* Kept for queries that can be sent again after a reopen */
+    MbimMessage            *request;
+    /* Subscribe list update, configured again after a reopen if accepted */
+    MbimMessage            *subscribe_list;
+    /* Monotonic times when the request was sent and the response received */
+    gint64                  tx_time;
+    gint64                  rx_time;
 } TransactionContext;
 
 static void
@@ -165,6 +234,12 @@ transaction_context_free (TransactionContext *ctx)
     if (ctx->fragments)
         mbim_message_unref (ctx->fragments);
 
+    if (ctx->request)
+        mbim_message_unref (ctx->request);
+
+    if (ctx->subscribe_list)
+        mbim_message_unref (ctx->subscribe_list);
+
     if (ctx->timeout_source) {
         if (!g_source_is_destroyed (ctx->timeout_source))
             g_source_destroy (ctx->timeout_source);
@@ -248,10 +323,16 @@ transaction_task_complete_and_free (GTask        *task,
             g_debug ("[%s] number of consecutive timeouts: %u",
                      self->priv->path_display,
                      self->priv->consecutive_timeouts);
+
+            /* Don't wait for the next health probe to check the device */
+            if (self->priv->health_probe_source)
+                device_health_probe (self);
         }
         transaction_task_trace (task, "complete: error");
         g_task_return_error (task, g_error_copy (error));
     } else {
+        ctx->rx_time = g_get_monotonic_time ();
+
         /* Reset number of consecutive timeouts */
         if (self->priv->consecutive_timeouts > 0) {
             g_debug ("[%s] reseted number of consecutive timeouts",
@@ -261,6 +342,14 @@ transaction_task_complete_and_free (GTask        *task,
         }
         transaction_task_trace (task, "complete: response");
         g_assert (ctx->fragments != NULL);
+
+        /* Only a subscribe list the device accepted is set again after a reopen */
+        if (ctx->subscribe_list &&
+            mbim_message_response_get_result (ctx->fragments, MBIM_MESSAGE_TYPE_COMMAND_DONE, NULL)) {
+            if (self->priv->subscribe_list_request)
+                mbim_message_unref (self->priv->subscribe_list_request);
+            self->priv->subscribe_list_request = g_steal_pointer (&ctx->subscribe_list);
+        }
         g_task_return_pointer (task, mbim_message_ref (ctx->fragments), (GDestroyNotify) mbim_message_unref);
     }
 
@@ -290,6 +379,7 @@ device_release_transaction (MbimDevice      *self,
     if ((ctx->type == expected_type) || (expected_type == MBIM_MESSAGE_TYPE_INVALID)) {
         /* If found, remove it from the HT */
         transaction_task_trace (task, "release");
+        MBIM_PROBE_TRANSACTION_RELEASE (self->priv->path_display, type, transaction_id, ctx->type, ctx->tx_time);
         g_hash_table_remove (self->priv->transactions[type], GUINT_TO_POINTER (transaction_id));
         return task;
     }
@@ -315,6 +405,8 @@ transaction_timed_out (TransactionWaitContext *wait_ctx)
     ctx = g_task_get_task_data (task);
     ctx->timeout_source = NULL;
 
+    MBIM_PROBE_TRANSACTION_TIMEOUT (wait_ctx->self->priv->path_display, wait_ctx->transaction_id, !!ctx->fragments, ctx->tx_time);
+
     /* If no fragment was received, complete transaction with a timeout error */
     if (!ctx->fragments) {
         error = g_error_new (MBIM_CORE_ERROR,
@@ -381,6 +473,7 @@ device_store_transaction (MbimDevice       *self,
         self->priv->transactions[type] = g_hash_table_new (g_direct_hash, g_direct_equal);
 
     ctx = g_task_get_task_data (task);
+    MBIM_PROBE_TRANSACTION_STORE (self->priv->path_display, type, ctx->transaction_id, ctx->type, timeout_ms);
 
     /* When storing the transaction in the device, we have two options: either this
      * is a completely new transaction, or this is a transaction that had already been
@@ -515,6 +608,40 @@ mbim_device_get_consecutive_timeouts (MbimDevice *self)
     return self->priv->consecutive_timeouts;
 }
 
+guint64
+mbim_device_get_open_step_time (MbimDevice         *self,
+                                MbimDeviceOpenStep  step)
+{
+    g_return_val_if_fail (MBIM_IS_DEVICE (self), 0);
+    g_return_val_if_fail (step < MBIM_DEVICE_OPEN_STEP_LAST, 0);
+
+    return self->priv->open_step_time[step];
+}
+
+guint64
+mbim_device_get_recovery_time (MbimDevice *self)
+{
+    g_return_val_if_fail (MBIM_IS_DEVICE (self), 0);
+
+    return self->priv->recovery_time;
+}
+
+/*****************************************************************************/
+
+static MbimMessage *device_info_cache_get_response (MbimDevice  *self,
+                                                    MbimService  service,
+                                                    guint32      cid);
+
+MbimMessage *
+mbim_device_get_cached_response (MbimDevice  *self,
+                                 MbimService  service,
+                                 guint        cid)
+{
+    g_return_val_if_fail (MBIM_IS_DEVICE (self), NULL);
+
+    return device_info_cache_get_response (self, service, cid);
+}
+
 /*****************************************************************************/
 
 static void
@@ -867,7 +994,10 @@ indication_ready (MbimDevice   *self,
         }
     }
 
+    self->priv->indication_rx_time = ((TransactionContext *) g_task_get_task_data (G_TASK (res)))->rx_time;
+    MBIM_PROBE_INDICATION_EMIT (self->priv->path_display, indication, self->priv->indication_rx_time);
     g_signal_emit (self, signals[SIGNAL_INDICATE_STATUS], 0, indication);
+    self->priv->indication_rx_time = 0;
 }
 
 static void
@@ -905,6 +1035,16 @@ process_message (MbimDevice        *self,
     is_partial_fragment = (_mbim_message_is_fragment (message) &&
                            _mbim_message_fragment_get_total (message) > 1);
 
+    /* Any message, including error responses, tells the device is alive */
+    self->priv->last_response_time = g_get_monotonic_time ();
+
+    MBIM_PROBE_MESSAGE_RECEIVE (self->priv->path_display, message);
+    if (is_partial_fragment)
+        MBIM_PROBE_FRAGMENT_RECEIVE (self->priv->path_display,
+                                     message,
+                                     _mbim_message_fragment_get_current (message),
+                                     _mbim_message_fragment_get_total (message));
+
     if (mbim_utils_get_traces_enabled ()) {
         g_autofree gchar *printable = NULL;
 
@@ -1105,6 +1245,11 @@ process_message (MbimDevice        *self,
          * signal may decide to force-close the device, which in turn clears the
          * internal buffer and the MbimMessage. */
         g_signal_emit (self, signals[SIGNAL_ERROR], 0, error_indication);
+
+        if (g_error_matches (error_indication, MBIM_PROTOCOL_ERROR, MBIM_PROTOCOL_ERROR_NOT_OPENED) &&
+            (self->priv->open_status == OPEN_STATUS_OPEN) &&
+            (self->priv->open_flags & MBIM_DEVICE_OPEN_FLAGS_AUTO_REOPEN))
+            device_recovery_start (self, "device reports not being opened");
         return;
     }
 
@@ -1176,6 +1321,12 @@ data_available (GIOChannel   *source,
             self->priv->response->len)
             g_byte_array_remove_range (self->priv->response, 0, self->priv->response->len);
 
+        if ((self->priv->open_status == OPEN_STATUS_OPEN) &&
+            (self->priv->open_flags & MBIM_DEVICE_OPEN_FLAGS_AUTO_REOPEN)) {
+            device_recovery_start (self, "port hangup");
+            return FALSE;
+        }
+
         mbim_device_close_force (self, NULL);
         g_signal_emit (self, signals[SIGNAL_REMOVED], 0 );
         return FALSE;
@@ -1233,6 +1384,194 @@ data_available (GIOChannel   *source,
     return TRUE;
 }
 
+/*****************************************************************************/
+/* Device info cache
+ *
+ * Information learnt while opening a device is kept per device path, as long
+ * as the device node is the same one, i.e. until the device is unplugged or
+ * the driver is rebound, which is cheaply checked with stat(). The cache is
+ * shared by all the MbimDevice objects in the process, and may be backed by
+ * a profile file on disk, see below. */
+
+typedef struct {
+    dev_t      rdev;
+    ino_t      ino;
+    time_t     ctime;
+    guint16    max_control_transfer;
+    /* Responses to queries without input, e.g. device services */
+    GPtrArray *responses;
+    /* Responses loaded from the on-disk profile, until the device ID is checked */
+    GPtrArray *loaded_responses;
+    /* On-disk profile details */
+    gboolean   profile_loaded;
+    gboolean   profile_dirty;
+    gchar     *identity;
+    gchar     *device_id;
+    gint64     updated;
+} DeviceInfo;
+
+G_LOCK_DEFINE_STATIC (device_info_cache);
+static GHashTable *device_info_cache;
+
+static void
+device_info_free (DeviceInfo *info)
+{
+    g_ptr_array_unref (info->responses);
+    g_ptr_array_unref (info->loaded_responses);
+    g_free (info->identity);
+    g_free (info->device_id);
+    g_slice_free (DeviceInfo, info);
+}
+
+/* Must be called with the cache lock held */
+static DeviceInfo *
+device_info_cache_peek (MbimDevice *self,
+                        gboolean    create)
+{
+    struct stat  st;
+    DeviceInfo  *info;
+
+    if (stat (self->priv->path, &st) < 0)
+        return NULL;
+
+    if (G_UNLIKELY (!device_info_cache))
+        device_info_cache = g_hash_table_new_full (g_str_hash,
+                                                   g_str_equal,
+                                                   g_free,
+                                                   (GDestroyNotify) device_info_free);
+
+    info = g_hash_table_lookup (device_info_cache, self->priv->path);
+    if (info && (info->rdev != st.st_rdev || info->ino != st.st_ino || info->ctime != st.st_ctime)) {
+        g_debug ("[%s] cached device info no longer valid", self->priv->path_display);
+        g_hash_table_remove (device_info_cache, self->priv->path);
+        info = NULL;
+    }
+
+    if (!info && create) {
+        info = g_slice_new0 (DeviceInfo);
+        info->rdev = st.st_rdev;
+        info->ino = st.st_ino;
+        info->ctime = st.st_ctime;
+        info->responses = g_ptr_array_new_with_free_func ((GDestroyNotify) mbim_message_unref);
+        info->loaded_responses = g_ptr_array_new_with_free_func ((GDestroyNotify) mbim_message_unref);
+        g_hash_table_insert (device_info_cache, g_strdup (self->priv->path), info);
+    }
+
+    return info;
+}
+
+/* Must be called with the cache lock held */
+static guint
+device_info_find_response (DeviceInfo  *info,
+                           MbimService  service,
+                           guint32      cid)
+{
+    guint i;
+
+    for (i = 0; i < info->responses->len; i++) {
+        MbimMessage *response;
+
+        response = g_ptr_array_index (info->responses, i);
+        if (mbim_message_command_done_get_service (response) == service &&
+            mbim_message_command_done_get_cid (response) == cid)
+            return i;
+    }
+    return G_MAXUINT;
+}
+
+static guint16
+device_info_cache_get_max_control_transfer (MbimDevice *self)
+{
+    DeviceInfo *info;
+    guint16     max = 0;
+
+    G_LOCK (device_info_cache);
+    info = device_info_cache_peek (self, FALSE);
+    if (info)
+        max = info->max_control_transfer;
+    G_UNLOCK (device_info_cache);
+    return max;
+}
+
+static void
+device_info_cache_set_max_control_transfer (MbimDevice *self,
+                                            guint16     max)
+{
+    DeviceInfo *info;
+
+    G_LOCK (device_info_cache);
+    info = device_info_cache_peek (self, TRUE);
+    if (info && info->max_control_transfer != max) {
+        info->max_control_transfer = max;
+        info->profile_dirty = TRUE;
+    }
+    G_UNLOCK (device_info_cache);
+}
+
+static MbimMessage *
+device_info_cache_get_response (MbimDevice  *self,
+                                MbimService  service,
+                                guint32      cid)
+{
+    DeviceInfo  *info;
+    MbimMessage *response = NULL;
+
+    G_LOCK (device_info_cache);
+    info = device_info_cache_peek (self, FALSE);
+    if (info) {
+        guint i;
+
+        i = device_info_find_response (info, service, cid);
+        if (i != G_MAXUINT)
+            response = mbim_message_ref (g_ptr_array_index (info->responses, i));
+    }
+    G_UNLOCK (device_info_cache);
+    return response;
+}
+
+/* Same contents, ignoring the transaction ID in the header */
+static gboolean
+device_info_response_equal (MbimMessage *a,
+                            MbimMessage *b)
+{
+    const GByteArray *array_a = (const GByteArray *)a;
+    const GByteArray *array_b = (const GByteArray *)b;
+
+    return (array_a->len == array_b->len &&
+            array_a->len >= sizeof (struct header) &&
+            memcmp (array_a->data, array_b->data, G_STRUCT_OFFSET (struct header, transaction_id)) == 0 &&
+            memcmp (array_a->data + sizeof (struct header),
+                    array_b->data + sizeof (struct header),
+                    array_a->len - sizeof (struct header)) == 0);
+}
+
+static void
+device_info_cache_set_response (MbimDevice  *self,
+                                MbimMessage *response)
+{
+    DeviceInfo *info;
+
+    G_LOCK (device_info_cache);
+    info = device_info_cache_peek (self, TRUE);
+    if (info) {
+        guint    i;
+        gboolean changed = TRUE;
+
+        i = device_info_find_response (info,
+                                       mbim_message_command_done_get_service (response),
+                                       mbim_message_command_done_get_cid (response));
+        if (i != G_MAXUINT) {
+            changed = !device_info_response_equal (g_ptr_array_index (info->responses, i), response);
+            g_ptr_array_remove_index (info->responses, i);
+        }
+        g_ptr_array_add (info->responses, mbim_message_ref (response));
+        /* The profile is only written if something changed */
+        if (changed)
+            info->profile_dirty = TRUE;
+    }
+    G_UNLOCK (device_info_cache);
+}
+
 /* "MBIM Control Model Functional Descriptor" */
 struct usb_cdc_mbim_desc {
     guint8  bLength;
@@ -1343,1250 +1682,2729 @@ read_max_control_transfer (MbimDevice *self)
     return MAX_CONTROL_TRANSFER;
 }
 
-typedef struct {
-    guint spawn_retries;
-} CreateIoChannelContext;
-
-static void
-create_iochannel_context_free (CreateIoChannelContext *ctx)
+/* Parsing the descriptors file is only done once per device */
+static guint16
+read_max_control_transfer_cached (MbimDevice *self)
 {
-    g_slice_free (CreateIoChannelContext, ctx);
+    guint16 max;
+
+    max = device_info_cache_get_max_control_transfer (self);
+    if (max > 0) {
+        g_debug ("[%s] cached max control message size: %" G_GUINT16_FORMAT,
+                 self->priv->path_display,
+                 max);
+        return max;
+    }
+
+    max = read_max_control_transfer (self);
+    device_info_cache_set_max_control_transfer (self, max);
+    return max;
 }
 
 static gboolean
-create_iochannel_finish (MbimDevice *self,
-                         GAsyncResult *res,
-                         GError **error)
+device_services_find_cid (MbimDeviceServiceElement **device_services,
+                          guint32                    device_services_count,
+                          MbimService                service,
+                          guint32                    cid)
 {
-    return g_task_propagate_boolean (G_TASK (res), error);
+    guint i;
+
+    for (i = 0; i < device_services_count; i++) {
+        guint32 j;
+
+        if (mbim_uuid_to_service (&device_services[i]->device_service_id) != service)
+            continue;
+        for (j = 0; j < device_services[i]->cids_count; j++) {
+            if (device_services[i]->cids[j] == cid)
+                return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+/*****************************************************************************/
+/* Device profile
+ *
+ * If a profile directory is given, the device info cache is also stored on
+ * disk, so that it survives the process. The profile is bound to the device
+ * identity as seen in sysfs (USB descriptors and serial number, or the PCI
+ * ids of WWAN devices), and to the device ID reported in the device caps,
+ * which is checked by a refresh run in the background once the device is
+ * open. Devices without identity don't use any on-disk profile, as there
+ * would be no way to tell whether it belongs to them. */
+
+#define PROFILE_VERSION      1
+#define PROFILE_FORMAT       "(ussqxaay)"
+#define PROFILE_REFRESH_SECS (24 * 60 * 60)
+
+static gchar *
+device_profile_get_filename (MbimDevice *self)
+{
+    g_autofree gchar *name = NULL;
+
+    /* e.g. "/dev/cdc-wdm0" stored as "_dev_cdc-wdm0.profile" */
+    name = g_strdelimit (g_strdup_printf ("%s.profile", self->priv->path), G_DIR_SEPARATOR_S, '_');
+    return g_build_filename (self->priv->profile_dir, name, NULL);
 }
 
 static void
-setup_iochannel (GTask *task)
+checksum_update_from_file (GChecksum   *checksum,
+                           const gchar *path)
 {
-    MbimDevice *self;
-    GError *inner_error = NULL;
+    g_autofree gchar *contents = NULL;
+    gsize             length = 0;
 
-    self = g_task_get_source_object (task);
+    if (g_file_get_contents (path, &contents, &length, NULL))
+        g_checksum_update (checksum, (const guchar *)contents, length);
+}
 
-    /* We don't want UTF-8 encoding, we're playing with raw binary data */
-    g_io_channel_set_encoding (self->priv->iochannel, NULL, NULL);
+static gchar *
+device_profile_build_identity (MbimDevice *self)
+{
+    static const gchar   *pci_attributes[] = { "vendor", "device", "subsystem_vendor", "subsystem_device", "revision" };
+    g_autoptr(GChecksum)  checksum = NULL;
+    g_autofree gchar     *descriptors_path = NULL;
+    g_autofree gchar     *dirname = NULL;
+    g_autofree gchar     *tmp = NULL;
+    g_autofree gchar     *basename = NULL;
+    g_autofree gchar     *sysfs_path = NULL;
+    guint                 i;
 
-    /* We don't want to get the channel buffered */
-    g_io_channel_set_buffered (self->priv->iochannel, FALSE);
+    if (self->priv->profile_identity)
+        return g_strdup (self->priv->profile_identity);
 
-    /* Let the GIOChannel own the FD */
-    g_io_channel_set_close_on_unref (self->priv->iochannel, TRUE);
+    checksum = g_checksum_new (G_CHECKSUM_SHA256);
 
-    /* We don't want to get blocked while writing stuff */
-    if (!g_io_channel_set_flags (self->priv->iochannel,
-                                 G_IO_FLAG_NONBLOCK,
-                                 &inner_error)) {
-        g_io_channel_shutdown (self->priv->iochannel, FALSE, NULL);
-        g_io_channel_unref (self->priv->iochannel);
-        self->priv->iochannel = NULL;
-        g_clear_object (&self->priv->socket_connection);
-        g_clear_object (&self->priv->socket_client);
-        g_task_return_error (task, inner_error);
-        g_object_unref (task);
-        return;
+    /* USB devices, the whole set of descriptors and the serial number */
+    descriptors_path = get_descriptors_filepath (self);
+    if (descriptors_path) {
+        g_autofree gchar *serial_path = NULL;
+
+        checksum_update_from_file (checksum, descriptors_path);
+        dirname = g_path_get_dirname (descriptors_path);
+        serial_path = g_build_filename (dirname, "serial", NULL);
+        checksum_update_from_file (checksum, serial_path);
+        return g_strdup (g_checksum_get_string (checksum));
     }
 
-    self->priv->iochannel_source = g_io_create_watch (self->priv->iochannel,
-                                                      G_IO_IN | G_IO_ERR | G_IO_HUP);
-    g_source_set_callback (self->priv->iochannel_source,
-                           (GSourceFunc)data_available,
-                           self,
-                           NULL);
-    g_source_attach (self->priv->iochannel_source, g_main_context_get_thread_default ());
+    /* WWAN devices, the PCI device they're exposed by */
+    basename = g_path_get_basename (self->priv->path);
+    tmp = g_strdup_printf ("/sys/class/wwan/%s/device", basename);
+    sysfs_path = realpath (tmp, NULL);
+    if (!sysfs_path)
+        return NULL;
 
-    g_task_return_boolean (task, TRUE);
-    g_object_unref (task);
+    g_checksum_update (checksum, (const guchar *)sysfs_path, strlen (sysfs_path));
+    for (i = 0; i < G_N_ELEMENTS (pci_attributes); i++) {
+        g_autofree gchar *attribute_path = NULL;
+
+        attribute_path = g_build_filename (sysfs_path, pci_attributes[i], NULL);
+        checksum_update_from_file (checksum, attribute_path);
+    }
+    return g_strdup (g_checksum_get_string (checksum));
+}
+
+static GBytes *
+device_profile_read (MbimDevice *self)
+{
+    g_autofree gchar  *filename = NULL;
+    g_autoptr(GError)  error = NULL;
+    gchar             *contents = NULL;
+    gsize              length = 0;
+
+    filename = device_profile_get_filename (self);
+    if (!g_file_get_contents (filename, &contents, &length, &error)) {
+        g_debug ("[%s] no device profile loaded: %s", self->priv->path_display, error->message);
+        return NULL;
+    }
+    return g_bytes_new_take (contents, length);
 }
 
+/* Must be called with the cache lock held */
 static void
-create_iochannel_with_fd (GTask *task)
+device_profile_load (MbimDevice  *self,
+                     DeviceInfo  *info,
+                     GBytes      *bytes)
 {
-    MbimDevice *self;
-    gint fd;
-    guint16 max;
+    g_autoptr(GVariant)      profile = NULL;
+    g_autoptr(GVariantIter)  iter = NULL;
+    GVariant                *child;
+    guint32                  version = 0;
+    const gchar             *profile_identity = NULL;
+    const gchar             *device_id = NULL;
+    guint16                  max_control_transfer = 0;
+    gint64                   updated = 0;
+
+    profile = g_variant_ref_sink (g_variant_new_from_bytes (G_VARIANT_TYPE (PROFILE_FORMAT), bytes, FALSE));
+    if (!g_variant_is_normal_form (profile)) {
+        g_debug ("[%s] invalid device profile ignored", self->priv->path_display);
+        return;
+    }
 
-    self = g_task_get_source_object (task);
-    errno = 0;
-    fd = open (self->priv->path, O_RDWR | O_EXCL | O_NONBLOCK | O_NOCTTY);
-    if (fd < 0) {
-        g_task_return_new_error (task,
-                                 MBIM_CORE_ERROR,
-                                 MBIM_CORE_ERROR_FAILED,
-                                 "Cannot open device file '%s': %s",
-                                 self->priv->path_display,
-                                 strerror (errno));
-        g_object_unref (task);
+    g_variant_get (profile, "(u&s&sqxaay)",
+                   &version,
+                   &profile_identity,
+                   &device_id,
+                   &max_control_transfer,
+                   &updated,
+                   &iter);
+    if (version != PROFILE_VERSION) {
+        g_debug ("[%s] unsupported device profile version ignored: %u", self->priv->path_display, version);
+        return;
+    }
+    if (!info->identity || g_strcmp0 (info->identity, profile_identity) != 0) {
+        g_debug ("[%s] device profile belongs to a different device: ignored", self->priv->path_display);
         return;
     }
 
-    /* Query message size */
-    if (ioctl (fd, IOCTL_WDM_MAX_COMMAND, &max) < 0) {
-        g_debug ("[%s] couldn't query maximum message size: "
-                 "IOCTL_WDM_MAX_COMMAND failed: %s",
-                 self->priv->path_display,
-                 strerror (errno));
-        /* Fallback, try to read the descriptor file */
-        max = read_max_control_transfer (self);
-    } else {
-        g_debug ("[%s] queried max control message size: %" G_GUINT16_FORMAT,
-                 self->priv->path_display,
-                 max);
+    if (!info->max_control_transfer)
+        info->max_control_transfer = max_control_transfer;
+    if (!info->device_id && device_id[0])
+        info->device_id = g_strdup (device_id);
+    info->updated = updated;
+
+    while ((child = g_variant_iter_next_value (iter)) != NULL) {
+        g_autoptr(GVariant)     value = child;
+        g_autoptr(MbimMessage)  response = NULL;
+        const guint8           *data;
+        gsize                   data_length = 0;
+
+        data = g_variant_get_fixed_array (value, &data_length, sizeof (guint8));
+        response = mbim_message_new (data, data_length);
+        if (!mbim_message_validate (response, NULL) ||
+            MBIM_MESSAGE_GET_MESSAGE_TYPE (response) != MBIM_MESSAGE_TYPE_COMMAND_DONE) {
+            g_debug ("[%s] invalid response in device profile: ignored", self->priv->path_display);
+            continue;
+        }
+        if (device_info_find_response (info,
+                                       mbim_message_command_done_get_service (response),
+                                       mbim_message_command_done_get_cid (response)) == G_MAXUINT) {
+            g_ptr_array_add (info->loaded_responses, mbim_message_ref (response));
+            g_ptr_array_add (info->responses, g_steal_pointer (&response));
+        }
     }
-    self->priv->max_control_transfer = max;
 
-    /* Create new GIOChannel */
-    self->priv->iochannel = g_io_channel_unix_new (fd);
+    g_debug ("[%s] device profile loaded: %u responses", self->priv->path_display, info->responses->len);
+}
 
-    setup_iochannel (task);
+/* Loads the on-disk profile into the cache, once per process */
+static void
+device_profile_prepare (MbimDevice *self)
+{
+    g_autofree gchar  *identity = NULL;
+    g_autoptr(GBytes)  contents = NULL;
+    DeviceInfo        *info;
+    gboolean           loaded;
+
+    if (!self->priv->profile_dir)
+        return;
+
+    G_LOCK (device_info_cache);
+    info = device_info_cache_peek (self, TRUE);
+    loaded = (!info || info->profile_loaded);
+    G_UNLOCK (device_info_cache);
+    if (loaded)
+        return;
+
+    /* Both sysfs and the profile are read without holding the cache lock */
+    identity = device_profile_build_identity (self);
+    if (!identity)
+        g_debug ("[%s] no device identity: device profile not used", self->priv->path_display);
+    else
+        contents = device_profile_read (self);
+
+    G_LOCK (device_info_cache);
+    info = device_info_cache_peek (self, TRUE);
+    if (info && !info->profile_loaded) {
+        info->profile_loaded = TRUE;
+        info->identity = g_steal_pointer (&identity);
+        if (contents)
+            device_profile_load (self, info, contents);
+    }
+    G_UNLOCK (device_info_cache);
 }
 
-static void create_iochannel_with_socket (GTask *task);
+static void
+device_profile_save (MbimDevice *self)
+{
+    g_autofree gchar    *filename = NULL;
+    g_autoptr(GVariant)  profile = NULL;
+    g_autoptr(GError)    error = NULL;
+    DeviceInfo          *info;
+
+    if (!self->priv->profile_dir)
+        return;
+
+    G_LOCK (device_info_cache);
+    info = device_info_cache_peek (self, FALSE);
+    if (info && info->identity && info->profile_dirty) {
+        GVariantBuilder builder;
+        guint           i;
+
+        g_variant_builder_init (&builder, G_VARIANT_TYPE ("aay"));
+        for (i = 0; i < info->responses->len; i++) {
+            const guint8 *data;
+            guint32       data_length = 0;
+
+            data = mbim_message_get_raw (g_ptr_array_index (info->responses, i), &data_length, NULL);
+            g_variant_builder_add_value (&builder,
+                                         g_variant_new_fixed_array (G_VARIANT_TYPE_BYTE, data, data_length, sizeof (guint8)));
+        }
+        profile = g_variant_ref_sink (g_variant_new (PROFILE_FORMAT,
+                                                     PROFILE_VERSION,
+                                                     info->identity,
+                                                     info->device_id ? info->device_id : "",
+                                                     info->max_control_transfer,
+                                                     info->updated,
+                                                     &builder));
+        info->profile_dirty = FALSE;
+    }
+    G_UNLOCK (device_info_cache);
+
+    if (!profile)
+        return;
+
+    filename = device_profile_get_filename (self);
+    if (g_mkdir_with_parents (self->priv->profile_dir, 0700) < 0)
+        g_warning ("[%s] couldn't create device profile directory: %s",
+                   self->priv->path_display, g_strerror (errno));
+    else if (!g_file_set_contents (filename,
+                                   g_variant_get_data (profile),
+                                   g_variant_get_size (profile),
+                                   &error))
+        g_warning ("[%s] couldn't store device profile: %s",
+                   self->priv->path_display, error->message);
+    else
+        g_debug ("[%s] device profile stored", self->priv->path_display);
+}
 
+/* Returns TRUE if the stored profile is too old or not bound to a device ID */
 static gboolean
-wait_for_proxy_cb (GTask *task)
+device_profile_needs_refresh (MbimDevice *self)
 {
-    create_iochannel_with_socket (task);
-    return FALSE;
+    DeviceInfo *info;
+    gboolean    needs_refresh = FALSE;
+
+    if (!self->priv->profile_dir)
+        return FALSE;
+
+    G_LOCK (device_info_cache);
+    info = device_info_cache_peek (self, FALSE);
+    if (info && info->identity)
+        needs_refresh = (!info->device_id ||
+                         (g_get_real_time () - info->updated) > (PROFILE_REFRESH_SECS * G_USEC_PER_SEC));
+    G_UNLOCK (device_info_cache);
+    return needs_refresh;
 }
 
+/* If the device reports a different device ID, the responses loaded from the
+ * profile and not learnt again since the device was opened are forgotten */
 static void
-spawn_child_setup (void)
+device_profile_set_device_id (MbimDevice  *self,
+                              const gchar *device_id)
 {
-    if (setpgid (0, 0) < 0)
-        g_warning ("couldn't setup proxy specific process group");
+    DeviceInfo *info;
+
+    G_LOCK (device_info_cache);
+    info = device_info_cache_peek (self, FALSE);
+    if (info) {
+        if (g_strcmp0 (info->device_id, device_id) != 0) {
+            if (info->device_id) {
+                guint i;
+
+                g_debug ("[%s] device ID changed: device profile reset", self->priv->path_display);
+                for (i = 0; i < info->loaded_responses->len; i++)
+                    g_ptr_array_remove (info->responses, g_ptr_array_index (info->loaded_responses, i));
+            }
+            g_free (info->device_id);
+            info->device_id = g_strdup (device_id);
+            info->profile_dirty = TRUE;
+        }
+        g_ptr_array_set_size (info->loaded_responses, 0);
+    }
+    G_UNLOCK (device_info_cache);
 }
 
 static void
-create_iochannel_with_socket (GTask *task)
+device_profile_set_updated (MbimDevice *self)
 {
-    MbimDevice                *self;
-    CreateIoChannelContext    *ctx;
-    g_autoptr(GSocketAddress)  socket_address = NULL;
-    GError                    *error = NULL;
+    DeviceInfo *info;
 
-    self = g_task_get_source_object (task);
-    ctx = g_task_get_task_data (task);
+    G_LOCK (device_info_cache);
+    info = device_info_cache_peek (self, FALSE);
+    if (info) {
+        info->updated = g_get_real_time ();
+        info->profile_dirty = TRUE;
+    }
+    G_UNLOCK (device_info_cache);
+}
 
-    /* Create socket client */
-    if (self->priv->socket_client)
-        g_object_unref (self->priv->socket_client);
-    self->priv->socket_client = g_socket_client_new ();
-    g_socket_client_set_family (self->priv->socket_client, G_SOCKET_FAMILY_UNIX);
-    g_socket_client_set_socket_type (self->priv->socket_client, G_SOCKET_TYPE_STREAM);
-    g_socket_client_set_protocol (self->priv->socket_client, G_SOCKET_PROTOCOL_DEFAULT);
+typedef enum {
+    PROFILE_REFRESH_STEP_FIRST,
+    PROFILE_REFRESH_STEP_DEVICE_SERVICES,
+    PROFILE_REFRESH_STEP_DEVICE_CAPS,
+    PROFILE_REFRESH_STEP_SYS_CAPS,
+    PROFILE_REFRESH_STEP_DEVICE_SLOT_MAPPINGS,
+    PROFILE_REFRESH_STEP_LAST,
+} ProfileRefreshStep;
 
-    /* Setup socket address */
-    socket_address = (g_unix_socket_address_new_with_type (
-                          MBIM_PROXY_SOCKET_PATH,
-                          -1,
-                          G_UNIX_SOCKET_ADDRESS_ABSTRACT));
-
-    /* Connect to address */
-    if (self->priv->socket_connection)
-        g_object_unref (self->priv->socket_connection);
-    self->priv->socket_connection = (g_socket_client_connect (
-                                              self->priv->socket_client,
-                                              G_SOCKET_CONNECTABLE (socket_address),
-                                              NULL,
-                                              &error));
-
-    if (!self->priv->socket_connection) {
-        g_auto(GStrv)      argc = NULL;
-        g_autoptr(GSource) source = NULL;
-
-        g_debug ("[%s] cannot connect to proxy: %s", self->priv->path_display, error->message);
-        g_clear_error (&error);
-        g_clear_object (&self->priv->socket_client);
-
-        /* Don't retry forever */
-        ctx->spawn_retries++;
-        if (ctx->spawn_retries > MAX_SPAWN_RETRIES) {
-            g_task_return_new_error (task,
-                                     MBIM_CORE_ERROR,
-                                     MBIM_CORE_ERROR_FAILED,
-                                     "Couldn't spawn the mbim-proxy");
-            g_object_unref (task);
-            return;
-        }
-
-        g_debug ("[%s] spawning new mbim-proxy (try %u)...", self->priv->path_display, ctx->spawn_retries);
-
-        argc = g_new0 (gchar *, 2);
-        argc[0] = g_strdup (LIBEXEC_PATH "/mbim-proxy");
-        if (!g_spawn_async (NULL, /* working directory */
-                            argc,
-                            NULL, /* envp */
-                            G_SPAWN_STDOUT_TO_DEV_NULL | G_SPAWN_STDERR_TO_DEV_NULL,
-                            (GSpawnChildSetupFunc) spawn_child_setup,
-                            NULL, /* child_setup_user_data */
-                            NULL,
-                            &error)) {
-            g_debug ("[%s] error spawning mbim-proxy: %s", self->priv->path_display, error->message);
-            g_clear_error (&error);
-        }
-
-        /* Wait some ms and retry */
-        source = g_timeout_source_new (100);
-        g_source_set_callback (source, (GSourceFunc)wait_for_proxy_cb, task, NULL);
-        g_source_attach (source, g_main_context_get_thread_default ());
-        return;
-    }
-
-    self->priv->iochannel = g_io_channel_unix_new (
-                                     g_socket_get_fd (
-                                         g_socket_connection_get_socket (self->priv->socket_connection)));
-
-    /* try to read the descriptor file */
-    self->priv->max_control_transfer = read_max_control_transfer (self);
-
-    setup_iochannel (task);
-}
+typedef struct {
+    MbimDevice         *self;
+    GCancellable       *cancellable;
+    ProfileRefreshStep  step;
+    MbimMessage        *device_services;
+} ProfileRefreshContext;
 
 static void
-create_iochannel (MbimDevice           *self,
-                  gboolean              proxy,
-                  GAsyncReadyCallback   callback,
-                  gpointer              user_data)
+profile_refresh_context_free (ProfileRefreshContext *ctx)
 {
-    CreateIoChannelContext *ctx;
-    GTask *task;
-
-    ctx = g_slice_new (CreateIoChannelContext);
-    ctx->spawn_retries = 0;
-
-    task = g_task_new (self, NULL, callback, user_data);
-    g_task_set_task_data (task, ctx, (GDestroyNotify)create_iochannel_context_free);
-
-    if (self->priv->iochannel) {
-        g_task_return_new_error (task,
-                                 MBIM_CORE_ERROR,
-                                 MBIM_CORE_ERROR_WRONG_STATE,
-                                 "Already open");
-        g_object_unref (task);
-        return;
-    }
-
-    g_assert (self->priv->file);
-    g_assert (self->priv->path);
-
-    if (proxy)
-        create_iochannel_with_socket (task);
-    else
-        create_iochannel_with_fd (task);
+    if (ctx->device_services)
+        mbim_message_unref (ctx->device_services);
+    if (ctx->self->priv->profile_refresh_cancellable == ctx->cancellable)
+        g_clear_object (&ctx->self->priv->profile_refresh_cancellable);
+    g_object_unref (ctx->cancellable);
+    g_object_unref (ctx->self);
+    g_slice_free (ProfileRefreshContext, ctx);
 }
 
-typedef enum {
-    DEVICE_OPEN_CONTEXT_STEP_FIRST = 0,
-    DEVICE_OPEN_CONTEXT_STEP_CREATE_IOCHANNEL,
-    DEVICE_OPEN_CONTEXT_STEP_FLAGS_PROXY,
-    DEVICE_OPEN_CONTEXT_STEP_CLOSE_MESSAGE,
-    DEVICE_OPEN_CONTEXT_STEP_OPEN_MESSAGE,
-    DEVICE_OPEN_CONTEXT_STEP_DEVICE_SERVICES,
-    DEVICE_OPEN_CONTEXT_STEP_MS_EXT_VERSION,
-    DEVICE_OPEN_CONTEXT_STEP_LAST
-} DeviceOpenContextStep;
-
-typedef struct {
-    DeviceOpenContextStep  step;
-    MbimDeviceOpenFlags    flags;
-    guint                  timeout;
-    GTimer                *timer;
-    gboolean               close_before_open;
-} DeviceOpenContext;
+static void profile_refresh_step (ProfileRefreshContext *ctx);
 
-static void
-device_open_context_free (DeviceOpenContext *ctx)
+static gboolean
+profile_refresh_cid_supported (ProfileRefreshContext *ctx,
+                               MbimService            service,
+                               guint32                cid)
 {
-    g_timer_destroy (ctx->timer);
-    g_slice_free (DeviceOpenContext, ctx);
-}
+    g_autoptr(MbimDeviceServiceElementArray) device_services = NULL;
+    guint32                                  device_services_count = 0;
+
+    if (!ctx->device_services ||
+        !mbim_message_device_services_response_parse (ctx->device_services,
+                                                      &device_services_count,
+                                                      NULL,
+                                                      &device_services,
+                                                      NULL))
+        return FALSE;
 
-gboolean
-mbim_device_open_full_finish (MbimDevice    *self,
-                              GAsyncResult  *res,
-                              GError       **error)
-{
-    return g_task_propagate_boolean (G_TASK (res), error);
+    return device_services_find_cid (device_services, device_services_count, service, cid);
 }
 
-gboolean
-mbim_device_open_finish (MbimDevice   *self,
-                         GAsyncResult  *res,
-                         GError       **error)
+static void
+profile_refresh_device_id (ProfileRefreshContext *ctx,
+                           MbimMessage           *response)
 {
-    return mbim_device_open_full_finish (self, res, error);
+    g_autofree gchar *device_id = NULL;
+    gboolean          parsed;
+
+    if (mbim_device_check_ms_mbimex_version (ctx->self, 3, 0))
+        parsed = mbim_message_ms_basic_connect_extensions_v3_device_caps_response_parse (
+                     response,
+                     NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL,
+                     NULL, NULL, NULL, NULL, NULL,
+                     &device_id,
+                     NULL, NULL,
+                     NULL);
+    else
+        parsed = mbim_message_device_caps_response_parse (
+                     response,
+                     NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL,
+                     &device_id,
+                     NULL, NULL,
+                     NULL);
+
+    if (parsed && device_id)
+        device_profile_set_device_id (ctx->self, device_id);
 }
 
-static void device_open_context_step (GTask *task);
-
 static void
-ms_ext_version_message_ready (MbimDevice   *self,
-                              GAsyncResult *res,
-                              GTask        *task)
+profile_refresh_ready (MbimDevice            *self,
+                       GAsyncResult          *res,
+                       ProfileRefreshContext *ctx)
 {
-    g_autoptr(MbimMessage)  response = NULL;
-    GError                 *error = NULL;
-    guint16                 mbim_version;
-    guint16                 ms_mbimex_version;
-    DeviceOpenContext      *ctx;
-
-    ctx = g_task_get_task_data (task);
+    g_autoptr(MbimMessage) response = NULL;
+    g_autoptr(GError)      error = NULL;
 
+    /* Cancelled transactions complete with an abort error */
     response = mbim_device_command_finish (self, res, &error);
-    if (!response ||
-        !mbim_message_response_get_result (response, MBIM_MESSAGE_TYPE_COMMAND_DONE, &error) ||
-        !mbim_message_ms_basic_connect_extensions_v2_version_response_parse (
-            response,
-            &mbim_version,
-            &ms_mbimex_version,
-            &error)){
-        g_task_return_error (task, error);
-        g_object_unref (task);
+    if (g_cancellable_is_cancelled (ctx->cancellable)) {
+        g_debug ("[%s] device profile refresh cancelled", self->priv->path_display);
+        profile_refresh_context_free (ctx);
         return;
     }
 
-    /* We fully ignore the MBIM version for now, we just assume it's 1.0, which
-     * is the only known release from the USB-IF for now. */
-    self->priv->ms_mbimex_version_major = (ms_mbimex_version >> 8) & 0xFF;
-    self->priv->ms_mbimex_version_minor = ms_mbimex_version & 0xFF;
-
-    g_debug ("[%s] successfully exchanged version information: version %x.%02x, extended version %x.%02x",
-             self->priv->path_display,
-             (mbim_version >> 8) & 0xFF,
-             mbim_version & 0xFF,
-             self->priv->ms_mbimex_version_major,
-             self->priv->ms_mbimex_version_minor);
+    if (!response || !mbim_message_response_get_result (response, MBIM_MESSAGE_TYPE_COMMAND_DONE, &error))
+        g_debug ("[%s] device profile refresh request failed: %s", self->priv->path_display, error->message);
+    else {
+        if (ctx->step == PROFILE_REFRESH_STEP_DEVICE_SERVICES)
+            ctx->device_services = mbim_message_ref (response);
+        device_info_cache_set_response (self, response);
+        if (ctx->step == PROFILE_REFRESH_STEP_DEVICE_CAPS)
+            profile_refresh_device_id (ctx, response);
+    }
 
     ctx->step++;
-    device_open_context_step (task);
+    profile_refresh_step (ctx);
 }
 
 static void
-ms_ext_version_message (GTask *task)
+profile_refresh_step (ProfileRefreshContext *ctx)
 {
-    MbimDevice             *self;
-    DeviceOpenContext      *ctx;
-    g_autoptr(MbimMessage)  request = NULL;
-    guint32                 mbim_version = 0;
-    guint32                 ms_mbimex_version = 0;
+    g_autoptr(MbimMessage) request = NULL;
 
-    self = g_task_get_source_object (task);
-    ctx = g_task_get_task_data (task);
+    switch (ctx->step) {
+    case PROFILE_REFRESH_STEP_FIRST:
+        ctx->step++;
+        /* Fall through */
 
-    if ((ctx->flags & MBIM_DEVICE_OPEN_FLAGS_MS_MBIMEX_V2) && (ctx->flags & MBIM_DEVICE_OPEN_FLAGS_MS_MBIMEX_V3)) {
-        g_task_return_new_error (task, MBIM_CORE_ERROR, MBIM_CORE_ERROR_INVALID_ARGS,
-                                 "Cannot request both MBIMEx v2.0 and v3.0 at the same time");
-        g_object_unref (task);
+    case PROFILE_REFRESH_STEP_DEVICE_SERVICES:
+        request = mbim_message_device_services_query_new (NULL);
+        break;
+
+    case PROFILE_REFRESH_STEP_DEVICE_CAPS:
+        request = mbim_message_device_caps_query_new (NULL);
+        break;
+
+    case PROFILE_REFRESH_STEP_SYS_CAPS:
+        if (profile_refresh_cid_supported (ctx,
+                                           MBIM_SERVICE_MS_BASIC_CONNECT_EXTENSIONS,
+                                           MBIM_CID_MS_BASIC_CONNECT_EXTENSIONS_SYS_CAPS)) {
+            request = mbim_message_ms_basic_connect_extensions_sys_caps_query_new (NULL);
+            break;
+        }
+        ctx->step++;
+        /* Fall through */
+
+    case PROFILE_REFRESH_STEP_DEVICE_SLOT_MAPPINGS:
+        if (profile_refresh_cid_supported (ctx,
+                                           MBIM_SERVICE_MS_BASIC_CONNECT_EXTENSIONS,
+                                           MBIM_CID_MS_BASIC_CONNECT_EXTENSIONS_DEVICE_SLOT_MAPPINGS)) {
+            request = mbim_message_ms_basic_connect_extensions_device_slot_mappings_query_new (NULL);
+            break;
+        }
+        ctx->step++;
+        /* Fall through */
+
+    case PROFILE_REFRESH_STEP_LAST:
+        g_debug ("[%s] device profile refreshed", ctx->self->priv->path_display);
+        device_profile_set_updated (ctx->self);
+        device_profile_save (ctx->self);
+        profile_refresh_context_free (ctx);
         return;
-    }
 
-    /* User requested MBIMEx 2.0 or 3.0, so we'll report it along with MBIM 1.0 */
-    mbim_version = 0x01 << 8 | 0x00;
-    if (ctx->flags & MBIM_DEVICE_OPEN_FLAGS_MS_MBIMEX_V2)
-        ms_mbimex_version = 0x02 << 8 | 0x00;
-    else if (ctx->flags & MBIM_DEVICE_OPEN_FLAGS_MS_MBIMEX_V3)
-        ms_mbimex_version = 0x03 << 8 | 0x00;
-    else
+    default:
         g_assert_not_reached ();
+    }
 
-    request = mbim_message_ms_basic_connect_extensions_v2_version_query_new (mbim_version, ms_mbimex_version, NULL);
     g_assert (request);
-
-    mbim_device_command (self,
+    mbim_device_command (ctx->self,
                          request,
-                         ctx->timeout,
-                         g_task_get_cancellable (task),
-                         (GAsyncReadyCallback)ms_ext_version_message_ready,
-                         task);
+                         10,
+                         ctx->cancellable,
+                         (GAsyncReadyCallback) profile_refresh_ready,
+                         ctx);
 }
 
 static void
-device_services_message_ready (MbimDevice   *device,
-                               GAsyncResult *res,
-                               GTask        *task)
+device_profile_refresh (MbimDevice *self)
 {
-    g_autoptr(MbimMessage)                    response = NULL;
-    g_autoptr(MbimDeviceServiceElementArray)  device_services = NULL;
-    GError                                   *error = NULL;
-    guint32                                   device_services_count;
-    guint32                                   max_dss_sessions;
-    DeviceOpenContext                        *ctx;
-    guint                                     i;
-
-    ctx = g_task_get_task_data (task);
+    ProfileRefreshContext *ctx;
 
-    response = mbim_device_command_finish (device, res, &error);
-    if (!response ||
-        !mbim_message_response_get_result (response, MBIM_MESSAGE_TYPE_COMMAND_DONE, &error) ||
-        !mbim_message_device_services_response_parse (
-            response,
-            &device_services_count,
-            &max_dss_sessions,
-            &device_services,
-            &error)) {
-        g_task_return_error (task, error);
-        g_object_unref (task);
+    if (self->priv->profile_refresh_cancellable || !device_profile_needs_refresh (self))
         return;
-    }
 
-    if (device_services_count == 0) {
-        g_task_return_new_error (task, MBIM_CORE_ERROR, MBIM_CORE_ERROR_FAILED,
-                                 "No supported services reported by the modem");
-        g_object_unref (task);
-        return;
-    }
+    g_debug ("[%s] refreshing device profile in the background...", self->priv->path_display);
 
-    for (i = 0; i < device_services_count; i++) {
-        MbimService service;
-        guint32     j;
+    ctx = g_slice_new0 (ProfileRefreshContext);
+    ctx->self = g_object_ref (self);
+    ctx->cancellable = g_cancellable_new ();
+    ctx->step = PROFILE_REFRESH_STEP_FIRST;
+    self->priv->profile_refresh_cancellable = g_object_ref (ctx->cancellable);
 
-        service = mbim_uuid_to_service (&device_services[i]->device_service_id);
-        for (j = 0; j < device_services[i]->cids_count; j++) {
+    profile_refresh_step (ctx);
+}
 
-            if ((service == MBIM_SERVICE_MS_BASIC_CONNECT_EXTENSIONS) &&
-                device_services[i]->cids[j] == MBIM_CID_MS_BASIC_CONNECT_EXTENSIONS_VERSION) {
-                /* version command is supported, go on */
-                ctx->step++;
-                device_open_context_step (task);
-                return;
-            }
-        }
-    }
+static void
+device_profile_refresh_cancel (MbimDevice *self)
+{
+    if (self->priv->profile_refresh_cancellable)
+        g_cancellable_cancel (self->priv->profile_refresh_cancellable);
+}
 
-    /* the version command isn't supported, so we can just jump to the end */
-    ctx->step = DEVICE_OPEN_CONTEXT_STEP_LAST;;
-    device_open_context_step (task);
+void
+_mbim_device_set_profile_identity (MbimDevice  *self,
+                                   const gchar *identity)
+{
+    g_free (self->priv->profile_identity);
+    self->priv->profile_identity = g_strdup (identity);
 }
 
-static void
-device_services_message (GTask *task)
+void
+_mbim_device_set_proxy_path (MbimDevice  *self,
+                             const gchar *path)
 {
-    MbimDevice             *self;
-    DeviceOpenContext      *ctx;
-    g_autoptr(MbimMessage)  request = NULL;
+    g_free (self->priv->proxy_path);
+    self->priv->proxy_path = g_strdup (path);
+}
 
-    self = g_task_get_source_object (task);
-    ctx  = g_task_get_task_data (task);
+void
+_mbim_device_info_cache_clear (void)
+{
+    G_LOCK (device_info_cache);
+    if (device_info_cache)
+        g_hash_table_remove_all (device_info_cache);
+    G_UNLOCK (device_info_cache);
+}
 
-    request = mbim_message_device_services_query_new (NULL);
-    g_assert (request);
+typedef struct {
+    guint    spawn_retries;
+    gint     ready_fd;
+    GSource *ready_source;
+    GSource *ready_timeout_source;
+} CreateIoChannelContext;
 
-    mbim_device_command (self,
-                         request,
-                         ctx->timeout,
-                         g_task_get_cancellable (task),
-                         (GAsyncReadyCallback)device_services_message_ready,
-                         task);
+static void
+create_iochannel_context_clear_ready (CreateIoChannelContext *ctx)
+{
+    if (ctx->ready_source) {
+        g_source_destroy (ctx->ready_source);
+        g_source_unref (ctx->ready_source);
+        ctx->ready_source = NULL;
+    }
+    if (ctx->ready_timeout_source) {
+        g_source_destroy (ctx->ready_timeout_source);
+        g_source_unref (ctx->ready_timeout_source);
+        ctx->ready_timeout_source = NULL;
+    }
+    if (ctx->ready_fd >= 0) {
+        close (ctx->ready_fd);
+        ctx->ready_fd = -1;
+    }
 }
 
 static void
-open_message_ready (MbimDevice   *self,
-                    GAsyncResult *res,
-                    GTask        *task)
+create_iochannel_context_free (CreateIoChannelContext *ctx)
 {
-    DeviceOpenContext      *ctx;
-    g_autoptr(MbimMessage)  response = NULL;
-    g_autoptr(GError)       error = NULL;
+    create_iochannel_context_clear_ready (ctx);
+    g_slice_free (CreateIoChannelContext, ctx);
+}
 
-    ctx = g_task_get_task_data (task);
+static gboolean
+create_iochannel_finish (MbimDevice *self,
+                         GAsyncResult *res,
+                         GError **error)
+{
+    return g_task_propagate_boolean (G_TASK (res), error);
+}
 
-    /* Cleanup, as no longer needed */
-    self->priv->open_transaction_id = 0;
+static gboolean
+setup_iochannel_watch (MbimDevice  *self,
+                       GError     **error)
+{
+    GError *inner_error = NULL;
 
-    response = mbim_device_command_finish (self, res, &error);
-    if (!response) {
-        /* If we get reported that the state is unknown, try to close before open */
-        if (g_error_matches (error, MBIM_CORE_ERROR, MBIM_CORE_ERROR_UNKNOWN_STATE)) {
-            ctx->close_before_open = TRUE;
-            ctx->step = DEVICE_OPEN_CONTEXT_STEP_CLOSE_MESSAGE;
-            device_open_context_step (task);
-            return;
-        }
+    /* We don't want UTF-8 encoding, we're playing with raw binary data */
+    g_io_channel_set_encoding (self->priv->iochannel, NULL, NULL);
 
-        /* Check if we should be retrying after a timeout */
-        if (g_error_matches (error, MBIM_CORE_ERROR, MBIM_CORE_ERROR_TIMEOUT)) {
-            device_open_context_step (task);
-            return;
-        }
+    /* We don't want to get the channel buffered */
+    g_io_channel_set_buffered (self->priv->iochannel, FALSE);
 
-        g_debug ("[%s] error reported in open operation: closed", self->priv->path_display);
-        self->priv->open_status = OPEN_STATUS_CLOSED;
-        g_task_return_error (task, g_steal_pointer (&error));
-        g_object_unref (task);
-        return;
-    }
+    /* Let the GIOChannel own the FD */
+    g_io_channel_set_close_on_unref (self->priv->iochannel, TRUE);
 
-    if (!mbim_message_response_get_result (response, MBIM_MESSAGE_TYPE_OPEN_DONE, &error)) {
-        g_debug ("[%s] getting open done result failed: closed", self->priv->path_display);
-        self->priv->open_status = OPEN_STATUS_CLOSED;
-        g_task_return_error (task, g_steal_pointer (&error));
-        g_object_unref (task);
-        return;
+    /* We don't want to get blocked while writing stuff */
+    if (!g_io_channel_set_flags (self->priv->iochannel,
+                                 G_IO_FLAG_NONBLOCK,
+                                 &inner_error)) {
+        g_io_channel_shutdown (self->priv->iochannel, FALSE, NULL);
+        g_io_channel_unref (self->priv->iochannel);
+        self->priv->iochannel = NULL;
+        g_clear_object (&self->priv->socket_connection);
+        g_clear_object (&self->priv->socket_client);
+        g_propagate_error (error, inner_error);
+        return FALSE;
     }
 
-    /* go on */
-    ctx->step++;
-    device_open_context_step (task);
+    self->priv->iochannel_source = g_io_create_watch (self->priv->iochannel,
+                                                      G_IO_IN | G_IO_ERR | G_IO_HUP);
+    g_source_set_callback (self->priv->iochannel_source,
+                           (GSourceFunc)data_available,
+                           self,
+                           NULL);
+    g_source_attach (self->priv->iochannel_source, g_main_context_get_thread_default ());
+    return TRUE;
 }
 
 static void
-open_message (GTask *task)
+setup_iochannel (GTask *task)
 {
-    MbimDevice             *self;
-    g_autoptr(MbimMessage)  request = NULL;
+    MbimDevice *self;
+    GError     *error = NULL;
 
     self = g_task_get_source_object (task);
 
-    /* Launch 'Open' command */
-    self->priv->open_transaction_id = mbim_device_get_next_transaction_id (self);
-    request = mbim_message_open_new (self->priv->open_transaction_id,
-                                     self->priv->max_control_transfer);
-    mbim_device_command (self,
-                         request,
-                         OPEN_RETRY_TIMEOUT_SECS,
-                         g_task_get_cancellable (task),
-                         (GAsyncReadyCallback)open_message_ready,
-                         task);
+    if (!setup_iochannel_watch (self, &error))
+        g_task_return_error (task, error);
+    else
+        g_task_return_boolean (task, TRUE);
+    g_object_unref (task);
 }
 
-static void
-close_message_before_open_ready (MbimDevice   *self,
-                                 GAsyncResult *res,
-                                 GTask        *task)
+static guint16
+query_max_control_transfer (MbimDevice *self,
+                            gint        fd)
 {
-    DeviceOpenContext      *ctx;
-    g_autoptr(MbimMessage)  response = NULL;
-    g_autoptr(GError)       error = NULL;
-
-    ctx = g_task_get_task_data (task);
+    guint16 max;
 
-    response = mbim_device_command_finish (self, res, &error);
-    if (!response)
-        g_debug ("[%s] error reported in close before open: %s (ignored)", self->priv->path_display, error->message);
-    else if (!mbim_message_response_get_result (response, MBIM_MESSAGE_TYPE_CLOSE_DONE, &error))
-        g_debug ("[%s] getting close done result failed: %s (ignored)", self->priv->path_display, error->message);
+    if (ioctl (fd, IOCTL_WDM_MAX_COMMAND, &max) < 0) {
+        g_debug ("[%s] couldn't query maximum message size: "
+                 "IOCTL_WDM_MAX_COMMAND failed: %s",
+                 self->priv->path_display,
+                 strerror (errno));
+        /* Fallback, try to read the descriptor file */
+        return read_max_control_transfer_cached (self);
+    }
 
-    /* go on */
-    ctx->step++;
-    device_open_context_step (task);
+    g_debug ("[%s] queried max control message size: %" G_GUINT16_FORMAT,
+             self->priv->path_display,
+             max);
+    return max;
 }
 
 static void
-close_message_before_open (GTask *task)
+create_iochannel_with_fd (GTask *task)
 {
-    MbimDevice             *self;
-    g_autoptr(MbimMessage)  request = NULL;
+    MbimDevice *self;
+    gint fd;
 
     self = g_task_get_source_object (task);
+    errno = 0;
+    fd = open (self->priv->path, O_RDWR | O_EXCL | O_NONBLOCK | O_NOCTTY);
+    if (fd < 0) {
+        g_task_return_new_error (task,
+                                 MBIM_CORE_ERROR,
+                                 MBIM_CORE_ERROR_FAILED,
+                                 "Cannot open device file '%s': %s",
+                                 self->priv->path_display,
+                                 strerror (errno));
+        g_object_unref (task);
+        return;
+    }
 
-    /* Launch 'Close' command */
-    request = mbim_message_close_new (mbim_device_get_next_transaction_id (self));
-    mbim_device_command (self,
-                         request,
-                         OPEN_CLOSE_TIMEOUT_SECS,
-                         g_task_get_cancellable (task),
-                         (GAsyncReadyCallback)close_message_before_open_ready,
-                         task);
+    /* Query message size */
+    self->priv->max_control_transfer = query_max_control_transfer (self, fd);
+
+    /* Create new GIOChannel */
+    self->priv->iochannel = g_io_channel_unix_new (fd);
+
+    setup_iochannel (task);
 }
 
-static void
-proxy_cfg_message_ready (MbimDevice   *self,
-                         GAsyncResult *res,
-                         GTask        *task)
+static void create_iochannel_with_socket (GTask *task);
+
+static gboolean
+wait_for_proxy_cb (GTask *task)
 {
-    DeviceOpenContext      *ctx;
-    GError                 *error = NULL;
-    g_autoptr(MbimMessage)  response = NULL;
+    CreateIoChannelContext *ctx;
 
     ctx = g_task_get_task_data (task);
+    create_iochannel_context_clear_ready (ctx);
 
-    response = mbim_device_command_finish (self, res, &error);
-    if (!response) {
-        /* Hard error if proxy cfg command fails */
-        g_debug ("[%s] proxy configuration failed: closed", self->priv->path_display);
-        self->priv->open_status = OPEN_STATUS_CLOSED;
-        g_task_return_error (task, error);
-        g_object_unref (task);
-        return;
-    }
-
-    ctx->step++;
-    device_open_context_step (task);
+    create_iochannel_with_socket (task);
+    return G_SOURCE_REMOVE;
 }
 
-static void
-proxy_cfg_message (GTask *task)
+static gboolean
+proxy_ready_cb (gint          fd,
+                GIOCondition  condition,
+                GTask        *task)
 {
-    MbimDevice             *self;
-    DeviceOpenContext      *ctx;
-    g_autoptr(MbimMessage)  request = NULL;
+    MbimDevice *self;
+    gchar       byte;
 
     self = g_task_get_source_object (task);
-    ctx = g_task_get_task_data (task);
 
-    request = mbim_message_proxy_control_configuration_set_new (self->priv->path, ctx->timeout, NULL);
-    g_assert (request);
+    /* Either the ready notification or EOF, e.g. if the new proxy exited
+     * because another one was already running; connect in both cases */
+    if (read (fd, &byte, 1) == 1)
+        g_debug ("[%s] mbim-proxy reported ready", self->priv->path_display);
+    else
+        g_debug ("[%s] mbim-proxy exited without reporting ready", self->priv->path_display);
 
-    /* This message is no longer a direct reply; as the proxy will also try to open the device
-     * directly. If it cannot open the device, it will return an error. */
-    mbim_device_command (self,
-                         request,
-                         ctx->timeout,
-                         g_task_get_cancellable (task),
-                         (GAsyncReadyCallback)proxy_cfg_message_ready,
-                         task);
+    return wait_for_proxy_cb (task);
 }
 
 static void
-create_iochannel_ready (MbimDevice   *self,
-                        GAsyncResult *res,
-                        GTask        *task)
+spawn_child_setup (gpointer user_data)
 {
-    DeviceOpenContext *ctx;
-    GError            *error = NULL;
+    gint ready_fd;
+    gint flags;
 
-    if (!create_iochannel_finish (self, res, &error)) {
-        g_debug ("[%s] creating iochannel failed: closed", self->priv->path_display);
-        self->priv->open_status = OPEN_STATUS_CLOSED;
-        g_task_return_error (task, error);
-        g_object_unref (task);
-        return;
-    }
+    if (setpgid (0, 0) < 0)
+        g_warning ("couldn't setup proxy specific process group");
 
-    /* Go on */
-    ctx = g_task_get_task_data (task);
-    ctx->step++;
-    device_open_context_step (task);
+    /* The ready fd is inherited by the proxy; the remaining ones have already
+     * been flagged as close-on-exec at this point */
+    ready_fd = GPOINTER_TO_INT (user_data);
+    flags = fcntl (ready_fd, F_GETFD);
+    if (flags >= 0)
+        fcntl (ready_fd, F_SETFD, flags & ~FD_CLOEXEC);
 }
 
 static void
-device_open_context_step (GTask *task)
+spawn_proxy (GTask *task)
 {
-    MbimDevice        *self;
-    DeviceOpenContext *ctx;
+    MbimDevice             *self;
+    CreateIoChannelContext *ctx;
+    g_auto(GStrv)           argv = NULL;
+    gint                    ready_fds[2];
+    GError                 *error = NULL;
 
     self = g_task_get_source_object (task);
-    ctx  = g_task_get_task_data (task);
+    ctx = g_task_get_task_data (task);
 
-    /* Timed out? */
-    if (g_timer_elapsed (ctx->timer, NULL) > ctx->timeout) {
-        g_debug ("[%s] open operation timed out: closed", self->priv->path_display);
-        self->priv->open_status = OPEN_STATUS_CLOSED;
-        g_task_return_new_error (task,
-                                 MBIM_CORE_ERROR,
-                                 MBIM_CORE_ERROR_TIMEOUT,
-                                 "Operation timed out: device is closed");
-        g_object_unref (task);
-        return;
+    g_debug ("[%s] spawning new mbim-proxy (try %u)...", self->priv->path_display, ctx->spawn_retries);
+
+    /* The proxy writes to the pipe once it accepts connections, so there is no
+     * need to poll until it's up */
+    if (!g_unix_open_pipe (ready_fds, FD_CLOEXEC, &error)) {
+        g_debug ("[%s] couldn't create mbim-proxy ready pipe: %s", self->priv->path_display, error->message);
+        g_clear_error (&error);
+        ready_fds[0] = ready_fds[1] = -1;
     }
 
-    switch (ctx->step) {
-    case DEVICE_OPEN_CONTEXT_STEP_FIRST:
-        if (self->priv->open_status == OPEN_STATUS_OPEN) {
-            g_task_return_new_error (task,
-                                     MBIM_CORE_ERROR,
-                                     MBIM_CORE_ERROR_WRONG_STATE,
-                                     "Already open");
-            g_object_unref (task);
-            return;
+    argv = g_new0 (gchar *, 3);
+    argv[0] = g_strdup (self->priv->proxy_path ? self->priv->proxy_path : LIBEXEC_PATH "/mbim-proxy");
+    if (ready_fds[1] >= 0)
+        argv[1] = g_strdup_printf ("--ready-fd=%d", ready_fds[1]);
+
+    if (!g_spawn_async (NULL, /* working directory */
+                        argv,
+                        NULL, /* envp */
+                        G_SPAWN_STDOUT_TO_DEV_NULL | G_SPAWN_STDERR_TO_DEV_NULL,
+                        (GSpawnChildSetupFunc) spawn_child_setup,
+                        GINT_TO_POINTER (ready_fds[1]),
+                        NULL,
+                        &error)) {
+        g_debug ("[%s] error spawning mbim-proxy: %s", self->priv->path_display, error->message);
+        g_clear_error (&error);
+        if (ready_fds[0] >= 0) {
+            close (ready_fds[0]);
+            close (ready_fds[1]);
+            ready_fds[0] = ready_fds[1] = -1;
         }
+    }
 
-        if (self->priv->open_status == OPEN_STATUS_OPENING) {
+    if (ready_fds[1] >= 0)
+        close (ready_fds[1]);
+
+    if (ready_fds[0] >= 0) {
+        ctx->ready_fd = ready_fds[0];
+        ctx->ready_source = g_unix_fd_source_new (ctx->ready_fd, G_IO_IN | G_IO_ERR | G_IO_HUP);
+        g_source_set_callback (ctx->ready_source, (GSourceFunc)proxy_ready_cb, task, NULL);
+        g_source_attach (ctx->ready_source, g_main_context_get_thread_default ());
+    }
+
+    /* Don't wait forever for the ready notification; and if there is no
+     * notification at all, just wait some ms and retry */
+    ctx->ready_timeout_source = g_timeout_source_new (ctx->ready_source ? PROXY_READY_TIMEOUT_MS : SPAWN_RETRY_TIMEOUT_MS);
+    g_source_set_callback (ctx->ready_timeout_source, (GSourceFunc)wait_for_proxy_cb, task, NULL);
+    g_source_attach (ctx->ready_timeout_source, g_main_context_get_thread_default ());
+}
+
+static void
+socket_connect_ready (GSocketClient *socket_client,
+                      GAsyncResult  *res,
+                      GTask         *task)
+{
+    MbimDevice             *self;
+    CreateIoChannelContext *ctx;
+    GSocketConnection      *socket_connection;
+    g_autoptr(GError)       error = NULL;
+
+    self = g_task_get_source_object (task);
+    ctx = g_task_get_task_data (task);
+
+    socket_connection = g_socket_client_connect_finish (socket_client, res, &error);
+    if (!socket_connection) {
+        g_debug ("[%s] cannot connect to proxy: %s", self->priv->path_display, error->message);
+        g_clear_object (&self->priv->socket_client);
+
+        /* Don't retry forever */
+        ctx->spawn_retries++;
+        if (ctx->spawn_retries > MAX_SPAWN_RETRIES) {
             g_task_return_new_error (task,
                                      MBIM_CORE_ERROR,
-                                     MBIM_CORE_ERROR_WRONG_STATE,
-                                     "Already opening");
+                                     MBIM_CORE_ERROR_FAILED,
+                                     "Couldn't spawn the mbim-proxy");
             g_object_unref (task);
             return;
         }
 
-        g_debug ("[%s] opening device...", self->priv->path_display);
-        g_assert (self->priv->open_status == OPEN_STATUS_CLOSED);
-        self->priv->open_status = OPEN_STATUS_OPENING;
-
-        ctx->step++;
-        /* Fall through */
-
-    case DEVICE_OPEN_CONTEXT_STEP_CREATE_IOCHANNEL:
-        create_iochannel (self,
-                          !!(ctx->flags & MBIM_DEVICE_OPEN_FLAGS_PROXY),
-                          (GAsyncReadyCallback)create_iochannel_ready,
-                          task);
+        spawn_proxy (task);
         return;
+    }
 
-    case DEVICE_OPEN_CONTEXT_STEP_FLAGS_PROXY:
-        if (ctx->flags & MBIM_DEVICE_OPEN_FLAGS_PROXY) {
-            proxy_cfg_message (task);
-            return;
-        }
-        ctx->step++;
-        /* Fall through */
+    if (self->priv->socket_connection)
+        g_object_unref (self->priv->socket_connection);
+    self->priv->socket_connection = socket_connection;
 
-    case DEVICE_OPEN_CONTEXT_STEP_CLOSE_MESSAGE:
-        /* Only send an explicit close during open if needed */
-        if (ctx->close_before_open) {
-            ctx->close_before_open = FALSE;
-            close_message_before_open (task);
-            return;
-        }
-        ctx->step++;
-        /* Fall through */
+    self->priv->iochannel = g_io_channel_unix_new (
+                                     g_socket_get_fd (
+                                         g_socket_connection_get_socket (self->priv->socket_connection)));
 
-    case DEVICE_OPEN_CONTEXT_STEP_OPEN_MESSAGE:
-        /* If the device is already in-session, avoid the open message */
-        if (!self->priv->in_session) {
-            open_message (task);
-            return;
-        }
-        ctx->step++;
-        /* Fall through */
+    /* try to read the descriptor file */
+    self->priv->max_control_transfer = read_max_control_transfer_cached (self);
 
-        case DEVICE_OPEN_CONTEXT_STEP_DEVICE_SERVICES:
-        if (ctx->flags & (MBIM_DEVICE_OPEN_FLAGS_MS_MBIMEX_V2 | MBIM_DEVICE_OPEN_FLAGS_MS_MBIMEX_V3)) {
-            device_services_message (task);
-            return;
-        }
-        ctx->step++;
-        /* Fall through */
+    setup_iochannel (task);
+}
 
-        case DEVICE_OPEN_CONTEXT_STEP_MS_EXT_VERSION:
-        if (ctx->flags & (MBIM_DEVICE_OPEN_FLAGS_MS_MBIMEX_V2 | MBIM_DEVICE_OPEN_FLAGS_MS_MBIMEX_V3)) {
-            ms_ext_version_message (task);
-            return;
-        }
-        ctx->step++;
-        /* Fall through */
+static void
+create_iochannel_with_socket (GTask *task)
+{
+    MbimDevice                *self;
+    g_autoptr(GSocketAddress)  socket_address = NULL;
 
-    case DEVICE_OPEN_CONTEXT_STEP_LAST:
-        /* Nothing else to process, complete without error */
-        self->priv->open_status = OPEN_STATUS_OPEN;
-        g_task_return_boolean (task, TRUE);
+    self = g_task_get_source_object (task);
+
+    /* Create socket client */
+    if (self->priv->socket_client)
+        g_object_unref (self->priv->socket_client);
+    self->priv->socket_client = g_socket_client_new ();
+    g_socket_client_set_family (self->priv->socket_client, G_SOCKET_FAMILY_UNIX);
+    g_socket_client_set_socket_type (self->priv->socket_client, G_SOCKET_TYPE_STREAM);
+    g_socket_client_set_protocol (self->priv->socket_client, G_SOCKET_PROTOCOL_DEFAULT);
+
+    /* Setup socket address */
+    socket_address = (g_unix_socket_address_new_with_type (
+                          MBIM_PROXY_SOCKET_PATH,
+                          -1,
+                          G_UNIX_SOCKET_ADDRESS_ABSTRACT));
+
+    /* Connect to address */
+    g_socket_client_connect_async (self->priv->socket_client,
+                                   G_SOCKET_CONNECTABLE (socket_address),
+                                   NULL,
+                                   (GAsyncReadyCallback)socket_connect_ready,
+                                   task);
+}
+
+static void
+create_iochannel (MbimDevice           *self,
+                  gboolean              proxy,
+                  GAsyncReadyCallback   callback,
+                  gpointer              user_data)
+{
+    CreateIoChannelContext *ctx;
+    GTask *task;
+
+    ctx = g_slice_new0 (CreateIoChannelContext);
+    ctx->ready_fd = -1;
+
+    task = g_task_new (self, NULL, callback, user_data);
+    g_task_set_task_data (task, ctx, (GDestroyNotify)create_iochannel_context_free);
+
+    if (self->priv->iochannel) {
+        g_task_return_new_error (task,
+                                 MBIM_CORE_ERROR,
+                                 MBIM_CORE_ERROR_WRONG_STATE,
+                                 "Already open");
         g_object_unref (task);
         return;
-
-    default:
-        break;
     }
 
-    g_assert_not_reached ();
+    g_assert (self->priv->file);
+    g_assert (self->priv->path);
+
+    if (proxy)
+        create_iochannel_with_socket (task);
+    else
+        create_iochannel_with_fd (task);
 }
 
-void
-mbim_device_open_full (MbimDevice          *self,
-                       MbimDeviceOpenFlags  flags,
-                       guint                timeout,
-                       GCancellable        *cancellable,
-                       GAsyncReadyCallback  callback,
-                       gpointer             user_data)
+typedef enum {
+    DEVICE_OPEN_CONTEXT_STEP_FIRST = 0,
+    DEVICE_OPEN_CONTEXT_STEP_CREATE_IOCHANNEL,
+    DEVICE_OPEN_CONTEXT_STEP_FLAGS_PROXY,
+    DEVICE_OPEN_CONTEXT_STEP_CLOSE_MESSAGE,
+    DEVICE_OPEN_CONTEXT_STEP_OPEN_MESSAGE,
+    DEVICE_OPEN_CONTEXT_STEP_DEVICE_SERVICES,
+    DEVICE_OPEN_CONTEXT_STEP_MS_EXT_VERSION,
+    DEVICE_OPEN_CONTEXT_STEP_LAST
+} DeviceOpenContextStep;
+
+typedef struct {
+    DeviceOpenContextStep  step;
+    MbimDeviceOpenFlags    flags;
+    guint                  timeout;
+    GTimer                *timer;
+    gboolean               close_before_open;
+
+    /* Step being timed, and when it started */
+    DeviceOpenContextStep  timed_step;
+    gint64                 step_start;
+
+    /* Device services and version requests in flight at the same time */
+    guint                  n_pending;
+    gboolean               ms_ext_version_supported;
+    GError                *device_services_error;
+    MbimMessage           *ms_ext_version_response;
+    GError                *ms_ext_version_error;
+} DeviceOpenContext;
+
+static void
+device_open_context_free (DeviceOpenContext *ctx)
 {
-    DeviceOpenContext *ctx;
-    GTask             *task;
+    g_clear_error (&ctx->device_services_error);
+    g_clear_error (&ctx->ms_ext_version_error);
+    if (ctx->ms_ext_version_response)
+        mbim_message_unref (ctx->ms_ext_version_response);
+    g_timer_destroy (ctx->timer);
+    g_slice_free (DeviceOpenContext, ctx);
+}
 
-    g_return_if_fail (MBIM_IS_DEVICE (self));
-    g_return_if_fail (timeout > 0);
+static void
+device_open_step_start (DeviceOpenContext *ctx)
+{
+    /* Retries of the same step are accounted together */
+    if (ctx->timed_step != ctx->step) {
+        ctx->timed_step = ctx->step;
+        ctx->step_start = g_get_monotonic_time ();
+    }
+}
 
-    ctx = g_slice_new0 (DeviceOpenContext);
-    ctx->step = DEVICE_OPEN_CONTEXT_STEP_FIRST;
-    ctx->flags = flags;
-    ctx->timeout = timeout;
-    ctx->timer = g_timer_new ();
-    ctx->close_before_open = FALSE;
+static void
+device_open_step_done (MbimDevice         *self,
+                       DeviceOpenContext  *ctx,
+                       MbimDeviceOpenStep  step)
+{
+    self->priv->open_step_time[step] = g_get_monotonic_time () - ctx->step_start;
+}
 
-    task = g_task_new (self, cancellable, callback, user_data);
-    g_task_set_task_data (task, ctx, (GDestroyNotify)device_open_context_free);
+static void
+device_open_steps_debug (MbimDevice *self)
+{
+    static const gchar *step_names[MBIM_DEVICE_OPEN_STEP_LAST] = {
+        "create iochannel",
+        "proxy config",
+        "close",
+        "open",
+        "device services",
+        "MBIMEx version",
+    };
+    g_autoptr(GString) str = NULL;
+    guint              i;
+
+    str = g_string_new (NULL);
+    for (i = 0; i < MBIM_DEVICE_OPEN_STEP_LAST; i++) {
+        if (self->priv->open_step_time[i] > 0)
+            g_string_append_printf (str, "%s%s %.1f ms",
+                                    str->len ? ", " : "",
+                                    step_names[i],
+                                    (gdouble) self->priv->open_step_time[i] / 1000.0);
+    }
+    g_debug ("[%s] open steps: %s", self->priv->path_display, str->str);
+}
 
-    /* Start processing */
-    device_open_context_step (task);
+gboolean
+mbim_device_open_full_finish (MbimDevice    *self,
+                              GAsyncResult  *res,
+                              GError       **error)
+{
+    return g_task_propagate_boolean (G_TASK (res), error);
 }
 
-void
-mbim_device_open (MbimDevice          *self,
-                  guint                timeout,
-                  GCancellable        *cancellable,
-                  GAsyncReadyCallback  callback,
-                  gpointer             user_data)
+gboolean
+mbim_device_open_finish (MbimDevice   *self,
+                         GAsyncResult  *res,
+                         GError       **error)
 {
-    mbim_device_open_full (self,
-                           MBIM_DEVICE_OPEN_FLAGS_NONE,
-                           timeout,
-                           cancellable,
-                           callback,
-                           user_data);
+    return mbim_device_open_full_finish (self, res, error);
 }
 
-/*****************************************************************************/
-/* Close channel */
+static void device_open_context_step (GTask *task);
 
 static gboolean
-destroy_iochannel (MbimDevice  *self,
-                   GError     **error)
+ms_ext_version_response_process (MbimDevice   *self,
+                                 MbimMessage  *response,
+                                 GError      **error)
 {
-    GError *inner_error = NULL;
+    guint16 mbim_version;
+    guint16 ms_mbimex_version;
 
-    /* Already closed? */
-    if (!self->priv->iochannel && !self->priv->socket_connection && !self->priv->socket_client)
-        return TRUE;
+    if (!mbim_message_response_get_result (response, MBIM_MESSAGE_TYPE_COMMAND_DONE, error) ||
+        !mbim_message_ms_basic_connect_extensions_v2_version_response_parse (
+            response,
+            &mbim_version,
+            &ms_mbimex_version,
+            error))
+        return FALSE;
 
-    g_debug ("[%s] channel destroyed", self->priv->path_display);
+    /* We fully ignore the MBIM version for now, we just assume it's 1.0, which
+     * is the only known release from the USB-IF for now. */
+    self->priv->ms_mbimex_version_major = (ms_mbimex_version >> 8) & 0xFF;
+    self->priv->ms_mbimex_version_minor = ms_mbimex_version & 0xFF;
+    device_info_cache_set_response (self, response);
 
-    if (self->priv->iochannel) {
-        g_io_channel_shutdown (self->priv->iochannel, TRUE, &inner_error);
-        g_io_channel_unref (self->priv->iochannel);
-        self->priv->iochannel = NULL;
-    }
+    g_debug ("[%s] successfully exchanged version information: version %x.%02x, extended version %x.%02x",
+             self->priv->path_display,
+             (mbim_version >> 8) & 0xFF,
+             mbim_version & 0xFF,
+             self->priv->ms_mbimex_version_major,
+             self->priv->ms_mbimex_version_minor);
+    return TRUE;
+}
 
-    /* Failures when closing still make the device to get closed */
-    g_clear_object (&self->priv->socket_connection);
-    g_clear_object (&self->priv->socket_client);
+static void device_open_pipeline_step (GTask *task);
 
-    if (self->priv->iochannel_source) {
-        g_source_destroy (self->priv->iochannel_source);
-        g_source_unref (self->priv->iochannel_source);
-        self->priv->iochannel_source = NULL;
-    }
+static void
+ms_ext_version_message_ready (MbimDevice   *self,
+                              GAsyncResult *res,
+                              GTask        *task)
+{
+    g_autoptr(MbimMessage)  response = NULL;
+    GError                 *error = NULL;
+    DeviceOpenContext      *ctx;
 
-    if (self->priv->response) {
-        g_byte_array_unref (self->priv->response);
-        self->priv->response = NULL;
+    ctx = g_task_get_task_data (task);
+    device_open_step_done (self, ctx, MBIM_DEVICE_OPEN_STEP_MS_MBIMEX_VERSION);
+
+    response = mbim_device_command_finish (self, res, &error);
+
+    /* If sent along with the device services query, the response is only
+     * processed once we know the device supports the version command */
+    if (ctx->n_pending > 0) {
+        ctx->ms_ext_version_response = g_steal_pointer (&response);
+        ctx->ms_ext_version_error = error;
+        device_open_pipeline_step (task);
+        return;
     }
 
-    if (inner_error) {
-        g_propagate_error (error, inner_error);
-        return FALSE;
+    if (!response || !ms_ext_version_response_process (self, response, &error)) {
+        g_task_return_error (task, error);
+        g_object_unref (task);
+        return;
     }
 
-    return TRUE;
+    ctx->step++;
+    device_open_context_step (task);
 }
 
-gboolean
-mbim_device_close_force (MbimDevice *self,
-                         GError **error)
+static MbimMessage *
+ms_ext_version_request_new (DeviceOpenContext  *ctx,
+                            GError            **error)
 {
-    g_return_val_if_fail (MBIM_IS_DEVICE (self), FALSE);
+    guint32 mbim_version = 0;
+    guint32 ms_mbimex_version = 0;
 
-    return destroy_iochannel (self, error);
-}
+    if ((ctx->flags & MBIM_DEVICE_OPEN_FLAGS_MS_MBIMEX_V2) && (ctx->flags & MBIM_DEVICE_OPEN_FLAGS_MS_MBIMEX_V3)) {
+        g_set_error (error, MBIM_CORE_ERROR, MBIM_CORE_ERROR_INVALID_ARGS,
+                     "Cannot request both MBIMEx v2.0 and v3.0 at the same time");
+        return NULL;
+    }
 
-typedef struct {
-    guint timeout;
-} DeviceCloseContext;
+    /* User requested MBIMEx 2.0 or 3.0, so we'll report it along with MBIM 1.0 */
+    mbim_version = 0x01 << 8 | 0x00;
+    if (ctx->flags & MBIM_DEVICE_OPEN_FLAGS_MS_MBIMEX_V2)
+        ms_mbimex_version = 0x02 << 8 | 0x00;
+    else if (ctx->flags & MBIM_DEVICE_OPEN_FLAGS_MS_MBIMEX_V3)
+        ms_mbimex_version = 0x03 << 8 | 0x00;
+    else
+        g_assert_not_reached ();
+
+    return mbim_message_ms_basic_connect_extensions_v2_version_query_new (mbim_version, ms_mbimex_version, error);
+}
+
+static void
+ms_ext_version_message (GTask        *task,
+                        MbimMessage  *request)
+{
+    MbimDevice        *self;
+    DeviceOpenContext *ctx;
+
+    self = g_task_get_source_object (task);
+    ctx = g_task_get_task_data (task);
+
+    device_command (self,
+                    request,
+                    ctx->timeout,
+                    g_task_get_cancellable (task),
+                    (GAsyncReadyCallback)ms_ext_version_message_ready,
+                    task,
+                    TRUE);
+}
+
+static gboolean
+device_services_response_process (MbimDevice   *self,
+                                  MbimMessage  *response,
+                                  gboolean     *out_ms_ext_version_supported,
+                                  GError      **error)
+{
+    g_autoptr(MbimDeviceServiceElementArray)  device_services = NULL;
+    guint32                                   device_services_count;
+    guint32                                   max_dss_sessions;
+
+    if (!mbim_message_response_get_result (response, MBIM_MESSAGE_TYPE_COMMAND_DONE, error) ||
+        !mbim_message_device_services_response_parse (
+            response,
+            &device_services_count,
+            &max_dss_sessions,
+            &device_services,
+            error))
+        return FALSE;
+
+    if (device_services_count == 0) {
+        g_set_error (error, MBIM_CORE_ERROR, MBIM_CORE_ERROR_FAILED,
+                     "No supported services reported by the modem");
+        return FALSE;
+    }
+
+    *out_ms_ext_version_supported = device_services_find_cid (device_services,
+                                                              device_services_count,
+                                                              MBIM_SERVICE_MS_BASIC_CONNECT_EXTENSIONS,
+                                                              MBIM_CID_MS_BASIC_CONNECT_EXTENSIONS_VERSION);
+    return TRUE;
+}
+
+static void
+device_services_message_ready (MbimDevice   *device,
+                               GAsyncResult *res,
+                               GTask        *task)
+{
+    g_autoptr(MbimMessage)  response = NULL;
+    GError                 *error = NULL;
+    gboolean                ms_ext_version_supported = FALSE;
+    DeviceOpenContext      *ctx;
+
+    ctx = g_task_get_task_data (task);
+    device_open_step_done (device, ctx, MBIM_DEVICE_OPEN_STEP_DEVICE_SERVICES);
+
+    response = mbim_device_command_finish (device, res, &error);
+    if (response && device_services_response_process (device, response, &ms_ext_version_supported, &error))
+        device_info_cache_set_response (device, response);
+
+    if (ctx->n_pending > 0) {
+        ctx->ms_ext_version_supported = ms_ext_version_supported;
+        ctx->device_services_error = error;
+        device_open_pipeline_step (task);
+        return;
+    }
+
+    if (error) {
+        g_task_return_error (task, error);
+        g_object_unref (task);
+        return;
+    }
+
+    if (ms_ext_version_supported) {
+        /* version command is supported, go on */
+        ctx->step++;
+        device_open_context_step (task);
+        return;
+    }
+
+    /* the version command isn't supported, so we can just jump to the end */
+    ctx->step = DEVICE_OPEN_CONTEXT_STEP_LAST;
+    device_open_context_step (task);
+}
+
+static void
+device_services_message (GTask *task)
+{
+    MbimDevice             *self;
+    DeviceOpenContext      *ctx;
+    g_autoptr(MbimMessage)  request = NULL;
+
+    self = g_task_get_source_object (task);
+    ctx  = g_task_get_task_data (task);
+
+    request = mbim_message_device_services_query_new (NULL);
+    g_assert (request);
+
+    device_command (self,
+                    request,
+                    ctx->timeout,
+                    g_task_get_cancellable (task),
+                    (GAsyncReadyCallback)device_services_message_ready,
+                    task,
+                    TRUE);
+}
+
+/* Completes the device services and version requests sent together */
+static void
+device_open_pipeline_step (GTask *task)
+{
+    MbimDevice        *self;
+    DeviceOpenContext *ctx;
+    GError            *error = NULL;
+
+    self = g_task_get_source_object (task);
+    ctx  = g_task_get_task_data (task);
+
+    if (--ctx->n_pending > 0)
+        return;
+
+    if (ctx->device_services_error) {
+        g_task_return_error (task, g_steal_pointer (&ctx->device_services_error));
+        g_object_unref (task);
+        return;
+    }
+
+    if (ctx->ms_ext_version_supported) {
+        if (ctx->ms_ext_version_error) {
+            g_task_return_error (task, g_steal_pointer (&ctx->ms_ext_version_error));
+            g_object_unref (task);
+            return;
+        }
+        if (!ms_ext_version_response_process (self, ctx->ms_ext_version_response, &error)) {
+            g_task_return_error (task, error);
+            g_object_unref (task);
+            return;
+        }
+    } else
+        g_debug ("[%s] version command not supported, response ignored", self->priv->path_display);
+
+    ctx->step = DEVICE_OPEN_CONTEXT_STEP_LAST;
+    device_open_context_step (task);
+}
+
+/* Device services learnt by a previous open are reused, if any */
+static gboolean
+device_open_cached_services (GTask *task)
+{
+    MbimDevice             *self;
+    DeviceOpenContext      *ctx;
+    g_autoptr(MbimMessage)  cached = NULL;
+
+    self = g_task_get_source_object (task);
+    ctx  = g_task_get_task_data (task);
+
+    cached = device_info_cache_get_response (self,
+                                             MBIM_SERVICE_BASIC_CONNECT,
+                                             MBIM_CID_BASIC_CONNECT_DEVICE_SERVICES);
+    if (!cached || !device_services_response_process (self, cached, &ctx->ms_ext_version_supported, NULL))
+        return FALSE;
+
+    g_debug ("[%s] reusing cached device services", self->priv->path_display);
+    ctx->step = (ctx->ms_ext_version_supported ?
+                 DEVICE_OPEN_CONTEXT_STEP_MS_EXT_VERSION :
+                 DEVICE_OPEN_CONTEXT_STEP_LAST);
+    device_open_context_step (task);
+    return TRUE;
+}
+
+/* Both the device services query and the version exchange are sent at once,
+ * and the version response is ignored if the device doesn't support it */
+static void
+device_open_pipeline (GTask *task)
+{
+    DeviceOpenContext      *ctx;
+    g_autoptr(MbimMessage)  request = NULL;
+    GError                 *error = NULL;
+
+    ctx = g_task_get_task_data (task);
+
+    request = ms_ext_version_request_new (ctx, &error);
+    if (!request) {
+        g_task_return_error (task, error);
+        g_object_unref (task);
+        return;
+    }
+
+    ctx->n_pending = 2;
+    device_services_message (task);
+    ms_ext_version_message (task, request);
+}
+
+static void
+open_message_ready (MbimDevice   *self,
+                    GAsyncResult *res,
+                    GTask        *task)
+{
+    DeviceOpenContext      *ctx;
+    g_autoptr(MbimMessage)  response = NULL;
+    g_autoptr(GError)       error = NULL;
+
+    ctx = g_task_get_task_data (task);
+    device_open_step_done (self, ctx, MBIM_DEVICE_OPEN_STEP_OPEN);
+
+    /* Cleanup, as no longer needed */
+    self->priv->open_transaction_id = 0;
+
+    response = mbim_device_command_finish (self, res, &error);
+    if (!response) {
+        /* If we get reported that the state is unknown, try to close before open */
+        if (g_error_matches (error, MBIM_CORE_ERROR, MBIM_CORE_ERROR_UNKNOWN_STATE)) {
+            ctx->close_before_open = TRUE;
+            ctx->step = DEVICE_OPEN_CONTEXT_STEP_CLOSE_MESSAGE;
+            device_open_context_step (task);
+            return;
+        }
+
+        /* Check if we should be retrying after a timeout */
+        if (g_error_matches (error, MBIM_CORE_ERROR, MBIM_CORE_ERROR_TIMEOUT)) {
+            device_open_context_step (task);
+            return;
+        }
+
+        g_debug ("[%s] error reported in open operation: closed", self->priv->path_display);
+        self->priv->open_status = OPEN_STATUS_CLOSED;
+        g_task_return_error (task, g_steal_pointer (&error));
+        g_object_unref (task);
+        return;
+    }
+
+    if (!mbim_message_response_get_result (response, MBIM_MESSAGE_TYPE_OPEN_DONE, &error)) {
+        g_debug ("[%s] getting open done result failed: closed", self->priv->path_display);
+        self->priv->open_status = OPEN_STATUS_CLOSED;
+        g_task_return_error (task, g_steal_pointer (&error));
+        g_object_unref (task);
+        return;
+    }
+
+    /* go on */
+    ctx->step++;
+    device_open_context_step (task);
+}
+
+static void
+open_message (GTask *task)
+{
+    MbimDevice             *self;
+    g_autoptr(MbimMessage)  request = NULL;
+
+    self = g_task_get_source_object (task);
+
+    /* Launch 'Open' command */
+    self->priv->open_transaction_id = mbim_device_get_next_transaction_id (self);
+    request = mbim_message_open_new (self->priv->open_transaction_id,
+                                     self->priv->max_control_transfer);
+    device_command (self,
+                    request,
+                    OPEN_RETRY_TIMEOUT_SECS,
+                    g_task_get_cancellable (task),
+                    (GAsyncReadyCallback)open_message_ready,
+                    task,
+                    TRUE);
+}
+
+static void
+close_message_before_open_ready (MbimDevice   *self,
+                                 GAsyncResult *res,
+                                 GTask        *task)
+{
+    DeviceOpenContext      *ctx;
+    g_autoptr(MbimMessage)  response = NULL;
+    g_autoptr(GError)       error = NULL;
+
+    ctx = g_task_get_task_data (task);
+    device_open_step_done (self, ctx, MBIM_DEVICE_OPEN_STEP_CLOSE);
+
+    response = mbim_device_command_finish (self, res, &error);
+    if (!response)
+        g_debug ("[%s] error reported in close before open: %s (ignored)", self->priv->path_display, error->message);
+    else if (!mbim_message_response_get_result (response, MBIM_MESSAGE_TYPE_CLOSE_DONE, &error))
+        g_debug ("[%s] getting close done result failed: %s (ignored)", self->priv->path_display, error->message);
+
+    /* go on */
+    ctx->step++;
+    device_open_context_step (task);
+}
+
+static void
+close_message_before_open (GTask *task)
+{
+    MbimDevice             *self;
+    g_autoptr(MbimMessage)  request = NULL;
+
+    self = g_task_get_source_object (task);
+
+    /* Launch 'Close' command */
+    request = mbim_message_close_new (mbim_device_get_next_transaction_id (self));
+    device_command (self,
+                    request,
+                    OPEN_CLOSE_TIMEOUT_SECS,
+                    g_task_get_cancellable (task),
+                    (GAsyncReadyCallback)close_message_before_open_ready,
+                    task,
+                    TRUE);
+}
+
+static void
+proxy_cfg_message_ready (MbimDevice   *self,
+                         GAsyncResult *res,
+                         GTask        *task)
+{
+    DeviceOpenContext      *ctx;
+    GError                 *error = NULL;
+    g_autoptr(MbimMessage)  response = NULL;
+
+    ctx = g_task_get_task_data (task);
+    device_open_step_done (self, ctx, MBIM_DEVICE_OPEN_STEP_PROXY_CONFIG);
+
+    response = mbim_device_command_finish (self, res, &error);
+    if (!response) {
+        /* Hard error if proxy cfg command fails */
+        g_debug ("[%s] proxy configuration failed: closed", self->priv->path_display);
+        self->priv->open_status = OPEN_STATUS_CLOSED;
+        g_task_return_error (task, error);
+        g_object_unref (task);
+        return;
+    }
+
+    ctx->step++;
+    device_open_context_step (task);
+}
+
+static void
+proxy_cfg_message (GTask *task)
+{
+    MbimDevice             *self;
+    DeviceOpenContext      *ctx;
+    g_autoptr(MbimMessage)  request = NULL;
+
+    self = g_task_get_source_object (task);
+    ctx = g_task_get_task_data (task);
+
+    request = mbim_message_proxy_control_configuration_set_new (self->priv->path, ctx->timeout, NULL);
+    g_assert (request);
+
+    /* This message is no longer a direct reply; as the proxy will also try to open the device
+     * directly. If it cannot open the device, it will return an error. */
+    device_command (self,
+                    request,
+                    ctx->timeout,
+                    g_task_get_cancellable (task),
+                    (GAsyncReadyCallback)proxy_cfg_message_ready,
+                    task,
+                    TRUE);
+}
+
+static void
+create_iochannel_ready (MbimDevice   *self,
+                        GAsyncResult *res,
+                        GTask        *task)
+{
+    DeviceOpenContext *ctx;
+    GError            *error = NULL;
+
+    ctx = g_task_get_task_data (task);
+    device_open_step_done (self, ctx, MBIM_DEVICE_OPEN_STEP_CREATE_IOCHANNEL);
+
+    if (!create_iochannel_finish (self, res, &error)) {
+        g_debug ("[%s] creating iochannel failed: closed", self->priv->path_display);
+        self->priv->open_status = OPEN_STATUS_CLOSED;
+        g_task_return_error (task, error);
+        g_object_unref (task);
+        return;
+    }
+
+    /* Go on */
+    ctx->step++;
+    device_open_context_step (task);
+}
+
+static void
+device_open_context_step (GTask *task)
+{
+    MbimDevice        *self;
+    DeviceOpenContext *ctx;
+
+    self = g_task_get_source_object (task);
+    ctx  = g_task_get_task_data (task);
+
+    /* Timed out? */
+    if (g_timer_elapsed (ctx->timer, NULL) > ctx->timeout) {
+        g_debug ("[%s] open operation timed out: closed", self->priv->path_display);
+        self->priv->open_status = OPEN_STATUS_CLOSED;
+        g_task_return_new_error (task,
+                                 MBIM_CORE_ERROR,
+                                 MBIM_CORE_ERROR_TIMEOUT,
+                                 "Operation timed out: device is closed");
+        g_object_unref (task);
+        return;
+    }
+
+    switch (ctx->step) {
+    case DEVICE_OPEN_CONTEXT_STEP_FIRST:
+        if (self->priv->open_status == OPEN_STATUS_OPEN) {
+            g_task_return_new_error (task,
+                                     MBIM_CORE_ERROR,
+                                     MBIM_CORE_ERROR_WRONG_STATE,
+                                     "Already open");
+            g_object_unref (task);
+            return;
+        }
+
+        if (self->priv->open_status == OPEN_STATUS_OPENING) {
+            g_task_return_new_error (task,
+                                     MBIM_CORE_ERROR,
+                                     MBIM_CORE_ERROR_WRONG_STATE,
+                                     "Already opening");
+            g_object_unref (task);
+            return;
+        }
+
+        g_debug ("[%s] opening device...", self->priv->path_display);
+        g_assert (self->priv->open_status == OPEN_STATUS_CLOSED);
+        self->priv->open_status = OPEN_STATUS_OPENING;
+        device_profile_prepare (self);
+
+        ctx->step++;
+        /* Fall through */
+
+    case DEVICE_OPEN_CONTEXT_STEP_CREATE_IOCHANNEL:
+        device_open_step_start (ctx);
+        create_iochannel (self,
+                          !!(ctx->flags & MBIM_DEVICE_OPEN_FLAGS_PROXY),
+                          (GAsyncReadyCallback)create_iochannel_ready,
+                          task);
+        return;
+
+    case DEVICE_OPEN_CONTEXT_STEP_FLAGS_PROXY:
+        if (ctx->flags & MBIM_DEVICE_OPEN_FLAGS_PROXY) {
+            device_open_step_start (ctx);
+            proxy_cfg_message (task);
+            return;
+        }
+        ctx->step++;
+        /* Fall through */
+
+    case DEVICE_OPEN_CONTEXT_STEP_CLOSE_MESSAGE:
+        /* Only send an explicit close during open if needed */
+        if (ctx->close_before_open) {
+            ctx->close_before_open = FALSE;
+            device_open_step_start (ctx);
+            close_message_before_open (task);
+            return;
+        }
+        ctx->step++;
+        /* Fall through */
+
+    case DEVICE_OPEN_CONTEXT_STEP_OPEN_MESSAGE:
+        /* If the device is already in-session, avoid the open message */
+        if (!self->priv->in_session) {
+            device_open_step_start (ctx);
+            open_message (task);
+            return;
+        }
+        ctx->step++;
+        /* Fall through */
+
+        case DEVICE_OPEN_CONTEXT_STEP_DEVICE_SERVICES:
+        if (ctx->flags & (MBIM_DEVICE_OPEN_FLAGS_MS_MBIMEX_V2 | MBIM_DEVICE_OPEN_FLAGS_MS_MBIMEX_V3)) {
+            device_open_step_start (ctx);
+            if (((ctx->flags & MBIM_DEVICE_OPEN_FLAGS_PIPELINE) || self->priv->profile_dir) &&
+                device_open_cached_services (task))
+                return;
+            if (ctx->flags & MBIM_DEVICE_OPEN_FLAGS_PIPELINE)
+                device_open_pipeline (task);
+            else
+                device_services_message (task);
+            return;
+        }
+        ctx->step++;
+        /* Fall through */
+
+        case DEVICE_OPEN_CONTEXT_STEP_MS_EXT_VERSION:
+        if (ctx->flags & (MBIM_DEVICE_OPEN_FLAGS_MS_MBIMEX_V2 | MBIM_DEVICE_OPEN_FLAGS_MS_MBIMEX_V3)) {
+            g_autoptr(MbimMessage)  request = NULL;
+            GError                 *error = NULL;
+
+            request = ms_ext_version_request_new (ctx, &error);
+            if (!request) {
+                g_task_return_error (task, error);
+                g_object_unref (task);
+                return;
+            }
+            device_open_step_start (ctx);
+            ms_ext_version_message (task, request);
+            return;
+        }
+        ctx->step++;
+        /* Fall through */
+
+    case DEVICE_OPEN_CONTEXT_STEP_LAST:
+        /* Nothing else to process, complete without error */
+        device_open_steps_debug (self);
+        self->priv->open_status = OPEN_STATUS_OPEN;
+        self->priv->open_flags = ctx->flags;
+        self->priv->open_timeout = ctx->timeout;
+        device_set_healthy (self, TRUE);
+        device_health_probe_setup (self);
+        device_profile_save (self);
+        device_profile_refresh (self);
+        g_task_return_boolean (task, TRUE);
+        g_object_unref (task);
+        return;
+
+    default:
+        break;
+    }
+
+    g_assert_not_reached ();
+}
+
+void
+mbim_device_open_full (MbimDevice          *self,
+                       MbimDeviceOpenFlags  flags,
+                       guint                timeout,
+                       GCancellable        *cancellable,
+                       GAsyncReadyCallback  callback,
+                       gpointer             user_data)
+{
+    DeviceOpenContext *ctx;
+    GTask             *task;
+
+    g_return_if_fail (MBIM_IS_DEVICE (self));
+    g_return_if_fail (timeout > 0);
+
+    ctx = g_slice_new0 (DeviceOpenContext);
+    ctx->step = DEVICE_OPEN_CONTEXT_STEP_FIRST;
+    ctx->flags = flags;
+    ctx->timeout = timeout;
+    ctx->timer = g_timer_new ();
+    ctx->close_before_open = FALSE;
+    ctx->timed_step = DEVICE_OPEN_CONTEXT_STEP_LAST;
+
+    memset (self->priv->open_step_time, 0, sizeof (self->priv->open_step_time));
+
+    task = g_task_new (self, cancellable, callback, user_data);
+    g_task_set_task_data (task, ctx, (GDestroyNotify)device_open_context_free);
+
+    /* Start processing */
+    device_open_context_step (task);
+}
+
+void
+mbim_device_open (MbimDevice          *self,
+                  guint                timeout,
+                  GCancellable        *cancellable,
+                  GAsyncReadyCallback  callback,
+                  gpointer             user_data)
+{
+    mbim_device_open_full (self,
+                           MBIM_DEVICE_OPEN_FLAGS_NONE,
+                           timeout,
+                           cancellable,
+                           callback,
+                           user_data);
+}
+
+/*****************************************************************************/
+/* Close channel */
+
+static gboolean
+destroy_iochannel (MbimDevice  *self,
+                   GError     **error)
+{
+    GError *inner_error = NULL;
+
+    /* Already closed? */
+    if (!self->priv->iochannel && !self->priv->socket_connection && !self->priv->socket_client)
+        return TRUE;
+
+    g_debug ("[%s] channel destroyed", self->priv->path_display);
+
+    device_profile_refresh_cancel (self);
+    if (self->priv->health_probe_source) {
+        g_source_destroy (self->priv->health_probe_source);
+        g_clear_pointer (&self->priv->health_probe_source, g_source_unref);
+    }
+
+    if (self->priv->iochannel) {
+        g_io_channel_shutdown (self->priv->iochannel, TRUE, &inner_error);
+        g_io_channel_unref (self->priv->iochannel);
+        self->priv->iochannel = NULL;
+    }
+
+    /* Failures when closing still make the device to get closed */
+    g_clear_object (&self->priv->socket_connection);
+    g_clear_object (&self->priv->socket_client);
+
+    if (self->priv->iochannel_source) {
+        g_source_destroy (self->priv->iochannel_source);
+        g_source_unref (self->priv->iochannel_source);
+        self->priv->iochannel_source = NULL;
+    }
+
+    if (self->priv->response) {
+        g_byte_array_unref (self->priv->response);
+        self->priv->response = NULL;
+    }
+
+    if (inner_error) {
+        g_propagate_error (error, inner_error);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+gboolean
+mbim_device_close_force (MbimDevice *self,
+                         GError **error)
+{
+    g_return_val_if_fail (MBIM_IS_DEVICE (self), FALSE);
+
+    device_recovery_stop (self);
+    return destroy_iochannel (self, error);
+}
+
+/*****************************************************************************/
+/* Hand off of the open device to another process */
+
+gboolean
+_mbim_device_is_idle (MbimDevice *self)
+{
+    guint i;
+
+    /* Neither host transactions nor partial indications ongoing */
+    for (i = 0; i < TRANSACTION_TYPE_LAST; i++) {
+        if (self->priv->transactions[i] && g_hash_table_size (self->priv->transactions[i]) > 0)
+            return FALSE;
+    }
+
+    /* And no partial message read */
+    return (!self->priv->response || self->priv->response->len == 0);
+}
+
+gint
+_mbim_device_steal_fd (MbimDevice  *self,
+                       GError     **error)
+{
+    gint fd;
+
+    if (self->priv->open_status != OPEN_STATUS_OPEN || !self->priv->iochannel || self->priv->socket_connection) {
+        g_set_error (error, MBIM_CORE_ERROR, MBIM_CORE_ERROR_WRONG_STATE,
+                     "Device is not open without proxy");
+        return -1;
+    }
+
+    if (!_mbim_device_is_idle (self)) {
+        g_set_error (error, MBIM_CORE_ERROR, MBIM_CORE_ERROR_WRONG_STATE,
+                     "Device has transactions ongoing");
+        return -1;
+    }
+
+    fd = fcntl (g_io_channel_unix_get_fd (self->priv->iochannel), F_DUPFD_CLOEXEC, 3);
+    if (fd < 0) {
+        g_set_error (error, MBIM_CORE_ERROR, MBIM_CORE_ERROR_FAILED,
+                     "Cannot duplicate device file descriptor: %s", strerror (errno));
+        return -1;
+    }
+
+    /* The device is left closed, without sending any close request */
+    destroy_iochannel (self, NULL);
+    self->priv->open_status = OPEN_STATUS_CLOSED;
+
+    g_debug ("[%s] device file descriptor stolen", self->priv->path_display);
+    return fd;
+}
+
+gboolean
+_mbim_device_adopt_fd (MbimDevice  *self,
+                       gint         fd,
+                       GError     **error)
+{
+    if (self->priv->iochannel) {
+        close (fd);
+        g_set_error (error, MBIM_CORE_ERROR, MBIM_CORE_ERROR_WRONG_STATE,
+                     "Already open");
+        return FALSE;
+    }
+
+    self->priv->max_control_transfer = query_max_control_transfer (self, fd);
+    self->priv->iochannel = g_io_channel_unix_new (fd);
+    if (!setup_iochannel_watch (self, error))
+        return FALSE;
+
+    /* The device is already open, no open request is sent */
+    self->priv->open_status = OPEN_STATUS_OPEN;
+
+    g_debug ("[%s] device file descriptor adopted", self->priv->path_display);
+    return TRUE;
+}
+
+typedef struct {
+    guint timeout;
+} DeviceCloseContext;
+
+static void
+device_close_context_free (DeviceCloseContext *ctx)
+{
+    g_slice_free (DeviceCloseContext, ctx);
+}
+
+gboolean
+mbim_device_close_finish (MbimDevice    *self,
+                          GAsyncResult  *res,
+                          GError       **error)
+{
+    return g_task_propagate_boolean (G_TASK (res), error);
+}
+
+static void
+close_message_ready (MbimDevice   *self,
+                     GAsyncResult *res,
+                     GTask        *task)
+{
+    g_autoptr(MbimMessage) response = NULL;
+    g_autoptr(GError)      error = NULL;
+    g_autoptr(GError)      iochannel_error = NULL;
+
+    response = mbim_device_command_finish (self, res, &error);
+    if (response)
+        mbim_message_response_get_result (response, MBIM_MESSAGE_TYPE_CLOSE_DONE, &error);
+
+    self->priv->open_status = OPEN_STATUS_CLOSED;
+    destroy_iochannel (self, &iochannel_error);
+
+    if (error)
+        g_task_return_error (task, g_steal_pointer (&error));
+    else if (iochannel_error)
+        g_task_return_error (task, g_steal_pointer (&iochannel_error));
+    else
+        g_task_return_boolean (task, TRUE);
+    g_object_unref (task);
+}
+
+void
+mbim_device_close (MbimDevice          *self,
+                   guint                timeout,
+                   GCancellable        *cancellable,
+                   GAsyncReadyCallback  callback,
+                   gpointer             user_data)
+{
+    g_autoptr(MbimMessage)  request = NULL;
+    DeviceCloseContext     *ctx;
+    GTask                  *task;
+
+    g_return_if_fail (MBIM_IS_DEVICE (self));
+
+    ctx = g_slice_new (DeviceCloseContext);
+    ctx->timeout = timeout;
+
+    task = g_task_new (self, cancellable, callback, user_data);
+    g_task_set_task_data (task, ctx, (GDestroyNotify)device_close_context_free);
+
+    /* If being reopened automatically, just stop */
+    if (self->priv->recovering) {
+        g_debug ("[%s] closing device: automatic reopen stopped", self->priv->path_display);
+        device_recovery_stop (self);
+        g_task_return_boolean (task, TRUE);
+        g_object_unref (task);
+        return;
+    }
+
+    /* If already closed, we're done */
+    if (self->priv->open_status == OPEN_STATUS_CLOSED) {
+        g_task_return_boolean (task, TRUE);
+        g_object_unref (task);
+        return;
+    }
+
+    /* If we're opening, fail with error. We could say we would abort the
+     * ongoing open attempt, but the way to abort that attempt is with the
+     * cancellable given in the open operation, not with an additional close.
+     */
+    if (self->priv->open_status == OPEN_STATUS_OPENING) {
+        g_task_return_new_error (
+            task, MBIM_CORE_ERROR, MBIM_CORE_ERROR_WRONG_STATE,
+            "Cannot close device: not yet fully open");
+        g_object_unref (task);
+        return;
+    }
+
+    g_debug ("[%s] closing device...", self->priv->path_display);
+    g_assert (self->priv->open_status == OPEN_STATUS_OPEN);
+
+    device_profile_refresh_cancel (self);
+    device_profile_save (self);
+
+    /* If the device is in-session, avoid the close message */
+    if (self->priv->in_session) {
+        GError *error = NULL;
+
+        self->priv->open_status = OPEN_STATUS_CLOSED;
+        if (!destroy_iochannel (self, &error))
+            g_task_return_error (task, error);
+        else
+            g_task_return_boolean (task, TRUE);
+        g_object_unref (task);
+        return;
+    }
+
+    /* Launch 'Close' command */
+    request = mbim_message_close_new (mbim_device_get_next_transaction_id (self));
+    mbim_device_command (self,
+                         request,
+                         10,
+                         cancellable,
+                         (GAsyncReadyCallback) close_message_ready,
+                         task);
+}
+
+/*****************************************************************************/
+
+guint32
+mbim_device_get_next_transaction_id (MbimDevice *self)
+{
+    guint32 next;
+
+    g_return_val_if_fail (MBIM_IS_DEVICE (self), 0);
+
+    next = self->priv->transaction_id;
+
+    /* Don't go further than 8bits in the CTL service */
+    if (self->priv->transaction_id == G_MAXUINT32)
+        /* Reset! */
+        self->priv->transaction_id = 0x01;
+    else
+        self->priv->transaction_id++;
+
+    return next;
+}
+
+/*****************************************************************************/
+
+guint32
+mbim_device_get_transaction_id (MbimDevice *self)
+{
+    g_return_val_if_fail (MBIM_IS_DEVICE (self), 0);
+
+    return self->priv->transaction_id;
+}
+
+/*****************************************************************************/
+
+static gboolean
+device_write (MbimDevice    *self,
+              const guint8  *data,
+              guint32        data_length,
+              GError       **error)
+{
+    gsize     written;
+    GIOStatus write_status;
+
+    written = 0;
+    write_status = G_IO_STATUS_AGAIN;
+    while (write_status == G_IO_STATUS_AGAIN) {
+        write_status = g_io_channel_write_chars (self->priv->iochannel,
+                                                 (gconstpointer)data,
+                                                 (gssize)data_length,
+                                                 &written,
+                                                 error);
+        switch (write_status) {
+        case G_IO_STATUS_ERROR:
+            g_prefix_error (error, "Cannot write message: ");
+            return FALSE;
+
+        case G_IO_STATUS_EOF:
+            /* We shouldn't get EOF when writing */
+            g_assert_not_reached ();
+            break;
+
+        case G_IO_STATUS_NORMAL:
+            /* All good, we'll exit the loop now */
+            break;
+
+        case G_IO_STATUS_AGAIN:
+            /* We're in a non-blocking channel and therefore we're up to receive
+             * EAGAIN; just retry in this case. TODO: in an idle? */
+            break;
+
+        default:
+            g_assert_not_reached ();
+            break;
+        }
+    }
+
+    return TRUE;
+}
+
+static gboolean
+device_send (MbimDevice   *self,
+             MbimMessage  *message,
+             GError      **error)
+{
+    const guint8                    *raw_message;
+    guint32                          raw_message_len;
+    g_autofree struct fragment_info *fragments = NULL;
+    guint                            n_fragments;
+    guint                            i;
+
+    raw_message = mbim_message_get_raw (message, &raw_message_len, NULL);
+    g_assert (raw_message);
+
+    MBIM_PROBE_MESSAGE_SEND (self->priv->path_display, message);
+
+    if (mbim_utils_get_traces_enabled ()) {
+        g_autofree gchar *hex = NULL;
+        g_autofree gchar *printable = NULL;
+
+        if (mbim_utils_get_show_personal_info () || (raw_message_len < MAX_PRINTED_BYTES)) {
+            hex = mbim_common_str_hex (raw_message, raw_message_len, ':');
+        } else {
+            g_autofree gchar *tmp = NULL;
+
+            tmp = mbim_common_str_hex (raw_message, MAX_PRINTED_BYTES, ':');
+            hex = g_strdup_printf ("%s...", tmp);
+        }
+
+        g_debug ("[%s] sent message...\n"
+                 "<<<<<< RAW:\n"
+                 "<<<<<<   length = %u\n"
+                 "<<<<<<   data   = %s\n",
+                 self->priv->path_display,
+                 ((GByteArray *)message)->len,
+                 hex);
+
+        printable = mbim_message_get_printable_full (message,
+                                                     self->priv->ms_mbimex_version_major,
+                                                     self->priv->ms_mbimex_version_minor,
+                                                     "<<<<<< ",
+                                                     FALSE,
+                                                     NULL);
+        g_debug ("[%s] sent message (translated)...\n%s",
+                 self->priv->path_display,
+                 printable);
+    }
+
+    /* Single fragment? Send it! */
+    if (raw_message_len <= MAX_CONTROL_TRANSFER)
+        return device_write (self, raw_message, raw_message_len, error);
+
+    /* The message to send must be able to handle fragments */
+    g_assert (_mbim_message_is_fragment (message));
+
+    fragments = _mbim_message_split_fragments (message, MAX_CONTROL_TRANSFER, &n_fragments);
+    for (i = 0; i < n_fragments; i++) {
+        g_autoptr(GByteArray)  full_fragment = NULL;
+        g_autofree gchar      *printable_headers = NULL;
+
+        /* Build compiled fragment headers */
+        full_fragment = g_byte_array_new ();
+        g_byte_array_append (full_fragment, (guint8 *)&fragments[i].header, sizeof (fragments[i].header));
+        g_byte_array_append (full_fragment, (guint8 *)&fragments[i].fragment_header, sizeof (fragments[i].fragment_header));
+
+        /* Build placeholder message with only headers for printable purposes only */
+        if (mbim_utils_get_traces_enabled ())
+            printable_headers = mbim_message_get_printable_full ((MbimMessage *)full_fragment,
+                                                                 self->priv->ms_mbimex_version_major,
+                                                                 self->priv->ms_mbimex_version_minor,
+                                                                 "<<<<<< ",
+                                                                 TRUE,
+                                                                 NULL);
+
+        /* Append the actual fragment data */
+        g_byte_array_append (full_fragment, (guint8 *)fragments[i].data, fragments[i].data_length);
+
+        if (mbim_utils_get_traces_enabled ()) {
+            g_autofree gchar *printable_full = NULL;
+
+            printable_full  = mbim_common_str_hex ((const guint8 *)full_fragment->data, full_fragment->len, ':');
+            g_debug ("[%s] sent fragment (%u)...\n"
+                     "<<<<<< RAW:\n"
+                     "<<<<<<   length = %u\n"
+                     "<<<<<<   data   = %s\n",
+                     self->priv->path_display, i,
+                     full_fragment->len,
+                     printable_full);
+
+            g_debug ("[%s] sent fragment (translated)...\n%s",
+                     self->priv->path_display,
+                     printable_headers);
+        }
+
+        /* Write whole packet to MBIM device.
+         * Here send whole packet rather than seperated elements, such as header,
+         * fragment_header, data, because some MBIM devices may have errors on
+         * seperated fragment case, such as "MBIM protocol error: LengthMismatch"
+         */
+        if (!device_write (self,
+                           (guint8 *)full_fragment->data,
+                           full_fragment->len,
+                           error))
+            return FALSE;
+    }
+
+    return TRUE;
+}
+
+/*****************************************************************************/
+/* Report error */
+
+typedef struct {
+    MbimDevice  *self;
+    MbimMessage *message;
+} ReportErrorContext;
 
 static void
-device_close_context_free (DeviceCloseContext *ctx)
+device_report_error_context_free (ReportErrorContext *ctx)
+{
+    mbim_message_unref (ctx->message);
+    g_object_unref (ctx->self);
+    g_slice_free (ReportErrorContext, ctx);
+}
+
+static gboolean
+device_report_error_in_idle (ReportErrorContext *ctx)
+{
+    /* Device must be open */
+    if (ctx->self->priv->iochannel) {
+        g_autoptr(GError) error = NULL;
+
+        if (!device_send (ctx->self, ctx->message, &error))
+            g_warning ("[%s] couldn't send host error message: %s",
+                       ctx->self->priv->path_display,
+                       error->message);
+    }
+
+    device_report_error_context_free (ctx);
+    return FALSE;
+}
+
+static void
+device_report_error (MbimDevice   *self,
+                     guint32       transaction_id,
+                     const GError *error)
+{
+    ReportErrorContext *ctx;
+    g_autoptr(GSource)  source = NULL;
+
+    /* Only protocol errors to be reported to the modem */
+    if (error->domain != MBIM_PROTOCOL_ERROR)
+        return;
+
+    ctx = g_slice_new (ReportErrorContext);
+    ctx->self = g_object_ref (self);
+    ctx->message = mbim_message_error_new (transaction_id, error->code);
+
+    source = g_idle_source_new ();
+    g_source_set_callback (source, (GSourceFunc)device_report_error_in_idle, ctx, NULL);
+    g_source_attach (source, g_main_context_get_thread_default ());
+}
+
+/*****************************************************************************/
+/* Command */
+
+MbimMessage *
+mbim_device_command_finish (MbimDevice    *self,
+                            GAsyncResult  *res,
+                            GError       **error)
 {
-    g_slice_free (DeviceCloseContext, ctx);
+    return g_task_propagate_pointer (G_TASK (res), error);
 }
 
-gboolean
-mbim_device_close_finish (MbimDevice    *self,
-                          GAsyncResult  *res,
-                          GError       **error)
+static gboolean
+message_is_idempotent (const MbimMessage *message)
 {
-    return g_task_propagate_boolean (G_TASK (res), error);
+    return (MBIM_MESSAGE_GET_MESSAGE_TYPE (message) == MBIM_MESSAGE_TYPE_COMMAND &&
+            mbim_message_command_get_command_type (message) == MBIM_MESSAGE_COMMAND_TYPE_QUERY);
 }
 
 static void
-close_message_ready (MbimDevice   *self,
-                     GAsyncResult *res,
-                     GTask        *task)
+device_command (MbimDevice          *self,
+                MbimMessage         *message,
+                guint                timeout,
+                GCancellable        *cancellable,
+                GAsyncReadyCallback  callback,
+                gpointer             user_data,
+                gboolean             internal)
 {
-    g_autoptr(MbimMessage) response = NULL;
-    g_autoptr(GError)      error = NULL;
-    g_autoptr(GError)      iochannel_error = NULL;
-
-    response = mbim_device_command_finish (self, res, &error);
-    if (response)
-        mbim_message_response_get_result (response, MBIM_MESSAGE_TYPE_CLOSE_DONE, &error);
-
-    self->priv->open_status = OPEN_STATUS_CLOSED;
-    destroy_iochannel (self, &iochannel_error);
+    g_autoptr(GError)   error = NULL;
+    GTask              *task;
+    TransactionContext *ctx;
+    guint32             transaction_id;
 
-    if (error)
-        g_task_return_error (task, g_steal_pointer (&error));
-    else if (iochannel_error)
-        g_task_return_error (task, g_steal_pointer (&iochannel_error));
-    else
-        g_task_return_boolean (task, TRUE);
-    g_object_unref (task);
-}
+    /* If the message comes without a explicit transaction ID, add one
+     * ourselves */
+    transaction_id = mbim_message_get_transaction_id (message);
+    if (!transaction_id) {
+        transaction_id = mbim_device_get_next_transaction_id (self);
+        mbim_message_set_transaction_id (message, transaction_id);
+    }
 
-void
-mbim_device_close (MbimDevice          *self,
-                   guint                timeout,
-                   GCancellable        *cancellable,
-                   GAsyncReadyCallback  callback,
-                   gpointer             user_data)
-{
-    g_autoptr(MbimMessage)  request = NULL;
-    DeviceCloseContext     *ctx;
-    GTask                  *task;
+    task = transaction_task_new (self,
+                                 MBIM_MESSAGE_GET_MESSAGE_TYPE (message),
+                                 transaction_id,
+                                 cancellable,
+                                 callback,
+                                 user_data);
 
-    g_return_if_fail (MBIM_IS_DEVICE (self));
+    if (!internal) {
+        /* Remember the subscribe list, to be configured again after a reopen
+         * once the device accepts it */
+        if (MBIM_MESSAGE_GET_MESSAGE_TYPE (message) == MBIM_MESSAGE_TYPE_COMMAND &&
+            mbim_message_command_get_service (message) == MBIM_SERVICE_BASIC_CONNECT &&
+            mbim_message_command_get_cid (message) == MBIM_CID_BASIC_CONNECT_DEVICE_SERVICE_SUBSCRIBE_LIST &&
+            mbim_message_command_get_command_type (message) == MBIM_MESSAGE_COMMAND_TYPE_SET) {
+            ctx = g_task_get_task_data (task);
+            ctx->subscribe_list = mbim_message_dup (message);
+        }
 
-    ctx = g_slice_new (DeviceCloseContext);
-    ctx->timeout = timeout;
+        /* Queries can be sent again after a reopen */
+        if (((self->priv->open_flags & MBIM_DEVICE_OPEN_FLAGS_AUTO_REOPEN) || self->priv->recovering) &&
+            message_is_idempotent (message)) {
+            ctx = g_task_get_task_data (task);
+            ctx->request = mbim_message_ref (message);
+        }
 
-    task = g_task_new (self, cancellable, callback, user_data);
-    g_task_set_task_data (task, ctx, (GDestroyNotify)device_close_context_free);
+        /* While reopening, queries are kept until the device is back */
+        if (self->priv->recovering) {
+            ctx = g_task_get_task_data (task);
+            if (!ctx->request) {
+                error = g_error_new (MBIM_CORE_ERROR,
+                                     MBIM_CORE_ERROR_WRONG_STATE,
+                                     "Device is being reopened");
+                transaction_task_complete_and_free (task, error);
+                return;
+            }
+            if (!device_store_transaction (self, TRANSACTION_TYPE_HOST, task, timeout * 1000, &error)) {
+                g_prefix_error (&error, "Cannot store transaction: ");
+                transaction_task_complete_and_free (task, error);
+            }
+            return;
+        }
+    }
 
-    /* If already closed, we're done */
-    if (self->priv->open_status == OPEN_STATUS_CLOSED) {
-        g_task_return_boolean (task, TRUE);
-        g_object_unref (task);
+    /* Device must be open */
+    if (!self->priv->iochannel) {
+        error = g_error_new (MBIM_CORE_ERROR,
+                             MBIM_CORE_ERROR_WRONG_STATE,
+                             "Device must be open to send commands");
+        transaction_task_complete_and_free (task, error);
         return;
     }
 
-    /* If we're opening, fail with error. We could say we would abort the
-     * ongoing open attempt, but the way to abort that attempt is with the
-     * cancellable given in the open operation, not with an additional close.
-     */
-    if (self->priv->open_status == OPEN_STATUS_OPENING) {
-        g_task_return_new_error (
-            task, MBIM_CORE_ERROR, MBIM_CORE_ERROR_WRONG_STATE,
-            "Cannot close device: not yet fully open");
-        g_object_unref (task);
+    /* Setup context to match response */
+    if (!device_store_transaction (self, TRANSACTION_TYPE_HOST, task, timeout * 1000, &error)) {
+        g_prefix_error (&error, "Cannot store transaction: ");
+        transaction_task_complete_and_free (task, error);
         return;
     }
 
-    g_debug ("[%s] closing device...", self->priv->path_display);
-    g_assert (self->priv->open_status == OPEN_STATUS_OPEN);
-
-    /* If the device is in-session, avoid the close message */
-    if (self->priv->in_session) {
-        GError *error = NULL;
-
-        self->priv->open_status = OPEN_STATUS_CLOSED;
-        if (!destroy_iochannel (self, &error))
-            g_task_return_error (task, error);
-        else
-            g_task_return_boolean (task, TRUE);
-        g_object_unref (task);
+    if (!device_send (self, message, &error)) {
+        /* Match transaction so that we remove it from our tracking table */
+        task = device_release_transaction (self,
+                                           TRANSACTION_TYPE_HOST,
+                                           MBIM_MESSAGE_GET_MESSAGE_TYPE (message),
+                                           mbim_message_get_transaction_id (message));
+        transaction_task_complete_and_free (task, error);
         return;
     }
 
-    /* Launch 'Close' command */
-    request = mbim_message_close_new (mbim_device_get_next_transaction_id (self));
-    mbim_device_command (self,
-                         request,
-                         10,
-                         cancellable,
-                         (GAsyncReadyCallback) close_message_ready,
-                         task);
-}
+    ctx = g_task_get_task_data (task);
+    ctx->tx_time = g_get_monotonic_time ();
 
-/*****************************************************************************/
+    /* Just return, we'll get response asynchronously */
+}
 
-guint32
-mbim_device_get_next_transaction_id (MbimDevice *self)
+gboolean
+mbim_device_command_get_timestamps (MbimDevice   *self,
+                                    GAsyncResult *res,
+                                    gint64       *out_tx_time,
+                                    gint64       *out_rx_time)
 {
-    guint32 next;
-
-    g_return_val_if_fail (MBIM_IS_DEVICE (self), 0);
+    TransactionContext *ctx;
 
-    next = self->priv->transaction_id;
+    g_return_val_if_fail (MBIM_IS_DEVICE (self), FALSE);
+    g_return_val_if_fail (G_IS_TASK (res), FALSE);
 
-    /* Don't go further than 8bits in the CTL service */
-    if (self->priv->transaction_id == G_MAXUINT32)
-        /* Reset! */
-        self->priv->transaction_id = 0x01;
-    else
-        self->priv->transaction_id++;
+    ctx = g_task_get_task_data (G_TASK (res));
+    if (!ctx->rx_time)
+        return FALSE;
 
-    return next;
+    if (out_tx_time)
+        *out_tx_time = ctx->tx_time;
+    if (out_rx_time)
+        *out_rx_time = ctx->rx_time;
+    return TRUE;
 }
 
-/*****************************************************************************/
-
-guint32
-mbim_device_get_transaction_id (MbimDevice *self)
+gint64
+mbim_device_get_indication_timestamp (MbimDevice *self)
 {
     g_return_val_if_fail (MBIM_IS_DEVICE (self), 0);
 
-    return self->priv->transaction_id;
+    return self->priv->indication_rx_time;
 }
 
-/*****************************************************************************/
-
-static gboolean
-device_write (MbimDevice    *self,
-              const guint8  *data,
-              guint32        data_length,
-              GError       **error)
+void
+mbim_device_command (MbimDevice          *self,
+                     MbimMessage         *message,
+                     guint                timeout,
+                     GCancellable        *cancellable,
+                     GAsyncReadyCallback  callback,
+                     gpointer             user_data)
 {
-    gsize     written;
-    GIOStatus write_status;
+    g_return_if_fail (MBIM_IS_DEVICE (self));
+    g_return_if_fail (message != NULL);
 
-    written = 0;
-    write_status = G_IO_STATUS_AGAIN;
-    while (write_status == G_IO_STATUS_AGAIN) {
-        write_status = g_io_channel_write_chars (self->priv->iochannel,
-                                                 (gconstpointer)data,
-                                                 (gssize)data_length,
-                                                 &written,
-                                                 error);
-        switch (write_status) {
-        case G_IO_STATUS_ERROR:
-            g_prefix_error (error, "Cannot write message: ");
-            return FALSE;
+    device_command (self, message, timeout, cancellable, callback, user_data, FALSE);
+}
 
-        case G_IO_STATUS_EOF:
-            /* We shouldn't get EOF when writing */
-            g_assert_not_reached ();
-            break;
+/*****************************************************************************/
+/* Automatic reopen
+ *
+ * If the device was opened with MBIM_DEVICE_OPEN_FLAGS_AUTO_REOPEN, a port
+ * hangup or a NotOpened error reported by the device trigger a reopen with
+ * the same flags, retried with an exponential backoff. Requests that change
+ * the device state fail right away, as there is no way to know whether the
+ * device processed them; queries stay pending (subject to their own timeout)
+ * and are sent again once the device is back, after the device service
+ * subscribe list has been configured again. */
 
-        case G_IO_STATUS_NORMAL:
-            /* All good, we'll exit the loop now */
-            break;
+static void
+device_abort_transactions (MbimDevice *self,
+                           gboolean    all)
+{
+    g_autoptr(GError)  error = NULL;
+    GHashTableIter     iter;
+    gpointer           value;
+    GList             *tasks = NULL;
+    GList             *l;
 
-        case G_IO_STATUS_AGAIN:
-            /* We're in a non-blocking channel and therefore we're up to receive
-             * EAGAIN; just retry in this case. TODO: in an idle? */
-            break;
+    if (!self->priv->transactions[TRANSACTION_TYPE_HOST])
+        return;
 
-        default:
-            g_assert_not_reached ();
-            break;
+    g_hash_table_iter_init (&iter, self->priv->transactions[TRANSACTION_TYPE_HOST]);
+    while (g_hash_table_iter_next (&iter, NULL, &value)) {
+        TransactionContext *ctx;
+
+        ctx = g_task_get_task_data (G_TASK (value));
+        if (all || !ctx->request) {
+            tasks = g_list_prepend (tasks, value);
+            g_hash_table_iter_remove (&iter);
         }
     }
 
-    return TRUE;
+    error = g_error_new (MBIM_CORE_ERROR,
+                         MBIM_CORE_ERROR_ABORTED,
+                         "Device connection lost");
+    for (l = tasks; l; l = g_list_next (l))
+        transaction_task_complete_and_free (G_TASK (l->data), error);
+    g_list_free (tasks);
 }
 
-static gboolean
-device_send (MbimDevice   *self,
-             MbimMessage  *message,
-             GError      **error)
+static void
+device_recovery_resubmit (MbimDevice *self)
 {
-    const guint8                    *raw_message;
-    guint32                          raw_message_len;
-    g_autofree struct fragment_info *fragments = NULL;
-    guint                            n_fragments;
-    guint                            i;
+    GList *transaction_ids;
+    GList *l;
 
-    raw_message = mbim_message_get_raw (message, &raw_message_len, NULL);
-    g_assert (raw_message);
-
-    if (mbim_utils_get_traces_enabled ()) {
-        g_autofree gchar *hex = NULL;
-        g_autofree gchar *printable = NULL;
+    if (!self->priv->transactions[TRANSACTION_TYPE_HOST])
+        return;
 
-        if (mbim_utils_get_show_personal_info () || (raw_message_len < MAX_PRINTED_BYTES)) {
-            hex = mbim_common_str_hex (raw_message, raw_message_len, ':');
-        } else {
-            g_autofree gchar *tmp = NULL;
+    /* Completing a transaction may end up in other ones being added or
+     * removed, so go through the list of IDs instead of the table */
+    transaction_ids = g_hash_table_get_keys (self->priv->transactions[TRANSACTION_TYPE_HOST]);
+    for (l = transaction_ids; l; l = g_list_next (l)) {
+        g_autoptr(GError)   error = NULL;
+        GTask              *task;
+        TransactionContext *ctx;
 
-            tmp = mbim_common_str_hex (raw_message, MAX_PRINTED_BYTES, ':');
-            hex = g_strdup_printf ("%s...", tmp);
-        }
+        task = g_hash_table_lookup (self->priv->transactions[TRANSACTION_TYPE_HOST], l->data);
+        if (!task)
+            continue;
 
-        g_debug ("[%s] sent message...\n"
-                 "<<<<<< RAW:\n"
-                 "<<<<<<   length = %u\n"
-                 "<<<<<<   data   = %s\n",
-                 self->priv->path_display,
-                 ((GByteArray *)message)->len,
-                 hex);
+        ctx = g_task_get_task_data (task);
+        if (!ctx->request)
+            continue;
 
-        printable = mbim_message_get_printable_full (message,
-                                                     self->priv->ms_mbimex_version_major,
-                                                     self->priv->ms_mbimex_version_minor,
-                                                     "<<<<<< ",
-                                                     FALSE,
-                                                     NULL);
-        g_debug ("[%s] sent message (translated)...\n%s",
-                 self->priv->path_display,
-                 printable);
+        /* Drop whatever was received before the connection was lost */
+        g_clear_pointer (&ctx->fragments, mbim_message_unref);
+
+        g_debug ("[%s] sending again pending request (transaction %u)",
+                 self->priv->path_display, ctx->transaction_id);
+        ctx->tx_time = g_get_monotonic_time ();
+        if (!device_send (self, ctx->request, &error)) {
+            task = device_release_transaction (self,
+                                               TRANSACTION_TYPE_HOST,
+                                               MBIM_MESSAGE_TYPE_INVALID,
+                                               GPOINTER_TO_UINT (l->data));
+            if (task)
+                transaction_task_complete_and_free (task, error);
+        }
     }
+    g_list_free (transaction_ids);
+}
 
-    /* Single fragment? Send it! */
-    if (raw_message_len <= MAX_CONTROL_TRANSFER)
-        return device_write (self, raw_message, raw_message_len, error);
+static void
+device_recovery_complete (MbimDevice *self)
+{
+    self->priv->recovering = FALSE;
+    self->priv->recovery_time = g_get_monotonic_time () - self->priv->recovery_start;
+    g_debug ("[%s] device reopened in %.1f ms after %u attempts",
+             self->priv->path_display,
+             (gdouble) self->priv->recovery_time / 1000.0,
+             self->priv->recovery_attempts);
 
-    /* The message to send must be able to handle fragments */
-    g_assert (_mbim_message_is_fragment (message));
+    device_recovery_resubmit (self);
+    device_set_healthy (self, TRUE);
+    g_signal_emit (self, signals[SIGNAL_REOPENED], 0);
+}
 
-    fragments = _mbim_message_split_fragments (message, MAX_CONTROL_TRANSFER, &n_fragments);
-    for (i = 0; i < n_fragments; i++) {
-        g_autoptr(GByteArray)  full_fragment = NULL;
-        g_autofree gchar      *printable_headers = NULL;
+static void
+subscribe_list_replay_ready (MbimDevice   *self,
+                             GAsyncResult *res)
+{
+    g_autoptr(MbimMessage) response = NULL;
+    g_autoptr(GError)      error = NULL;
 
-        /* Build compiled fragment headers */
-        full_fragment = g_byte_array_new ();
-        g_byte_array_append (full_fragment, (guint8 *)&fragments[i].header, sizeof (fragments[i].header));
-        g_byte_array_append (full_fragment, (guint8 *)&fragments[i].fragment_header, sizeof (fragments[i].fragment_header));
+    response = mbim_device_command_finish (self, res, &error);
+    if (!response || !mbim_message_response_get_result (response, MBIM_MESSAGE_TYPE_COMMAND_DONE, &error))
+        g_warning ("[%s] couldn't configure device service subscribe list after reopen: %s",
+                   self->priv->path_display, error->message);
 
-        /* Build placeholder message with only headers for printable purposes only */
-        if (mbim_utils_get_traces_enabled ())
-            printable_headers = mbim_message_get_printable_full ((MbimMessage *)full_fragment,
-                                                                 self->priv->ms_mbimex_version_major,
-                                                                 self->priv->ms_mbimex_version_minor,
-                                                                 "<<<<<< ",
-                                                                 TRUE,
-                                                                 NULL);
+    if (self->priv->recovering)
+        device_recovery_complete (self);
+}
 
-        /* Append the actual fragment data */
-        g_byte_array_append (full_fragment, (guint8 *)fragments[i].data, fragments[i].data_length);
+static void device_recovery_schedule (MbimDevice *self);
 
-        if (mbim_utils_get_traces_enabled ()) {
-            g_autofree gchar *printable_full = NULL;
+static void
+device_recovery_open_ready (MbimDevice   *self,
+                            GAsyncResult *res)
+{
+    g_autoptr(GError)      error = NULL;
+    g_autoptr(MbimMessage) request = NULL;
 
-            printable_full  = mbim_common_str_hex ((const guint8 *)full_fragment->data, full_fragment->len, ':');
-            g_debug ("[%s] sent fragment (%u)...\n"
-                     "<<<<<< RAW:\n"
-                     "<<<<<<   length = %u\n"
-                     "<<<<<<   data   = %s\n",
-                     self->priv->path_display, i,
-                     full_fragment->len,
-                     printable_full);
+    if (!mbim_device_open_full_finish (self, res, &error)) {
+        g_debug ("[%s] couldn't reopen device: %s", self->priv->path_display, error->message);
+        destroy_iochannel (self, NULL);
+        self->priv->open_status = OPEN_STATUS_CLOSED;
+        if (self->priv->recovering)
+            device_recovery_schedule (self);
+        return;
+    }
 
-            g_debug ("[%s] sent fragment (translated)...\n%s",
-                     self->priv->path_display,
-                     printable_headers);
-        }
+    /* Recovery stopped while the device was being opened */
+    if (!self->priv->recovering) {
+        destroy_iochannel (self, NULL);
+        self->priv->open_status = OPEN_STATUS_CLOSED;
+        return;
+    }
 
-        /* Write whole packet to MBIM device.
-         * Here send whole packet rather than seperated elements, such as header,
-         * fragment_header, data, because some MBIM devices may have errors on
-         * seperated fragment case, such as "MBIM protocol error: LengthMismatch"
-         */
-        if (!device_write (self,
-                           (guint8 *)full_fragment->data,
-                           full_fragment->len,
-                           error))
-            return FALSE;
+    if (!self->priv->subscribe_list_request) {
+        device_recovery_complete (self);
+        return;
     }
 
-    return TRUE;
+    request = mbim_message_dup (self->priv->subscribe_list_request);
+    mbim_message_set_transaction_id (request, mbim_device_get_next_transaction_id (self));
+    device_command (self,
+                    request,
+                    self->priv->open_timeout,
+                    self->priv->recovery_cancellable,
+                    (GAsyncReadyCallback) subscribe_list_replay_ready,
+                    NULL,
+                    TRUE);
 }
 
-/*****************************************************************************/
-/* Report error */
+static gboolean
+device_recovery_attempt (MbimDevice *self)
+{
+    g_clear_pointer (&self->priv->recovery_source, g_source_unref);
 
-typedef struct {
-    MbimDevice  *self;
-    MbimMessage *message;
-} ReportErrorContext;
+    g_debug ("[%s] reopening device (attempt %u)...",
+             self->priv->path_display, self->priv->recovery_attempts);
+    mbim_device_open_full (self,
+                           self->priv->open_flags,
+                           self->priv->open_timeout,
+                           self->priv->recovery_cancellable,
+                           (GAsyncReadyCallback) device_recovery_open_ready,
+                           NULL);
+    return G_SOURCE_REMOVE;
+}
 
 static void
-device_report_error_context_free (ReportErrorContext *ctx)
+device_recovery_schedule (MbimDevice *self)
 {
-    mbim_message_unref (ctx->message);
-    g_object_unref (ctx->self);
-    g_slice_free (ReportErrorContext, ctx);
+    guint delay_ms;
+
+    if (self->priv->recovery_attempts == RECOVERY_MAX_ATTEMPTS) {
+        g_debug ("[%s] giving up reopening device", self->priv->path_display);
+        device_recovery_stop (self);
+        g_signal_emit (self, signals[SIGNAL_REMOVED], 0);
+        return;
+    }
+
+    delay_ms = MIN (RECOVERY_INITIAL_DELAY_MS << self->priv->recovery_attempts, RECOVERY_MAX_DELAY_MS);
+    self->priv->recovery_attempts++;
+
+    g_assert (!self->priv->recovery_source);
+    self->priv->recovery_source = g_timeout_source_new (delay_ms);
+    g_source_set_callback (self->priv->recovery_source, (GSourceFunc) device_recovery_attempt, self, NULL);
+    g_source_attach (self->priv->recovery_source, g_main_context_get_thread_default ());
 }
 
-static gboolean
-device_report_error_in_idle (ReportErrorContext *ctx)
+static void
+device_recovery_start (MbimDevice  *self,
+                       const gchar *reason)
 {
-    /* Device must be open */
-    if (ctx->self->priv->iochannel) {
-        g_autoptr(GError) error = NULL;
+    g_debug ("[%s] %s: reopening device automatically...", self->priv->path_display, reason);
 
-        if (!device_send (ctx->self, ctx->message, &error))
-            g_warning ("[%s] couldn't send host error message: %s",
-                       ctx->self->priv->path_display,
-                       error->message);
-    }
+    self->priv->recovering = TRUE;
+    self->priv->recovery_attempts = 0;
+    self->priv->recovery_start = g_get_monotonic_time ();
+    g_clear_object (&self->priv->recovery_cancellable);
+    self->priv->recovery_cancellable = g_cancellable_new ();
 
-    device_report_error_context_free (ctx);
-    return FALSE;
+    destroy_iochannel (self, NULL);
+    self->priv->open_status = OPEN_STATUS_CLOSED;
+    device_abort_transactions (self, FALSE);
+
+    /* The first attempt is delayed as well, to let the device settle */
+    device_recovery_schedule (self);
 }
 
 static void
-device_report_error (MbimDevice   *self,
-                     guint32       transaction_id,
-                     const GError *error)
+device_recovery_stop (MbimDevice *self)
 {
-    ReportErrorContext *ctx;
-    g_autoptr(GSource)  source = NULL;
-
-    /* Only protocol errors to be reported to the modem */
-    if (error->domain != MBIM_PROTOCOL_ERROR)
+    if (!self->priv->recovering)
         return;
 
-    ctx = g_slice_new (ReportErrorContext);
-    ctx->self = g_object_ref (self);
-    ctx->message = mbim_message_error_new (transaction_id, error->code);
+    self->priv->recovering = FALSE;
+    if (self->priv->recovery_source) {
+        g_source_destroy (self->priv->recovery_source);
+        g_clear_pointer (&self->priv->recovery_source, g_source_unref);
+    }
+    if (self->priv->recovery_cancellable)
+        g_cancellable_cancel (self->priv->recovery_cancellable);
 
-    source = g_idle_source_new ();
-    g_source_set_callback (source, (GSourceFunc)device_report_error_in_idle, ctx, NULL);
-    g_source_attach (source, g_main_context_get_thread_default ());
+    destroy_iochannel (self, NULL);
+    self->priv->open_status = OPEN_STATUS_CLOSED;
+    device_abort_transactions (self, TRUE);
 }
 
 /*****************************************************************************/
-/* Command */
+/* Health probe
+ *
+ * If enabled, a cheap query is sent periodically with a short timeout, unless
+ * the device sent any message within the last interval. A probe is also
+ * sent right away when a request times out. The device is reported as not
+ * healthy when a probe times out, and reopened if it was opened with
+ * MBIM_DEVICE_OPEN_FLAGS_AUTO_REOPEN.
+ *
+ * No probe is sent while other requests sent within the last interval are
+ * still pending, as the probe would be queued behind them in a busy device
+ * and time out even if the device is alive; those requests have their own
+ * timeouts, which trigger a probe if they expire. */
 
-MbimMessage *
-mbim_device_command_finish (MbimDevice    *self,
-                            GAsyncResult  *res,
-                            GError       **error)
+static void
+device_set_healthy (MbimDevice *self,
+                    gboolean    healthy)
 {
-    return g_task_propagate_pointer (G_TASK (res), error);
+    if (self->priv->healthy == healthy)
+        return;
+
+    self->priv->healthy = healthy;
+    g_debug ("[%s] device is %s", self->priv->path_display, healthy ? "healthy" : "not responding");
+    g_signal_emit (self, signals[SIGNAL_HEALTH_CHANGED], 0, healthy);
 }
 
-void
-mbim_device_command (MbimDevice          *self,
-                     MbimMessage         *message,
-                     guint                timeout,
-                     GCancellable        *cancellable,
-                     GAsyncReadyCallback  callback,
-                     gpointer             user_data)
+static void
+health_probe_ready (MbimDevice   *self,
+                    GAsyncResult *res)
 {
-    g_autoptr(GError)  error = NULL;
-    GTask             *task;
-    guint32            transaction_id;
+    g_autoptr(MbimMessage) response = NULL;
+    g_autoptr(GError)      error = NULL;
 
-    g_return_if_fail (MBIM_IS_DEVICE (self));
-    g_return_if_fail (message != NULL);
+    self->priv->health_probe_pending = FALSE;
 
-    /* If the message comes without a explicit transaction ID, add one
-     * ourselves */
-    transaction_id = mbim_message_get_transaction_id (message);
-    if (!transaction_id) {
-        transaction_id = mbim_device_get_next_transaction_id (self);
-        mbim_message_set_transaction_id (message, transaction_id);
+    /* Any response, even an error one, means the device is alive */
+    response = mbim_device_command_finish (self, res, &error);
+    if (response) {
+        device_set_healthy (self, TRUE);
+        return;
     }
 
-    task = transaction_task_new (self,
-                                 MBIM_MESSAGE_GET_MESSAGE_TYPE (message),
-                                 transaction_id,
-                                 cancellable,
-                                 callback,
-                                 user_data);
-
-    /* Device must be open */
-    if (!self->priv->iochannel) {
-        error = g_error_new (MBIM_CORE_ERROR,
-                             MBIM_CORE_ERROR_WRONG_STATE,
-                             "Device must be open to send commands");
-        transaction_task_complete_and_free (task, error);
+    if (!g_error_matches (error, MBIM_CORE_ERROR, MBIM_CORE_ERROR_TIMEOUT)) {
+        g_debug ("[%s] health probe failed: %s", self->priv->path_display, error->message);
         return;
     }
 
-    /* Setup context to match response */
-    if (!device_store_transaction (self, TRANSACTION_TYPE_HOST, task, timeout * 1000, &error)) {
-        g_prefix_error (&error, "Cannot store transaction: ");
-        transaction_task_complete_and_free (task, error);
-        return;
+    device_set_healthy (self, FALSE);
+    if ((self->priv->open_status == OPEN_STATUS_OPEN) &&
+        (self->priv->open_flags & MBIM_DEVICE_OPEN_FLAGS_AUTO_REOPEN))
+        device_recovery_start (self, "health probe timed out");
+}
+
+static gint64
+device_get_oldest_pending_tx_time (MbimDevice *self)
+{
+    GHashTableIter iter;
+    gpointer       value;
+    gint64         oldest = 0;
+
+    if (!self->priv->transactions[TRANSACTION_TYPE_HOST])
+        return 0;
+
+    g_hash_table_iter_init (&iter, self->priv->transactions[TRANSACTION_TYPE_HOST]);
+    while (g_hash_table_iter_next (&iter, NULL, &value)) {
+        TransactionContext *ctx;
+
+        ctx = g_task_get_task_data (G_TASK (value));
+        if (ctx->tx_time && (!oldest || ctx->tx_time < oldest))
+            oldest = ctx->tx_time;
     }
 
-    if (!device_send (self, message, &error)) {
-        /* Match transaction so that we remove it from our tracking table */
-        task = device_release_transaction (self,
-                                           TRANSACTION_TYPE_HOST,
-                                           MBIM_MESSAGE_GET_MESSAGE_TYPE (message),
-                                           mbim_message_get_transaction_id (message));
-        transaction_task_complete_and_free (task, error);
+    return oldest;
+}
+
+static void
+device_health_probe (MbimDevice *self)
+{
+    g_autoptr(MbimMessage) request = NULL;
+    gint64                 oldest_tx_time;
+
+    if (self->priv->health_probe_pending || self->priv->open_status != OPEN_STATUS_OPEN)
+        return;
+
+    /* The device may just be busy with other requests */
+    oldest_tx_time = device_get_oldest_pending_tx_time (self);
+    if (oldest_tx_time &&
+        (g_get_monotonic_time () - oldest_tx_time) < ((gint64) MAX (self->priv->health_probe_interval, HEALTH_PROBE_TIMEOUT_SECS) * G_USEC_PER_SEC)) {
+        g_debug ("[%s] health probe skipped: requests pending", self->priv->path_display);
         return;
     }
 
-    /* Just return, we'll get response asynchronously */
+    self->priv->health_probe_pending = TRUE;
+    request = mbim_message_radio_state_query_new (NULL);
+    device_command (self,
+                    request,
+                    HEALTH_PROBE_TIMEOUT_SECS,
+                    NULL,
+                    (GAsyncReadyCallback) health_probe_ready,
+                    NULL,
+                    TRUE);
+}
+
+static gboolean
+health_probe_timeout_cb (MbimDevice *self)
+{
+    /* Any message from the device already tells it is alive */
+    if ((g_get_monotonic_time () - self->priv->last_response_time) < ((gint64) self->priv->health_probe_interval * G_USEC_PER_SEC))
+        return G_SOURCE_CONTINUE;
+
+    device_health_probe (self);
+    return G_SOURCE_CONTINUE;
+}
+
+static void
+device_health_probe_setup (MbimDevice *self)
+{
+    if (self->priv->health_probe_source) {
+        g_source_destroy (self->priv->health_probe_source);
+        g_clear_pointer (&self->priv->health_probe_source, g_source_unref);
+    }
+
+    if (!self->priv->health_probe_interval || self->priv->open_status != OPEN_STATUS_OPEN)
+        return;
+
+    self->priv->health_probe_source = g_timeout_source_new_seconds (self->priv->health_probe_interval);
+    g_source_set_callback (self->priv->health_probe_source, (GSourceFunc) health_probe_timeout_cb, self, NULL);
+    g_source_attach (self->priv->health_probe_source, g_main_context_get_thread_default ());
 }
 
 /*****************************************************************************/
@@ -2726,6 +4544,14 @@ set_property (GObject      *object,
     case PROP_CONSECUTIVE_TIMEOUTS:
         g_assert_not_reached ();
         break;
+    case PROP_PROFILE_DIR:
+        g_free (self->priv->profile_dir);
+        self->priv->profile_dir = g_value_dup_string (value);
+        break;
+    case PROP_HEALTH_PROBE_INTERVAL:
+        self->priv->health_probe_interval = g_value_get_uint (value);
+        device_health_probe_setup (self);
+        break;
     default:
         G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
         break;
@@ -2753,6 +4579,12 @@ get_property (GObject    *object,
     case PROP_CONSECUTIVE_TIMEOUTS:
         g_value_set_uint (value, self->priv->consecutive_timeouts);
         break;
+    case PROP_PROFILE_DIR:
+        g_value_set_string (value, self->priv->profile_dir);
+        break;
+    case PROP_HEALTH_PROBE_INTERVAL:
+        g_value_set_uint (value, self->priv->health_probe_interval);
+        break;
     default:
         G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
         break;
@@ -2772,6 +4604,8 @@ mbim_device_init (MbimDevice *self)
 
     /* By default, assume v1.0 supported */
     self->priv->ms_mbimex_version_major = 0x01;
+
+    self->priv->healthy = TRUE;
 }
 
 static void
@@ -2781,6 +4615,10 @@ dispose (GObject *object)
 
     g_clear_object (&self->priv->file);
 
+    device_recovery_stop (self);
+    g_clear_object (&self->priv->recovery_cancellable);
+    g_clear_pointer (&self->priv->subscribe_list_request, mbim_message_unref);
+
     self->priv->open_status = OPEN_STATUS_CLOSED;
     destroy_iochannel (self, NULL);
     g_clear_object (&self->priv->net_port_manager);
@@ -2807,6 +4645,9 @@ finalize (GObject *object)
     g_free (self->priv->path);
     g_free (self->priv->path_display);
     g_free (self->priv->wwan_iface);
+    g_free (self->priv->profile_dir);
+    g_free (self->priv->profile_identity);
+    g_free (self->priv->proxy_path);
 
     G_OBJECT_CLASS (mbim_device_parent_class)->finalize (object);
 }
@@ -2884,6 +4725,32 @@ mbim_device_class_init (MbimDeviceClass *klass)
                            G_PARAM_READABLE);
     g_object_class_install_property (object_class, PROP_CONSECUTIVE_TIMEOUTS, properties[PROP_CONSECUTIVE_TIMEOUTS]);
 
+    /**
+     * MbimDevice:device-profile-dir:
+     *
+     * Since: 1.30
+     */
+    properties[PROP_PROFILE_DIR] =
+        g_param_spec_string (MBIM_DEVICE_PROFILE_DIR,
+                             "Profile directory",
+                             "Directory where the device profile is stored",
+                             NULL,
+                             G_PARAM_READWRITE);
+    g_object_class_install_property (object_class, PROP_PROFILE_DIR, properties[PROP_PROFILE_DIR]);
+
+    /**
+     * MbimDevice:device-health-probe-interval:
+     *
+     * Since: 1.30
+     */
+    properties[PROP_HEALTH_PROBE_INTERVAL] =
+        g_param_spec_uint (MBIM_DEVICE_HEALTH_PROBE_INTERVAL,
+                           "Health probe interval",
+                           "Interval, in seconds, between health probes while the device is idle, or 0 to disable them",
+                           0, G_MAXUINT, 0,
+                           G_PARAM_READWRITE);
+    g_object_class_install_property (object_class, PROP_HEALTH_PROBE_INTERVAL, properties[PROP_HEALTH_PROBE_INTERVAL]);
+
   /**
    * MbimDevice::device-indicate-status:
    * @self: the #MbimDevice
@@ -2945,4 +4812,49 @@ mbim_device_class_init (MbimDeviceClass *klass)
                       NULL,
                       G_TYPE_NONE,
                       0);
+
+  /**
+   * MbimDevice::device-reopened:
+   * @self: the #MbimDevice
+   *
+   * The ::device-reopened signal is emitted when the device has been reopened
+   * automatically after a port hang-up or after reporting that it was not
+   * opened, see %MBIM_DEVICE_OPEN_FLAGS_AUTO_REOPEN. If the device cannot be
+   * reopened, #MbimDevice::device-removed is emitted instead.
+   *
+   * Since: 1.30
+   */
+    signals[SIGNAL_REOPENED] =
+        g_signal_new (MBIM_DEVICE_SIGNAL_REOPENED,
+                      G_OBJECT_CLASS_TYPE (G_OBJECT_CLASS (klass)),
+                      G_SIGNAL_RUN_LAST,
+                      0,
+                      NULL,
+                      NULL,
+                      NULL,
+                      G_TYPE_NONE,
+                      0);
+
+  /**
+   * MbimDevice::device-health-changed:
+   * @self: the #MbimDevice
+   * @healthy: %TRUE if the device answers requests, %FALSE otherwise.
+   *
+   * The ::device-health-changed signal is emitted when a health probe times
+   * out, and when the device answers again afterwards, see
+   * #MbimDevice:device-health-probe-interval.
+   *
+   * Since: 1.30
+   */
+    signals[SIGNAL_HEALTH_CHANGED] =
+        g_signal_new (MBIM_DEVICE_SIGNAL_HEALTH_CHANGED,
+                      G_OBJECT_CLASS_TYPE (G_OBJECT_CLASS (klass)),
+                      G_SIGNAL_RUN_LAST,
+                      0,
+                      NULL,
+                      NULL,
+                      NULL,
+                      G_TYPE_NONE,
+                      1,
+                      G_TYPE_BOOLEAN);
 }
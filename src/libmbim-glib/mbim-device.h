@@ -79,6 +79,29 @@ typedef struct _MbimDevicePrivate MbimDevicePrivate;
  */
 #define MBIM_DEVICE_CONSECUTIVE_TIMEOUTS "device-consecutive-timeouts"
 
+/**
+ * MBIM_DEVICE_PROFILE_DIR:
+ *
+ * Symbol defining the #MbimDevice:device-profile-dir property.
+ *
+ * If set, the information learnt from the device (e.g. supported services,
+ * device caps) is stored in a profile in this directory, and reused when
+ * opening the same device in a later process. The profile is refreshed in the
+ * background once the device is open if it is too old.
+ *
+ * Since: 1.30
+ */
+#define MBIM_DEVICE_PROFILE_DIR "device-profile-dir"
+
+/**
+ * MBIM_DEVICE_HEALTH_PROBE_INTERVAL:
+ *
+ * Symbol defining the #MbimDevice:device-health-probe-interval property.
+ *
+ * Since: 1.30
+ */
+#define MBIM_DEVICE_HEALTH_PROBE_INTERVAL "device-health-probe-interval"
+
 /**
  * MBIM_DEVICE_SIGNAL_INDICATE_STATUS:
  *
@@ -106,6 +129,24 @@ typedef struct _MbimDevicePrivate MbimDevicePrivate;
  */
 #define MBIM_DEVICE_SIGNAL_REMOVED "device-removed"
 
+/**
+ * MBIM_DEVICE_SIGNAL_REOPENED:
+ *
+ * Symbol defining the #MbimDevice::device-reopened signal.
+ *
+ * Since: 1.30
+ */
+#define MBIM_DEVICE_SIGNAL_REOPENED "device-reopened"
+
+/**
+ * MBIM_DEVICE_SIGNAL_HEALTH_CHANGED:
+ *
+ * Symbol defining the #MbimDevice::device-health-changed signal.
+ *
+ * Since: 1.30
+ */
+#define MBIM_DEVICE_SIGNAL_HEALTH_CHANGED "device-health-changed"
+
 /**
  * MbimDevice:
  *
@@ -293,6 +334,12 @@ gboolean mbim_device_check_ms_mbimex_version (MbimDevice *self,
  * @MBIM_DEVICE_OPEN_FLAGS_PROXY: Try to open the port through the 'mbim-proxy'.
  * @MBIM_DEVICE_OPEN_FLAGS_MS_MBIMEX_V2: Try to enable MS MBIMEx 2.0 support. Since 1.28.
  * @MBIM_DEVICE_OPEN_FLAGS_MS_MBIMEX_V3: Try to enable MS MBIMEx 3.0 support. Since 1.28.
+ * @MBIM_DEVICE_OPEN_FLAGS_PIPELINE: Overlap the independent requests of the open
+ *  sequence, and reuse the list of device services learnt by previous opens of
+ *  the same device in this process. Since 1.30.
+ * @MBIM_DEVICE_OPEN_FLAGS_AUTO_REOPEN: Reopen the device automatically if the
+ *  port is hung up or if the device reports it is not opened, see
+ *  #MbimDevice::device-reopened. Since 1.30.
  *
  * Flags to specify which actions to be performed when the device is open.
  *
@@ -303,8 +350,36 @@ typedef enum { /*< since=1.10 >*/
     MBIM_DEVICE_OPEN_FLAGS_PROXY        = 1 << 0,
     MBIM_DEVICE_OPEN_FLAGS_MS_MBIMEX_V2 = 1 << 1,
     MBIM_DEVICE_OPEN_FLAGS_MS_MBIMEX_V3 = 1 << 2,
+    MBIM_DEVICE_OPEN_FLAGS_PIPELINE     = 1 << 3,
+    MBIM_DEVICE_OPEN_FLAGS_AUTO_REOPEN  = 1 << 4,
 } MbimDeviceOpenFlags;
 
+/**
+ * MbimDeviceOpenStep:
+ * @MBIM_DEVICE_OPEN_STEP_CREATE_IOCHANNEL: Opening the port, or connecting to the proxy.
+ * @MBIM_DEVICE_OPEN_STEP_PROXY_CONFIG: Proxy configuration request.
+ * @MBIM_DEVICE_OPEN_STEP_CLOSE: Close request sent before the open one.
+ * @MBIM_DEVICE_OPEN_STEP_OPEN: Open request.
+ * @MBIM_DEVICE_OPEN_STEP_DEVICE_SERVICES: Device services query.
+ * @MBIM_DEVICE_OPEN_STEP_MS_MBIMEX_VERSION: MS MBIMEx version exchange.
+ * @MBIM_DEVICE_OPEN_STEP_LAST: Internal value.
+ *
+ * Steps of the open sequence, as reported by mbim_device_get_open_step_time().
+ *
+ * Since: 1.30
+ */
+typedef enum { /*< since=1.30 >*/
+    MBIM_DEVICE_OPEN_STEP_CREATE_IOCHANNEL,
+    MBIM_DEVICE_OPEN_STEP_PROXY_CONFIG,
+    MBIM_DEVICE_OPEN_STEP_CLOSE,
+    MBIM_DEVICE_OPEN_STEP_OPEN,
+    MBIM_DEVICE_OPEN_STEP_DEVICE_SERVICES,
+    MBIM_DEVICE_OPEN_STEP_MS_MBIMEX_VERSION,
+#if defined LIBMBIM_GLIB_COMPILATION
+    MBIM_DEVICE_OPEN_STEP_LAST /*< skip >*/
+#endif
+} MbimDeviceOpenStep;
+
 /**
  * mbim_device_open_full:
  * @self: a #MbimDevice.
@@ -473,6 +548,55 @@ guint32 mbim_device_get_transaction_id (MbimDevice *self);
  */
 guint mbim_device_get_consecutive_timeouts (MbimDevice *self);
 
+/**
+ * mbim_device_get_open_step_time:
+ * @self: a #MbimDevice.
+ * @step: a #MbimDeviceOpenStep.
+ *
+ * Gets how long the given step took in the last open operation, which may
+ * have overlapped with other steps if %MBIM_DEVICE_OPEN_FLAGS_PIPELINE was
+ * given.
+ *
+ * Returns: the time in microseconds, or 0 if the step was skipped.
+ *
+ * Since: 1.30
+ */
+guint64 mbim_device_get_open_step_time (MbimDevice         *self,
+                                        MbimDeviceOpenStep  step);
+
+/**
+ * mbim_device_get_recovery_time:
+ * @self: a #MbimDevice.
+ *
+ * Gets how long it took to reopen the device the last time it was
+ * automatically recovered, see %MBIM_DEVICE_OPEN_FLAGS_AUTO_REOPEN.
+ *
+ * Returns: the time in microseconds, or 0 if the device was never recovered.
+ *
+ * Since: 1.30
+ */
+guint64 mbim_device_get_recovery_time (MbimDevice *self);
+
+/**
+ * mbim_device_get_cached_response:
+ * @self: a #MbimDevice.
+ * @service: a #MbimService.
+ * @cid: the command ID.
+ *
+ * Gets the response to a query without input that the device provided
+ * earlier in this process, or that was stored in the device profile, see
+ * #MbimDevice:device-profile-dir. Only the device services, device caps,
+ * system caps, device slot mappings and MBIMEx version responses are cached.
+ *
+ * Returns: (transfer full): a #MbimMessage response, or %NULL if not
+ * available. The returned value should be freed with mbim_message_unref().
+ *
+ * Since: 1.30
+ */
+MbimMessage *mbim_device_get_cached_response (MbimDevice  *self,
+                                              MbimService  service,
+                                              guint        cid);
+
 /**
  * mbim_device_command:
  * @self: a #MbimDevice.
@@ -515,6 +639,46 @@ MbimMessage *mbim_device_command_finish (MbimDevice    *self,
                                          GAsyncResult  *res,
                                          GError       **error);
 
+/**
+ * mbim_device_command_get_timestamps:
+ * @self: a #MbimDevice.
+ * @res: a #GAsyncResult given to the callback of mbim_device_command().
+ * @out_tx_time: (out) (optional): return location for the time the request
+ *  was written to the device, or %NULL.
+ * @out_rx_time: (out) (optional): return location for the time the response
+ *  was read from the device, or %NULL.
+ *
+ * Gets when a request was sent and when its response was received, in the
+ * time base of g_get_monotonic_time(). For a fragmented response, the receive
+ * time is the one of the last fragment.
+ *
+ * Comparing the receive time with the current time when the response is
+ * processed gives how long it was queued in the main loop, independently of
+ * the latency of the device.
+ *
+ * Returns: %TRUE if a response was received, %FALSE otherwise.
+ *
+ * Since: 1.30
+ */
+gboolean mbim_device_command_get_timestamps (MbimDevice   *self,
+                                             GAsyncResult *res,
+                                             gint64       *out_tx_time,
+                                             gint64       *out_rx_time);
+
+/**
+ * mbim_device_get_indication_timestamp:
+ * @self: a #MbimDevice.
+ *
+ * Gets when the indication being reported in the #MbimDevice::device-indicate-status
+ * signal was read from the device, in the time base of g_get_monotonic_time().
+ *
+ * Returns: the receive time, or 0 if not called from a
+ * #MbimDevice::device-indicate-status signal handler.
+ *
+ * Since: 1.30
+ */
+gint64 mbim_device_get_indication_timestamp (MbimDevice *self);
+
 /**
  * MBIM_DEVICE_SESSION_ID_AUTOMATIC:
  *
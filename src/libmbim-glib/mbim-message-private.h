@@ -365,6 +365,51 @@ gboolean _mbim_message_read_tlv_list          (const MbimMessage  *self,
                                                guint32            *bytes_read,
                                                GError            **error);
 
+/*****************************************************************************/
+/* Printable sink */
+
+/* Printable contents are accumulated in chunks of this size before being
+ * handed over to the sink callback */
+#define MBIM_PRINTABLE_SINK_CHUNK_SIZE 1024
+
+typedef struct {
+    MbimMessagePrintableFunc  func;
+    gpointer                  user_data;
+    /* Text written only if some other contents follow */
+    gchar                    *pending;
+    /* First error reported by func, if any */
+    GError                   *error;
+    gsize                     chunk_length;
+    gchar                     chunk[MBIM_PRINTABLE_SINK_CHUNK_SIZE];
+} MbimPrintableSink;
+
+void     _mbim_printable_sink_init          (MbimPrintableSink         *sink,
+                                             MbimMessagePrintableFunc   func,
+                                             gpointer                   user_data);
+void     _mbim_printable_sink_append        (MbimPrintableSink         *sink,
+                                             const gchar               *str);
+void     _mbim_printable_sink_append_printf (MbimPrintableSink         *sink,
+                                             const gchar               *format,
+                                             ...) G_GNUC_PRINTF (2, 3);
+void     _mbim_printable_sink_set_pending   (MbimPrintableSink         *sink,
+                                             gchar                     *pending);
+gboolean _mbim_printable_sink_finish        (MbimPrintableSink         *sink,
+                                             GError                   **error);
+
+/*****************************************************************************/
+/* JSON writers */
+
+void _mbim_json_write_string (MbimPrintableSink *sink,
+                              const gchar       *str);
+void _mbim_json_write_hex    (MbimPrintableSink *sink,
+                              const guint8      *data,
+                              gsize              data_length);
+void _mbim_json_write_enum   (MbimPrintableSink *sink,
+                              const gchar       *nick,
+                              guint64            value);
+void _mbim_json_write_tlv    (MbimPrintableSink *sink,
+                              const MbimTlv     *tlv);
+
 G_END_DECLS
 
 #endif /* _LIBMBIM_GLIB_MBIM_MESSAGE_PRIVATE_H_ */
@@ -1899,6 +1899,35 @@ mbim_message_new (const guint8 *data,
     return (MbimMessage *)out;
 }
 
+MbimMessage *
+mbim_message_new_take (guint8  *data,
+                       guint32  data_length)
+{
+    g_return_val_if_fail (data != NULL, NULL);
+
+    return (MbimMessage *)g_byte_array_new_take (data, data_length);
+}
+
+MbimMessage *
+mbim_message_new_from_bytes (GBytes *bytes)
+{
+    g_return_val_if_fail (bytes != NULL, NULL);
+
+    /* Steals the data if the given reference is the last one, copies otherwise */
+    return (MbimMessage *)g_bytes_unref_to_array (bytes);
+}
+
+GBytes *
+mbim_message_get_bytes (MbimMessage *self)
+{
+    g_return_val_if_fail (self != NULL, NULL);
+
+    return g_bytes_new_with_free_func (self->data,
+                                       self->len,
+                                       (GDestroyNotify)mbim_message_unref,
+                                       mbim_message_ref (self));
+}
+
 MbimMessage *
 mbim_message_dup (const MbimMessage *self)
 {
@@ -1936,41 +1965,416 @@ mbim_message_get_printable (const MbimMessage *self,
     return mbim_message_get_printable_full (self, 1, 0, line_prefix, headers_only, NULL);
 }
 
-gchar *
-mbim_message_get_printable_full (const MbimMessage  *self,
-                                 guint8              mbimex_version_major,
-                                 guint8              mbimex_version_minor,
-                                 const gchar        *line_prefix,
-                                 gboolean            headers_only,
-                                 GError            **error)
+/*****************************************************************************/
+/* Printable sink */
+
+void
+_mbim_printable_sink_init (MbimPrintableSink        *sink,
+                           MbimMessagePrintableFunc  func,
+                           gpointer                  user_data)
 {
-    GString     *printable = NULL;
-    MbimService  service_read_fields = MBIM_SERVICE_INVALID;
+    sink->func = func;
+    sink->user_data = user_data;
+    sink->pending = NULL;
+    sink->error = NULL;
+    sink->chunk_length = 0;
+}
 
-    g_return_val_if_fail (self != NULL, NULL);
-    g_return_val_if_fail (line_prefix != NULL, NULL);
-    g_return_val_if_fail (_mbim_message_validate_internal (self, TRUE, NULL), NULL);
+static void
+printable_sink_flush (MbimPrintableSink *sink)
+{
+    if (sink->chunk_length > 0 && !sink->error)
+        sink->func (sink->chunk, sink->chunk_length, sink->user_data, &sink->error);
+    sink->chunk_length = 0;
+}
+
+static void
+printable_sink_write (MbimPrintableSink *sink,
+                      const gchar       *data,
+                      gsize              data_length)
+{
+    if (sink->error)
+        return;
+
+    if (sink->chunk_length + data_length > MBIM_PRINTABLE_SINK_CHUNK_SIZE)
+        printable_sink_flush (sink);
+
+    /* Data not fitting in a whole chunk is given right away */
+    if (data_length >= MBIM_PRINTABLE_SINK_CHUNK_SIZE) {
+        if (!sink->error)
+            sink->func (data, data_length, sink->user_data, &sink->error);
+        return;
+    }
+
+    memcpy (&sink->chunk[sink->chunk_length], data, data_length);
+    sink->chunk_length += data_length;
+}
+
+static void
+printable_sink_write_pending (MbimPrintableSink *sink)
+{
+    g_autofree gchar *pending = NULL;
+
+    pending = g_steal_pointer (&sink->pending);
+    if (pending)
+        printable_sink_write (sink, pending, strlen (pending));
+}
+
+void
+_mbim_printable_sink_append (MbimPrintableSink *sink,
+                             const gchar       *str)
+{
+    printable_sink_write_pending (sink);
+    printable_sink_write (sink, str, strlen (str));
+}
+
+void
+_mbim_printable_sink_append_printf (MbimPrintableSink *sink,
+                                    const gchar       *format,
+                                    ...)
+{
+    va_list args;
+    gint    n;
+    gsize   available;
+
+    printable_sink_write_pending (sink);
+    if (sink->error)
+        return;
+
+    /* Try to format straight into the current chunk */
+    available = MBIM_PRINTABLE_SINK_CHUNK_SIZE - sink->chunk_length;
+    va_start (args, format);
+    n = g_vsnprintf (&sink->chunk[sink->chunk_length], available, format, args);
+    va_end (args);
+    if (n < 0)
+        return;
+    if ((gsize)n < available) {
+        sink->chunk_length += n;
+        return;
+    }
+
+    /* Didn't fit, so flush and retry in an empty chunk */
+    printable_sink_flush (sink);
+    if (sink->error)
+        return;
+    if (n < MBIM_PRINTABLE_SINK_CHUNK_SIZE) {
+        va_start (args, format);
+        g_vsnprintf (sink->chunk, MBIM_PRINTABLE_SINK_CHUNK_SIZE, format, args);
+        va_end (args);
+        sink->chunk_length = n;
+        return;
+    }
+
+    /* Larger than a whole chunk */
+    {
+        g_autofree gchar *str = NULL;
+
+        va_start (args, format);
+        str = g_strdup_vprintf (format, args);
+        va_end (args);
+        sink->func (str, n, sink->user_data, &sink->error);
+    }
+}
+
+void
+_mbim_printable_sink_set_pending (MbimPrintableSink *sink,
+                                  gchar             *pending)
+{
+    g_free (sink->pending);
+    sink->pending = pending;
+}
+
+gboolean
+_mbim_printable_sink_finish (MbimPrintableSink  *sink,
+                             GError            **error)
+{
+    g_clear_pointer (&sink->pending, g_free);
+    printable_sink_flush (sink);
+    if (sink->error) {
+        g_propagate_error (error, g_steal_pointer (&sink->error));
+        return FALSE;
+    }
+    return TRUE;
+}
+
+/*****************************************************************************/
+/* JSON writers */
+
+void
+_mbim_json_write_string (MbimPrintableSink *sink,
+                         const gchar       *str)
+{
+    const gchar *run;
+    const gchar *p;
+
+    if (!str) {
+        _mbim_printable_sink_append (sink, "null");
+        return;
+    }
+
+    printable_sink_write_pending (sink);
+    printable_sink_write (sink, "\"", 1);
+
+    /* Write runs of characters not requiring escaping in one go */
+    for (run = p = str; *p; p++) {
+        guchar c = (guchar) *p;
+
+        if (c != '"' && c != '\\' && c >= 0x20)
+            continue;
+
+        printable_sink_write (sink, run, p - run);
+        switch (c) {
+        case '"':
+            printable_sink_write (sink, "\\\"", 2);
+            break;
+        case '\\':
+            printable_sink_write (sink, "\\\\", 2);
+            break;
+        case '\n':
+            printable_sink_write (sink, "\\n", 2);
+            break;
+        case '\r':
+            printable_sink_write (sink, "\\r", 2);
+            break;
+        case '\t':
+            printable_sink_write (sink, "\\t", 2);
+            break;
+        default:
+            _mbim_printable_sink_append_printf (sink, "\\u%04x", c);
+            break;
+        }
+        run = p + 1;
+    }
+    printable_sink_write (sink, run, p - run);
+    printable_sink_write (sink, "\"", 1);
+}
+
+void
+_mbim_json_write_hex (MbimPrintableSink *sink,
+                      const guint8      *data,
+                      gsize              data_length)
+{
+    static const gchar hex[] = "0123456789abcdef";
+    gsize              i;
+
+    printable_sink_write_pending (sink);
+    printable_sink_write (sink, "\"", 1);
+    for (i = 0; i < data_length; i++) {
+        gchar byte[3];
+
+        byte[0] = hex[data[i] >> 4];
+        byte[1] = hex[data[i] & 0x0f];
+        byte[2] = ':';
+        printable_sink_write (sink, byte, (i < data_length - 1) ? 3 : 2);
+    }
+    printable_sink_write (sink, "\"", 1);
+}
+
+void
+_mbim_json_write_enum (MbimPrintableSink *sink,
+                       const gchar       *nick,
+                       guint64            value)
+{
+    /* Unknown values are written as plain numbers */
+    if (nick)
+        _mbim_json_write_string (sink, nick);
+    else
+        _mbim_printable_sink_append_printf (sink, "%" G_GUINT64_FORMAT, value);
+}
+
+void
+_mbim_json_write_tlv (MbimPrintableSink *sink,
+                      const MbimTlv     *tlv)
+{
+    MbimTlvType   tlv_type;
+    const guint8 *tlv_data;
+    guint32       tlv_data_size;
+
+    tlv_type = mbim_tlv_get_tlv_type (tlv);
+    tlv_data = mbim_tlv_get_tlv_data (tlv, &tlv_data_size);
+
+    _mbim_printable_sink_append (sink, "{\"type\":");
+    _mbim_json_write_enum (sink, mbim_tlv_type_get_string (tlv_type), tlv_type);
+    _mbim_printable_sink_append (sink, ",\"data\":");
+    _mbim_json_write_hex (sink, tlv_data, tlv_data_size);
+    if (tlv_type == MBIM_TLV_TYPE_WCHAR_STR) {
+        g_autofree gchar *str = NULL;
+
+        str = mbim_tlv_string_get (tlv, NULL);
+        _mbim_printable_sink_append (sink, ",\"string\":");
+        _mbim_json_write_string (sink, str);
+    }
+    _mbim_printable_sink_append (sink, "}");
+}
+
+/*****************************************************************************/
+
+typedef gboolean (* WritePrintableFieldsFunc) (const MbimMessage  *message,
+                                               MbimPrintableSink  *sink,
+                                               const gchar        *line_prefix,
+                                               GError            **error);
+typedef gboolean (* WriteJsonFieldsFunc)      (const MbimMessage  *message,
+                                               MbimPrintableSink  *sink,
+                                               GError            **error);
+
+typedef struct {
+    WritePrintableFieldsFunc printable;
+    WriteJsonFieldsFunc      json;
+} FieldWriters;
+
+#define MBIMEX_VERSION_MAJOR_MAX 3
+
+/* Field writers of each service, indexed by the MBIMEx major version the
+ * service definition applies to (v1 at index 0). Services updated in a
+ * given MBIMEx version only define the commands that changed, so lookups
+ * fall back to the previous versions for everything else. */
+static const FieldWriters field_writers[MBIM_SERVICE_LAST][MBIMEX_VERSION_MAJOR_MAX] = {
+    [MBIM_SERVICE_BASIC_CONNECT] = {
+        { __mbim_message_basic_connect_write_printable_fields, __mbim_message_basic_connect_write_json_fields },
+        { __mbim_message_ms_basic_connect_v2_write_printable_fields, __mbim_message_ms_basic_connect_v2_write_json_fields },
+        { __mbim_message_ms_basic_connect_v3_write_printable_fields, __mbim_message_ms_basic_connect_v3_write_json_fields },
+    },
+    [MBIM_SERVICE_SMS] = {
+        { __mbim_message_sms_write_printable_fields, __mbim_message_sms_write_json_fields },
+    },
+    [MBIM_SERVICE_USSD] = {
+        { __mbim_message_ussd_write_printable_fields, __mbim_message_ussd_write_json_fields },
+    },
+    [MBIM_SERVICE_PHONEBOOK] = {
+        { __mbim_message_phonebook_write_printable_fields, __mbim_message_phonebook_write_json_fields },
+    },
+    [MBIM_SERVICE_STK] = {
+        { __mbim_message_stk_write_printable_fields, __mbim_message_stk_write_json_fields },
+    },
+    [MBIM_SERVICE_AUTH] = {
+        { __mbim_message_auth_write_printable_fields, __mbim_message_auth_write_json_fields },
+    },
+    [MBIM_SERVICE_DSS] = {
+        { __mbim_message_dss_write_printable_fields, __mbim_message_dss_write_json_fields },
+    },
+    [MBIM_SERVICE_MS_FIRMWARE_ID] = {
+        { __mbim_message_ms_firmware_id_write_printable_fields, __mbim_message_ms_firmware_id_write_json_fields },
+    },
+    [MBIM_SERVICE_MS_HOST_SHUTDOWN] = {
+        { __mbim_message_ms_host_shutdown_write_printable_fields, __mbim_message_ms_host_shutdown_write_json_fields },
+    },
+    [MBIM_SERVICE_PROXY_CONTROL] = {
+        { __mbim_message_proxy_control_write_printable_fields, __mbim_message_proxy_control_write_json_fields },
+    },
+    [MBIM_SERVICE_QMI] = {
+        { __mbim_message_qmi_write_printable_fields, __mbim_message_qmi_write_json_fields },
+    },
+    [MBIM_SERVICE_ATDS] = {
+        { __mbim_message_atds_write_printable_fields, __mbim_message_atds_write_json_fields },
+    },
+    [MBIM_SERVICE_INTEL_FIRMWARE_UPDATE] = {
+        { __mbim_message_intel_firmware_update_write_printable_fields, __mbim_message_intel_firmware_update_write_json_fields },
+        { __mbim_message_intel_firmware_update_v2_write_printable_fields, __mbim_message_intel_firmware_update_v2_write_json_fields },
+    },
+    [MBIM_SERVICE_MS_BASIC_CONNECT_EXTENSIONS] = {
+        { __mbim_message_ms_basic_connect_extensions_write_printable_fields, __mbim_message_ms_basic_connect_extensions_write_json_fields },
+        { __mbim_message_ms_basic_connect_extensions_v2_write_printable_fields, __mbim_message_ms_basic_connect_extensions_v2_write_json_fields },
+        { __mbim_message_ms_basic_connect_extensions_v3_write_printable_fields, __mbim_message_ms_basic_connect_extensions_v3_write_json_fields },
+    },
+    [MBIM_SERVICE_MS_SAR] = {
+        { __mbim_message_ms_sar_write_printable_fields, __mbim_message_ms_sar_write_json_fields },
+    },
+    [MBIM_SERVICE_QDU] = {
+        { __mbim_message_qdu_write_printable_fields, __mbim_message_qdu_write_json_fields },
+    },
+    [MBIM_SERVICE_MS_UICC_LOW_LEVEL_ACCESS] = {
+        { __mbim_message_ms_uicc_low_level_access_write_printable_fields, __mbim_message_ms_uicc_low_level_access_write_json_fields },
+    },
+    [MBIM_SERVICE_QUECTEL] = {
+        { __mbim_message_quectel_write_printable_fields, __mbim_message_quectel_write_json_fields },
+    },
+    [MBIM_SERVICE_INTEL_THERMAL_RF] = {
+        { __mbim_message_intel_thermal_rf_write_printable_fields, __mbim_message_intel_thermal_rf_write_json_fields },
+    },
+    [MBIM_SERVICE_MS_VOICE_EXTENSIONS] = {
+        { __mbim_message_ms_voice_extensions_write_printable_fields, __mbim_message_ms_voice_extensions_write_json_fields },
+    },
+    [MBIM_SERVICE_INTEL_MUTUAL_AUTHENTICATION] = {
+        { __mbim_message_intel_mutual_authentication_write_printable_fields, __mbim_message_intel_mutual_authentication_write_json_fields },
+    },
+    [MBIM_SERVICE_INTEL_TOOLS] = {
+        { __mbim_message_intel_tools_write_printable_fields, __mbim_message_intel_tools_write_json_fields },
+    },
+    [MBIM_SERVICE_GOOGLE] = {
+        { __mbim_message_google_write_printable_fields, __mbim_message_google_write_json_fields },
+    },
+};
+
+static void
+message_write_fields (const MbimMessage  *self,
+                      MbimService         service,
+                      guint8              mbimex_version_major,
+                      gboolean            json,
+                      const gchar        *line_prefix,
+                      MbimPrintableSink  *sink,
+                      GError            **error)
+{
+    GError *inner_error = NULL;
+    gint    i;
+
+    g_assert (service != MBIM_SERVICE_INVALID);
 
-    if (mbimex_version_major > 3) {
+    /* Custom services don't have any field writer */
+    if (service >= MBIM_SERVICE_LAST)
+        return;
+
+    for (i = CLAMP (mbimex_version_major, 1, MBIMEX_VERSION_MAJOR_MAX) - 1; i >= 0; i--) {
+        const FieldWriters *writers = &field_writers[service][i];
+
+        /* Not all services are updated in all MBIMEx versions */
+        if (!writers->printable)
+            continue;
+
+        g_clear_error (&inner_error);
+        if (json)
+            writers->json (self, sink, &inner_error);
+        else
+            writers->printable (self, sink, line_prefix, &inner_error);
+
+        /* attempt fallback to the previous version if unsupported */
+        if (!g_error_matches (inner_error, MBIM_CORE_ERROR, MBIM_CORE_ERROR_UNSUPPORTED))
+            break;
+    }
+
+    if (inner_error)
+        g_propagate_error (error, inner_error);
+}
+
+static gboolean
+message_write_printable (const MbimMessage  *self,
+                         guint8              mbimex_version_major,
+                         guint8              mbimex_version_minor,
+                         const gchar        *line_prefix,
+                         gboolean            headers_only,
+                         MbimPrintableSink  *sink,
+                         GError            **error)
+{
+    MbimService service_read_fields = MBIM_SERVICE_INVALID;
+
+    if (mbimex_version_major > MBIMEX_VERSION_MAJOR_MAX) {
         g_set_error (error, MBIM_CORE_ERROR, MBIM_CORE_ERROR_INVALID_ARGS,
                      "MBIMEx version %x.%02x is unsupported",
                      mbimex_version_major, mbimex_version_minor);
-        return NULL;
+        return FALSE;
     }
 
     if (!line_prefix)
         line_prefix = "";
 
-    printable = g_string_new ("");
-    g_string_append_printf (printable,
-                            "%sHeader:\n"
-                            "%s  length      = %u\n"
-                            "%s  type        = %s (0x%08x)\n"
-                            "%s  transaction = %u\n",
-                            line_prefix,
-                            line_prefix, MBIM_MESSAGE_GET_MESSAGE_LENGTH (self),
-                            line_prefix, mbim_message_type_get_string (MBIM_MESSAGE_GET_MESSAGE_TYPE (self)), MBIM_MESSAGE_GET_MESSAGE_TYPE (self),
-                            line_prefix, MBIM_MESSAGE_GET_TRANSACTION_ID (self));
+    _mbim_printable_sink_append_printf (sink,
+                                        "%sHeader:\n"
+                                        "%s  length      = %u\n"
+                                        "%s  type        = %s (0x%08x)\n"
+                                        "%s  transaction = %u\n",
+                                        line_prefix,
+                                        line_prefix, MBIM_MESSAGE_GET_MESSAGE_LENGTH (self),
+                                        line_prefix, mbim_message_type_get_string (MBIM_MESSAGE_GET_MESSAGE_TYPE (self)), MBIM_MESSAGE_GET_MESSAGE_TYPE (self),
+                                        line_prefix, MBIM_MESSAGE_GET_TRANSACTION_ID (self));
 
     switch (MBIM_MESSAGE_GET_MESSAGE_TYPE (self)) {
     case MBIM_MESSAGE_TYPE_INVALID:
@@ -1979,11 +2383,11 @@ mbim_message_get_printable_full (const MbimMessage  *self,
 
     case MBIM_MESSAGE_TYPE_OPEN:
         if (!headers_only)
-            g_string_append_printf (printable,
-                                    "%sContents:\n"
-                                    "%s  max control transfer = %u\n",
-                                    line_prefix,
-                                    line_prefix, mbim_message_open_get_max_control_transfer (self));
+            _mbim_printable_sink_append_printf (sink,
+                                                "%sContents:\n"
+                                                "%s  max control transfer = %u\n",
+                                                line_prefix,
+                                                line_prefix, mbim_message_open_get_max_control_transfer (self));
         break;
 
     case MBIM_MESSAGE_TYPE_CLOSE:
@@ -1994,11 +2398,11 @@ mbim_message_get_printable_full (const MbimMessage  *self,
             MbimStatusError status;
 
             status = mbim_message_open_done_get_status_code (self);
-            g_string_append_printf (printable,
-                                    "%sContents:\n"
-                                    "%s  status error = '%s' (0x%08x)\n",
-                                    line_prefix,
-                                    line_prefix, mbim_status_error_get_string (status), status);
+            _mbim_printable_sink_append_printf (sink,
+                                                "%sContents:\n"
+                                                "%s  status error = '%s' (0x%08x)\n",
+                                                line_prefix,
+                                                line_prefix, mbim_status_error_get_string (status), status);
         }
         break;
 
@@ -2007,11 +2411,11 @@ mbim_message_get_printable_full (const MbimMessage  *self,
             MbimStatusError status;
 
             status = mbim_message_close_done_get_status_code (self);
-            g_string_append_printf (printable,
-                                    "%sContents:\n"
-                                    "%s  status error = '%s' (0x%08x)\n",
-                                    line_prefix,
-                                    line_prefix, mbim_status_error_get_string (status), status);
+            _mbim_printable_sink_append_printf (sink,
+                                                "%sContents:\n"
+                                                "%s  status error = '%s' (0x%08x)\n",
+                                                line_prefix,
+                                                line_prefix, mbim_status_error_get_string (status), status);
         }
         break;
 
@@ -2021,22 +2425,22 @@ mbim_message_get_printable_full (const MbimMessage  *self,
             MbimProtocolError protocol_error;
 
             protocol_error = mbim_message_error_get_error_status_code (self);
-            g_string_append_printf (printable,
-                                    "%sContents:\n"
-                                    "%s  error = '%s' (0x%08x)\n",
-                                    line_prefix,
-                                    line_prefix, mbim_protocol_error_get_string (protocol_error), protocol_error);
+            _mbim_printable_sink_append_printf (sink,
+                                                "%sContents:\n"
+                                                "%s  error = '%s' (0x%08x)\n",
+                                                line_prefix,
+                                                line_prefix, mbim_protocol_error_get_string (protocol_error), protocol_error);
         }
         break;
 
     case MBIM_MESSAGE_TYPE_COMMAND:
-        g_string_append_printf (printable,
-                                "%sFragment header:\n"
-                                "%s  total   = %u\n"
-                                "%s  current = %u\n",
-                                line_prefix,
-                                line_prefix, _mbim_message_fragment_get_total (self),
-                                line_prefix, _mbim_message_fragment_get_current (self));
+        _mbim_printable_sink_append_printf (sink,
+                                            "%sFragment header:\n"
+                                            "%s  total   = %u\n"
+                                            "%s  current = %u\n",
+                                            line_prefix,
+                                            line_prefix, _mbim_message_fragment_get_total (self),
+                                            line_prefix, _mbim_message_fragment_get_current (self));
         if (!headers_only) {
             g_autofree gchar *uuid_printable = NULL;
             const gchar      *cid_printable;
@@ -2046,26 +2450,26 @@ mbim_message_get_printable_full (const MbimMessage  *self,
             uuid_printable = mbim_uuid_get_printable (mbim_message_command_get_service_id (self));
             cid_printable = mbim_cid_get_printable (mbim_message_command_get_service (self),
                                                     mbim_message_command_get_cid (self));
-            g_string_append_printf (printable,
-                                    "%sContents:\n"
-                                    "%s  service = '%s' (%s)\n"
-                                    "%s  cid     = '%s' (0x%08x)\n"
-                                    "%s  type    = '%s' (0x%08x)\n",
-                                    line_prefix,
-                                    line_prefix, mbim_service_lookup_name (mbim_message_command_get_service (self)), uuid_printable,
-                                    line_prefix, cid_printable, mbim_message_command_get_cid (self),
-                                    line_prefix, mbim_message_command_type_get_string (mbim_message_command_get_command_type (self)), mbim_message_command_get_command_type (self));
+            _mbim_printable_sink_append_printf (sink,
+                                                "%sContents:\n"
+                                                "%s  service = '%s' (%s)\n"
+                                                "%s  cid     = '%s' (0x%08x)\n"
+                                                "%s  type    = '%s' (0x%08x)\n",
+                                                line_prefix,
+                                                line_prefix, mbim_service_lookup_name (mbim_message_command_get_service (self)), uuid_printable,
+                                                line_prefix, cid_printable, mbim_message_command_get_cid (self),
+                                                line_prefix, mbim_message_command_type_get_string (mbim_message_command_get_command_type (self)), mbim_message_command_get_command_type (self));
         }
         break;
 
     case MBIM_MESSAGE_TYPE_COMMAND_DONE:
-        g_string_append_printf (printable,
-                                "%sFragment header:\n"
-                                "%s  total   = %u\n"
-                                "%s  current = %u\n",
-                                line_prefix,
-                                line_prefix, _mbim_message_fragment_get_total (self),
-                                line_prefix, _mbim_message_fragment_get_current (self));
+        _mbim_printable_sink_append_printf (sink,
+                                            "%sFragment header:\n"
+                                            "%s  total   = %u\n"
+                                            "%s  current = %u\n",
+                                            line_prefix,
+                                            line_prefix, _mbim_message_fragment_get_total (self),
+                                            line_prefix, _mbim_message_fragment_get_current (self));
         if (!headers_only) {
             g_autofree gchar *uuid_printable = NULL;
             MbimStatusError   status;
@@ -2077,26 +2481,26 @@ mbim_message_get_printable_full (const MbimMessage  *self,
             uuid_printable = mbim_uuid_get_printable (mbim_message_command_done_get_service_id (self));
             cid_printable = mbim_cid_get_printable (mbim_message_command_done_get_service (self),
                                                     mbim_message_command_done_get_cid (self));
-            g_string_append_printf (printable,
-                                    "%sContents:\n"
-                                    "%s  status error = '%s' (0x%08x)\n"
-                                    "%s  service      = '%s' (%s)\n"
-                                    "%s  cid          = '%s' (0x%08x)\n",
-                                    line_prefix,
-                                    line_prefix, mbim_status_error_get_string (status), status,
-                                    line_prefix, mbim_service_lookup_name (mbim_message_command_done_get_service (self)), uuid_printable,
-                                    line_prefix, cid_printable, mbim_message_command_done_get_cid (self));
+            _mbim_printable_sink_append_printf (sink,
+                                                "%sContents:\n"
+                                                "%s  status error = '%s' (0x%08x)\n"
+                                                "%s  service      = '%s' (%s)\n"
+                                                "%s  cid          = '%s' (0x%08x)\n",
+                                                line_prefix,
+                                                line_prefix, mbim_status_error_get_string (status), status,
+                                                line_prefix, mbim_service_lookup_name (mbim_message_command_done_get_service (self)), uuid_printable,
+                                                line_prefix, cid_printable, mbim_message_command_done_get_cid (self));
         }
         break;
 
     case MBIM_MESSAGE_TYPE_INDICATE_STATUS:
-        g_string_append_printf (printable,
-                                "%sFragment header:\n"
-                                "%s  total   = %u\n"
-                                "%s  current = %u\n",
-                                line_prefix,
-                                line_prefix, _mbim_message_fragment_get_total (self),
-                                line_prefix, _mbim_message_fragment_get_current (self));
+        _mbim_printable_sink_append_printf (sink,
+                                            "%sFragment header:\n"
+                                            "%s  total   = %u\n"
+                                            "%s  current = %u\n",
+                                            line_prefix,
+                                            line_prefix, _mbim_message_fragment_get_total (self),
+                                            line_prefix, _mbim_message_fragment_get_current (self));
         if (!headers_only) {
             g_autofree gchar *uuid_printable = NULL;
             const gchar      *cid_printable;
@@ -2106,13 +2510,13 @@ mbim_message_get_printable_full (const MbimMessage  *self,
             uuid_printable = mbim_uuid_get_printable (mbim_message_indicate_status_get_service_id (self));
             cid_printable = mbim_cid_get_printable (mbim_message_indicate_status_get_service (self),
                                                     mbim_message_indicate_status_get_cid (self));
-            g_string_append_printf (printable,
-                                    "%sContents:\n"
-                                    "%s  service = '%s' (%s)\n"
-                                    "%s  cid     = '%s' (0x%08x)\n",
-                                    line_prefix,
-                                    line_prefix, mbim_service_lookup_name (mbim_message_indicate_status_get_service (self)), uuid_printable,
-                                    line_prefix, cid_printable, mbim_message_indicate_status_get_cid (self));
+            _mbim_printable_sink_append_printf (sink,
+                                                "%sContents:\n"
+                                                "%s  service = '%s' (%s)\n"
+                                                "%s  cid     = '%s' (0x%08x)\n",
+                                                line_prefix,
+                                                line_prefix, mbim_service_lookup_name (mbim_message_indicate_status_get_service (self)), uuid_printable,
+                                                line_prefix, cid_printable, mbim_message_indicate_status_get_cid (self));
         }
         break;
 
@@ -2121,152 +2525,322 @@ mbim_message_get_printable_full (const MbimMessage  *self,
     }
 
     if (service_read_fields != MBIM_SERVICE_INVALID) {
-        g_autofree gchar  *fields_printable = NULL;
-        g_autoptr(GError)  inner_error = NULL;
-
-        switch (service_read_fields) {
-        case MBIM_SERVICE_BASIC_CONNECT:
-            if (mbimex_version_major < 2)
-                fields_printable = __mbim_message_basic_connect_get_printable_fields (self, line_prefix, &inner_error);
-            else if (mbimex_version_major == 2) {
-                fields_printable = __mbim_message_ms_basic_connect_v2_get_printable_fields (self, line_prefix, &inner_error);
-                /* attempt fallback to v1 printable */
-                if (g_error_matches (inner_error, MBIM_CORE_ERROR, MBIM_CORE_ERROR_UNSUPPORTED)) {
-                    g_clear_error (&inner_error);
-                    fields_printable = __mbim_message_basic_connect_get_printable_fields (self, line_prefix, &inner_error);
-                }
-            } else if (mbimex_version_major == 3) {
-                fields_printable = __mbim_message_ms_basic_connect_v3_get_printable_fields (self, line_prefix, &inner_error);
-                /* attempt fallback to v2 printable */
-                if (g_error_matches (inner_error, MBIM_CORE_ERROR, MBIM_CORE_ERROR_UNSUPPORTED)) {
-                    g_clear_error (&inner_error);
-                    fields_printable = __mbim_message_ms_basic_connect_v2_get_printable_fields (self, line_prefix, &inner_error);
-                    /* attempt fallback to v1 printable */
-                    if (g_error_matches (inner_error, MBIM_CORE_ERROR, MBIM_CORE_ERROR_UNSUPPORTED)) {
-                        g_clear_error (&inner_error);
-                        fields_printable = __mbim_message_basic_connect_get_printable_fields (self, line_prefix, &inner_error);
-                    }
-                }
-            } else
-                g_assert_not_reached ();
-            break;
-        case MBIM_SERVICE_SMS:
-            fields_printable = __mbim_message_sms_get_printable_fields (self, line_prefix, &inner_error);
-            break;
-        case MBIM_SERVICE_USSD:
-            fields_printable = __mbim_message_ussd_get_printable_fields (self, line_prefix, &inner_error);
-            break;
-        case MBIM_SERVICE_PHONEBOOK:
-            fields_printable = __mbim_message_phonebook_get_printable_fields (self, line_prefix, &inner_error);
-            break;
-        case MBIM_SERVICE_STK:
-            fields_printable = __mbim_message_stk_get_printable_fields (self, line_prefix, &inner_error);
-            break;
-        case MBIM_SERVICE_AUTH:
-            fields_printable = __mbim_message_auth_get_printable_fields (self, line_prefix, &inner_error);
-            break;
-        case MBIM_SERVICE_DSS:
-            fields_printable = __mbim_message_dss_get_printable_fields (self, line_prefix, &inner_error);
-            break;
-        case MBIM_SERVICE_MS_FIRMWARE_ID:
-            fields_printable = __mbim_message_ms_firmware_id_get_printable_fields (self, line_prefix, &inner_error);
-            break;
-        case MBIM_SERVICE_MS_HOST_SHUTDOWN:
-            fields_printable = __mbim_message_ms_host_shutdown_get_printable_fields (self, line_prefix, &inner_error);
-            break;
-        case MBIM_SERVICE_MS_SAR:
-            fields_printable = __mbim_message_ms_sar_get_printable_fields (self, line_prefix, &inner_error);
-            break;
-        case MBIM_SERVICE_PROXY_CONTROL:
-            fields_printable = __mbim_message_proxy_control_get_printable_fields (self, line_prefix, &inner_error);
-            break;
-        case MBIM_SERVICE_QMI:
-            fields_printable = __mbim_message_qmi_get_printable_fields (self, line_prefix, &inner_error);
-            break;
-        case MBIM_SERVICE_ATDS:
-            fields_printable = __mbim_message_atds_get_printable_fields (self, line_prefix, &inner_error);
-            break;
-        case MBIM_SERVICE_INTEL_FIRMWARE_UPDATE:
-            if (mbimex_version_major < 2)
-                fields_printable = __mbim_message_intel_firmware_update_get_printable_fields (self, line_prefix, &inner_error);
-            else if (mbimex_version_major >= 2) {
-                fields_printable = __mbim_message_intel_firmware_update_v2_get_printable_fields (self, line_prefix, &inner_error);
-                if (g_error_matches (inner_error, MBIM_CORE_ERROR, MBIM_CORE_ERROR_UNSUPPORTED)) {
-                    g_clear_error (&inner_error);
-                    fields_printable = __mbim_message_intel_firmware_update_get_printable_fields (self, line_prefix, &inner_error);
-                }
-            }
-            break;
-        case MBIM_SERVICE_QDU:
-            fields_printable = __mbim_message_qdu_get_printable_fields (self, line_prefix, &inner_error);
-            break;
-        case MBIM_SERVICE_MS_BASIC_CONNECT_EXTENSIONS:
-            if (mbimex_version_major < 2)
-                fields_printable = __mbim_message_ms_basic_connect_extensions_get_printable_fields (self, line_prefix, &inner_error);
-            else if (mbimex_version_major == 2) {
-                fields_printable = __mbim_message_ms_basic_connect_extensions_v2_get_printable_fields (self, line_prefix, &inner_error);
-                /* attempt fallback to v1 printable */
-                if (g_error_matches (inner_error, MBIM_CORE_ERROR, MBIM_CORE_ERROR_UNSUPPORTED)) {
-                    g_clear_error (&inner_error);
-                    fields_printable = __mbim_message_ms_basic_connect_extensions_get_printable_fields (self, line_prefix, &inner_error);
-                }
-            } else if (mbimex_version_major == 3) {
-                fields_printable = __mbim_message_ms_basic_connect_extensions_v3_get_printable_fields (self, line_prefix, &inner_error);
-                /* attempt fallback to v2 printable */
-                if (g_error_matches (inner_error, MBIM_CORE_ERROR, MBIM_CORE_ERROR_UNSUPPORTED)) {
-                    g_clear_error (&inner_error);
-                    fields_printable = __mbim_message_ms_basic_connect_extensions_v2_get_printable_fields (self, line_prefix, &inner_error);
-                    /* attempt fallback to v1 printable */
-                    if (g_error_matches (inner_error, MBIM_CORE_ERROR, MBIM_CORE_ERROR_UNSUPPORTED)) {
-                        g_clear_error (&inner_error);
-                        fields_printable = __mbim_message_ms_basic_connect_extensions_get_printable_fields (self, line_prefix, &inner_error);
-                    }
-                }
-             } else
-               g_assert_not_reached ();
-            break;
-        case MBIM_SERVICE_MS_UICC_LOW_LEVEL_ACCESS:
-            fields_printable = __mbim_message_ms_uicc_low_level_access_get_printable_fields (self, line_prefix, &inner_error);
-            break;
-        case MBIM_SERVICE_QUECTEL:
-            fields_printable = __mbim_message_quectel_get_printable_fields (self, line_prefix, &inner_error);
-            break;
-        case MBIM_SERVICE_INTEL_THERMAL_RF:
-            fields_printable = __mbim_message_intel_thermal_rf_get_printable_fields (self, line_prefix, &inner_error);
-            break;
-        case MBIM_SERVICE_MS_VOICE_EXTENSIONS:
-            fields_printable = __mbim_message_ms_voice_extensions_get_printable_fields (self, line_prefix, &inner_error);
-            break;
-        case MBIM_SERVICE_INTEL_MUTUAL_AUTHENTICATION:
-            fields_printable = __mbim_message_intel_mutual_authentication_get_printable_fields (self, line_prefix, &inner_error);
-            break;
-        case MBIM_SERVICE_INTEL_TOOLS:
-            fields_printable = __mbim_message_intel_tools_get_printable_fields (self, line_prefix, &inner_error);
-            break;
-        case MBIM_SERVICE_GOOGLE:
-            fields_printable = __mbim_message_google_get_printable_fields (self, line_prefix, &inner_error);
-            break;
-        case MBIM_SERVICE_INVALID:
-        case MBIM_SERVICE_LAST:
-            g_assert_not_reached ();
-        default:
-            break;
-        }
+        g_autoptr(GError) inner_error = NULL;
 
+        /* The fields header is only written if the service printer
+         * writes any field */
+        _mbim_printable_sink_set_pending (sink, g_strdup_printf ("%sFields:\n", line_prefix));
+
+        message_write_fields (self, service_read_fields, mbimex_version_major, FALSE, line_prefix, sink, &inner_error);
+
+        _mbim_printable_sink_set_pending (sink, NULL);
         if (inner_error)
-            g_string_append_printf (printable,
-                                    "%sFields: %s\n",
-                                    line_prefix, inner_error->message);
-        else if (fields_printable && fields_printable[0])
-            g_string_append_printf (printable,
-                                    "%sFields:\n"
-                                    "%s",
-                                    line_prefix, fields_printable);
+            _mbim_printable_sink_append_printf (sink,
+                                                "%sFields: %s\n",
+                                                line_prefix, inner_error->message);
+    }
+
+    return _mbim_printable_sink_finish (sink, error);
+}
+
+static gboolean
+printable_string_append (const gchar  *chunk,
+                         gsize         chunk_length,
+                         GString      *str,
+                         GError      **error)
+{
+    g_string_append_len (str, chunk, chunk_length);
+    return TRUE;
+}
+
+gchar *
+mbim_message_get_printable_full (const MbimMessage  *self,
+                                 guint8              mbimex_version_major,
+                                 guint8              mbimex_version_minor,
+                                 const gchar        *line_prefix,
+                                 gboolean            headers_only,
+                                 GError            **error)
+{
+    MbimPrintableSink  sink;
+    GString           *printable;
+
+    g_return_val_if_fail (self != NULL, NULL);
+    g_return_val_if_fail (line_prefix != NULL, NULL);
+    g_return_val_if_fail (_mbim_message_validate_internal (self, TRUE, NULL), NULL);
+
+    printable = g_string_new ("");
+    _mbim_printable_sink_init (&sink, (MbimMessagePrintableFunc)printable_string_append, printable);
+    if (!message_write_printable (self, mbimex_version_major, mbimex_version_minor, line_prefix, headers_only, &sink, error)) {
+        g_string_free (printable, TRUE);
+        return NULL;
     }
 
     return g_string_free (printable, FALSE);
 }
 
+gboolean
+mbim_message_write_printable (const MbimMessage         *self,
+                              guint8                     mbimex_version_major,
+                              guint8                     mbimex_version_minor,
+                              const gchar               *line_prefix,
+                              gboolean                   headers_only,
+                              MbimMessagePrintableFunc   func,
+                              gpointer                   user_data,
+                              GError                   **error)
+{
+    MbimPrintableSink sink;
+
+    g_return_val_if_fail (self != NULL, FALSE);
+    g_return_val_if_fail (line_prefix != NULL, FALSE);
+    g_return_val_if_fail (func != NULL, FALSE);
+    g_return_val_if_fail (_mbim_message_validate_internal (self, TRUE, NULL), FALSE);
+
+    _mbim_printable_sink_init (&sink, func, user_data);
+    return message_write_printable (self, mbimex_version_major, mbimex_version_minor, line_prefix, headers_only, &sink, error);
+}
+
+typedef struct {
+    GOutputStream *stream;
+    GCancellable  *cancellable;
+} PrintableStreamContext;
+
+static gboolean
+printable_stream_write (const gchar             *chunk,
+                        gsize                    chunk_length,
+                        PrintableStreamContext  *ctx,
+                        GError                 **error)
+{
+    return g_output_stream_write_all (ctx->stream, chunk, chunk_length, NULL, ctx->cancellable, error);
+}
+
+gboolean
+mbim_message_write_printable_to_stream (const MbimMessage  *self,
+                                        guint8              mbimex_version_major,
+                                        guint8              mbimex_version_minor,
+                                        const gchar        *line_prefix,
+                                        gboolean            headers_only,
+                                        GOutputStream      *stream,
+                                        GCancellable       *cancellable,
+                                        GError            **error)
+{
+    PrintableStreamContext ctx;
+
+    g_return_val_if_fail (G_IS_OUTPUT_STREAM (stream), FALSE);
+
+    ctx.stream = stream;
+    ctx.cancellable = cancellable;
+    return mbim_message_write_printable (self,
+                                         mbimex_version_major,
+                                         mbimex_version_minor,
+                                         line_prefix,
+                                         headers_only,
+                                         (MbimMessagePrintableFunc)printable_stream_write,
+                                         &ctx,
+                                         error);
+}
+
+/*****************************************************************************/
+
+static void
+json_write_fragment (const MbimMessage *self,
+                     MbimPrintableSink *sink)
+{
+    _mbim_printable_sink_append_printf (sink,
+                                        ",\"fragment\":{\"total\":%u,\"current\":%u}",
+                                        _mbim_message_fragment_get_total (self),
+                                        _mbim_message_fragment_get_current (self));
+}
+
+static void
+json_write_service (MbimPrintableSink *sink,
+                    MbimService        service,
+                    const MbimUuid    *service_id,
+                    guint32            cid)
+{
+    g_autofree gchar *uuid_printable = NULL;
+
+    uuid_printable = mbim_uuid_get_printable (service_id);
+    _mbim_printable_sink_append (sink, "\"service\":");
+    _mbim_json_write_string (sink, mbim_service_lookup_name (service));
+    _mbim_printable_sink_append (sink, ",\"service-id\":");
+    _mbim_json_write_string (sink, uuid_printable);
+    _mbim_printable_sink_append (sink, ",\"cid\":");
+    _mbim_json_write_enum (sink, mbim_cid_get_printable (service, cid), cid);
+}
+
+static gboolean
+message_write_json (const MbimMessage  *self,
+                    guint8              mbimex_version_major,
+                    guint8              mbimex_version_minor,
+                    MbimPrintableSink  *sink,
+                    GError            **error)
+{
+    MbimService service_read_fields = MBIM_SERVICE_INVALID;
+    MbimMessageType message_type;
+
+    if (mbimex_version_major > MBIMEX_VERSION_MAJOR_MAX) {
+        g_set_error (error, MBIM_CORE_ERROR, MBIM_CORE_ERROR_INVALID_ARGS,
+                     "MBIMEx version %x.%02x is unsupported",
+                     mbimex_version_major, mbimex_version_minor);
+        return FALSE;
+    }
+
+    message_type = MBIM_MESSAGE_GET_MESSAGE_TYPE (self);
+    _mbim_printable_sink_append (sink, "{\"header\":{\"type\":");
+    _mbim_json_write_enum (sink, mbim_message_type_get_string (message_type), message_type);
+    _mbim_printable_sink_append_printf (sink,
+                                        ",\"length\":%u,\"transaction\":%u}",
+                                        MBIM_MESSAGE_GET_MESSAGE_LENGTH (self),
+                                        MBIM_MESSAGE_GET_TRANSACTION_ID (self));
+
+    switch (message_type) {
+    case MBIM_MESSAGE_TYPE_INVALID:
+        g_warn_if_reached ();
+        break;
+
+    case MBIM_MESSAGE_TYPE_OPEN:
+        _mbim_printable_sink_append_printf (sink,
+                                            ",\"contents\":{\"max-control-transfer\":%u}",
+                                            mbim_message_open_get_max_control_transfer (self));
+        break;
+
+    case MBIM_MESSAGE_TYPE_CLOSE:
+        break;
+
+    case MBIM_MESSAGE_TYPE_OPEN_DONE:
+    case MBIM_MESSAGE_TYPE_CLOSE_DONE: {
+        MbimStatusError status;
+
+        status = (message_type == MBIM_MESSAGE_TYPE_OPEN_DONE ?
+                  mbim_message_open_done_get_status_code (self) :
+                  mbim_message_close_done_get_status_code (self));
+        _mbim_printable_sink_append (sink, ",\"contents\":{\"status-error\":");
+        _mbim_json_write_enum (sink, mbim_status_error_get_string (status), status);
+        _mbim_printable_sink_append (sink, "}");
+        break;
+    }
+
+    case MBIM_MESSAGE_TYPE_HOST_ERROR:
+    case MBIM_MESSAGE_TYPE_FUNCTION_ERROR: {
+        MbimProtocolError protocol_error;
+
+        protocol_error = mbim_message_error_get_error_status_code (self);
+        _mbim_printable_sink_append (sink, ",\"contents\":{\"error\":");
+        _mbim_json_write_enum (sink, mbim_protocol_error_get_string (protocol_error), protocol_error);
+        _mbim_printable_sink_append (sink, "}");
+        break;
+    }
+
+    case MBIM_MESSAGE_TYPE_COMMAND: {
+        MbimMessageCommandType command_type;
+
+        json_write_fragment (self, sink);
+        service_read_fields = mbim_message_command_get_service (self);
+        command_type = mbim_message_command_get_command_type (self);
+        _mbim_printable_sink_append (sink, ",\"contents\":{");
+        json_write_service (sink,
+                            service_read_fields,
+                            mbim_message_command_get_service_id (self),
+                            mbim_message_command_get_cid (self));
+        _mbim_printable_sink_append (sink, ",\"command-type\":");
+        _mbim_json_write_enum (sink, mbim_message_command_type_get_string (command_type), command_type);
+        _mbim_printable_sink_append (sink, "}");
+        break;
+    }
+
+    case MBIM_MESSAGE_TYPE_COMMAND_DONE: {
+        MbimStatusError status;
+
+        json_write_fragment (self, sink);
+        service_read_fields = mbim_message_command_done_get_service (self);
+        status = mbim_message_command_done_get_status_code (self);
+        _mbim_printable_sink_append (sink, ",\"contents\":{\"status-error\":");
+        _mbim_json_write_enum (sink, mbim_status_error_get_string (status), status);
+        _mbim_printable_sink_append (sink, ",");
+        json_write_service (sink,
+                            service_read_fields,
+                            mbim_message_command_done_get_service_id (self),
+                            mbim_message_command_done_get_cid (self));
+        _mbim_printable_sink_append (sink, "}");
+        break;
+    }
+
+    case MBIM_MESSAGE_TYPE_INDICATE_STATUS:
+        json_write_fragment (self, sink);
+        service_read_fields = mbim_message_indicate_status_get_service (self);
+        _mbim_printable_sink_append (sink, ",\"contents\":{");
+        json_write_service (sink,
+                            service_read_fields,
+                            mbim_message_indicate_status_get_service_id (self),
+                            mbim_message_indicate_status_get_cid (self));
+        _mbim_printable_sink_append (sink, "}");
+        break;
+
+    default:
+        g_assert_not_reached ();
+    }
+
+    if (service_read_fields != MBIM_SERVICE_INVALID) {
+        g_autoptr(GError) inner_error = NULL;
+
+        /* The fields object is only opened if the service writer writes
+         * any field */
+        _mbim_printable_sink_set_pending (sink, g_strdup (",\"fields\":{"));
+        message_write_fields (self, service_read_fields, mbimex_version_major, TRUE, NULL, sink, &inner_error);
+        if (!sink->pending)
+            _mbim_printable_sink_append (sink, "}");
+        _mbim_printable_sink_set_pending (sink, NULL);
+
+        if (inner_error) {
+            _mbim_printable_sink_append (sink, ",\"fields-error\":");
+            _mbim_json_write_string (sink, inner_error->message);
+        }
+    }
+
+    _mbim_printable_sink_append (sink, "}");
+    return _mbim_printable_sink_finish (sink, error);
+}
+
+gchar *
+mbim_message_get_json (const MbimMessage  *self,
+                       guint8              mbimex_version_major,
+                       guint8              mbimex_version_minor,
+                       GError            **error)
+{
+    MbimPrintableSink  sink;
+    GString           *json;
+
+    g_return_val_if_fail (self != NULL, NULL);
+    g_return_val_if_fail (_mbim_message_validate_internal (self, TRUE, NULL), NULL);
+
+    json = g_string_new ("");
+    _mbim_printable_sink_init (&sink, (MbimMessagePrintableFunc)printable_string_append, json);
+    if (!message_write_json (self, mbimex_version_major, mbimex_version_minor, &sink, error)) {
+        g_string_free (json, TRUE);
+        return NULL;
+    }
+
+    return g_string_free (json, FALSE);
+}
+
+gboolean
+mbim_message_write_json (const MbimMessage         *self,
+                         guint8                     mbimex_version_major,
+                         guint8                     mbimex_version_minor,
+                         MbimMessagePrintableFunc   func,
+                         gpointer                   user_data,
+                         GError                   **error)
+{
+    MbimPrintableSink sink;
+
+    g_return_val_if_fail (self != NULL, FALSE);
+    g_return_val_if_fail (func != NULL, FALSE);
+    g_return_val_if_fail (_mbim_message_validate_internal (self, TRUE, NULL), FALSE);
+
+    _mbim_printable_sink_init (&sink, func, user_data);
+    return message_write_json (self, mbimex_version_major, mbimex_version_minor, &sink, error);
+}
+
 /*****************************************************************************/
 /* Fragment interface */
 
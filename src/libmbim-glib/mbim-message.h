@@ -16,6 +16,7 @@
 
 #include <glib.h>
 #include <glib-object.h>
+#include <gio/gio.h>
 
 #include "mbim-uuid.h"
 #include "mbim-errors.h"
@@ -118,6 +119,58 @@ typedef enum { /*< since=1.0 >*/
 MbimMessage *mbim_message_new (const guint8 *data,
                                guint32       data_length);
 
+/**
+ * mbim_message_new_take:
+ * @data: (transfer full): contents of the message, allocated with g_malloc().
+ * @data_length: length of the message.
+ *
+ * Create a #MbimMessage taking ownership of the given contents, without
+ * copying them.
+ *
+ * After this call, @data belongs to the returned #MbimMessage and must not
+ * be modified or freed by the caller.
+ *
+ * Returns: (transfer full): a newly created #MbimMessage, which should be freed with mbim_message_unref().
+ *
+ * Since: 1.30
+ */
+MbimMessage *mbim_message_new_take (guint8  *data,
+                                    guint32  data_length);
+
+/**
+ * mbim_message_new_from_bytes:
+ * @bytes: (transfer full): a #GBytes with the contents of the message.
+ *
+ * Create a #MbimMessage with the contents of @bytes, taking ownership of the
+ * given reference.
+ *
+ * If the given reference is the last one to @bytes and its contents were
+ * allocated with g_malloc(), the memory is adopted by the new #MbimMessage
+ * without copying it; otherwise the contents are copied.
+ *
+ * Returns: (transfer full): a newly created #MbimMessage, which should be freed with mbim_message_unref().
+ *
+ * Since: 1.30
+ */
+MbimMessage *mbim_message_new_from_bytes (GBytes *bytes);
+
+/**
+ * mbim_message_get_bytes:
+ * @self: a #MbimMessage.
+ *
+ * Gets the contents of @self as a #GBytes, without copying them.
+ *
+ * The returned #GBytes keeps a reference to @self, so the message contents
+ * stay valid for as long as the #GBytes is alive. The contents must not be
+ * modified (e.g. with mbim_message_set_transaction_id()) while the #GBytes
+ * is in use.
+ *
+ * Returns: (transfer full): a #GBytes, which should be freed with g_bytes_unref().
+ *
+ * Since: 1.30
+ */
+GBytes *mbim_message_get_bytes (MbimMessage *self);
+
 /**
  * mbim_message_dup:
  * @self: a #MbimMessage to duplicate.
@@ -210,6 +263,136 @@ gchar *mbim_message_get_printable_full (const MbimMessage  *self,
                                         gboolean            headers_only,
                                         GError            **error);
 
+/**
+ * MbimMessagePrintableFunc:
+ * @chunk: a chunk of the printable contents, not NUL-terminated.
+ * @chunk_length: length of @chunk.
+ * @user_data: user data given to mbim_message_write_printable().
+ * @error: return location for error or %NULL.
+ *
+ * Callback used to receive the printable contents of a #MbimMessage in
+ * bounded chunks.
+ *
+ * Returns: %TRUE if the chunk was consumed, or %FALSE if @error is set.
+ *
+ * Since: 1.30
+ */
+typedef gboolean (* MbimMessagePrintableFunc) (const gchar  *chunk,
+                                               gsize         chunk_length,
+                                               gpointer      user_data,
+                                               GError      **error);
+
+/**
+ * mbim_message_write_printable:
+ * @self: a #MbimMessage.
+ * @mbimex_version_major: major version of the agreed MBIMEx support.
+ * @mbimex_version_minor: minor version of the agreed MBIMEx support.
+ * @line_prefix: prefix string to use in each new generated line.
+ * @headers_only: %TRUE if only basic headers should be printed.
+ * @func: (scope call): a #MbimMessagePrintableFunc to receive the printable contents.
+ * @user_data: user data to pass to @func.
+ * @error: return location for error or %NULL.
+ *
+ * Writes the same printable contents as mbim_message_get_printable_full(),
+ * but instead of building a string, passes them to @func in chunks of
+ * bounded size as they are generated.
+ *
+ * If @func fails, no more chunks are written and its error is returned.
+ *
+ * Returns: %TRUE if the whole printable contents were written, or %FALSE
+ * if @error is set.
+ *
+ * Since: 1.30
+ */
+gboolean mbim_message_write_printable (const MbimMessage         *self,
+                                       guint8                     mbimex_version_major,
+                                       guint8                     mbimex_version_minor,
+                                       const gchar               *line_prefix,
+                                       gboolean                   headers_only,
+                                       MbimMessagePrintableFunc   func,
+                                       gpointer                   user_data,
+                                       GError                   **error);
+
+/**
+ * mbim_message_write_printable_to_stream:
+ * @self: a #MbimMessage.
+ * @mbimex_version_major: major version of the agreed MBIMEx support.
+ * @mbimex_version_minor: minor version of the agreed MBIMEx support.
+ * @line_prefix: prefix string to use in each new generated line.
+ * @headers_only: %TRUE if only basic headers should be printed.
+ * @stream: a #GOutputStream.
+ * @cancellable: (nullable): optional #GCancellable object, #NULL to ignore.
+ * @error: return location for error or %NULL.
+ *
+ * Writes the same printable contents as mbim_message_get_printable_full()
+ * into @stream, in chunks of bounded size as they are generated.
+ *
+ * Returns: %TRUE if the whole printable contents were written, or %FALSE
+ * if @error is set.
+ *
+ * Since: 1.30
+ */
+gboolean mbim_message_write_printable_to_stream (const MbimMessage  *self,
+                                                 guint8              mbimex_version_major,
+                                                 guint8              mbimex_version_minor,
+                                                 const gchar        *line_prefix,
+                                                 gboolean            headers_only,
+                                                 GOutputStream      *stream,
+                                                 GCancellable       *cancellable,
+                                                 GError            **error);
+
+/**
+ * mbim_message_get_json:
+ * @self: a #MbimMessage.
+ * @mbimex_version_major: major version of the agreed MBIMEx support.
+ * @mbimex_version_minor: minor version of the agreed MBIMEx support.
+ * @error: return location for error or %NULL.
+ *
+ * Gets a JSON object representing the contents of the whole message.
+ *
+ * The object contains a "header" member, the "fragment" and "contents"
+ * members where applicable, and a "fields" member with all the known fields
+ * of the message keyed by the field name used in the MBIM specification.
+ * Enumerations are given by nickname, flags as a mask string, byte arrays as
+ * colon-separated hexadecimal strings and structs as nested objects. A field
+ * that cannot be read is given as null, the fields after it are skipped, and
+ * the error is given in a "fields-error" member.
+ *
+ * Returns: a newly allocated string, which should be freed with g_free(), or
+ * %NULL if @error is set.
+ *
+ * Since: 1.30
+ */
+gchar *mbim_message_get_json (const MbimMessage  *self,
+                              guint8              mbimex_version_major,
+                              guint8              mbimex_version_minor,
+                              GError            **error);
+
+/**
+ * mbim_message_write_json:
+ * @self: a #MbimMessage.
+ * @mbimex_version_major: major version of the agreed MBIMEx support.
+ * @mbimex_version_minor: minor version of the agreed MBIMEx support.
+ * @func: (scope call): a #MbimMessagePrintableFunc.
+ * @user_data: (closure): data to pass to @func.
+ * @error: return location for error or %NULL.
+ *
+ * Writes the same JSON contents as mbim_message_get_json() through @func,
+ * in chunks of bounded size as they are generated, without building the
+ * whole string in memory.
+ *
+ * Returns: %TRUE if the whole JSON contents were written, or %FALSE if
+ * @error is set.
+ *
+ * Since: 1.30
+ */
+gboolean mbim_message_write_json (const MbimMessage         *self,
+                                  guint8                     mbimex_version_major,
+                                  guint8                     mbimex_version_minor,
+                                  MbimMessagePrintableFunc   func,
+                                  gpointer                   user_data,
+                                  GError                   **error);
+
 /**
  * mbim_message_get_raw:
  * @self: a #MbimMessage.
@@ -0,0 +1,182 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * libmbim-glib -- GLib/GIO based library to control MBIM devices
+ *
+ * This is a private non-installed header
+ */
+
+#ifndef _LIBMBIM_GLIB_MBIM_PROBES_PRIVATE_H_
+#define _LIBMBIM_GLIB_MBIM_PROBES_PRIVATE_H_
+
+#if !defined (LIBMBIM_GLIB_COMPILATION)
+#error "This is a private header!!"
+#endif
+
+#include <string.h>
+#include <glib.h>
+
+#include "mbim-message.h"
+
+G_BEGIN_DECLS
+
+/*****************************************************************************/
+/* USDT static tracepoints
+ *
+ * When built with -Dusdt=true, the probes below are compiled into the library
+ * under the "libmbim" provider and can be attached to with e.g.:
+ *
+ *   bpftrace -e 'usdt:/usr/lib/libmbim-glib.so.4:libmbim:message__receive { ... }'
+ *
+ * The probes are single no-op instructions until a tracer attaches, but
+ * their arguments are still evaluated, so they must stay cheap to compute
+ * (no allocations, no lookups). When disabled at build time, the probes
+ * expand to nothing and their arguments are never evaluated.
+ *
+ * Service UUIDs are given as a pointer to the raw 16 bytes in the message
+ * (or NULL if the message has no service), to avoid any lookup in the hot
+ * path. Timestamps are g_get_monotonic_time() values in microseconds.
+ */
+
+#ifdef HAVE_USDT
+
+#include <sys/sdt.h>
+
+/* Offsets of the service UUID and CID fields in the raw COMMAND,
+ * COMMAND_DONE and INDICATE_STATUS messages, right after the message
+ * header and the fragment header. */
+#define MBIM_PROBE_SERVICE_OFFSET 20
+#define MBIM_PROBE_CID_OFFSET     36
+
+static inline gboolean
+mbim_probe_message_has_service (const MbimMessage *message)
+{
+    const GByteArray *array = (const GByteArray *) message;
+    guint32           type;
+    guint32           current;
+
+    if (array->len < MBIM_PROBE_CID_OFFSET + 4)
+        return FALSE;
+
+    type = GUINT32_FROM_LE (((const guint32 *) array->data)[0]);
+    if (type != MBIM_MESSAGE_TYPE_COMMAND &&
+        type != MBIM_MESSAGE_TYPE_COMMAND_DONE &&
+        type != MBIM_MESSAGE_TYPE_INDICATE_STATUS)
+        return FALSE;
+
+    /* Only the first fragment carries the service and CID */
+    current = GUINT32_FROM_LE (((const guint32 *) array->data)[4]);
+    return (current == 0);
+}
+
+static inline const guint8 *
+mbim_probe_message_service (const MbimMessage *message)
+{
+    if (!mbim_probe_message_has_service (message))
+        return NULL;
+    return &((const GByteArray *) message)->data[MBIM_PROBE_SERVICE_OFFSET];
+}
+
+static inline guint32
+mbim_probe_message_cid (const MbimMessage *message)
+{
+    guint32 cid;
+
+    if (!mbim_probe_message_has_service (message))
+        return 0;
+    memcpy (&cid, &((const GByteArray *) message)->data[MBIM_PROBE_CID_OFFSET], sizeof (cid));
+    return GUINT32_FROM_LE (cid);
+}
+
+static inline guint32
+mbim_probe_message_type (const MbimMessage *message)
+{
+    return GUINT32_FROM_LE (((const guint32 *) ((const GByteArray *) message)->data)[0]);
+}
+
+static inline guint32
+mbim_probe_message_transaction_id (const MbimMessage *message)
+{
+    return GUINT32_FROM_LE (((const guint32 *) ((const GByteArray *) message)->data)[2]);
+}
+
+/* The DTRACE_PROBEn macros have a fixed number of arguments, counted before
+ * any of them is expanded; forwarding through a variadic macro lets
+ * MBIM_PROBE_MESSAGE_ARGS() expand into several arguments first. */
+#define MBIM_PROBE6(...) DTRACE_PROBE6 (__VA_ARGS__)
+
+#define MBIM_PROBE_MESSAGE_ARGS(message)                \
+    mbim_probe_message_type (message),                  \
+    mbim_probe_message_transaction_id (message),        \
+    mbim_probe_message_service (message),               \
+    mbim_probe_message_cid (message),                   \
+    ((const GByteArray *) (message))->len
+
+/* message__receive (path, type, transaction id, service, cid, length) */
+#define MBIM_PROBE_MESSAGE_RECEIVE(path, message)                       \
+    MBIM_PROBE6 (libmbim, message__receive, path, MBIM_PROBE_MESSAGE_ARGS (message))
+
+/* message__send (path, type, transaction id, service, cid, length) */
+#define MBIM_PROBE_MESSAGE_SEND(path, message)                          \
+    MBIM_PROBE6 (libmbim, message__send, path, MBIM_PROBE_MESSAGE_ARGS (message))
+
+/* fragment__receive (path, transaction id, current, total, length) */
+#define MBIM_PROBE_FRAGMENT_RECEIVE(path, message, current, total)      \
+    DTRACE_PROBE5 (libmbim, fragment__receive, path,                    \
+                   mbim_probe_message_transaction_id (message),         \
+                   current, total,                                      \
+                   ((const GByteArray *) (message))->len)
+
+/* transaction__store (path, transaction type, transaction id, message type, timeout ms) */
+#define MBIM_PROBE_TRANSACTION_STORE(path, transaction_type, transaction_id, message_type, timeout_ms) \
+    DTRACE_PROBE5 (libmbim, transaction__store, path, transaction_type, transaction_id, message_type, timeout_ms)
+
+/* transaction__release (path, transaction type, transaction id, message type, tx time) */
+#define MBIM_PROBE_TRANSACTION_RELEASE(path, transaction_type, transaction_id, message_type, tx_time) \
+    DTRACE_PROBE5 (libmbim, transaction__release, path, transaction_type, transaction_id, message_type, tx_time)
+
+/* transaction__timeout (path, transaction id, fragmented, tx time, now) */
+#define MBIM_PROBE_TRANSACTION_TIMEOUT(path, transaction_id, fragmented, tx_time) \
+    DTRACE_PROBE5 (libmbim, transaction__timeout, path, transaction_id, fragmented, tx_time, g_get_monotonic_time ())
+
+/* indication__emit (path, transaction id, service, cid, length, rx time) */
+#define MBIM_PROBE_INDICATION_EMIT(path, message, rx_time)              \
+    DTRACE_PROBE6 (libmbim, indication__emit, path,                     \
+                   mbim_probe_message_transaction_id (message),         \
+                   mbim_probe_message_service (message),                \
+                   mbim_probe_message_cid (message),                    \
+                   ((const GByteArray *) (message))->len,               \
+                   rx_time)
+
+/* proxy__forward (client id, client transaction id, service, cid, length, queue wait us) */
+#define MBIM_PROBE_PROXY_FORWARD(client_id, transaction_id, message, queue_wait) \
+    DTRACE_PROBE6 (libmbim, proxy__forward, client_id, transaction_id,  \
+                   mbim_probe_message_service (message),                \
+                   mbim_probe_message_cid (message),                    \
+                   ((const GByteArray *) (message))->len,               \
+                   queue_wait)
+
+/* proxy__complete (client id, client transaction id, response type, length, device latency us) */
+#define MBIM_PROBE_PROXY_COMPLETE(client_id, transaction_id, response, latency) \
+    DTRACE_PROBE5 (libmbim, proxy__complete, client_id, transaction_id, \
+                   (response) ? mbim_probe_message_type (response) : 0, \
+                   (response) ? ((const GByteArray *) (response))->len : 0, \
+                   latency)
+
+#else
+
+#define MBIM_PROBE_MESSAGE_RECEIVE(path, message) do {} while (0)
+#define MBIM_PROBE_MESSAGE_SEND(path, message) do {} while (0)
+#define MBIM_PROBE_FRAGMENT_RECEIVE(path, message, current, total) do {} while (0)
+#define MBIM_PROBE_TRANSACTION_STORE(path, transaction_type, transaction_id, message_type, timeout_ms) do {} while (0)
+#define MBIM_PROBE_TRANSACTION_RELEASE(path, transaction_type, transaction_id, message_type, tx_time) do {} while (0)
+#define MBIM_PROBE_TRANSACTION_TIMEOUT(path, transaction_id, fragmented, tx_time) do {} while (0)
+#define MBIM_PROBE_INDICATION_EMIT(path, message, rx_time) do {} while (0)
+#define MBIM_PROBE_PROXY_FORWARD(client_id, transaction_id, message, queue_wait) do {} while (0)
+#define MBIM_PROBE_PROXY_COMPLETE(client_id, transaction_id, response, latency) do {} while (0)
+
+#endif /* HAVE_USDT */
+
+G_END_DECLS
+
+#endif /* _LIBMBIM_GLIB_MBIM_PROBES_PRIVATE_H_ */
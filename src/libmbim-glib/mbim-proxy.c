@@ -12,17 +12,21 @@
 #include <sys/file.h>
 #include <sys/types.h>
 #include <errno.h>
+#include <unistd.h>
 
 #include <glib.h>
 #include <glib/gstdio.h>
 #include <gio/gunixsocketaddress.h>
+#include <gio/gunixfdmessage.h>
 
 #include "config.h"
 #include "mbim-device.h"
+#include "mbim-device-private.h"
 #include "mbim-utils.h"
 #include "mbim-helpers.h"
 #include "mbim-proxy.h"
 #include "mbim-message-private.h"
+#include "mbim-probes-private.h"
 #include "mbim-cid.h"
 #include "mbim-enum-types.h"
 #include "mbim-error-types.h"
@@ -34,6 +38,12 @@
  * firmware upgrade, and the BUFFER_SIZE should be at least equal
  * to MAX_CONTROL_TRANSFER which defined in mbim-device.c, which
  * will bring better performance in such case.
+ *
+ * Client input is read directly into a per-client chunk of (at least) this
+ * size. A chunk holding exactly one complete message is shrunk to the message
+ * length and handed over as the message itself; messages sent back to back in
+ * the same chunk are copied once. The chunk is released once all its messages
+ * are parsed, so clients only keep one while a message is partially received.
  */
 #define BUFFER_SIZE 4096
 
@@ -41,51 +51,215 @@
  * MBIMEx version, if any */
 #define MBIM_DEVICE_PROXY_CONTROL_VERSION "mbim-device-proxy-control-version"
 
+/* Default maximum amount of bytes pending to be written to a single client */
+#define CLIENT_QUEUE_MAX_SIZE_DEFAULT (1024 * 1024)
+
+/* Default maximum amount of requests forwarded to a single device and not yet
+ * completed, none; if a limit is set, the remaining ones are queued and
+ * dispatched fairly among clients */
+#define DEVICE_MAX_IN_FLIGHT_DEFAULT 0
+
+/* Default minimum time requests are kept in flight in the device; clients may
+ * configure a longer one */
+#define REQUEST_TIMEOUT_DEFAULT 300
+
+/* Handoff to a new proxy process: how often and for how long to wait for the
+ * devices to be idle, and the timeout of each transfer operation */
+#define HANDOFF_QUIESCE_CHECK_MS    10
+#define HANDOFF_QUIESCE_TIMEOUT_MS  5000
+#define HANDOFF_SOCKET_TIMEOUT_SECS 10
+
 G_DEFINE_TYPE (MbimProxy, mbim_proxy, G_TYPE_OBJECT)
 
 enum {
     PROP_0,
     PROP_N_CLIENTS,
     PROP_N_DEVICES,
+    PROP_CLIENT_QUEUE_MAX_SIZE,
+    PROP_CLIENT_QUEUE_DROP_INDICATIONS,
+    PROP_DEVICE_MAX_IN_FLIGHT,
+    PROP_QUERY_CACHE_TTL,
+    PROP_INDICATION_REPLAY,
+    PROP_REQUEST_TIMEOUT,
+    PROP_DEVICE_THREADS,
+    PROP_HANDOFF,
     PROP_LAST
 };
 
 static GParamSpec *properties[PROP_LAST];
 
+enum {
+    SIGNAL_HANDED_OFF,
+    SIGNAL_LAST
+};
+
+static guint signals[SIGNAL_LAST] = { 0 };
+
 struct _MbimProxyPrivate {
-    /* Unix socket service */
+    /* Unix socket service, and its listening socket */
     GSocketService *socket_service;
+    GSocket        *socket;
+
+    /* Last client id given */
+    gulong          client_id;
 
-    /* Clients */
-    GList *clients;
+    /* Clients, indexed by id */
+    GHashTable *clients;
 
     /* Devices */
     GList *devices;
     GList *opening_devices;
+
+    /* Client output queue limits */
+    guint    client_queue_max_size;
+    gboolean client_queue_drop_indications;
+
+    /* Request scheduling */
+    guint       device_max_in_flight;
+    GHashTable *client_quotas;
+
+    /* Query response cache lifetime, in ms */
+    guint       query_cache_ttl;
+
+    /* Replay last indications to new subscribers */
+    gboolean    indication_replay;
+
+    /* Minimum request timeout, in seconds */
+    guint       request_timeout;
+
+    /* Device threads, indexed by device path, and the ones of untracked
+     * devices waiting to be stopped from the main thread */
+    gboolean      device_threads;
+    GHashTable   *workers;
+    GList        *stopping_workers;
+    GMainContext *context;
+
+    /* Protects the state handled in the main thread */
+    GRecMutex   lock;
+
+    /* Protects the tables shared by all threads */
+    GMutex      tables_lock;
+
+    /* Handoff to a new proxy process */
+    gboolean           handoff;
+    GSocketService    *handoff_service;
+    GSocketConnection *handoff_connection;
+    GSource           *handoff_source;
+    gint64             handoff_start;
 };
 
+typedef struct {
+    guint max_in_flight;
+    guint weight;
+} ClientQuota;
+
 static void        track_device         (MbimProxy *self, MbimDevice *device);
 static void        untrack_device       (MbimProxy *self, MbimDevice *device);
 static MbimDevice *peek_device_for_path (MbimProxy *self, const gchar *path);
+static GList      *peek_device_clients  (MbimDevice *device);
+static GPtrArray  *client_collect_last_indications (Client *client);
+static void        device_statistics_request  (MbimDevice *device);
+static void        device_statistics_response (MbimDevice *device, MbimMessage *response, gint64 latency);
+
+/*****************************************************************************/
+/* Proxy lock
+ *
+ * With device threads, each device and its clients are handled in the thread
+ * of the device, while new clients are accepted in the main one. Each thread
+ * has its own recursive lock protecting the state it handles, taken in each
+ * entry point (socket sources and device callbacks); MbimDevice I/O and
+ * message reassembly run without it. Device threads never take the lock of
+ * any other thread, so the main one may take the lock of any device while
+ * holding its own, e.g. to collect statistics.
+ *
+ * The clients, devices, opening devices, workers and quotas tables are shared
+ * by all threads, and protected by a separate lock which is only held while
+ * accessing them, never when taking any other lock or emitting signals. */
+
+static GPrivate thread_lock = G_PRIVATE_INIT (NULL);
+
+/* The lock of the current thread */
+static GRecMutex *
+proxy_peek_lock (MbimProxy *self)
+{
+    GRecMutex *lock;
+
+    lock = g_private_get (&thread_lock);
+    return lock ? lock : &self->priv->lock;
+}
+
+typedef struct {
+    MbimProxy *self;
+    GRecMutex *lock;
+} ProxyLocker;
+
+static ProxyLocker *
+proxy_locker_new (MbimProxy *self)
+{
+    ProxyLocker *locker;
+
+    locker = g_slice_new (ProxyLocker);
+    locker->self = g_object_ref (self);
+    locker->lock = proxy_peek_lock (self);
+    g_rec_mutex_lock (locker->lock);
+    return locker;
+}
+
+static void
+proxy_locker_free (ProxyLocker *locker)
+{
+    g_rec_mutex_unlock (locker->lock);
+    g_object_unref (locker->self);
+    g_slice_free (ProxyLocker, locker);
+}
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (ProxyLocker, proxy_locker_free)
 
 /*****************************************************************************/
 
 guint
 mbim_proxy_get_n_clients (MbimProxy *self)
 {
+    g_autoptr(GMutexLocker) locker = NULL;
+
     g_return_val_if_fail (MBIM_IS_PROXY (self), 0);
 
-    return g_list_length (self->priv->clients);
+    locker = g_mutex_locker_new (&self->priv->tables_lock);
+    return g_hash_table_size (self->priv->clients);
 }
 
 guint
 mbim_proxy_get_n_devices (MbimProxy *self)
 {
+    g_autoptr(GMutexLocker) locker = NULL;
+
     g_return_val_if_fail (MBIM_IS_PROXY (self), 0);
 
+    locker = g_mutex_locker_new (&self->priv->tables_lock);
     return g_list_length (self->priv->devices);
 }
 
+void
+mbim_proxy_set_client_quota (MbimProxy *self,
+                             guint      uid,
+                             guint      max_in_flight,
+                             guint      weight)
+{
+    g_autoptr(GMutexLocker)  locker = NULL;
+    ClientQuota             *quota;
+
+    g_return_if_fail (MBIM_IS_PROXY (self));
+    g_return_if_fail (weight > 0);
+
+    locker = g_mutex_locker_new (&self->priv->tables_lock);
+
+    /* Applies to the clients connected afterwards */
+    quota = g_slice_new (ClientQuota);
+    quota->max_in_flight = max_in_flight;
+    quota->weight = weight;
+    g_hash_table_replace (self->priv->client_quotas, GUINT_TO_POINTER (uid), quota);
+}
+
 /*****************************************************************************/
 /* Client info */
 
@@ -94,15 +268,61 @@ typedef struct {
     gulong        id;
 
     MbimProxy *self; /* not full ref */
+    uid_t uid;
     GSocketConnection *connection;
     GSource *connection_readable_source;
     GByteArray *buffer;
+    guint buffer_offset;
+
+    /* Where the client sources are attached, and the lock protecting the
+     * client; the ones of the device thread once handed off */
+    GMainContext *context;
+    GRecMutex *lock;
+
+    /* Messages pending to be written, drained when the socket is writable */
+    GQueue output_queue;
+    gsize output_queue_size;
+    gsize output_offset;
+    GSource *connection_writable_source;
+    GSource *untrack_source;
+
+    /* Output queue metrics */
+    gsize output_queue_peak;
+    guint64 output_bytes_sent;
+    guint output_messages_sent;
+    guint output_indications_dropped;
 
     /* Only one proxy config allowed at a time */
     gboolean config_ongoing;
 
+    /* Timeout configured by the client, in seconds */
+    guint32 timeout_secs;
+
+    /* Requests forwarded to the device, cancelled on disconnection */
+    GQueue in_flight_requests;
+
+    /* Requests waiting to be dispatched to the device, and quota */
+    GQueue pending_requests;
+    GList *scheduler_link; /* in the list of clients of the device with requests to dispatch */
+    guint in_flight;
+    guint max_in_flight;
+    guint weight;
+    guint deficit;
+
+    /* Scheduling metrics */
+    guint requests_dispatched;
+    gint64 queue_wait_total;
+    gint64 queue_wait_max;
+
+    /* Statistics */
+    guint64 requests_received;
+    guint64 responses_sent;
+    guint64 indications_forwarded;
+    guint64 input_bytes;
+    guint64 input_bytes_copied;
+
     MbimDevice *device;
-    guint indication_id;
+    GList *device_link; /* in the list of clients of the device */
     MbimEventEntry **mbim_event_entry_array;
     gsize mbim_event_entry_array_size;
 } Client;
@@ -110,10 +330,38 @@ typedef struct {
 static gboolean connection_readable_cb (GSocket *socket, GIOCondition condition, Client *client);
 static void     track_client           (MbimProxy *self, Client *client);
 static void     untrack_client         (MbimProxy *self, Client *client);
+static void     client_route           (Client *client);
+static void     client_unroute         (Client *client);
+static void     client_device_link     (Client *client);
+static void     client_device_unlink   (Client *client);
+static void     client_unschedule      (Client *client);
+static void     client_cancel_in_flight_requests (Client *client);
+static void     client_discard_query_followers   (Client *client);
+static gboolean client_hand_off        (Client *client, const gchar *path, MbimMessage *message);
+
+static void
+client_output_queue_clear (Client *client)
+{
+    if (client->connection_writable_source) {
+        g_source_destroy (client->connection_writable_source);
+        g_source_unref (client->connection_writable_source);
+        client->connection_writable_source = NULL;
+    }
+
+    g_queue_foreach (&client->output_queue, (GFunc) mbim_message_unref, NULL);
+    g_queue_clear (&client->output_queue);
+    client->output_queue_size = 0;
+    client->output_offset = 0;
+}
 
 static void
 client_disconnect (Client *client)
 {
+    client_unschedule (client);
+    client_discard_query_followers (client);
+    client_cancel_in_flight_requests (client);
+    client_device_unlink (client);
+    client_unroute (client);
     g_clear_pointer (&client->mbim_event_entry_array, mbim_event_entry_array_free);
     client->mbim_event_entry_array_size = 0;
 
@@ -124,43 +372,50 @@ client_disconnect (Client *client)
     }
 
     if (client->connection) {
-        g_debug ("[client %lu] connection closed", client->id);
+        if (client->output_queue_size > 0)
+            g_debug ("[client %lu] discarding %" G_GSIZE_FORMAT " pending output bytes",
+                     client->id, client->output_queue_size);
+        client_output_queue_clear (client);
+
+        g_debug ("[client %lu] connection closed (output: %u messages, %" G_GUINT64_FORMAT " bytes, "
+                 "%u indications dropped, queue peak %" G_GSIZE_FORMAT " bytes)",
+                 client->id, client->output_messages_sent, client->output_bytes_sent,
+                 client->output_indications_dropped, client->output_queue_peak);
+        if (client->requests_dispatched > 0)
+            g_debug ("[client %lu] %u requests dispatched (queue wait: average %.1f ms, max %.1f ms)",
+                     client->id, client->requests_dispatched,
+                     (gdouble) client->queue_wait_total / client->requests_dispatched / 1000.0,
+                     (gdouble) client->queue_wait_max / 1000.0);
         g_output_stream_close (g_io_stream_get_output_stream (G_IO_STREAM (client->connection)), NULL, NULL);
         g_object_unref (client->connection);
         client->connection = NULL;
     }
 }
 
-static void client_indication_cb (MbimDevice *device,
-                                  MbimMessage *message,
-                                  Client *client);
-
 static void
 client_set_device (Client *client,
                    MbimDevice *device)
 {
     if (client->device) {
-        if (g_signal_handler_is_connected (client->device, client->indication_id))
-            g_signal_handler_disconnect (client->device, client->indication_id);
+        client_device_unlink (client);
+        client_unroute (client);
         g_object_unref (client->device);
     }
 
     if (device) {
         client->device = g_object_ref (device);
-        client->indication_id = g_signal_connect (client->device,
-                                                  MBIM_DEVICE_SIGNAL_INDICATE_STATUS,
-                                                  G_CALLBACK (client_indication_cb),
-                                                  client);
-    } else {
+        client_device_link (client);
+        client_route (client);
+    } else
         client->device = NULL;
-        client->indication_id = 0;
-    }
 }
 
 static void
 client_unref (Client *client)
 {
     if (g_atomic_int_dec_and_test (&client->ref_count)) {
+        g_assert (!client->untrack_source);
+
         /* Ensure disconnected */
         client_disconnect (client);
         /* Reset device */
@@ -172,6 +427,9 @@ client_unref (Client *client)
         if (client->mbim_event_entry_array)
             mbim_event_entry_array_free (client->mbim_event_entry_array);
 
+        if (client->context)
+            g_main_context_unref (client->context);
+
         g_slice_free (Client, client);
     }
 }
@@ -183,11 +441,124 @@ client_ref (Client *client)
     return client;
 }
 
+static gboolean
+client_untrack_idle (Client *client)
+{
+    g_autoptr(ProxyLocker) locker = proxy_locker_new (client->self);
+
+    /* the source is being dispatched, don't let untrack_client() remove it */
+    g_clear_pointer (&client->untrack_source, g_source_unref);
+    untrack_client (client->self, client);
+    return G_SOURCE_REMOVE;
+}
+
+/* Untracking the client right away may not be safe while the caller is
+ * iterating the list of clients, so defer it */
+static void
+client_schedule_untrack (Client *client)
+{
+    client_disconnect (client);
+    if (!client->untrack_source) {
+        client->untrack_source = g_idle_source_new ();
+        g_source_set_callback (client->untrack_source,
+                               (GSourceFunc) client_untrack_idle,
+                               client_ref (client),
+                               (GDestroyNotify) client_unref);
+        g_source_attach (client->untrack_source, client->context);
+    }
+}
+
+static gboolean connection_writable_cb (GSocket *socket, GIOCondition condition, Client *client);
+
+static gboolean
+client_output_queue_flush (Client  *client,
+                           GError **error)
+{
+    GSocket     *socket;
+    MbimMessage *message;
+
+    socket = g_socket_connection_get_socket (client->connection);
+
+    while ((message = g_queue_peek_head (&client->output_queue)) != NULL) {
+        g_autoptr(GError) inner_error = NULL;
+        gssize            written;
+
+        written = g_socket_send_with_blocking (socket,
+                                               (const gchar *) &message->data[client->output_offset],
+                                               message->len - client->output_offset,
+                                               FALSE,
+                                               NULL,
+                                               &inner_error);
+        if (written < 0) {
+            if (g_error_matches (inner_error, G_IO_ERROR, G_IO_ERROR_WOULD_BLOCK))
+                break;
+            g_propagate_error (error, g_steal_pointer (&inner_error));
+            return FALSE;
+        }
+
+        client->output_offset += written;
+        client->output_queue_size -= written;
+        client->output_bytes_sent += written;
+        if (client->output_offset < message->len)
+            continue;
+
+        /* Full message written */
+        g_queue_pop_head (&client->output_queue);
+        mbim_message_unref (message);
+        client->output_offset = 0;
+        client->output_messages_sent++;
+    }
+
+    if (g_queue_is_empty (&client->output_queue)) {
+        if (client->connection_writable_source) {
+            g_source_destroy (client->connection_writable_source);
+            g_source_unref (client->connection_writable_source);
+            client->connection_writable_source = NULL;
+        }
+        return TRUE;
+    }
+
+    /* Wait until the socket is writable again */
+    if (!client->connection_writable_source) {
+        client->connection_writable_source = g_socket_create_source (socket, G_IO_OUT, NULL);
+        g_source_set_callback (client->connection_writable_source,
+                               (GSourceFunc) connection_writable_cb,
+                               client,
+                               NULL);
+        g_source_attach (client->connection_writable_source, client->context);
+    }
+    return TRUE;
+}
+
+static gboolean
+connection_writable_cb (GSocket      *socket,
+                        GIOCondition  condition,
+                        Client       *client)
+{
+    g_autoptr(ProxyLocker) locker = proxy_locker_new (client->self);
+    g_autoptr(GError)      error = NULL;
+
+    if (condition & G_IO_HUP || condition & G_IO_ERR) {
+        untrack_client (client->self, client);
+        return G_SOURCE_REMOVE;
+    }
+
+    if (!client_output_queue_flush (client, &error)) {
+        g_warning ("[client %lu] couldn't write to client: %s", client->id, error->message);
+        untrack_client (client->self, client);
+        return G_SOURCE_REMOVE;
+    }
+
+    return G_SOURCE_CONTINUE;
+}
+
 static gboolean
 client_send_message (Client       *client,
                      MbimMessage  *message,
                      GError      **error)
 {
+    MbimProxyPrivate *priv;
+
     if (!client->connection) {
         g_set_error (error,
                      MBIM_CORE_ERROR,
@@ -196,12 +567,38 @@ client_send_message (Client       *client,
         return FALSE;
     }
 
-    if (!g_output_stream_write_all (g_io_stream_get_output_stream (G_IO_STREAM (client->connection)),
-                                    message->data,
-                                    message->len,
-                                    NULL, /* bytes_written */
-                                    NULL, /* cancellable */
-                                    error)) {
+    /* A single message bigger than the limit is allowed if nothing else is
+     * pending, otherwise it could never be sent */
+    priv = client->self->priv;
+    if (priv->client_queue_max_size > 0 &&
+        client->output_queue_size > 0 &&
+        client->output_queue_size + message->len > priv->client_queue_max_size) {
+        if (priv->client_queue_drop_indications &&
+            mbim_message_get_message_type (message) == MBIM_MESSAGE_TYPE_INDICATE_STATUS) {
+            client->output_indications_dropped++;
+            g_debug ("[client %lu] output queue full: indication dropped", client->id);
+            return TRUE;
+        }
+
+        g_set_error (error,
+                     MBIM_CORE_ERROR,
+                     MBIM_CORE_ERROR_FAILED,
+                     "Cannot send message to client: output queue full (%" G_GSIZE_FORMAT " bytes pending)",
+                     client->output_queue_size);
+        client_schedule_untrack (client);
+        return FALSE;
+    }
+
+    g_queue_push_tail (&client->output_queue, mbim_message_ref (message));
+    client->output_queue_size += message->len;
+    client->output_queue_peak = MAX (client->output_queue_peak, client->output_queue_size);
+
+    /* If other messages were already pending, the writable source will take
+     * care of this one as well */
+    if (client->connection_writable_source)
+        return TRUE;
+
+    if (!client_output_queue_flush (client, error)) {
         g_prefix_error (error, "Cannot send message to client: ");
         return FALSE;
     }
@@ -216,7 +613,9 @@ static void
 track_client (MbimProxy *self,
               Client *client)
 {
-    self->priv->clients = g_list_append (self->priv->clients, client_ref (client));
+    g_mutex_lock (&self->priv->tables_lock);
+    g_hash_table_insert (self->priv->clients, GSIZE_TO_POINTER (client->id), client_ref (client));
+    g_mutex_unlock (&self->priv->tables_lock);
     g_object_notify_by_pspec (G_OBJECT (self), properties[PROP_N_CLIENTS]);
 }
 
@@ -224,13 +623,50 @@ static void
 untrack_client (MbimProxy *self,
                 Client *client)
 {
+    gboolean removed = FALSE;
+
+    /* The deferred untrack may hold the last reference other than ours */
+    client_ref (client);
+
+    if (client->untrack_source) {
+        g_source_destroy (client->untrack_source);
+        g_clear_pointer (&client->untrack_source, g_source_unref);
+    }
+
     /* Disconnect the client explicitly when untracking */
     client_disconnect (client);
 
-    if (g_list_find (self->priv->clients, client)) {
-        self->priv->clients = g_list_remove (self->priv->clients, client);
-        client_unref (client);
+    g_mutex_lock (&self->priv->tables_lock);
+    if (g_hash_table_lookup (self->priv->clients, GSIZE_TO_POINTER (client->id)) == client) {
+        g_hash_table_remove (self->priv->clients, GSIZE_TO_POINTER (client->id));
+        removed = TRUE;
+    }
+    g_mutex_unlock (&self->priv->tables_lock);
+
+    if (removed)
         g_object_notify_by_pspec (G_OBJECT (self), properties[PROP_N_CLIENTS]);
+
+    client_unref (client);
+}
+
+/* Takes the lock of the thread handling the client, from any other thread.
+ * The client is only handed off from its current thread, so the lock stays
+ * valid once taken if it didn't change meanwhile */
+static GRecMutex *
+client_lock (Client *client)
+{
+    MbimProxy *self = client->self;
+    GRecMutex *lock;
+
+    while (TRUE) {
+        g_mutex_lock (&self->priv->tables_lock);
+        lock = client->lock;
+        g_mutex_unlock (&self->priv->tables_lock);
+
+        g_rec_mutex_lock (lock);
+        if (client->lock == lock)
+            return lock;
+        g_rec_mutex_unlock (lock);
     }
 }
 
@@ -242,51 +678,13 @@ forward_indication (Client      *client,
                     MbimMessage *message)
 {
     g_autoptr(GError) error = NULL;
+    guint             dropped;
 
+    dropped = client->output_indications_dropped;
     if (!client_send_message (client, message, &error))
         g_warning ("[client %lu] couldn't forward indication: %s", client->id, error->message);
-}
-
-static void
-client_indication_cb (MbimDevice *device,
-                      MbimMessage *message,
-                      Client *client)
-{
-    MbimEventEntry *entry;
-    guint           i;
-
-    /* if client doesn't have a subscribe list, we're done. */
-    if (!client->mbim_event_entry_array)
-        return;
-
-    /* Look for the event list associated to the service */
-    entry = NULL;
-    for (i = 0; i < client->mbim_event_entry_array_size; i++) {
-        if (mbim_uuid_cmp (mbim_message_indicate_status_get_service_id (message),
-                           &client->mbim_event_entry_array[i]->device_service_id)) {
-            entry = client->mbim_event_entry_array[i];
-            break;
-        }
-    }
-
-    /* if client didn't subscribe to anything in this service, we're done */
-    if (!entry)
-        return;
-
-    /* if client subscribed using the wildcard, no need to match specific cid */
-    if (entry->cids_count == 0) {
-        forward_indication (client, message);
-        return;
-    }
-
-    /* Look for the specific cid in the event list */
-    for (i = 0; i < entry->cids_count; i++) {
-        if (mbim_message_indicate_status_get_cid (message) == entry->cids[i]) {
-            /* exact match in the subscription */
-            forward_indication (client, message);
-            return;
-        }
-    }
+    else if (dropped == client->output_indications_dropped)
+        client->indications_forwarded++;
 }
 
 /*****************************************************************************/
@@ -300,11 +698,35 @@ typedef struct {
     guint32 original_transaction_id;
     /* Only used in proxy config */
     guint32 timeout_secs;
+    /* Only used in scheduled requests */
+    gint64 queued_time;
+    MbimDevice *device;
+    /* Only used in requests forwarded to the device */
+    gint64 dispatch_time;
+    /* Only used in queries other clients may be waiting for */
+    struct _QueryCacheEntry *query_cache_entry;
+    GError *error; /* if completed without response */
+    /* Only used in service subscribe list updates */
+    GPtrArray *replay_indications;
+    /* Only used in requests forwarded to the device */
+    GCancellable *cancellable;
+    GList *in_flight_link; /* in the list of requests in flight of the client */
 } Request;
 
+static void     request_schedule             (Request *request);
+static void     request_dispatch_done        (Request *request);
+static gboolean request_query_cache_process  (Request *request);
+static void     request_query_cache_complete (Request *request);
+static void     request_query_cache_set_done (Request    *request,
+                                              MbimDevice *device);
+
 static void
 request_complete_and_free (Request *request)
 {
+    /* Complete the queries of other clients waiting for this one */
+    if (request->query_cache_entry)
+        request_query_cache_complete (request);
+
     if (request->response) {
         g_autoptr(GError) error = NULL;
 
@@ -315,11 +737,32 @@ request_complete_and_free (Request *request)
                        request->client->id, request->original_transaction_id, error->message);
             /* Disconnect and untrack client */
             untrack_client (request->self, request->client);
-        }
+        } else
+            request->client->responses_sent++;
 
         mbim_message_unref (request->response);
     }
 
+    /* Indications to replay once the subscribe list update is acknowledged */
+    if (request->replay_indications) {
+        guint i;
+
+        for (i = 0; i < request->replay_indications->len && request->client->connection; i++)
+            forward_indication (request->client, g_ptr_array_index (request->replay_indications, i));
+        g_ptr_array_unref (request->replay_indications);
+    }
+
+    /* Release the scheduling slot, if any */
+    if (request->device)
+        request_dispatch_done (request);
+
+    if (request->in_flight_link) {
+        g_queue_delete_link (&request->client->in_flight_requests, request->in_flight_link);
+        request->in_flight_link = NULL;
+    }
+    g_clear_object (&request->cancellable);
+    g_clear_error (&request->error);
+
     if (request->message)
         mbim_message_unref (request->message);
     client_unref (request->client);
@@ -343,6 +786,46 @@ request_new (MbimProxy   *self,
     return request;
 }
 
+/* Tracks the request as forwarded to the device on behalf of the client, and
+ * returns the cancellable to use in the device command */
+static GCancellable *
+request_set_in_flight (Request *request)
+{
+    g_assert (!request->cancellable);
+    request->cancellable = g_cancellable_new ();
+    g_queue_push_tail (&request->client->in_flight_requests, request);
+    request->in_flight_link = g_queue_peek_tail_link (&request->client->in_flight_requests);
+    return request->cancellable;
+}
+
+static guint
+client_get_request_timeout (Client *client)
+{
+    /* The one configured by the client, if any */
+    return (client->timeout_secs ? client->timeout_secs : client->self->priv->request_timeout);
+}
+
+static void
+client_cancel_in_flight_requests (Client *client)
+{
+    g_autoptr(GPtrArray) cancellables = NULL;
+    GList               *l;
+    guint                i;
+
+    if (g_queue_is_empty (&client->in_flight_requests))
+        return;
+
+    g_debug ("[client %lu] cancelling %u requests in flight",
+             client->id, g_queue_get_length (&client->in_flight_requests));
+
+    /* Requests may be completed right away when cancelled */
+    cancellables = g_ptr_array_new_with_free_func (g_object_unref);
+    for (l = client->in_flight_requests.head; l; l = g_list_next (l))
+        g_ptr_array_add (cancellables, g_object_ref (((Request *) l->data)->cancellable));
+    for (i = 0; i < cancellables->len; i++)
+        g_cancellable_cancel (g_ptr_array_index (cancellables, i));
+}
+
 /*****************************************************************************/
 /* Internal proxy device opening operation */
 
@@ -403,7 +886,10 @@ static OpeningDevice *
 peek_opening_device_info (MbimProxy  *self,
                           MbimDevice *device)
 {
-    GList *l;
+    g_autoptr(GMutexLocker)  locker = NULL;
+    GList                   *l;
+
+    locker = g_mutex_locker_new (&self->priv->tables_lock);
 
     /* If already being opened, queue it up */
     for (l = self->priv->opening_devices; l; l = g_list_next (l)) {
@@ -428,7 +914,9 @@ complete_opening_device (MbimProxy    *self,
     if (!info)
         return;
 
+    g_mutex_lock (&self->priv->tables_lock);
     self->priv->opening_devices = g_list_remove (self->priv->opening_devices, info);
+    g_mutex_unlock (&self->priv->tables_lock);
     opening_device_complete_and_free (info, error);
 }
 
@@ -453,7 +941,8 @@ device_open_ready (MbimDevice   *device,
                    GAsyncResult *res,
                    MbimProxy    *self)
 {
-    GError *error = NULL;
+    g_autoptr(ProxyLocker)  locker = proxy_locker_new (self);
+    GError                 *error = NULL;
 
     mbim_device_open_finish (device, res, &error);
 
@@ -488,7 +977,9 @@ internal_open (GTask *task)
     info = g_slice_new0 (OpeningDevice);
     info->device = g_object_ref (ctx->device);
     info->pending = g_list_append (info->pending, task);
+    g_mutex_lock (&self->priv->tables_lock);
     self->priv->opening_devices = g_list_prepend (self->priv->opening_devices, info);
+    g_mutex_unlock (&self->priv->tables_lock);
 
     /* Note: for now, only the first timeout request is taken into account */
 
@@ -510,6 +1001,7 @@ internal_device_open_caps_query_ready (MbimDevice   *device,
                                        GAsyncResult *res,
                                        GTask        *task)
 {
+    g_autoptr(ProxyLocker)  locker = proxy_locker_new (g_task_get_source_object (task));
     MbimProxy              *self;
     g_autoptr(MbimMessage)  response = NULL;
     g_autoptr(GError)       error = NULL;
@@ -639,33 +1131,45 @@ process_internal_proxy_close (MbimProxy   *self,
 /* Proxy config */
 
 static MbimMessage *
-build_proxy_control_command_done (MbimMessage     *message,
-                                  MbimStatusError  status)
+build_proxy_control_command_done_with_buffer (MbimMessage     *message,
+                                              MbimStatusError  status,
+                                              const guint8    *buffer,
+                                              guint32          buffer_len)
 {
     MbimMessage *response;
     struct command_done_message *command_done;
 
     response = (MbimMessage *) _mbim_message_allocate (MBIM_MESSAGE_TYPE_COMMAND_DONE,
                                                        mbim_message_get_transaction_id (message),
-                                                       sizeof (struct command_done_message));
+                                                       sizeof (struct command_done_message) + buffer_len);
     command_done = &(((struct full_message *)(response->data))->message.command_done);
     command_done->fragment_header.total   = GUINT32_TO_LE (1);
     command_done->fragment_header.current = 0;
     memcpy (command_done->service_id, MBIM_UUID_PROXY_CONTROL, sizeof (MbimUuid));
     command_done->command_id  = GUINT32_TO_LE (mbim_message_command_get_cid (message));
     command_done->status_code = GUINT32_TO_LE (status);
-    command_done->buffer_length = 0;
+    command_done->buffer_length = GUINT32_TO_LE (buffer_len);
+    if (buffer_len)
+        memcpy (&command_done->buffer[0], buffer, buffer_len);
 
     return response;
 }
 
+static MbimMessage *
+build_proxy_control_command_done (MbimMessage     *message,
+                                  MbimStatusError  status)
+{
+    return build_proxy_control_command_done_with_buffer (message, status, NULL, 0);
+}
+
 static void
 proxy_config_internal_device_open_ready (MbimProxy    *self,
                                          GAsyncResult *res,
                                          Request      *request)
 {
-    g_autoptr(GError)  error = NULL;
-    MbimMessage       *indication;
+    g_autoptr(ProxyLocker)  locker = proxy_locker_new (self);
+    g_autoptr(GError)       error = NULL;
+    MbimMessage            *indication;
 
     if (!internal_device_open_finish (self, res, &error)) {
         g_warning ("[client %lu,0x%08x] cannot configure proxy: couldn't open MBIM device: %s",
@@ -676,8 +1180,11 @@ proxy_config_internal_device_open_ready (MbimProxy    *self,
         return;
     }
 
-    g_debug ("[client %lu,0x%08x] proxy configured",
-             request->client->id, request->original_transaction_id);
+    g_debug ("[client %lu,0x%08x] proxy configured (timeout: %u seconds)",
+             request->client->id, request->original_transaction_id, request->timeout_secs);
+
+    /* The timeout configured by the client applies to all its requests */
+    request->client->timeout_secs = request->timeout_secs;
 
     /* notify the client about the MBIMEx version */
     indication = (MbimMessage *) g_object_get_data (G_OBJECT (request->client->device), MBIM_DEVICE_PROXY_CONTROL_VERSION);
@@ -699,9 +1206,10 @@ device_new_ready (GObject      *source,
                   GAsyncResult *res,
                   Request      *request)
 {
-    g_autoptr(GError)  error = NULL;
-    MbimDevice        *existing;
-    MbimDevice        *device;
+    g_autoptr(ProxyLocker)  locker = proxy_locker_new (request->self);
+    g_autoptr(GError)       error = NULL;
+    MbimDevice             *existing;
+    MbimDevice             *device;
 
     device = mbim_device_new_finish (res, &error);
     if (!device) {
@@ -805,6 +1313,13 @@ process_internal_proxy_config (MbimProxy   *self,
         return TRUE;
     }
 
+    /* With device threads, the configuration is processed in the thread of
+     * the device */
+    if (self->priv->device_threads && client_hand_off (client, path, message)) {
+        request_complete_and_free (request);
+        return TRUE;
+    }
+
     /* Read requested timeout value */
     if (!_mbim_message_read_guint32 (message, 8, &request->timeout_secs, &error)) {
         g_warning ("[client %lu,0x%08x] cannot configure proxy: couldn't read timeout from request: %s",
@@ -859,9 +1374,11 @@ track_service_subscribe_list (Client      *client,
     /* On each new request from the client, it should provide the FULL list of
      * events it's subscribed to, so we can safely recreate the whole array each
      * time. */
+    client_unroute (client);
     g_clear_pointer (&client->mbim_event_entry_array, mbim_event_entry_array_free);
     client->mbim_event_entry_array = g_steal_pointer (&mbim_event_entry_array);
     client->mbim_event_entry_array_size = mbim_event_entry_array_size;
+    client_route (client);
 
     if (mbim_utils_get_traces_enabled ()) {
         g_debug ("[client %lu] service subscribe list built", client->id);
@@ -878,6 +1395,10 @@ device_service_subscribe_list_set_complete (Request         *request,
     guint32                      raw_len;
     const guint8                *raw_data;
 
+    /* Last indications are only replayed if the device accepted the update */
+    if (status != MBIM_STATUS_ERROR_NONE)
+        g_clear_pointer (&request->replay_indications, g_ptr_array_unref);
+
     /* The raw message data to send back as response to client */
     raw_data = mbim_message_command_get_raw_information_buffer (request->message, &raw_len);
 
@@ -902,12 +1423,16 @@ device_service_subscribe_list_set_ready (MbimDevice   *device,
                                          GAsyncResult *res,
                                          Request      *request)
 {
+    g_autoptr(ProxyLocker) locker = proxy_locker_new (request->self);
     g_autoptr(MbimMessage) tmp_response = NULL;
     g_autoptr(GError)      error = NULL;
     MbimStatusError        error_status_code;
 
     tmp_response = mbim_device_command_finish (device, res, &error);
     if (!tmp_response) {
+        /* Nothing to replay if the update didn't reach the device */
+        g_clear_pointer (&request->replay_indications, g_ptr_array_unref);
+
         /* Translate a MbimDevice wrong state error into a Not-Opened function error. */
         if (g_error_matches (error, MBIM_CORE_ERROR, MBIM_CORE_ERROR_WRONG_STATE)) {
             g_debug ("[client %lu,0x%08x] sending request to device failed: wrong state",
@@ -939,6 +1464,7 @@ process_device_service_subscribe_list (MbimProxy   *self,
     gsize                   updated_size = 0;
     Request                *request;
     g_autoptr(MbimMessage)  request_message = NULL;
+    g_autoptr(GPtrArray)    previous_indications = NULL;
 
     /* create request holder */
     request = request_new (self, client, message);
@@ -946,9 +1472,32 @@ process_device_service_subscribe_list (MbimProxy   *self,
     g_debug ("[client %lu,0x%08x] request to update service subscribe list received",
              request->client->id, request->original_transaction_id);
 
+    /* last indications the client was already subscribed to */
+    if (self->priv->indication_replay)
+        previous_indications = client_collect_last_indications (client);
+
     /* trace the service subscribe list for the client */
     track_service_subscribe_list (client, message);
 
+    /* last indications the client is newly subscribed to, replayed after the
+     * response is sent */
+    if (self->priv->indication_replay) {
+        GPtrArray *indications;
+        guint      i;
+
+        indications = client_collect_last_indications (client);
+        for (i = indications->len; i > 0; i--) {
+            if (g_ptr_array_find (previous_indications, g_ptr_array_index (indications, i - 1), NULL))
+                g_ptr_array_remove_index (indications, i - 1);
+        }
+        if (indications->len > 0) {
+            g_debug ("[client %lu,0x%08x] replaying %u last indications after the subscribe list update",
+                     request->client->id, request->original_transaction_id, indications->len);
+            request->replay_indications = indications;
+        } else
+            g_ptr_array_unref (indications);
+    }
+
     /* merge all service subscribe list for all clients to set on device */
     updated = merge_client_service_subscribe_lists (self, client->device, &updated_size);
     if (!updated) {
@@ -966,7 +1515,7 @@ process_device_service_subscribe_list (MbimProxy   *self,
              request->client->id, request->original_transaction_id);
     mbim_device_command (client->device,
                          request_message,
-                         300,
+                         client_get_request_timeout (client),
                          NULL,
                          (GAsyncReadyCallback)device_service_subscribe_list_set_ready,
                          request);
@@ -1020,6 +1569,7 @@ monitor_ms_basic_connect_extensions_version_response (MbimProxy   *self,
     guint8                  ms_mbimex_version_major;
     guint8                  ms_mbimex_version_minor;
     GList                  *l;
+    GList                  *next;
 
     /* monitor the MBIMEx version agreed between the clients and the device */
     if (!mbim_message_response_get_result (response, MBIM_MESSAGE_TYPE_COMMAND_DONE, NULL) ||
@@ -1037,14 +1587,13 @@ monitor_ms_basic_connect_extensions_version_response (MbimProxy   *self,
 
     /* notify to all clients about the MBIMEx version update */
     indication = build_proxy_control_version_notification (mbim_version, ms_mbimex_version);
-    for (l = self->priv->clients; l; l = g_list_next (l)) {
+    for (l = peek_device_clients (device); l; l = next) {
         g_autoptr(GError)  error = NULL;
         Client            *client;
 
+        /* sending may disconnect the client, unlinking it from the list */
+        next = g_list_next (l);
         client = l->data;
-        if (client->device != device)
-            continue;
-
         if (!client_send_message (client, indication, &error))
             g_warning ("[client %lu] couldn't report MBIMEx version update to %x.%02x: %s",
                        client->id, ms_mbimex_version_major, ms_mbimex_version_minor, error->message);
@@ -1069,9 +1618,18 @@ device_command_ready (MbimDevice   *device,
                       GAsyncResult *res,
                       Request      *request)
 {
-    g_autoptr(GError) error = NULL;
+    g_autoptr(ProxyLocker) locker = proxy_locker_new (request->self);
+    g_autoptr(GError)      error = NULL;
 
     request->response = mbim_device_command_finish (device, res, &error);
+    MBIM_PROBE_PROXY_COMPLETE (request->client->id,
+                               request->original_transaction_id,
+                               request->response,
+                               g_get_monotonic_time () - request->dispatch_time);
+
+    if (mbim_message_command_get_command_type (request->message) == MBIM_MESSAGE_COMMAND_TYPE_SET)
+        request_query_cache_set_done (request, device);
+
     if (!request->response) {
         /* Translate a MbimDevice wrong state error into a Not-Opened function error. */
         if (g_error_matches (error, MBIM_CORE_ERROR, MBIM_CORE_ERROR_WRONG_STATE)) {
@@ -1082,9 +1640,18 @@ device_command_ready (MbimDevice   *device,
             return;
         }
 
+        /* The client is gone, nothing else to do */
+        if (g_cancellable_is_cancelled (request->cancellable)) {
+            g_debug ("[client %lu,0x%08x] request cancelled",
+                     request->client->id, request->original_transaction_id);
+            request_complete_and_free (request);
+            return;
+        }
+
         /* Don't disconnect client, just let the request timeout in its side */
         g_debug ("[client %lu,0x%08x] sending request to device failed: %s",
                  request->client->id, request->original_transaction_id, error->message);
+        request->error = g_steal_pointer (&error);
         request_complete_and_free (request);
         return;
     }
@@ -1093,6 +1660,8 @@ device_command_ready (MbimDevice   *device,
     g_debug ("[client %lu,0x%08x] response from device received",
              request->client->id, request->original_transaction_id);
 
+    device_statistics_response (device, request->response, g_get_monotonic_time () - request->dispatch_time);
+
     /* try to match the MBIMEx version exchange */
     monitor_ms_basic_connect_extensions_version_response (request->self, device, request->response);
 
@@ -1124,6 +1693,19 @@ process_command (MbimProxy   *self,
              command_type ? command_type : "unknown command type",
              command      ? command      : "unknown command");
 
+    /* Queries may be served from the cache, or wait for the same query
+     * from another client */
+    if (request_query_cache_process (request))
+        return TRUE;
+
+    /* Single fragment requests go through the device scheduler; fragmented
+     * ones are forwarded right away, as their fragments must share the same
+     * transaction id */
+    if (_mbim_message_fragment_get_total (message) == 1) {
+        request_schedule (request);
+        return TRUE;
+    }
+
     if (_mbim_message_fragment_get_current (message) == _mbim_message_fragment_get_total (message) - 1)
         /* replace command transaction id with internal proxy transaction id to avoid collision */
         mbim_message_set_transaction_id (message, mbim_device_get_next_transaction_id (client->device));
@@ -1133,13 +1715,15 @@ process_command (MbimProxy   *self,
 
     /* The timeout needs to be big enough for any kind of transaction to
      * complete, otherwise the remote clients will lose the reply if they
-     * configured a timeout bigger than this internal one. We should likely
-     * make this value configurable per-client, instead of a hardcoded value.
+     * configured a timeout bigger than this internal one.
      */
+    request->dispatch_time = g_get_monotonic_time ();
+    MBIM_PROBE_PROXY_FORWARD (client->id, request->original_transaction_id, message, 0);
+    device_statistics_request (client->device);
     mbim_device_command (client->device,
                          message,
-                         300,
-                         NULL,
+                         client_get_request_timeout (client),
+                         request_set_in_flight (request),
                          (GAsyncReadyCallback)device_command_ready,
                          request);
     return TRUE;
@@ -1147,10 +1731,14 @@ process_command (MbimProxy   *self,
 
 /*****************************************************************************/
 
+static gboolean process_internal_proxy_statistics (MbimProxy   *self,
+                                                   Client      *client,
+                                                   MbimMessage *message);
+
 static gboolean
-process_message (MbimProxy   *self,
-                 Client      *client,
-                 MbimMessage *message)
+dispatch_message (MbimProxy   *self,
+                  Client      *client,
+                  MbimMessage *message)
 {
     /* Filter by message type */
     switch (mbim_message_get_message_type (message)) {
@@ -1163,6 +1751,9 @@ process_message (MbimProxy   *self,
         if (mbim_message_command_get_service (message) == MBIM_SERVICE_PROXY_CONTROL &&
             mbim_message_command_get_cid (message) == MBIM_CID_PROXY_CONTROL_CONFIGURATION)
             return process_internal_proxy_config (self, client, message);
+        if (mbim_message_command_get_service (message) == MBIM_SERVICE_PROXY_CONTROL &&
+            mbim_message_command_get_cid (message) == MBIM_CID_PROXY_CONTROL_STATISTICS)
+            return process_internal_proxy_statistics (self, client, message);
         /* device service subscribe list message? */
         if (mbim_message_command_get_service (message) == MBIM_SERVICE_BASIC_CONNECT &&
             mbim_message_command_get_cid (message) == MBIM_CID_BASIC_CONNECT_DEVICE_SERVICE_SUBSCRIBE_LIST)
@@ -1184,30 +1775,85 @@ process_message (MbimProxy   *self,
     g_assert_not_reached ();
 }
 
+static gboolean
+process_message (MbimProxy   *self,
+                 Client      *client,
+                 MbimMessage *message)
+{
+    client->requests_received++;
+    return dispatch_message (self, client, message);
+}
+
+/* The spare room of the chunk is given back, so that queued messages only
+ * take their own length */
+static MbimMessage *
+client_input_chunk_steal (Client *client)
+{
+    guint   len;
+    guint8 *data;
+
+    len = client->buffer->len;
+    data = g_byte_array_free (client->buffer, FALSE);
+    client->buffer = NULL;
+    client->buffer_offset = 0;
+    return mbim_message_new_take (g_realloc (data, len), len);
+}
+
+static void
+client_input_chunk_clear (Client *client)
+{
+    g_clear_pointer (&client->buffer, g_byte_array_unref);
+    client->buffer_offset = 0;
+}
+
 static void
 parse_request (MbimProxy *self,
                Client    *client)
 {
+    GMainContext *context;
+
+    /* Parsing stops if the client is handed off to a device thread; the
+     * remaining input is parsed there */
+    context = client->context;
+
     do {
         g_autoptr(MbimMessage) message = NULL;
         g_autoptr(GError)      error = NULL;
+        struct _MbimMessage    input;
+        guint32                message_len;
+
+        /* Pending input, starting at the current offset in the chunk */
+        input.data = &client->buffer->data[client->buffer_offset];
+        input.len = client->buffer->len - client->buffer_offset;
 
         /* Invalid message? */
-        if (!_mbim_message_validate_internal ((const MbimMessage *)client->buffer, TRUE, &error)) {
+        if (!_mbim_message_validate_internal (&input, TRUE, &error)) {
             /* No full message yet */
             if (g_error_matches (error, MBIM_CORE_ERROR, MBIM_CORE_ERROR_INCOMPLETE_MESSAGE))
                 return;
             /* Invalid message */
-            g_byte_array_remove_range (client->buffer, 0, client->buffer->len);
+            client_input_chunk_clear (client);
             return;
         }
 
-        message = mbim_message_dup ((const MbimMessage *)client->buffer);
-        g_assert (message);
+        message_len = mbim_message_get_message_length (&input);
+        if (client->buffer_offset == 0 && input.len == message_len) {
+            /* The whole chunk is the message */
+            message = client_input_chunk_steal (client);
+        } else {
+            message = mbim_message_new (input.data, message_len);
+            client->input_bytes_copied += message_len;
+            client->buffer_offset += message_len;
+            if (client->buffer_offset == client->buffer->len)
+                client_input_chunk_clear (client);
+        }
 
-        g_byte_array_remove_range (client->buffer, 0, mbim_message_get_message_length (message));
         process_message (self, client, message);
-    } while (client->buffer->len > 0);
+
+        /* Handed off, the input is no longer owned by this thread */
+        if (client->context != context)
+            break;
+    } while (client->buffer && client->buffer->len > client->buffer_offset);
 }
 
 static gboolean
@@ -1215,10 +1861,11 @@ connection_readable_cb (GSocket *socket,
                         GIOCondition condition,
                         Client *client)
 {
-    MbimProxy         *self;
-    guint8             buffer[BUFFER_SIZE];
-    g_autoptr(GError)  error = NULL;
-    gssize             r;
+    g_autoptr(ProxyLocker)  locker = proxy_locker_new (client->self);
+    MbimProxy              *self;
+    g_autoptr(GError)       error = NULL;
+    guint                   offset;
+    gssize                  r;
 
     /* Recover proxy pointer soon */
     self = client->self;
@@ -1231,11 +1878,24 @@ connection_readable_cb (GSocket *socket,
     if (!(condition & G_IO_IN || condition & G_IO_PRI))
         return TRUE;
 
+    /* Read directly into the end of the current input chunk, after moving
+     * any partial message left to its beginning */
+    if (!client->buffer)
+        client->buffer = g_byte_array_sized_new (BUFFER_SIZE);
+    else if (client->buffer_offset > 0) {
+        client->input_bytes_copied += client->buffer->len - client->buffer_offset;
+        g_byte_array_remove_range (client->buffer, 0, client->buffer_offset);
+        client->buffer_offset = 0;
+    }
+    offset = client->buffer->len;
+    g_byte_array_set_size (client->buffer, offset + BUFFER_SIZE);
+
     r = g_input_stream_read (g_io_stream_get_input_stream (G_IO_STREAM (client->connection)),
-                             buffer,
+                             &client->buffer->data[offset],
                              BUFFER_SIZE,
                              NULL,
                              &error);
+    g_byte_array_set_size (client->buffer, offset + MAX (r, 0));
     if (r < 0) {
         g_warning ("[client %lu] error reading from istream: %s", client->id, error ? error->message : "unknown");
         /* Close the device */
@@ -1243,13 +1903,14 @@ connection_readable_cb (GSocket *socket,
         return FALSE;
     }
 
-    if (r == 0)
+    if (r == 0) {
+        if (!client->buffer->len)
+            client_input_chunk_clear (client);
         return TRUE;
+    }
 
     /* else, r > 0 */
-    if (!G_UNLIKELY (client->buffer))
-        client->buffer = g_byte_array_sized_new (r);
-    g_byte_array_append (client->buffer, buffer, r);
+    client->input_bytes += r;
 
     /* Try to parse input messages */
     parse_request (self, client);
@@ -1258,38 +1919,267 @@ connection_readable_cb (GSocket *socket,
 }
 
 static void
-incoming_cb (GSocketService    *service,
-             GSocketConnection *connection,
-             GObject           *unused,
-             MbimProxy         *self)
+client_attach_readable_source (Client *client)
+{
+    client->connection_readable_source = g_socket_create_source (g_socket_connection_get_socket (client->connection),
+                                                                 G_IO_IN | G_IO_PRI | G_IO_ERR | G_IO_HUP,
+                                                                 NULL);
+    g_source_set_callback (client->connection_readable_source,
+                           (GSourceFunc)connection_readable_cb,
+                           client,
+                           NULL);
+    g_source_attach (client->connection_readable_source, client->context);
+}
+
+/*****************************************************************************/
+/* Device threads
+ *
+ * Each device runs its own main context in a worker thread. Clients are
+ * accepted in the main thread, and handed off to the thread of their device
+ * when the proxy configuration request is received, which is then processed
+ * again in that thread. The thread is stopped once the device is untracked. */
+
+typedef struct {
+    gchar        *path;
+    GMainContext *context;
+    GMainLoop    *loop;
+    GThread      *thread;
+    GRecMutex     lock;
+    GSource      *stop_source;
+} DeviceWorker;
+
+static gpointer
+device_worker_thread (DeviceWorker *worker)
+{
+    g_private_set (&thread_lock, &worker->lock);
+    g_main_context_push_thread_default (worker->context);
+    g_main_loop_run (worker->loop);
+    g_main_context_pop_thread_default (worker->context);
+    return NULL;
+}
+
+static gboolean
+device_worker_quit (DeviceWorker *worker)
+{
+    g_main_loop_quit (worker->loop);
+    return G_SOURCE_REMOVE;
+}
+
+static void
+device_worker_stop (DeviceWorker *worker)
+{
+    if (!worker->thread)
+        return;
+
+    g_main_context_invoke (worker->context, (GSourceFunc) device_worker_quit, worker);
+    g_thread_join (worker->thread);
+    worker->thread = NULL;
+    g_debug ("[%s] device thread stopped", worker->path);
+}
+
+static void
+device_worker_free (DeviceWorker *worker)
+{
+    device_worker_stop (worker);
+    if (worker->stop_source) {
+        g_source_destroy (worker->stop_source);
+        g_source_unref (worker->stop_source);
+    }
+    g_rec_mutex_clear (&worker->lock);
+    g_main_loop_unref (worker->loop);
+    g_main_context_unref (worker->context);
+    g_free (worker->path);
+    g_slice_free (DeviceWorker, worker);
+}
+
+static DeviceWorker *
+peek_device_worker (MbimProxy   *self,
+                    const gchar *path)
+{
+    g_autoptr(GMutexLocker)  locker = NULL;
+    DeviceWorker            *worker;
+    g_autofree gchar        *name = NULL;
+
+    locker = g_mutex_locker_new (&self->priv->tables_lock);
+
+    worker = g_hash_table_lookup (self->priv->workers, path);
+    if (worker)
+        return worker;
+
+    worker = g_slice_new0 (DeviceWorker);
+    worker->path = g_strdup (path);
+    worker->context = g_main_context_new ();
+    worker->loop = g_main_loop_new (worker->context, FALSE);
+    g_rec_mutex_init (&worker->lock);
+    name = g_path_get_basename (path);
+    worker->thread = g_thread_new (name, (GThreadFunc) device_worker_thread, worker);
+    g_hash_table_insert (self->priv->workers, worker->path, worker);
+    g_debug ("[%s] device thread started", path);
+    return worker;
+}
+
+typedef struct {
+    MbimProxy    *self;
+    DeviceWorker *worker;
+} DeviceWorkerStop;
+
+static void
+device_worker_stop_free (DeviceWorkerStop *stop)
+{
+    g_slice_free (DeviceWorkerStop, stop);
+}
+
+static gboolean
+device_worker_stop_cb (DeviceWorkerStop *stop)
+{
+    MbimProxy *self = stop->self;
+
+    g_mutex_lock (&self->priv->tables_lock);
+    self->priv->stopping_workers = g_list_remove (self->priv->stopping_workers, stop->worker);
+    g_mutex_unlock (&self->priv->tables_lock);
+
+    device_worker_free (stop->worker);
+    return G_SOURCE_REMOVE;
+}
+
+/* A thread cannot join itself, so the thread of an untracked device is
+ * stopped from the main one; clients of the same device handed off
+ * afterwards get a new thread */
+static void
+release_device_worker (MbimProxy   *self,
+                       const gchar *path)
+{
+    DeviceWorker     *worker;
+    DeviceWorkerStop *stop;
+
+    g_mutex_lock (&self->priv->tables_lock);
+    worker = g_hash_table_lookup (self->priv->workers, path);
+    if (worker) {
+        g_hash_table_steal (self->priv->workers, path);
+        self->priv->stopping_workers = g_list_prepend (self->priv->stopping_workers, worker);
+    }
+    g_mutex_unlock (&self->priv->tables_lock);
+
+    if (!worker)
+        return;
+
+    stop = g_slice_new (DeviceWorkerStop);
+    stop->self = self;
+    stop->worker = worker;
+    worker->stop_source = g_idle_source_new ();
+    g_source_set_callback (worker->stop_source,
+                           (GSourceFunc) device_worker_stop_cb,
+                           stop,
+                           (GDestroyNotify) device_worker_stop_free);
+    g_source_attach (worker->stop_source, self->priv->context);
+}
+
+typedef struct {
+    Client      *client;
+    MbimMessage *message;
+    GByteArray  *buffer;
+    guint        buffer_offset;
+} ClientHandOff;
+
+static gboolean
+client_hand_off_cb (ClientHandOff *hand_off)
+{
+    g_autoptr(ProxyLocker)  locker = proxy_locker_new (hand_off->client->self);
+    Client                 *client;
+    g_autoptr(GError)       error = NULL;
+
+    client = hand_off->client;
+    client->buffer = g_steal_pointer (&hand_off->buffer);
+    client->buffer_offset = hand_off->buffer_offset;
+    if (client->connection) {
+        client_attach_readable_source (client);
+
+        /* Keep on writing any pending output from this thread */
+        if (!client_output_queue_flush (client, &error)) {
+            g_warning ("[client %lu] couldn't write to client: %s", client->id, error->message);
+            untrack_client (client->self, client);
+        } else {
+            /* Already counted when received in the original thread */
+            dispatch_message (client->self, client, hand_off->message);
+            if (client->connection && client->buffer && client->buffer->len > client->buffer_offset)
+                parse_request (client->self, client);
+        }
+    }
+
+    mbim_message_unref (hand_off->message);
+    client_unref (client);
+    g_slice_free (ClientHandOff, hand_off);
+    return G_SOURCE_REMOVE;
+}
+
+/* Returns TRUE if the client has been handed off to the thread of the device,
+ * where the message will be processed */
+static gboolean
+client_hand_off (Client      *client,
+                 const gchar *path,
+                 MbimMessage *message)
+{
+    DeviceWorker  *worker;
+    ClientHandOff *hand_off;
+
+    worker = peek_device_worker (client->self, path);
+    if (client->context == worker->context || !client->connection)
+        return FALSE;
+
+    g_debug ("[client %lu] handing off to the thread of device '%s'", client->id, path);
+
+    /* Sources are created again in the device thread */
+    g_source_destroy (client->connection_readable_source);
+    g_clear_pointer (&client->connection_readable_source, g_source_unref);
+    if (client->connection_writable_source) {
+        g_source_destroy (client->connection_writable_source);
+        g_clear_pointer (&client->connection_writable_source, g_source_unref);
+    }
+    g_main_context_unref (client->context);
+    client->context = g_main_context_ref (worker->context);
+
+    /* The current lock is held, so others waiting for it see the change */
+    g_mutex_lock (&client->self->priv->tables_lock);
+    client->lock = &worker->lock;
+    g_mutex_unlock (&client->self->priv->tables_lock);
+
+    hand_off = g_slice_new (ClientHandOff);
+    hand_off->client = client_ref (client);
+    hand_off->message = mbim_message_ref (message);
+    /* Input left after the message is parsed in the device thread */
+    hand_off->buffer = g_steal_pointer (&client->buffer);
+    hand_off->buffer_offset = client->buffer_offset;
+    client->buffer_offset = 0;
+    g_main_context_invoke (worker->context, (GSourceFunc) client_hand_off_cb, hand_off);
+    return TRUE;
+}
+
+static Client *
+client_new (MbimProxy         *self,
+            GSocketConnection *connection,
+            gulong             client_id)
 {
-    static gulong            client_id = 0;
     Client                  *client;
     g_autoptr(GCredentials)  credentials = NULL;
     g_autoptr(GError)        error = NULL;
     uid_t                    uid;
-
-    /* Each new incoming request updates the client id, even if the request is
-     * not accepted */
-    client_id++;
-
-    g_debug ("[client %lu] connection open...", client_id);
+    ClientQuota             *quota;
 
     credentials = g_socket_get_credentials (g_socket_connection_get_socket (connection), &error);
     if (!credentials) {
         g_warning ("[client %lu] not allowed: error getting socket credentials: %s", client_id, error->message);
-        return;
+        return NULL;
     }
 
     uid = g_credentials_get_unix_user (credentials, &error);
     if (error) {
         g_warning ("[client %lu] not allowed: error getting unix user id: %s", client_id, error->message);
-        return;
+        return NULL;
     }
 
     if (!mbim_helpers_check_user_allowed (uid, &error)) {
         g_warning ("[client %lu] not allowed: %s", client_id, error->message);
-        return;
+        return NULL;
     }
 
     /* Create client */
@@ -1297,19 +2187,44 @@ incoming_cb (GSocketService    *service,
     client->self = self;
     client->ref_count = 1;
     client->id = client_id;
+    client->uid = uid;
     client->connection = g_object_ref (connection);
+    client->context = g_main_context_ref_thread_default ();
+    client->lock = proxy_peek_lock (self);
+
+    /* Request scheduling quota for the user, if any */
+    g_mutex_lock (&self->priv->tables_lock);
+    quota = g_hash_table_lookup (self->priv->client_quotas, GUINT_TO_POINTER (uid));
+    client->max_in_flight = quota ? quota->max_in_flight : 0;
+    client->weight = quota ? quota->weight : 1;
+    g_mutex_unlock (&self->priv->tables_lock);
 
     /* By default, a new client has all the standard services enabled for indications */
     client->mbim_event_entry_array = _mbim_proxy_helper_service_subscribe_list_new_standard (&client->mbim_event_entry_array_size);
 
-    client->connection_readable_source = g_socket_create_source (g_socket_connection_get_socket (client->connection),
-                                                                 G_IO_IN | G_IO_PRI | G_IO_ERR | G_IO_HUP,
-                                                                 NULL);
-    g_source_set_callback (client->connection_readable_source,
-                           (GSourceFunc)connection_readable_cb,
-                           client,
-                           NULL);
-    g_source_attach (client->connection_readable_source, g_main_context_get_thread_default ());
+    return client;
+}
+
+static void
+incoming_cb (GSocketService    *service,
+             GSocketConnection *connection,
+             GObject           *unused,
+             MbimProxy         *self)
+{
+    g_autoptr(ProxyLocker)  locker = proxy_locker_new (self);
+    Client                 *client;
+
+    /* Each new incoming request updates the client id, even if the request is
+     * not accepted */
+    self->priv->client_id++;
+
+    g_debug ("[client %lu] connection open...", self->priv->client_id);
+
+    client = client_new (self, connection, self->priv->client_id);
+    if (!client)
+        return;
+
+    client_attach_readable_source (client);
 
     /* Keep the client info around */
     track_client (self, client);
@@ -1317,9 +2232,9 @@ incoming_cb (GSocketService    *service,
     client_unref (client);
 }
 
-static gboolean
-setup_socket_service (MbimProxy  *self,
-                      GError    **error)
+static GSocket *
+create_listening_socket (const gchar  *path,
+                         GError      **error)
 {
     g_autoptr(GSocketAddress) socket_address = NULL;
     g_autoptr(GSocket)        socket = NULL;
@@ -1329,27 +2244,44 @@ setup_socket_service (MbimProxy  *self,
                            G_SOCKET_PROTOCOL_DEFAULT,
                            error);
     if (!socket)
-        return FALSE;
+        return NULL;
 
     /* Bind to address */
     socket_address = (g_unix_socket_address_new_with_type (
-                          MBIM_PROXY_SOCKET_PATH,
+                          path,
                           -1,
                           G_UNIX_SOCKET_ADDRESS_ABSTRACT));
     if (!g_socket_bind (socket, socket_address, TRUE, error))
-        return FALSE;
-
-    g_debug ("creating UNIX socket service...");
+        return NULL;
 
     /* Listen */
     if (!g_socket_listen (socket, error))
-        return FALSE;
+        return NULL;
+
+    return g_steal_pointer (&socket);
+}
+
+/* If no listening socket is given, a new one is created */
+static gboolean
+setup_socket_service (MbimProxy  *self,
+                      GSocket    *socket,
+                      GError    **error)
+{
+    g_debug ("creating UNIX socket service...");
+
+    if (socket)
+        self->priv->socket = g_object_ref (socket);
+    else {
+        self->priv->socket = create_listening_socket (MBIM_PROXY_SOCKET_PATH, error);
+        if (!self->priv->socket)
+            return FALSE;
+    }
 
     /* Create socket service */
     self->priv->socket_service = g_socket_service_new ();
     g_signal_connect (self->priv->socket_service, "incoming", G_CALLBACK (incoming_cb), self);
     if (!g_socket_listener_add_socket (G_SOCKET_LISTENER (self->priv->socket_service),
-                                       socket,
+                                       self->priv->socket,
                                        NULL, /* don't pass an object, will take a reference */
                                        error)) {
         g_prefix_error (error, "Error adding socket at '%s' to socket service: ", MBIM_PROXY_SOCKET_PATH);
@@ -1365,222 +2297,2102 @@ setup_socket_service (MbimProxy  *self,
 /* Device tracking */
 
 #define DEVICE_CONTEXT_TAG "device-context-tag"
-static GQuark device_context_quark;
+
+static GQuark
+device_context_quark (void)
+{
+    static gsize quark = 0;
+
+    if (g_once_init_enter (&quark))
+        g_once_init_leave (&quark, g_quark_from_static_string (DEVICE_CONTEXT_TAG));
+    return (GQuark) quark;
+}
 
 typedef struct {
+    /* Lock of the thread handling the device */
+    GRecMutex       *lock;
+
     /* Combined events array */
     MbimEventEntry **mbim_event_entry_array;
     gsize            mbim_event_entry_array_size;
+
+    /* Indication routes, each one a set of clients; the number of clients in
+     * each set is the subscription count of the service and cid */
+    GHashTable      *routes;
+
+    /* Set whenever a route of a non-standard service is added or removed, as
+     * the combined events array needs to be rebuilt */
+    gboolean         routes_updated;
+
+    /* Connected clients using this device */
+    GQueue           clients;
+
+    /* Clients with requests waiting to be dispatched, in round robin order */
+    GQueue           scheduled_clients;
+    guint            in_flight;
+
+    /* Query responses, and queries in flight */
+    GHashTable      *query_cache;
+
+    /* Last indication received for each service and cid */
+    GHashTable      *last_indications;
+
+    /* Statistics */
+    guint64          requests;
+    guint64          responses;
+    guint64          indications;
+    guint64          query_cache_hits;
+    guint64          queries_coalesced;
+    GHashTable      *cid_statistics;
 } DeviceContext;
 
 static void
 device_context_free (DeviceContext *ctx)
 {
+    g_hash_table_unref (ctx->cid_statistics);
+    g_hash_table_unref (ctx->last_indications);
+    g_hash_table_unref (ctx->query_cache);
+    g_assert (g_queue_is_empty (&ctx->clients));
+    g_assert (g_queue_is_empty (&ctx->scheduled_clients));
+    g_hash_table_unref (ctx->routes);
     mbim_event_entry_array_free (ctx->mbim_event_entry_array);
     g_slice_free (DeviceContext, ctx);
 }
 
+/* Indications are routed by service and cid; cid 0 (never a valid cid) is
+ * used for the clients subscribed to all the cids of the service */
+typedef struct {
+    MbimUuid service_id;
+    guint32  cid;
+} RouteKey;
+
+static guint
+service_id_hash (const MbimUuid *service_id)
+{
+    const guint8 *bytes = (const guint8 *) service_id;
+    guint32       hash = 2166136261u;
+    guint         i;
+
+    /* FNV-1a */
+    for (i = 0; i < sizeof (MbimUuid); i++)
+        hash = (hash ^ bytes[i]) * 16777619u;
+    return hash;
+}
+
+static guint
+route_key_hash (const RouteKey *key)
+{
+    return service_id_hash (&key->service_id) ^ key->cid;
+}
+
+static gboolean
+route_key_equal (const RouteKey *a,
+                 const RouteKey *b)
+{
+    return (a->cid == b->cid && mbim_uuid_cmp (&a->service_id, &b->service_id));
+}
+
+static void
+route_key_free (RouteKey *key)
+{
+    g_slice_free (RouteKey, key);
+}
+
+static gboolean
+route_key_is_standard (const RouteKey *key)
+{
+    MbimService service;
+
+    /* subscriptions to the standard services are always enabled in the device,
+     * see _mbim_proxy_helper_service_subscribe_list_merge() */
+    service = mbim_uuid_to_service (&key->service_id);
+    return (service >= MBIM_SERVICE_BASIC_CONNECT && service <= MBIM_SERVICE_DSS);
+}
+
+/* Response latency, per service and cid */
+static const guint32 latency_bounds[] = { 10, 50, 100, 500, 1000, 5000, 30000, G_MAXUINT32 };
+
+typedef struct {
+    guint32 responses;
+    guint64 latency_total;
+    guint32 latency_max;
+    guint32 latency_histogram[G_N_ELEMENTS (latency_bounds)];
+} CidStatistics;
+
+static void
+cid_statistics_free (CidStatistics *stats)
+{
+    g_slice_free (CidStatistics, stats);
+}
+
+/* Queries are identified by service, cid and payload */
+typedef struct {
+    MbimUuid  service_id;
+    guint32   cid;
+    GBytes   *payload;
+} QueryKey;
+
+static guint
+query_key_hash (const QueryKey *key)
+{
+    return service_id_hash (&key->service_id) ^ key->cid ^ g_bytes_hash (key->payload);
+}
+
+static gboolean
+query_key_equal (const QueryKey *a,
+                 const QueryKey *b)
+{
+    return (a->cid == b->cid &&
+            mbim_uuid_cmp (&a->service_id, &b->service_id) &&
+            g_bytes_equal (a->payload, b->payload));
+}
+
+typedef struct _QueryCacheEntry {
+    QueryKey     key;
+    /* Last successful response, until it expires */
+    MbimMessage *response;
+    gint64       expiry;
+    /* Query in flight, and the same queries from other clients */
+    Request     *leader;
+    GQueue       followers;
+    /* Set if the response of the query in flight must not be cached */
+    gboolean     invalidated;
+} QueryCacheEntry;
+
+static void
+query_cache_entry_free (QueryCacheEntry *entry)
+{
+    g_assert (!entry->leader);
+    g_assert (g_queue_is_empty (&entry->followers));
+    g_clear_pointer (&entry->response, mbim_message_unref);
+    g_bytes_unref (entry->key.payload);
+    g_slice_free (QueryCacheEntry, entry);
+}
+
 static DeviceContext *
 device_context_get (MbimDevice *device)
 {
     DeviceContext *ctx;
 
-    if (G_UNLIKELY (!device_context_quark))
-        device_context_quark = g_quark_from_static_string (DEVICE_CONTEXT_TAG);
-
-    ctx = g_object_get_qdata (G_OBJECT (device), device_context_quark);
+    ctx = g_object_get_qdata (G_OBJECT (device), device_context_quark ());
     if (!ctx) {
         ctx = g_slice_new0 (DeviceContext);
         ctx->mbim_event_entry_array = _mbim_proxy_helper_service_subscribe_list_new_standard (&ctx->mbim_event_entry_array_size);
+        ctx->routes = g_hash_table_new_full ((GHashFunc) route_key_hash,
+                                             (GEqualFunc) route_key_equal,
+                                             (GDestroyNotify) route_key_free,
+                                             (GDestroyNotify) g_hash_table_unref);
+        ctx->query_cache = g_hash_table_new_full ((GHashFunc) query_key_hash,
+                                                  (GEqualFunc) query_key_equal,
+                                                  NULL,
+                                                  (GDestroyNotify) query_cache_entry_free);
+        ctx->last_indications = g_hash_table_new_full ((GHashFunc) route_key_hash,
+                                                       (GEqualFunc) route_key_equal,
+                                                       (GDestroyNotify) route_key_free,
+                                                       (GDestroyNotify) mbim_message_unref);
+        ctx->cid_statistics = g_hash_table_new_full ((GHashFunc) route_key_hash,
+                                                     (GEqualFunc) route_key_equal,
+                                                     (GDestroyNotify) route_key_free,
+                                                     (GDestroyNotify) cid_statistics_free);
 
         g_debug ("[%s] initial device subscribe list...", mbim_device_get_path (device));
         _mbim_proxy_helper_service_subscribe_list_debug ((const MbimEventEntry * const *)ctx->mbim_event_entry_array, ctx->mbim_event_entry_array_size);
 
-        g_object_set_qdata_full (G_OBJECT (device), device_context_quark, ctx, (GDestroyNotify)device_context_free);
+        g_object_set_qdata_full (G_OBJECT (device), device_context_quark (), ctx, (GDestroyNotify)device_context_free);
     }
 
     return ctx;
 }
 
-static MbimEventEntry **
-merge_client_service_subscribe_lists (MbimProxy  *self,
-                                      MbimDevice *device,
-                                      gsize      *out_size)
+static void
+device_context_route_update (DeviceContext  *ctx,
+                             const MbimUuid *service_id,
+                             guint32         cid,
+                             Client         *client,
+                             gboolean        add)
+{
+    RouteKey    key;
+    GHashTable *clients;
+
+    memcpy (&key.service_id, service_id, sizeof (MbimUuid));
+    key.cid = cid;
+
+    clients = g_hash_table_lookup (ctx->routes, &key);
+    if (add) {
+        if (!clients) {
+            clients = g_hash_table_new (g_direct_hash, g_direct_equal);
+            g_hash_table_insert (ctx->routes, g_slice_dup (RouteKey, &key), clients);
+            if (!route_key_is_standard (&key))
+                ctx->routes_updated = TRUE;
+        }
+        g_hash_table_add (clients, client);
+    } else if (clients) {
+        g_hash_table_remove (clients, client);
+        if (g_hash_table_size (clients) == 0) {
+            g_hash_table_remove (ctx->routes, &key);
+            if (!route_key_is_standard (&key))
+                ctx->routes_updated = TRUE;
+        }
+    }
+}
+
+static void
+client_route_update (Client   *client,
+                     gboolean  add)
+{
+    DeviceContext *ctx;
+    guint          i;
+    guint          j;
+
+    if (!client->device || !client->mbim_event_entry_array)
+        return;
+
+    ctx = device_context_get (client->device);
+    for (i = 0; i < client->mbim_event_entry_array_size; i++) {
+        const MbimEventEntry *entry = client->mbim_event_entry_array[i];
+
+        /* if client subscribed using the wildcard, no need to match specific cid */
+        if (entry->cids_count == 0) {
+            device_context_route_update (ctx, &entry->device_service_id, 0, client, add);
+            continue;
+        }
+
+        for (j = 0; j < entry->cids_count; j++)
+            device_context_route_update (ctx, &entry->device_service_id, entry->cids[j], client, add);
+    }
+}
+
+static gboolean
+client_is_routed (DeviceContext  *ctx,
+                  Client         *client,
+                  const RouteKey *key)
+{
+    RouteKey    wildcard;
+    GHashTable *clients;
+
+    clients = g_hash_table_lookup (ctx->routes, key);
+    if (clients && g_hash_table_contains (clients, client))
+        return TRUE;
+
+    memcpy (&wildcard.service_id, &key->service_id, sizeof (MbimUuid));
+    wildcard.cid = 0;
+    clients = g_hash_table_lookup (ctx->routes, &wildcard);
+    return (clients && g_hash_table_contains (clients, client));
+}
+
+static GPtrArray *
+client_collect_last_indications (Client *client)
+{
+    GPtrArray      *indications;
+    DeviceContext  *ctx;
+    GHashTableIter  iter;
+    gpointer        key;
+    gpointer        message;
+
+    indications = g_ptr_array_new_with_free_func ((GDestroyNotify) mbim_message_unref);
+    if (!client->device)
+        return indications;
+
+    ctx = device_context_get (client->device);
+    g_hash_table_iter_init (&iter, ctx->last_indications);
+    while (g_hash_table_iter_next (&iter, &key, &message)) {
+        if (client_is_routed (ctx, client, key))
+            g_ptr_array_add (indications, mbim_message_ref (message));
+    }
+    return indications;
+}
+
+static void
+client_route (Client *client)
+{
+    client_route_update (client, TRUE);
+}
+
+static void
+client_unroute (Client *client)
+{
+    client_route_update (client, FALSE);
+}
+
+static void
+client_device_link (Client *client)
+{
+    DeviceContext *ctx;
+
+    /* Clients already disconnected are never linked to the device */
+    if (client->device_link || !client->connection)
+        return;
+
+    ctx = device_context_get (client->device);
+    client->device_link = g_list_alloc ();
+    client->device_link->data = client;
+    g_queue_push_tail_link (&ctx->clients, client->device_link);
+}
+
+static void
+client_device_unlink (Client *client)
+{
+    DeviceContext *ctx;
+
+    if (!client->device_link)
+        return;
+
+    ctx = device_context_get (client->device);
+    g_queue_unlink (&ctx->clients, client->device_link);
+    g_list_free_1 (client->device_link);
+    client->device_link = NULL;
+}
+
+/*****************************************************************************/
+/* Request scheduling
+ *
+ * Requests are dispatched to the device in deficit round robin order among
+ * the clients with requests waiting: on each turn a client may dispatch as
+ * many requests as its weight. The total amount of requests in flight in the
+ * device may be limited, as well as the amount of requests in flight per
+ * client if a quota was configured for its user; without any limit, requests
+ * are dispatched right away. */
+
+static gboolean
+client_quota_exceeded (Client *client)
+{
+    return (client->max_in_flight > 0 && client->in_flight >= client->max_in_flight);
+}
+
+static void
+client_schedule (Client *client)
+{
+    DeviceContext *ctx;
+
+    if (client->scheduler_link ||
+        g_queue_is_empty (&client->pending_requests) ||
+        client_quota_exceeded (client))
+        return;
+
+    ctx = device_context_get (client->device);
+    client->scheduler_link = g_list_alloc ();
+    client->scheduler_link->data = client;
+    g_queue_push_tail_link (&ctx->scheduled_clients, client->scheduler_link);
+}
+
+static void
+client_unschedule (Client *client)
+{
+    Request *request;
+
+    if (client->scheduler_link) {
+        DeviceContext *ctx;
+
+        ctx = device_context_get (client->device);
+        g_queue_unlink (&ctx->scheduled_clients, client->scheduler_link);
+        g_list_free_1 (client->scheduler_link);
+        client->scheduler_link = NULL;
+        client->deficit = 0;
+    }
+
+    /* Requests not yet dispatched are just discarded */
+    while ((request = g_queue_pop_head (&client->pending_requests)) != NULL) {
+        g_debug ("[client %lu,0x%08x] discarding request not yet dispatched",
+                 client->id, request->original_transaction_id);
+        request_complete_and_free (request);
+    }
+}
+
+static void
+request_dispatch (Request *request)
+{
+    Client        *client;
+    DeviceContext *ctx;
+    gint64         queue_wait;
+
+    client = request->client;
+    ctx = device_context_get (client->device);
+
+    queue_wait = g_get_monotonic_time () - request->queued_time;
+    client->queue_wait_total += queue_wait;
+    client->queue_wait_max = MAX (client->queue_wait_max, queue_wait);
+    client->requests_dispatched++;
+    client->in_flight++;
+    ctx->in_flight++;
+    request->device = g_object_ref (client->device);
+
+    g_debug ("[client %lu,0x%08x] dispatching request to device (%.1f ms in queue)",
+             client->id, request->original_transaction_id, (gdouble) queue_wait / 1000.0);
+
+    /* replace command transaction id with internal proxy transaction id to avoid collision */
+    mbim_message_set_transaction_id (request->message, mbim_device_get_next_transaction_id (request->device));
+
+    /* The timeout needs to be big enough for any kind of transaction to
+     * complete, otherwise the remote clients will lose the reply if they
+     * configured a timeout bigger than this internal one.
+     */
+    request->dispatch_time = g_get_monotonic_time ();
+    MBIM_PROBE_PROXY_FORWARD (client->id, request->original_transaction_id, request->message, queue_wait);
+    device_statistics_request (request->device);
+    mbim_device_command (request->device,
+                         request->message,
+                         client_get_request_timeout (client),
+                         request_set_in_flight (request),
+                         (GAsyncReadyCallback)device_command_ready,
+                         request);
+}
+
+static void
+device_dispatch_requests (MbimProxy  *self,
+                          MbimDevice *device)
+{
+    DeviceContext *ctx;
+
+    ctx = device_context_get (device);
+
+    while (!g_queue_is_empty (&ctx->scheduled_clients) &&
+           (self->priv->device_max_in_flight == 0 || ctx->in_flight < self->priv->device_max_in_flight)) {
+        GList  *link;
+        Client *client;
+
+        link = ctx->scheduled_clients.head;
+        client = link->data;
+
+        /* New turn for the client */
+        if (client->deficit == 0)
+            client->deficit = client->weight;
+
+        request_dispatch (g_queue_pop_head (&client->pending_requests));
+        client->deficit--;
+
+        /* Keep on with the same client until its turn is over */
+        if (client->deficit > 0 &&
+            !g_queue_is_empty (&client->pending_requests) &&
+            !client_quota_exceeded (client))
+            continue;
+
+        client->deficit = 0;
+        g_queue_unlink (&ctx->scheduled_clients, link);
+        if (!g_queue_is_empty (&client->pending_requests) && !client_quota_exceeded (client))
+            g_queue_push_tail_link (&ctx->scheduled_clients, link);
+        else {
+            g_list_free_1 (link);
+            client->scheduler_link = NULL;
+        }
+    }
+}
+
+static void
+request_schedule (Request *request)
+{
+    request->queued_time = g_get_monotonic_time ();
+    g_queue_push_tail (&request->client->pending_requests, request);
+    client_schedule (request->client);
+    device_dispatch_requests (request->self, request->client->device);
+}
+
+static void
+request_dispatch_done (Request *request)
+{
+    Client        *client;
+    DeviceContext *ctx;
+
+    client = request->client;
+    ctx = device_context_get (request->device);
+
+    g_assert (client->in_flight > 0);
+    g_assert (ctx->in_flight > 0);
+    client->in_flight--;
+    ctx->in_flight--;
+
+    /* The client may be allowed to dispatch again */
+    if (client->device == request->device)
+        client_schedule (client);
+    device_dispatch_requests (request->self, request->device);
+
+    g_clear_object (&request->device);
+}
+
+/*****************************************************************************/
+/* Query response cache
+ *
+ * Successful query responses are kept for a short time and given to any
+ * client sending the same query. Queries received while the same one is in
+ * flight are not forwarded; they complete with the response of the one in
+ * flight, or with a function error if it failed without response.
+ * Indications and completed sets drop the cached responses of their service
+ * and cid. */
+
+static void
+query_cache_invalidate (DeviceContext  *ctx,
+                        const MbimUuid *service_id,
+                        guint32         cid)
+{
+    GHashTableIter  iter;
+    gpointer        value;
+
+    g_hash_table_iter_init (&iter, ctx->query_cache);
+    while (g_hash_table_iter_next (&iter, NULL, &value)) {
+        QueryCacheEntry *entry = value;
+
+        if (service_id && (entry->key.cid != cid || !mbim_uuid_cmp (&entry->key.service_id, service_id)))
+            continue;
+
+        /* Entries with a query in flight are removed once it completes */
+        if (entry->leader) {
+            g_clear_pointer (&entry->response, mbim_message_unref);
+            entry->invalidated = TRUE;
+            continue;
+        }
+        g_hash_table_iter_remove (&iter);
+    }
+}
+
+static gboolean
+request_query_cache_process (Request *request)
+{
+    MbimMessage     *message;
+    DeviceContext   *ctx;
+    QueryCacheEntry *entry;
+    QueryKey         key;
+    const guint8    *payload;
+    guint32          payload_len = 0;
+
+    message = request->message;
+    if (!request->self->priv->query_cache_ttl ||
+        mbim_message_command_get_command_type (message) != MBIM_MESSAGE_COMMAND_TYPE_QUERY ||
+        _mbim_message_fragment_get_total (message) != 1)
+        return FALSE;
+
+    ctx = device_context_get (request->client->device);
+
+    memcpy (&key.service_id, mbim_message_command_get_service_id (message), sizeof (MbimUuid));
+    key.cid = mbim_message_command_get_cid (message);
+    payload = mbim_message_command_get_raw_information_buffer (message, &payload_len);
+    key.payload = g_bytes_new (payload, payload_len);
+
+    entry = g_hash_table_lookup (ctx->query_cache, &key);
+    if (entry && entry->response && entry->expiry <= g_get_monotonic_time ())
+        g_clear_pointer (&entry->response, mbim_message_unref);
+
+    if (entry && entry->response) {
+        g_debug ("[client %lu,0x%08x] query response served from cache",
+                 request->client->id, request->original_transaction_id);
+        ctx->query_cache_hits++;
+        g_bytes_unref (key.payload);
+        request->response = mbim_message_dup (entry->response);
+        mbim_message_set_transaction_id (request->response, request->original_transaction_id);
+        request_complete_and_free (request);
+        return TRUE;
+    }
+
+    if (entry && entry->leader) {
+        g_debug ("[client %lu,0x%08x] same query already in flight from client %lu, waiting for it",
+                 request->client->id, request->original_transaction_id, entry->leader->client->id);
+        g_bytes_unref (key.payload);
+        ctx->queries_coalesced++;
+        g_queue_push_tail (&entry->followers, request);
+        return TRUE;
+    }
+
+    if (!entry) {
+        entry = g_slice_new0 (QueryCacheEntry);
+        entry->key = key;
+        g_hash_table_add (ctx->query_cache, entry);
+    } else
+        g_bytes_unref (key.payload);
+
+    /* This query will be forwarded to the device */
+    entry->leader = request;
+    entry->invalidated = FALSE;
+    request->query_cache_entry = entry;
+    return FALSE;
+}
+
+static void
+client_discard_query_followers (Client *client)
+{
+    DeviceContext  *ctx;
+    GHashTableIter  iter;
+    gpointer        value;
+    GList          *discarded = NULL;
+
+    if (!client->device)
+        return;
+
+    ctx = device_context_get (client->device);
+    g_hash_table_iter_init (&iter, ctx->query_cache);
+    while (g_hash_table_iter_next (&iter, NULL, &value)) {
+        QueryCacheEntry *entry = value;
+        GList           *l;
+        GList           *next;
+
+        for (l = entry->followers.head; l; l = next) {
+            next = g_list_next (l);
+            if (((Request *) l->data)->client == client) {
+                discarded = g_list_prepend (discarded, l->data);
+                g_queue_delete_link (&entry->followers, l);
+            }
+        }
+    }
+
+    /* Completed without response */
+    g_list_free_full (discarded, (GDestroyNotify) request_complete_and_free);
+}
+
+static void
+request_query_cache_complete (Request *request)
+{
+    QueryCacheEntry *entry;
+    DeviceContext   *ctx;
+    Request         *follower;
+
+    entry = request->query_cache_entry;
+    request->query_cache_entry = NULL;
+    g_assert (entry->leader == request);
+    entry->leader = NULL;
+
+    /* If the query was discarded before being forwarded to the device, or
+     * cancelled, the next client waiting for it takes over */
+    if (!request->response &&
+        (!request->device || g_cancellable_is_cancelled (request->cancellable))) {
+        follower = g_queue_pop_head (&entry->followers);
+        if (follower) {
+            entry->leader = follower;
+            follower->query_cache_entry = entry;
+            request_schedule (follower);
+            return;
+        }
+    }
+
+    /* Complete the followers with the same response, or with a function
+     * error, as they would otherwise wait for their own timeout, which
+     * started later than the one of the failed query */
+    while ((follower = g_queue_pop_head (&entry->followers)) != NULL) {
+        if (request->response) {
+            follower->response = mbim_message_dup (request->response);
+            mbim_message_set_transaction_id (follower->response, follower->original_transaction_id);
+        } else if (request->error) {
+            g_debug ("[client %lu,0x%08x] same query from client %lu failed: %s",
+                     follower->client->id, follower->original_transaction_id,
+                     request->client->id, request->error->message);
+            follower->response = mbim_message_function_error_new (follower->original_transaction_id,
+                                                                  (g_error_matches (request->error, MBIM_CORE_ERROR, MBIM_CORE_ERROR_ABORTED) ?
+                                                                   MBIM_PROTOCOL_ERROR_NOT_OPENED :
+                                                                   MBIM_PROTOCOL_ERROR_UNKNOWN));
+        }
+        request_complete_and_free (follower);
+    }
+
+    ctx = device_context_get (request->client->device);
+    if (!entry->invalidated &&
+        request->response &&
+        mbim_message_response_get_result (request->response, MBIM_MESSAGE_TYPE_COMMAND_DONE, NULL)) {
+        entry->response = mbim_message_dup (request->response);
+        entry->expiry = g_get_monotonic_time () + (gint64) request->self->priv->query_cache_ttl * 1000;
+        return;
+    }
+
+    g_hash_table_remove (ctx->query_cache, entry);
+}
+
+/* Cached query responses of the same service and cid may be outdated once a
+ * set completes, whatever the result */
+static void
+request_query_cache_set_done (Request    *request,
+                              MbimDevice *device)
+{
+    query_cache_invalidate (device_context_get (device),
+                            mbim_message_command_get_service_id (request->message),
+                            mbim_message_command_get_cid (request->message));
+}
+
+/*****************************************************************************/
+/* Proxy statistics */
+
+static void
+device_statistics_request (MbimDevice *device)
+{
+    device_context_get (device)->requests++;
+}
+
+static void
+device_statistics_response (MbimDevice  *device,
+                            MbimMessage *response,
+                            gint64       latency)
+{
+    DeviceContext *ctx;
+    CidStatistics *stats;
+    RouteKey       key;
+    guint32        latency_ms;
+    guint          i;
+
+    ctx = device_context_get (device);
+    ctx->responses++;
+
+    if (mbim_message_get_message_type (response) != MBIM_MESSAGE_TYPE_COMMAND_DONE)
+        return;
+
+    memcpy (&key.service_id, mbim_message_command_done_get_service_id (response), sizeof (MbimUuid));
+    key.cid = mbim_message_command_done_get_cid (response);
+
+    stats = g_hash_table_lookup (ctx->cid_statistics, &key);
+    if (!stats) {
+        stats = g_slice_new0 (CidStatistics);
+        g_hash_table_insert (ctx->cid_statistics, g_slice_dup (RouteKey, &key), stats);
+    }
+
+    latency_ms = (guint32) MIN (latency / 1000, (gint64) G_MAXUINT32);
+    stats->responses++;
+    stats->latency_total += latency_ms;
+    stats->latency_max = MAX (stats->latency_max, latency_ms);
+    for (i = 0; latency_ms > latency_bounds[i]; i++);
+    stats->latency_histogram[i]++;
+}
+
+static gint
+client_id_cmp (const Client **a,
+               const Client **b)
+{
+    return ((*a)->id > (*b)->id) - ((*a)->id < (*b)->id);
+}
+
+static void
+statistics_append_struct (MbimStructBuilder *builder,
+                          MbimStructBuilder *struct_builder)
+{
+    g_autoptr(GByteArray) raw = NULL;
+
+    /* Each struct of a ref-struct-array is given as offset and length */
+    raw = _mbim_struct_builder_complete (struct_builder);
+    _mbim_struct_builder_append_byte_array (builder, TRUE, TRUE, FALSE, raw->data, raw->len, FALSE);
+}
+
+/* Each device and client is read with the lock of the thread handling it,
+ * so with device threads this must be called from the main one */
+static GByteArray *
+build_statistics (MbimProxy *self)
+{
+    MbimStructBuilder   *builder;
+    g_autoptr(GList)     devices = NULL;
+    g_autoptr(GPtrArray) clients = NULL;
+    g_autoptr(GPtrArray) cids = NULL;
+    GHashTableIter       iter;
+    gpointer             key;
+    gpointer             value;
+    GList               *l;
+    guint                i;
+
+    builder = _mbim_struct_builder_new ();
+
+    g_mutex_lock (&self->priv->tables_lock);
+    devices = g_list_copy_deep (self->priv->devices, (GCopyFunc) g_object_ref, NULL);
+    clients = g_ptr_array_new_full (g_hash_table_size (self->priv->clients), (GDestroyNotify) client_unref);
+    g_hash_table_iter_init (&iter, self->priv->clients);
+    while (g_hash_table_iter_next (&iter, NULL, &value))
+        g_ptr_array_add (clients, client_ref (value));
+    g_mutex_unlock (&self->priv->tables_lock);
+
+    /* Devices, and their response latency per service and cid, added last */
+    cids = g_ptr_array_new ();
+    _mbim_struct_builder_append_guint32 (builder, g_list_length (devices));
+    for (l = devices; l; l = g_list_next (l)) {
+        MbimStructBuilder *device_builder;
+        DeviceContext     *ctx;
+        GList             *c;
+        guint32            queued = 0;
+
+        ctx = device_context_get (l->data);
+        g_rec_mutex_lock (ctx->lock);
+
+        for (c = ctx->clients.head; c; c = g_list_next (c))
+            queued += g_queue_get_length (&((Client *) c->data)->pending_requests);
+
+        device_builder = _mbim_struct_builder_new ();
+        _mbim_struct_builder_append_string (device_builder, mbim_device_get_path (l->data));
+        _mbim_struct_builder_append_guint32 (device_builder, g_queue_get_length (&ctx->clients));
+        _mbim_struct_builder_append_guint32 (device_builder, queued);
+        _mbim_struct_builder_append_guint32 (device_builder, ctx->in_flight);
+        _mbim_struct_builder_append_guint64 (device_builder, ctx->requests);
+        _mbim_struct_builder_append_guint64 (device_builder, ctx->responses);
+        _mbim_struct_builder_append_guint64 (device_builder, ctx->indications);
+        _mbim_struct_builder_append_guint64 (device_builder, ctx->query_cache_hits);
+        _mbim_struct_builder_append_guint64 (device_builder, ctx->queries_coalesced);
+        statistics_append_struct (builder, device_builder);
+
+        g_hash_table_iter_init (&iter, ctx->cid_statistics);
+        while (g_hash_table_iter_next (&iter, &key, &value)) {
+            MbimStructBuilder *cid_builder;
+            CidStatistics     *stats = value;
+
+            cid_builder = _mbim_struct_builder_new ();
+            _mbim_struct_builder_append_string (cid_builder, mbim_device_get_path (l->data));
+            _mbim_struct_builder_append_uuid (cid_builder, &((RouteKey *) key)->service_id);
+            _mbim_struct_builder_append_guint32 (cid_builder, ((RouteKey *) key)->cid);
+            _mbim_struct_builder_append_guint32 (cid_builder, stats->responses);
+            _mbim_struct_builder_append_guint32 (cid_builder, (guint32) (stats->latency_total / stats->responses));
+            _mbim_struct_builder_append_guint32 (cid_builder, stats->latency_max);
+            _mbim_struct_builder_append_guint32 (cid_builder, G_N_ELEMENTS (latency_bounds));
+            _mbim_struct_builder_append_guint32_array (cid_builder, stats->latency_histogram, G_N_ELEMENTS (latency_bounds));
+            g_ptr_array_add (cids, cid_builder);
+        }
+
+        g_rec_mutex_unlock (ctx->lock);
+    }
+    g_list_free_full (g_steal_pointer (&devices), g_object_unref);
+
+    /* Clients, in connection order */
+    g_ptr_array_sort (clients, (GCompareFunc) client_id_cmp);
+    _mbim_struct_builder_append_guint32 (builder, clients->len);
+    for (i = 0; i < clients->len; i++) {
+        MbimStructBuilder *client_builder;
+        Client            *client;
+        GRecMutex         *lock;
+
+        client = g_ptr_array_index (clients, i);
+        lock = client_lock (client);
+
+        client_builder = _mbim_struct_builder_new ();
+        _mbim_struct_builder_append_guint64 (client_builder, client->id);
+        _mbim_struct_builder_append_guint32 (client_builder, client->uid);
+        _mbim_struct_builder_append_string (client_builder, client->device ? mbim_device_get_path (client->device) : NULL);
+        _mbim_struct_builder_append_guint64 (client_builder, client->requests_received);
+        _mbim_struct_builder_append_guint64 (client_builder, client->responses_sent);
+        _mbim_struct_builder_append_guint64 (client_builder, client->indications_forwarded);
+        _mbim_struct_builder_append_guint32 (client_builder, client->output_indications_dropped);
+        _mbim_struct_builder_append_guint64 (client_builder, client->input_bytes);
+        _mbim_struct_builder_append_guint64 (client_builder, client->input_bytes_copied);
+        _mbim_struct_builder_append_guint64 (client_builder, client->output_bytes_sent);
+        _mbim_struct_builder_append_guint32 (client_builder, (guint32) client->output_queue_size);
+        _mbim_struct_builder_append_guint32 (client_builder, (guint32) client->output_queue_peak);
+        _mbim_struct_builder_append_guint32 (client_builder, g_queue_get_length (&client->pending_requests));
+        _mbim_struct_builder_append_guint32 (client_builder, client->in_flight);
+        _mbim_struct_builder_append_guint32 (client_builder,
+                                             client->requests_dispatched ?
+                                             (guint32) (client->queue_wait_total / client->requests_dispatched) : 0);
+        _mbim_struct_builder_append_guint32 (client_builder, (guint32) client->queue_wait_max);
+
+        g_rec_mutex_unlock (lock);
+        statistics_append_struct (builder, client_builder);
+    }
+
+    /* Latency histogram bucket upper bounds, in ms */
+    _mbim_struct_builder_append_guint32 (builder, G_N_ELEMENTS (latency_bounds));
+    _mbim_struct_builder_append_guint32_array (builder, latency_bounds, G_N_ELEMENTS (latency_bounds));
+
+    /* Response latency per device, service and cid */
+    _mbim_struct_builder_append_guint32 (builder, cids->len);
+    for (i = 0; i < cids->len; i++)
+        statistics_append_struct (builder, g_ptr_array_index (cids, i));
+
+    return _mbim_struct_builder_complete (builder);
+}
+
+/* With device threads, the statistics are collected in the main thread and
+ * the response sent with the lock of the thread handling the client */
+static gboolean
+statistics_collect_cb (Request *request)
+{
+    g_autoptr(ProxyLocker)  locker = proxy_locker_new (request->self);
+    g_autoptr(GByteArray)   statistics = NULL;
+    GRecMutex              *lock;
+
+    statistics = build_statistics (request->self);
+    request->response = build_proxy_control_command_done_with_buffer (request->message, MBIM_STATUS_ERROR_NONE, statistics->data, statistics->len);
+
+    lock = client_lock (request->client);
+    request_complete_and_free (request);
+    g_rec_mutex_unlock (lock);
+    return G_SOURCE_REMOVE;
+}
+
+static gboolean
+process_internal_proxy_statistics (MbimProxy   *self,
+                                   Client      *client,
+                                   MbimMessage *message)
+{
+    Request               *request;
+    g_autoptr(GByteArray)  statistics = NULL;
+
+    /* create request holder */
+    request = request_new (self, client, message);
+
+    g_debug ("[client %lu,0x%08x] request to query proxy statistics",
+             request->client->id, request->original_transaction_id);
+
+    /* Only allow QUERY command */
+    if (mbim_message_command_get_command_type (message) != MBIM_MESSAGE_COMMAND_TYPE_QUERY) {
+        g_warning ("[client %lu,0x%08x] cannot query proxy statistics: invalid request type",
+                   request->client->id, request->original_transaction_id);
+        request->response = build_proxy_control_command_done (message, MBIM_STATUS_ERROR_INVALID_PARAMETERS);
+        request_complete_and_free (request);
+        return TRUE;
+    }
+
+    if (self->priv->device_threads) {
+        g_autoptr(GSource) source = NULL;
+
+        source = g_idle_source_new ();
+        g_source_set_callback (source, (GSourceFunc) statistics_collect_cb, request, NULL);
+        g_source_attach (source, self->priv->context);
+        return TRUE;
+    }
+
+    statistics = build_statistics (self);
+    request->response = build_proxy_control_command_done_with_buffer (message, MBIM_STATUS_ERROR_NONE, statistics->data, statistics->len);
+    request_complete_and_free (request);
+    return TRUE;
+}
+
+/*****************************************************************************/
+
+static GList *
+peek_device_clients (MbimDevice *device)
+{
+    return device_context_get (device)->clients.head;
+}
+
+static void
+proxy_device_indication_cb (MbimDevice  *device,
+                            MbimMessage *message,
+                            MbimProxy   *self)
+{
+    g_autoptr(ProxyLocker) locker = proxy_locker_new (self);
+    DeviceContext         *ctx;
+    RouteKey               key;
+    g_autoptr(GPtrArray)   recipients = NULL;
+    guint                  i;
+
+    ctx = device_context_get (device);
+
+    memcpy (&key.service_id, mbim_message_indicate_status_get_service_id (message), sizeof (MbimUuid));
+    key.cid = mbim_message_indicate_status_get_cid (message);
+
+    /* Cached query responses of this service and cid are no longer valid */
+    query_cache_invalidate (ctx, &key.service_id, key.cid);
+
+    ctx->indications++;
+
+    /* Keep the last indication, to replay it to new subscribers */
+    if (self->priv->indication_replay)
+        g_hash_table_replace (ctx->last_indications, g_slice_dup (RouteKey, &key), mbim_message_ref (message));
+
+    /* Collect recipients first, as forwarding may end up disconnecting clients
+     * and updating the routes */
+    recipients = g_ptr_array_new_with_free_func ((GDestroyNotify) client_unref);
+    for (i = 0; i < 2; i++) {
+        GHashTable     *clients;
+        GHashTableIter  iter;
+        gpointer        client;
+
+        clients = g_hash_table_lookup (ctx->routes, &key);
+        if (clients) {
+            g_hash_table_iter_init (&iter, clients);
+            while (g_hash_table_iter_next (&iter, &client, NULL))
+                g_ptr_array_add (recipients, client_ref ((Client *) client));
+        }
+        /* then, the clients subscribed to all cids */
+        key.cid = 0;
+    }
+
+    /* The same message is queued in all recipients, not copied */
+    for (i = 0; i < recipients->len; i++) {
+        Client *client = g_ptr_array_index (recipients, i);
+
+        if (client->connection)
+            forward_indication (client, message);
+    }
+}
+
+static MbimEventEntry **
+build_service_subscribe_list_from_routes (DeviceContext *ctx,
+                                          gsize         *out_size)
+{
+    g_autoptr(GHashTable)  services = NULL;
+    GHashTableIter         iter;
+    gpointer               key;
+    gpointer               value;
+    MbimEventEntry       **list;
+    gsize                  list_size;
+    gsize                  i;
+
+    /* Entries of the non-standard services, indexed by UUID */
+    services = g_hash_table_new ((GHashFunc) service_id_hash, (GEqualFunc) mbim_uuid_cmp);
+
+    g_hash_table_iter_init (&iter, ctx->routes);
+    while (g_hash_table_iter_next (&iter, &key, NULL)) {
+        const RouteKey *route = key;
+        RouteKey        wildcard;
+        MbimEventEntry *entry;
+
+        if (route_key_is_standard (route))
+            continue;
+
+        entry = g_hash_table_lookup (services, &route->service_id);
+        if (!entry) {
+            entry = g_new0 (MbimEventEntry, 1);
+            memcpy (&entry->device_service_id, &route->service_id, sizeof (MbimUuid));
+            g_hash_table_insert (services, &entry->device_service_id, entry);
+        }
+
+        /* if any client subscribed using the wildcard, all cids are enabled */
+        if (route->cid == 0)
+            continue;
+        memcpy (&wildcard.service_id, &route->service_id, sizeof (MbimUuid));
+        wildcard.cid = 0;
+        if (g_hash_table_contains (ctx->routes, &wildcard))
+            continue;
+
+        entry->cids = g_realloc (entry->cids, sizeof (guint32) * (entry->cids_count + 1));
+        entry->cids[entry->cids_count++] = route->cid;
+    }
+
+    /* Standard list first, then the non-standard services */
+    list = _mbim_proxy_helper_service_subscribe_list_new_standard (&list_size);
+    list = g_realloc (list, sizeof (MbimEventEntry *) * (list_size + g_hash_table_size (services) + 1));
+    i = list_size;
+    g_hash_table_iter_init (&iter, services);
+    while (g_hash_table_iter_next (&iter, NULL, &value))
+        list[i++] = value;
+    list[i] = NULL;
+
+    *out_size = i;
+    return list;
+}
+
+static MbimEventEntry **
+merge_client_service_subscribe_lists (MbimProxy  *self,
+                                      MbimDevice *device,
+                                      gsize      *out_size)
+{
+    g_autoptr(MbimEventEntryArray)  updated = NULL;
+    gsize                           updated_size = 0;
+    DeviceContext                  *ctx;
+
+    ctx = device_context_get (device);
+    g_assert (ctx);
+
+    g_assert (out_size != NULL);
+
+    /* The subscription counts are updated as soon as the client lists change,
+     * so if no (service, cid) pair was added or removed, nothing to do */
+    if (!ctx->routes_updated) {
+        g_debug ("[%s] merged service subscribe list not updated", mbim_device_get_path (device));
+        return NULL;
+    }
+
+    g_debug ("[%s] merging client service subscribe lists...", mbim_device_get_path (device));
+    updated = build_service_subscribe_list_from_routes (ctx, &updated_size);
+    ctx->routes_updated = FALSE;
+
+    /* If lists are equal, ignore re-setting them up */
+    if (_mbim_proxy_helper_service_subscribe_list_cmp (
+            (const MbimEventEntry *const *)updated, updated_size,
+            (const MbimEventEntry *const *)ctx->mbim_event_entry_array, ctx->mbim_event_entry_array_size)) {
+        g_debug ("[%s] merged service subscribe list not updated", mbim_device_get_path (device));
+        return NULL;
+    }
+
+    /* Lists are different, update stored one */
+    g_clear_pointer (&ctx->mbim_event_entry_array, mbim_event_entry_array_free);
+    ctx->mbim_event_entry_array = g_steal_pointer (&updated);
+    ctx->mbim_event_entry_array_size = updated_size;
+
+    if (mbim_utils_get_traces_enabled ()) {
+        g_debug ("[%s] merged service subscribe list built", mbim_device_get_path (device));
+        _mbim_proxy_helper_service_subscribe_list_debug ((const MbimEventEntry * const *)ctx->mbim_event_entry_array,
+                                                         ctx->mbim_event_entry_array_size);
+    }
+
+    *out_size = ctx->mbim_event_entry_array_size;
+    return ctx->mbim_event_entry_array;
+}
+
+static void
+reset_client_service_subscribe_lists (MbimProxy  *self,
+                                      MbimDevice *device)
+{
+    DeviceContext *ctx;
+    GList         *l;
+
+    g_debug ("[%s] reseting client service subscribe lists...", mbim_device_get_path (device));
+    ctx = device_context_get (device);
+    g_assert (ctx);
+
+    /* make sure that all clients of this device don't track any event registered */
+    for (l = peek_device_clients (device); l; l = g_list_next (l)) {
+        Client *client;
+
+        client = l->data;
+        if (!client->mbim_event_entry_array)
+            continue;
+
+        client_unroute (client);
+        g_clear_pointer (&client->mbim_event_entry_array, mbim_event_entry_array_free);
+        client->mbim_event_entry_array = _mbim_proxy_helper_service_subscribe_list_new_standard (&client->mbim_event_entry_array_size);
+        client_route (client);
+    }
+
+    /* The device is being reopened, so drop all cached query responses and
+     * indications */
+    query_cache_invalidate (ctx, NULL, 0);
+    g_hash_table_remove_all (ctx->last_indications);
+
+    /* And reset the device-specific merged list */
+    g_clear_pointer (&ctx->mbim_event_entry_array, mbim_event_entry_array_free);
+    ctx->mbim_event_entry_array = _mbim_proxy_helper_service_subscribe_list_new_standard (&ctx->mbim_event_entry_array_size);
+}
+
+static void
+proxy_device_error_cb (MbimDevice *device,
+                       GError     *error,
+                       MbimProxy  *self)
+{
+    g_autoptr(ProxyLocker) locker = proxy_locker_new (self);
+
+    if (g_error_matches (error, MBIM_PROTOCOL_ERROR, MBIM_PROTOCOL_ERROR_NOT_OPENED)) {
+        g_debug ("[%s] reports as being closed...", mbim_device_get_path (device));
+        reset_client_service_subscribe_lists (self, device);
+        mbim_device_close_force (device, NULL);
+    }
+}
+
+static MbimDevice *
+peek_device_for_path (MbimProxy   *self,
+                      const gchar *path)
+{
+    g_autoptr(GMutexLocker)  locker = NULL;
+    GList                   *l;
+
+    locker = g_mutex_locker_new (&self->priv->tables_lock);
+
+    for (l = self->priv->devices; l; l = g_list_next (l)) {
+        /* Return if found */
+        if (g_str_equal (mbim_device_get_path ((MbimDevice *)l->data), path))
+            return (MbimDevice *)l->data;
+    }
+
+    return NULL;
+}
+
+static void
+proxy_device_removed_cb (MbimDevice *device,
+                         MbimProxy  *self)
+{
+    g_autoptr(ProxyLocker) locker = proxy_locker_new (self);
+
+    untrack_device (self, device);
+}
+
+static void
+untrack_device (MbimProxy  *self,
+                MbimDevice *device)
+{
+    GList    *l;
+    GList    *to_remove;
+    gboolean  tracked;
+
+    g_debug ("[%s] untracking device...", mbim_device_get_path (device));
+
+    g_mutex_lock (&self->priv->tables_lock);
+    tracked = !!g_list_find (self->priv->devices, device);
+    g_mutex_unlock (&self->priv->tables_lock);
+    if (!tracked)
+        return;
+
+    /* Disconnect right away */
+    g_signal_handlers_disconnect_by_func (device, proxy_device_error_cb, self);
+    g_signal_handlers_disconnect_by_func (device, proxy_device_removed_cb, self);
+    g_signal_handlers_disconnect_by_func (device, proxy_device_indication_cb, self);
+
+    /* If pending openings ongoing, complete them with error */
+    cancel_opening_device (self, device);
+
+    /* Remove all clients with this device; untracking them updates the list */
+    to_remove = g_list_copy_deep (peek_device_clients (device), (GCopyFunc) client_ref, NULL);
+    for (l = to_remove; l; l = g_list_next (l))
+        untrack_client (self, (Client *)(l->data));
+    g_list_free_full (to_remove, (GDestroyNotify) client_unref);
+
+    /* And finally, remove the device and stop its thread */
+    g_mutex_lock (&self->priv->tables_lock);
+    self->priv->devices = g_list_remove (self->priv->devices, device);
+    g_mutex_unlock (&self->priv->tables_lock);
+    if (self->priv->device_threads)
+        release_device_worker (self, mbim_device_get_path (device));
+    g_object_unref (device);
+    g_object_notify_by_pspec (G_OBJECT (self), properties[PROP_N_DEVICES]);
+}
+
+static void
+track_device (MbimProxy *self,
+              MbimDevice *device)
+{
+    g_signal_connect (device,
+                      MBIM_DEVICE_SIGNAL_REMOVED,
+                      G_CALLBACK (proxy_device_removed_cb),
+                      self);
+
+    g_signal_connect (device,
+                      MBIM_DEVICE_SIGNAL_ERROR,
+                      G_CALLBACK (proxy_device_error_cb),
+                      self);
+
+    g_signal_connect (device,
+                      MBIM_DEVICE_SIGNAL_INDICATE_STATUS,
+                      G_CALLBACK (proxy_device_indication_cb),
+                      self);
+
+    /* Tracked from the thread handling the device */
+    device_context_get (device)->lock = proxy_peek_lock (self);
+
+    g_mutex_lock (&self->priv->tables_lock);
+    self->priv->devices = g_list_append (self->priv->devices, g_object_ref (device));
+    g_mutex_unlock (&self->priv->tables_lock);
+    g_object_notify_by_pspec (G_OBJECT (self), properties[PROP_N_DEVICES]);
+}
+
+/*****************************************************************************/
+/* Handoff
+ *
+ * A new proxy process connects to the handoff socket of the running one,
+ * which stops accepting clients and reading their requests, and waits until
+ * all devices are idle. The state is then sent as a serialized GVariant,
+ * followed by the listening socket, device and client file descriptors. Once
+ * the new proxy acknowledges it has taken over, the devices and clients are
+ * dropped without sending any close request nor disconnecting the clients,
+ * and the new proxy is told so with a final commit byte.
+ *
+ * The new proxy only reports success once it gets the commit, so both never
+ * end up using the same devices: if the acknowledgement doesn't arrive in
+ * HANDOFF_SOCKET_TIMEOUT_SECS, e.g. because the new proxy was stuck while
+ * taking over the file descriptors, the running proxy resumes and closes the
+ * handoff connection, and the new one fails and drops everything it took
+ * over. If the commit is the one lost instead, the running proxy has already
+ * dropped everything, and the clients need to open the devices again.
+ *
+ * The wire format is a header with the size of the state and the number of
+ * file descriptors, the state itself, and the file descriptors in batches of
+ * HANDOFF_FDS_PER_MESSAGE, each one sent along with a single dummy byte. */
+
+#define HANDOFF_STATE_VERSION   1
+#define HANDOFF_STATE_TYPE      "(utha(shuyybayay)a(thsuayay))"
+#define HANDOFF_FDS_PER_MESSAGE 250 /* SCM_MAX_FD is 253 */
+#define HANDOFF_ACK             'y'
+#define HANDOFF_COMMIT          'c'
+
+static gboolean setup_handoff_service (MbimProxy *self, GError **error);
+
+static gboolean
+handoff_send_all (GSocket       *socket,
+                  const guint8  *data,
+                  gsize          len,
+                  GError       **error)
+{
+    while (len > 0) {
+        gssize r;
+
+        r = g_socket_send (socket, (const gchar *) data, len, NULL, error);
+        if (r < 0)
+            return FALSE;
+        data += r;
+        len -= r;
+    }
+    return TRUE;
+}
+
+static gboolean
+handoff_receive_all (GSocket  *socket,
+                     guint8   *data,
+                     gsize     len,
+                     GError  **error)
+{
+    while (len > 0) {
+        gssize r;
+
+        r = g_socket_receive (socket, (gchar *) data, len, NULL, error);
+        if (r < 0)
+            return FALSE;
+        if (r == 0) {
+            g_set_error (error, MBIM_CORE_ERROR, MBIM_CORE_ERROR_FAILED, "Connection closed");
+            return FALSE;
+        }
+        data += r;
+        len -= r;
+    }
+    return TRUE;
+}
+
+static gboolean
+handoff_send_fds (GSocket  *socket,
+                  GArray   *fds,
+                  GError  **error)
+{
+    guint i;
+
+    for (i = 0; i < fds->len; i += HANDOFF_FDS_PER_MESSAGE) {
+        g_autoptr(GSocketControlMessage) message = NULL;
+        GOutputVector                    vector = { "", 1 };
+        guint                            j;
+
+        message = g_unix_fd_message_new ();
+        for (j = i; j < MIN (fds->len, i + HANDOFF_FDS_PER_MESSAGE); j++) {
+            if (!g_unix_fd_message_append_fd (G_UNIX_FD_MESSAGE (message), g_array_index (fds, gint, j), error))
+                return FALSE;
+        }
+        if (g_socket_send_message (socket, NULL, &vector, 1, &message, 1, G_SOCKET_MSG_NONE, NULL, error) < 0)
+            return FALSE;
+    }
+    return TRUE;
+}
+
+static gboolean
+handoff_receive_fds (GSocket  *socket,
+                     guint     n_fds,
+                     GArray   *fds,
+                     GError  **error)
+{
+    while (fds->len < n_fds) {
+        GSocketControlMessage **messages = NULL;
+        gint                    n_messages = 0;
+        gchar                   byte;
+        GInputVector            vector = { &byte, 1 };
+        gssize                  r;
+        gint                    i;
+
+        r = g_socket_receive_message (socket, NULL, &vector, 1, &messages, &n_messages, NULL, NULL, error);
+        if (r < 0)
+            return FALSE;
+
+        for (i = 0; i < n_messages; i++) {
+            if (G_IS_UNIX_FD_MESSAGE (messages[i])) {
+                gint *received;
+                gint  n_received;
+
+                received = g_unix_fd_message_steal_fds (G_UNIX_FD_MESSAGE (messages[i]), &n_received);
+                g_array_append_vals (fds, received, n_received);
+                g_free (received);
+            }
+            g_object_unref (messages[i]);
+        }
+        g_free (messages);
+
+        if (r == 0) {
+            g_set_error (error, MBIM_CORE_ERROR, MBIM_CORE_ERROR_FAILED, "Connection closed");
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+static GVariant *
+handoff_bytes_variant (const guint8 *data,
+                       gsize         len)
+{
+    return g_variant_new_fixed_array (G_VARIANT_TYPE_BYTE, data, len, sizeof (guint8));
+}
+
+/* Subscribe lists are serialized as service subscribe list set messages */
+static GVariant *
+handoff_subscribe_list_variant (MbimEventEntry **array,
+                                gsize            array_size)
+{
+    g_autoptr(MbimMessage)  message = NULL;
+    const guint8           *raw = NULL;
+    guint32                 len = 0;
+
+    if (array) {
+        message = mbim_message_device_service_subscribe_list_set_new (array_size, (const MbimEventEntry *const *)array, NULL);
+        raw = mbim_message_get_raw (message, &len, NULL);
+    }
+    return handoff_bytes_variant (raw, len);
+}
+
+static MbimEventEntry **
+handoff_subscribe_list_parse (GVariant *variant,
+                              gsize    *out_size)
+{
+    g_autoptr(MbimMessage)  message = NULL;
+    const guint8           *raw;
+    gsize                   len;
+
+    raw = g_variant_get_fixed_array (variant, &len, sizeof (guint8));
+    if (len == 0)
+        return NULL;
+
+    message = mbim_message_new (raw, len);
+    return _mbim_proxy_helper_service_subscribe_request_parse (message, out_size, NULL);
+}
+
+/* Returns the file descriptor given, which is no longer owned by the array */
+static gint
+handoff_take_fd (GArray  *fds,
+                 gint32   handle,
+                 GError **error)
+{
+    gint fd;
+
+    if (handle < 0 || (guint) handle >= fds->len || g_array_index (fds, gint, handle) < 0) {
+        g_set_error (error, MBIM_CORE_ERROR, MBIM_CORE_ERROR_INVALID_ARGS,
+                     "Invalid file descriptor handle: %d", handle);
+        return -1;
+    }
+
+    fd = g_array_index (fds, gint, handle);
+    g_array_index (fds, gint, handle) = -1;
+    return fd;
+}
+
+/* No requests in flight nor partial messages in any device, nothing
+ * waiting to be written to any client */
+static gboolean
+handoff_is_quiescent (MbimProxy *self)
+{
+    GHashTableIter  iter;
+    gpointer        value;
+    GList          *l;
+
+    if (self->priv->opening_devices)
+        return FALSE;
+
+    for (l = self->priv->devices; l; l = g_list_next (l)) {
+        MbimDevice *device = l->data;
+
+        if (device_context_get (device)->in_flight > 0 || !_mbim_device_is_idle (device))
+            return FALSE;
+    }
+
+    g_hash_table_iter_init (&iter, self->priv->clients);
+    while (g_hash_table_iter_next (&iter, NULL, &value)) {
+        Client *client = value;
+
+        if (client->config_ongoing ||
+            client->untrack_source ||
+            !g_queue_is_empty (&client->in_flight_requests) ||
+            !g_queue_is_empty (&client->pending_requests) ||
+            client->output_queue_size > 0)
+            return FALSE;
+    }
+
+    return TRUE;
+}
+
+static void
+handoff_pause_clients (MbimProxy *self,
+                       gboolean   pause)
+{
+    GHashTableIter iter;
+    gpointer       value;
+
+    g_hash_table_iter_init (&iter, self->priv->clients);
+    while (g_hash_table_iter_next (&iter, NULL, &value)) {
+        Client *client = value;
+
+        if (pause && client->connection_readable_source) {
+            g_source_destroy (client->connection_readable_source);
+            g_clear_pointer (&client->connection_readable_source, g_source_unref);
+        } else if (!pause && client->connection && !client->connection_readable_source)
+            client_attach_readable_source (client);
+    }
+}
+
+static gboolean
+handoff_send_state (MbimProxy  *self,
+                    GPtrArray  *stolen_devices,
+                    GArray     *stolen_fds,
+                    GError    **error)
+{
+    g_autoptr(GArray)    fds = NULL;
+    g_autoptr(GVariant)  state = NULL;
+    GVariantBuilder      devices;
+    GVariantBuilder      clients;
+    GSocket             *socket;
+    GHashTableIter       iter;
+    gpointer             value;
+    GList               *l;
+    guint32              header[2];
+    guint8               ack = 0;
+    gint                 listener_fd;
+
+    /* The listening socket goes first */
+    fds = g_array_new (FALSE, FALSE, sizeof (gint));
+    listener_fd = g_socket_get_fd (self->priv->socket);
+    g_array_append_val (fds, listener_fd);
+
+    /* Open devices, which are left closed without sending any close request */
+    g_variant_builder_init (&devices, G_VARIANT_TYPE ("a(shuyybayay)"));
+    for (l = self->priv->devices; l; l = g_list_next (l)) {
+        MbimDevice    *device = l->data;
+        DeviceContext *ctx;
+        MbimMessage   *indication;
+        const guint8  *raw = NULL;
+        guint32        raw_len = 0;
+        gboolean       in_session = FALSE;
+        guint8         mbimex_major;
+        guint8         mbimex_minor = 0;
+        gint           fd;
+
+        if (!mbim_device_is_open (device))
+            continue;
+
+        fd = _mbim_device_steal_fd (device, error);
+        if (fd < 0) {
+            g_prefix_error (error, "Cannot hand off device '%s': ", mbim_device_get_path (device));
+            g_variant_builder_clear (&devices);
+            return FALSE;
+        }
+        g_ptr_array_add (stolen_devices, g_object_ref (device));
+        g_array_append_val (stolen_fds, fd);
+
+        ctx = device_context_get (device);
+        mbimex_major = mbim_device_get_ms_mbimex_version (device, &mbimex_minor);
+        g_object_get (device, MBIM_DEVICE_IN_SESSION, &in_session, NULL);
+        indication = g_object_get_data (G_OBJECT (device), MBIM_DEVICE_PROXY_CONTROL_VERSION);
+        if (indication)
+            raw = mbim_message_get_raw (indication, &raw_len, NULL);
+
+        g_variant_builder_add (&devices, "(shuyyb@ay@ay)",
+                               mbim_device_get_path (device),
+                               (gint32) fds->len,
+                               mbim_device_get_transaction_id (device),
+                               mbimex_major,
+                               mbimex_minor,
+                               in_session,
+                               handoff_subscribe_list_variant (ctx->mbim_event_entry_array, ctx->mbim_event_entry_array_size),
+                               handoff_bytes_variant (raw, raw_len));
+        g_array_append_val (fds, fd);
+    }
+
+    /* Connected clients, along with any partial request read */
+    g_variant_builder_init (&clients, G_VARIANT_TYPE ("a(thsuayay)"));
+    g_hash_table_iter_init (&iter, self->priv->clients);
+    while (g_hash_table_iter_next (&iter, NULL, &value)) {
+        Client *client = value;
+        gint    fd;
+
+        if (!client->connection)
+            continue;
+
+        fd = g_socket_get_fd (g_socket_connection_get_socket (client->connection));
+        g_variant_builder_add (&clients, "(thsu@ay@ay)",
+                               (guint64) client->id,
+                               (gint32) fds->len,
+                               client->device ? mbim_device_get_path (client->device) : "",
+                               client->timeout_secs,
+                               handoff_subscribe_list_variant (client->mbim_event_entry_array, client->mbim_event_entry_array_size),
+                               handoff_bytes_variant (client->buffer ? &client->buffer->data[client->buffer_offset] : NULL,
+                                                      client->buffer ? client->buffer->len - client->buffer_offset : 0));
+        g_array_append_val (fds, fd);
+    }
+
+    state = g_variant_ref_sink (g_variant_new (HANDOFF_STATE_TYPE,
+                                               HANDOFF_STATE_VERSION,
+                                               (guint64) self->priv->client_id,
+                                               0, /* listening socket */
+                                               &devices,
+                                               &clients));
+
+    g_debug ("handing off %u devices and %u clients...", stolen_fds->len, fds->len - stolen_fds->len - 1);
+
+    socket = g_socket_connection_get_socket (self->priv->handoff_connection);
+    g_socket_set_timeout (socket, HANDOFF_SOCKET_TIMEOUT_SECS);
+    header[0] = g_variant_get_size (state);
+    header[1] = fds->len;
+    if (!handoff_send_all (socket, (const guint8 *) header, sizeof (header), error) ||
+        !handoff_send_all (socket, g_variant_get_data (state), g_variant_get_size (state), error) ||
+        !handoff_send_fds (socket, fds, error))
+        return FALSE;
+
+    /* Wait until the new proxy has taken over */
+    if (!handoff_receive_all (socket, &ack, 1, error))
+        return FALSE;
+    if (ack != HANDOFF_ACK) {
+        g_set_error (error, MBIM_CORE_ERROR, MBIM_CORE_ERROR_FAILED, "Unexpected handoff acknowledgement");
+        return FALSE;
+    }
+    return TRUE;
+}
+
+static gboolean
+handoff_transfer (MbimProxy  *self,
+                  GError    **error)
+{
+    g_autoptr(GPtrArray) stolen_devices = NULL;
+    g_autoptr(GArray)    stolen_fds = NULL;
+    g_autoptr(GList)     clients = NULL;
+    g_autoptr(GError)    commit_error = NULL;
+    GList               *l;
+    guint                i;
+    guint8               commit = HANDOFF_COMMIT;
+
+    stolen_devices = g_ptr_array_new_with_free_func (g_object_unref);
+    stolen_fds = g_array_new (FALSE, FALSE, sizeof (gint));
+
+    if (!handoff_send_state (self, stolen_devices, stolen_fds, error)) {
+        /* Keep on using the devices as they were */
+        for (i = 0; i < stolen_devices->len; i++) {
+            MbimDevice        *device = g_ptr_array_index (stolen_devices, i);
+            g_autoptr(GError)  inner_error = NULL;
+
+            if (!_mbim_device_adopt_fd (device, g_array_index (stolen_fds, gint, i), &inner_error)) {
+                g_warning ("[%s] couldn't resume using the device: %s", mbim_device_get_path (device), inner_error->message);
+                untrack_device (self, device);
+            }
+        }
+        return FALSE;
+    }
+
+    /* The new proxy owns everything now; the devices were already closed and
+     * untracking them and the clients just releases our side */
+    for (i = 0; i < stolen_fds->len; i++)
+        close (g_array_index (stolen_fds, gint, i));
+    while (self->priv->devices)
+        untrack_device (self, MBIM_DEVICE (self->priv->devices->data));
+    clients = g_hash_table_get_values (self->priv->clients);
+    g_list_foreach (clients, (GFunc) client_ref, NULL);
+    for (l = clients; l; l = g_list_next (l)) {
+        untrack_client (self, (Client *) l->data);
+        client_unref ((Client *) l->data);
+    }
+    g_socket_listener_close (G_SOCKET_LISTENER (self->priv->socket_service));
+
+    /* Nothing is used here any more, the new proxy may start */
+    if (!handoff_send_all (g_socket_connection_get_socket (self->priv->handoff_connection), &commit, 1, &commit_error))
+        g_warning ("couldn't commit handoff: %s", commit_error->message);
+    return TRUE;
+}
+
+static void
+handoff_resume (MbimProxy *self)
+{
+    g_autoptr(GError) error = NULL;
+
+    g_clear_object (&self->priv->handoff_connection);
+    handoff_pause_clients (self, FALSE);
+    g_socket_service_start (self->priv->socket_service);
+
+    if (self->priv->handoff && !setup_handoff_service (self, &error))
+        g_warning ("couldn't listen for handoff requests: %s", error->message);
+}
+
+static gboolean
+handoff_quiesce_cb (MbimProxy *self)
+{
+    g_autoptr(ProxyLocker) locker = proxy_locker_new (self);
+    g_autoptr(GError)      error = NULL;
+    gint64                 elapsed;
+
+    elapsed = g_get_monotonic_time () - self->priv->handoff_start;
+    if (!handoff_is_quiescent (self)) {
+        if (elapsed < (HANDOFF_QUIESCE_TIMEOUT_MS * 1000))
+            return G_SOURCE_CONTINUE;
+        g_set_error (&error, MBIM_CORE_ERROR, MBIM_CORE_ERROR_TIMEOUT,
+                     "Devices not idle after %u ms", HANDOFF_QUIESCE_TIMEOUT_MS);
+    }
+
+    g_clear_pointer (&self->priv->handoff_source, g_source_unref);
+
+    if (!error && handoff_transfer (self, &error)) {
+        g_debug ("handoff completed (%.1f ms waiting for devices to be idle, %.1f ms total)",
+                 (gdouble) elapsed / 1000.0,
+                 (gdouble) (g_get_monotonic_time () - self->priv->handoff_start) / 1000.0);
+        g_clear_object (&self->priv->handoff_connection);
+        g_signal_emit (self, signals[SIGNAL_HANDED_OFF], 0);
+        return G_SOURCE_REMOVE;
+    }
+
+    g_warning ("handoff failed: %s", error->message);
+    handoff_resume (self);
+    return G_SOURCE_REMOVE;
+}
+
+static void
+handoff_incoming_cb (GSocketService    *service,
+                     GSocketConnection *connection,
+                     GObject           *unused,
+                     MbimProxy         *self)
+{
+    g_autoptr(ProxyLocker)  locker = proxy_locker_new (self);
+    g_autoptr(GCredentials) credentials = NULL;
+    g_autoptr(GError)       error = NULL;
+    uid_t                   uid;
+
+    credentials = g_socket_get_credentials (g_socket_connection_get_socket (connection), &error);
+    if (!credentials) {
+        g_warning ("handoff not allowed: error getting socket credentials: %s", error->message);
+        return;
+    }
+
+    uid = g_credentials_get_unix_user (credentials, &error);
+    if (error) {
+        g_warning ("handoff not allowed: error getting unix user id: %s", error->message);
+        return;
+    }
+
+    if (uid != getuid ()) {
+        g_warning ("handoff not allowed: requested by user %u", (guint) uid);
+        return;
+    }
+
+    if (self->priv->device_threads) {
+        g_warning ("handoff not allowed: not supported with device threads");
+        return;
+    }
+
+    if (self->priv->handoff_connection) {
+        g_warning ("handoff not allowed: already ongoing");
+        return;
+    }
+
+    g_debug ("handoff requested, waiting for devices to be idle...");
+    self->priv->handoff_connection = g_object_ref (connection);
+    self->priv->handoff_start = g_get_monotonic_time ();
+
+    /* Release the handoff socket name right away, so that the new proxy can
+     * listen on it; new clients wait in the backlog of the listening socket,
+     * and requests of the current ones in their sockets */
+    g_socket_service_stop (self->priv->handoff_service);
+    g_socket_listener_close (G_SOCKET_LISTENER (self->priv->handoff_service));
+    g_socket_service_stop (self->priv->socket_service);
+    handoff_pause_clients (self, TRUE);
+
+    self->priv->handoff_source = g_timeout_source_new (HANDOFF_QUIESCE_CHECK_MS);
+    g_source_set_callback (self->priv->handoff_source, (GSourceFunc) handoff_quiesce_cb, self, NULL);
+    g_source_attach (self->priv->handoff_source, g_main_context_get_thread_default ());
+}
+
+static gboolean
+setup_handoff_service (MbimProxy  *self,
+                       GError    **error)
+{
+    g_autoptr(GSocket) socket = NULL;
+
+    g_clear_object (&self->priv->handoff_service);
+
+    socket = create_listening_socket (MBIM_PROXY_HANDOFF_SOCKET_PATH, error);
+    if (!socket)
+        return FALSE;
+
+    self->priv->handoff_service = g_socket_service_new ();
+    g_signal_connect (self->priv->handoff_service, "incoming", G_CALLBACK (handoff_incoming_cb), self);
+    if (!g_socket_listener_add_socket (G_SOCKET_LISTENER (self->priv->handoff_service), socket, NULL, error)) {
+        g_clear_object (&self->priv->handoff_service);
+        return FALSE;
+    }
+
+    g_debug ("listening for handoff requests at '%s'...", MBIM_PROXY_HANDOFF_SOCKET_PATH);
+    g_socket_service_start (self->priv->handoff_service);
+    return TRUE;
+}
+
+static void
+stop_handoff_service (MbimProxy *self)
+{
+    if (!self->priv->handoff_service)
+        return;
+
+    g_socket_service_stop (self->priv->handoff_service);
+    g_socket_listener_close (G_SOCKET_LISTENER (self->priv->handoff_service));
+    g_clear_object (&self->priv->handoff_service);
+}
+
+static void
+set_handoff (MbimProxy *self,
+             gboolean   handoff)
+{
+    g_autoptr(GError) error = NULL;
+
+    self->priv->handoff = handoff;
+    if (!handoff)
+        stop_handoff_service (self);
+    else if (!self->priv->handoff_service && !self->priv->handoff_connection &&
+             !setup_handoff_service (self, &error))
+        g_warning ("couldn't listen for handoff requests: %s", error->message);
+}
+
+static gboolean
+handoff_take_device (MbimProxy  *self,
+                     GVariant   *entry,
+                     GArray     *fds,
+                     GError    **error)
+{
+    g_autoptr(MbimDevice)   device = NULL;
+    g_autoptr(GFile)        file = NULL;
+    g_autoptr(GVariant)     subscribe_list = NULL;
+    g_autoptr(GVariant)     indication = NULL;
+    const gchar            *path;
+    gint32                  handle;
+    guint32                 transaction_id;
+    guint8                  mbimex_major;
+    guint8                  mbimex_minor;
+    gboolean                in_session;
+    gint                    fd;
+    MbimEventEntry        **array;
+    gsize                   array_size = 0;
+    const guint8           *raw;
+    gsize                   raw_len;
+
+    g_variant_get (entry, "(&shuyyb@ay@ay)",
+                   &path, &handle, &transaction_id, &mbimex_major, &mbimex_minor,
+                   &in_session, &subscribe_list, &indication);
+
+    fd = handoff_take_fd (fds, handle, error);
+    if (fd < 0)
+        return FALSE;
+
+    file = g_file_new_for_path (path);
+    device = g_object_new (MBIM_TYPE_DEVICE,
+                           MBIM_DEVICE_FILE,           file,
+                           MBIM_DEVICE_TRANSACTION_ID, MAX (transaction_id, 1),
+                           MBIM_DEVICE_IN_SESSION,     in_session,
+                           NULL);
+    if (!_mbim_device_adopt_fd (device, fd, error)) {
+        g_prefix_error (error, "Cannot take over device '%s': ", path);
+        return FALSE;
+    }
+    mbim_device_set_ms_mbimex_version (device, mbimex_major, mbimex_minor, NULL);
+    track_device (self, device);
+
+    /* The merged subscribe list already configured in the device */
+    array = handoff_subscribe_list_parse (subscribe_list, &array_size);
+    if (array) {
+        DeviceContext *ctx;
+
+        ctx = device_context_get (device);
+        g_clear_pointer (&ctx->mbim_event_entry_array, mbim_event_entry_array_free);
+        ctx->mbim_event_entry_array = array;
+        ctx->mbim_event_entry_array_size = array_size;
+    }
+
+    raw = g_variant_get_fixed_array (indication, &raw_len, sizeof (guint8));
+    if (raw_len > 0)
+        g_object_set_data_full (G_OBJECT (device),
+                                MBIM_DEVICE_PROXY_CONTROL_VERSION,
+                                mbim_message_new (raw, raw_len),
+                                (GDestroyNotify)mbim_message_unref);
+
+    g_debug ("[%s] device taken over (MBIMEx %u.%u)", path, mbimex_major, mbimex_minor);
+    return TRUE;
+}
+
+static gboolean
+handoff_take_client (MbimProxy  *self,
+                     GVariant   *entry,
+                     GArray     *fds,
+                     GError    **error)
 {
-    GList                          *l;
-    g_autoptr(MbimEventEntryArray)  updated = NULL;
-    gsize                           updated_size = 0;
-    DeviceContext                  *ctx;
-
-    g_debug ("[%s] merging client service subscribe lists...", mbim_device_get_path (device));
-    ctx = device_context_get (device);
-    g_assert (ctx);
-
-    g_assert (out_size != NULL);
+    g_autoptr(GSocket)            socket = NULL;
+    g_autoptr(GSocketConnection)  connection = NULL;
+    g_autoptr(GVariant)           subscribe_list = NULL;
+    g_autoptr(GVariant)           input = NULL;
+    guint64                       client_id;
+    gint32                        handle;
+    const gchar                  *path;
+    guint32                       timeout_secs;
+    gint                          fd;
+    Client                       *client;
+    MbimDevice                   *device;
+    MbimEventEntry              **array;
+    gsize                         array_size = 0;
+    const guint8                 *data;
+    gsize                         len;
+
+    g_variant_get (entry, "(th&su@ay@ay)",
+                   &client_id, &handle, &path, &timeout_secs, &subscribe_list, &input);
+
+    fd = handoff_take_fd (fds, handle, error);
+    if (fd < 0)
+        return FALSE;
 
-    /* Init default list */
-    updated = _mbim_proxy_helper_service_subscribe_list_new_standard (&updated_size);
+    socket = g_socket_new_from_fd (fd, error);
+    if (!socket) {
+        close (fd);
+        return FALSE;
+    }
+    connection = g_socket_connection_factory_create_connection (socket);
 
-    /* Lookup all clients with this device */
-    for (l = self->priv->clients; l; l = g_list_next (l)) {
-        Client *client;
+    /* If no longer allowed, the client is just dropped */
+    client = client_new (self, connection, (gulong) client_id);
+    if (!client)
+        return TRUE;
 
-        client = l->data;
-        if (!client->mbim_event_entry_array)
-            continue;
+    client->timeout_secs = timeout_secs;
 
-        /* Add per-client list */
-        if (client->device == device)
-            updated = _mbim_proxy_helper_service_subscribe_list_merge (updated, updated_size,
-                                                                       client->mbim_event_entry_array, client->mbim_event_entry_array_size,
-                                                                       &updated_size);
+    array = handoff_subscribe_list_parse (subscribe_list, &array_size);
+    if (array) {
+        g_clear_pointer (&client->mbim_event_entry_array, mbim_event_entry_array_free);
+        client->mbim_event_entry_array = array;
+        client->mbim_event_entry_array_size = array_size;
     }
 
-    /* If lists are equal, ignore re-setting them up */
-    if (_mbim_proxy_helper_service_subscribe_list_cmp (
-            (const MbimEventEntry *const *)updated, updated_size,
-            (const MbimEventEntry *const *)ctx->mbim_event_entry_array, ctx->mbim_event_entry_array_size)) {
-        g_debug ("[%s] merged service subscribe list not updated", mbim_device_get_path (device));
-        return NULL;
+    data = g_variant_get_fixed_array (input, &len, sizeof (guint8));
+    if (len > 0) {
+        client->buffer = g_byte_array_sized_new (MAX (len, BUFFER_SIZE));
+        g_byte_array_append (client->buffer, data, len);
     }
 
-    /* Lists are different, update stored one */
-    g_clear_pointer (&ctx->mbim_event_entry_array, mbim_event_entry_array_free);
-    ctx->mbim_event_entry_array = g_steal_pointer (&updated);
-    ctx->mbim_event_entry_array_size = updated_size;
+    /* Linking the device also routes the indications the client subscribed to */
+    device = path[0] ? peek_device_for_path (self, path) : NULL;
+    if (device)
+        client_set_device (client, device);
 
-    if (mbim_utils_get_traces_enabled ()) {
-        g_debug ("[%s] merged service subscribe list built", mbim_device_get_path (device));
-        _mbim_proxy_helper_service_subscribe_list_debug ((const MbimEventEntry * const *)ctx->mbim_event_entry_array,
-                                                         ctx->mbim_event_entry_array_size);
-    }
+    client_attach_readable_source (client);
+    track_client (self, client);
+    client_unref (client);
 
-    *out_size = ctx->mbim_event_entry_array_size;
-    return ctx->mbim_event_entry_array;
+    g_debug ("[client %lu] client taken over", (gulong) client_id);
+    return TRUE;
 }
 
-static void
-reset_client_service_subscribe_lists (MbimProxy  *self,
-                                      MbimDevice *device)
+static gboolean
+handoff_take_state (MbimProxy  *self,
+                    GVariant   *state,
+                    GArray     *fds,
+                    GError    **error)
 {
-    DeviceContext *ctx;
-    GList         *l;
-
-    g_debug ("[%s] reseting client service subscribe lists...", mbim_device_get_path (device));
-    ctx = device_context_get (device);
-    g_assert (ctx);
-
-    /* make sure that all clients of this device don't track any event registered */
-    for (l = self->priv->clients; l; l = g_list_next (l)) {
-        Client *client;
+    g_autoptr(GVariantIter) devices = NULL;
+    g_autoptr(GVariantIter) clients = NULL;
+    g_autoptr(GSocket)      listener = NULL;
+    GVariant               *entry;
+    guint32                 version;
+    guint64                 client_id;
+    gint32                  handle;
+    gint                    fd;
+
+    g_variant_get_child (state, 0, "u", &version);
+    if (version != HANDOFF_STATE_VERSION) {
+        g_set_error (error, MBIM_CORE_ERROR, MBIM_CORE_ERROR_UNSUPPORTED,
+                     "Unsupported handoff state version: %u", version);
+        return FALSE;
+    }
 
-        client = l->data;
-        if (!client->mbim_event_entry_array)
-            continue;
+    g_variant_get (state, HANDOFF_STATE_TYPE, NULL, &client_id, &handle, &devices, &clients);
 
-        if (client->device == device) {
-            g_clear_pointer (&client->mbim_event_entry_array, mbim_event_entry_array_free);
-            client->mbim_event_entry_array = _mbim_proxy_helper_service_subscribe_list_new_standard (&client->mbim_event_entry_array_size);
-        }
+    fd = handoff_take_fd (fds, handle, error);
+    if (fd < 0)
+        return FALSE;
+    listener = g_socket_new_from_fd (fd, error);
+    if (!listener) {
+        close (fd);
+        return FALSE;
     }
+    if (!setup_socket_service (self, listener, error))
+        return FALSE;
+    self->priv->client_id = (gulong) client_id;
 
-    /* And reset the device-specific merged list */
-    g_clear_pointer (&ctx->mbim_event_entry_array, mbim_event_entry_array_free);
-    ctx->mbim_event_entry_array = _mbim_proxy_helper_service_subscribe_list_new_standard (&ctx->mbim_event_entry_array_size);
-}
+    /* Devices first, so that clients get linked to them */
+    while ((entry = g_variant_iter_next_value (devices)) != NULL) {
+        gboolean success;
 
-static void
-proxy_device_error_cb (MbimDevice *device,
-                       GError     *error,
-                       MbimProxy  *self)
-{
-    if (g_error_matches (error, MBIM_PROTOCOL_ERROR, MBIM_PROTOCOL_ERROR_NOT_OPENED)) {
-        g_debug ("[%s] reports as being closed...", mbim_device_get_path (device));
-        reset_client_service_subscribe_lists (self, device);
-        mbim_device_close_force (device, NULL);
+        success = handoff_take_device (self, entry, fds, error);
+        g_variant_unref (entry);
+        if (!success)
+            return FALSE;
     }
-}
 
-static MbimDevice *
-peek_device_for_path (MbimProxy   *self,
-                      const gchar *path)
-{
-    GList *l;
+    while ((entry = g_variant_iter_next_value (clients)) != NULL) {
+        gboolean success;
 
-    for (l = self->priv->devices; l; l = g_list_next (l)) {
-        /* Return if found */
-        if (g_str_equal (mbim_device_get_path ((MbimDevice *)l->data), path))
-            return (MbimDevice *)l->data;
+        success = handoff_take_client (self, entry, fds, error);
+        g_variant_unref (entry);
+        if (!success)
+            return FALSE;
     }
 
-    return NULL;
+    return TRUE;
 }
 
-static void
-proxy_device_removed_cb (MbimDevice *device,
-                         MbimProxy  *self)
+static gboolean
+handoff_receive (MbimProxy  *self,
+                 GError    **error)
 {
-    untrack_device (self, device);
-}
+    g_autoptr(GSocket)        socket = NULL;
+    g_autoptr(GSocketAddress) socket_address = NULL;
+    g_autoptr(GArray)         fds = NULL;
+    g_autoptr(GBytes)         bytes = NULL;
+    g_autoptr(GVariant)       state = NULL;
+    g_autofree guint8        *payload = NULL;
+    guint32                   header[2];
+    guint8                    ack = HANDOFF_ACK;
+    guint8                    commit = 0;
+    gboolean                  success;
+    gint64                    start;
+    guint                     i;
 
-static void
-untrack_device (MbimProxy  *self,
-                MbimDevice *device)
-{
-    GList *l;
-    GList *to_remove = NULL;
+    socket = g_socket_new (G_SOCKET_FAMILY_UNIX,
+                           G_SOCKET_TYPE_STREAM,
+                           G_SOCKET_PROTOCOL_DEFAULT,
+                           error);
+    if (!socket)
+        return FALSE;
+    g_socket_set_timeout (socket, HANDOFF_SOCKET_TIMEOUT_SECS);
 
-    g_debug ("[%s] untracking device...", mbim_device_get_path (device));
+    socket_address = (g_unix_socket_address_new_with_type (
+                          MBIM_PROXY_HANDOFF_SOCKET_PATH,
+                          -1,
+                          G_UNIX_SOCKET_ADDRESS_ABSTRACT));
+    if (!g_socket_connect (socket, socket_address, NULL, error)) {
+        g_prefix_error (error, "Cannot connect to the running proxy: ");
+        return FALSE;
+    }
 
-    if (!g_list_find (self->priv->devices, device))
-        return;
+    g_debug ("waiting for the running proxy to hand off...");
+    start = g_get_monotonic_time ();
 
-    /* Disconnect right away */
-    g_signal_handlers_disconnect_by_func (device, proxy_device_error_cb, self);
-    g_signal_handlers_disconnect_by_func (device, proxy_device_removed_cb, self);
+    if (!handoff_receive_all (socket, (guint8 *) header, sizeof (header), error))
+        return FALSE;
+    payload = g_malloc (header[0]);
+    if (!handoff_receive_all (socket, payload, header[0], error))
+        return FALSE;
+    bytes = g_bytes_new_take (g_steal_pointer (&payload), header[0]);
+    state = g_variant_ref_sink (g_variant_new_from_bytes (G_VARIANT_TYPE (HANDOFF_STATE_TYPE), bytes, FALSE));
 
-    /* If pending openings ongoing, complete them with error */
-    cancel_opening_device (self, device);
+    fds = g_array_new (FALSE, FALSE, sizeof (gint));
+    success = (handoff_receive_fds (socket, header[1], fds, error) &&
+               handoff_take_state (self, state, fds, error));
 
-    /* Lookup all clients with this device */
-    for (l = self->priv->clients; l; l = g_list_next (l)) {
-        if (((Client *)(l->data))->device == device)
-            to_remove = g_list_append (to_remove, l->data);
+    /* Close any file descriptor not taken over */
+    for (i = 0; i < fds->len; i++) {
+        if (g_array_index (fds, gint, i) >= 0)
+            close (g_array_index (fds, gint, i));
     }
 
-    /* Remove all these clients */
-    for (l = to_remove; l; l = g_list_next (l))
-        untrack_client (self, (Client *)(l->data));
-    g_list_free (to_remove);
+    if (!success)
+        return FALSE;
 
-    /* And finally, remove the device */
-    self->priv->devices = g_list_remove (self->priv->devices, device);
-    g_object_unref (device);
-    g_object_notify_by_pspec (G_OBJECT (self), properties[PROP_N_DEVICES]);
+    /* The running proxy may have given up waiting for the acknowledgement and
+     * kept on using everything */
+    if (!handoff_send_all (socket, &ack, 1, error) ||
+        !handoff_receive_all (socket, &commit, 1, error)) {
+        g_prefix_error (error, "Running proxy didn't release its devices: ");
+        return FALSE;
+    }
+    if (commit != HANDOFF_COMMIT) {
+        g_set_error (error, MBIM_CORE_ERROR, MBIM_CORE_ERROR_FAILED, "Unexpected handoff commit");
+        return FALSE;
+    }
+
+    g_debug ("took over %u devices and %u clients in %.1f ms",
+             g_list_length (self->priv->devices),
+             g_hash_table_size (self->priv->clients),
+             (gdouble) (g_get_monotonic_time () - start) / 1000.0);
+    return TRUE;
 }
 
-static void
-track_device (MbimProxy *self,
-              MbimDevice *device)
+/*****************************************************************************/
+
+MbimProxy *
+mbim_proxy_new (GError **error)
 {
-    g_signal_connect (device,
-                      MBIM_DEVICE_SIGNAL_REMOVED,
-                      G_CALLBACK (proxy_device_removed_cb),
-                      self);
+    g_autoptr(MbimProxy) self = NULL;
 
-    g_signal_connect (device,
-                      MBIM_DEVICE_SIGNAL_ERROR,
-                      G_CALLBACK (proxy_device_error_cb),
-                      self);
+    if (!mbim_helpers_check_user_allowed (getuid(), error))
+        return NULL;
 
-    self->priv->devices = g_list_append (self->priv->devices, g_object_ref (device));
-    g_object_notify_by_pspec (G_OBJECT (self), properties[PROP_N_DEVICES]);
-}
+    self = g_object_new (MBIM_TYPE_PROXY, NULL);
+    if (!setup_socket_service (self, NULL, error))
+        return NULL;
 
-/*****************************************************************************/
+    return g_steal_pointer (&self);
+}
 
 MbimProxy *
-mbim_proxy_new (GError **error)
+mbim_proxy_new_from_handoff (GError **error)
 {
     g_autoptr(MbimProxy) self = NULL;
 
@@ -1588,16 +4400,79 @@ mbim_proxy_new (GError **error)
         return NULL;
 
     self = g_object_new (MBIM_TYPE_PROXY, NULL);
-    if (!setup_socket_service (self, error))
+    if (!handoff_receive (self, error))
         return NULL;
 
     return g_steal_pointer (&self);
 }
 
+static void
+client_quota_free (ClientQuota *quota)
+{
+    g_slice_free (ClientQuota, quota);
+}
+
 static void
 mbim_proxy_init (MbimProxy *self)
 {
     self->priv = G_TYPE_INSTANCE_GET_PRIVATE (self, MBIM_TYPE_PROXY, MbimProxyPrivate);
+    self->priv->client_queue_max_size = CLIENT_QUEUE_MAX_SIZE_DEFAULT;
+    self->priv->device_max_in_flight = DEVICE_MAX_IN_FLIGHT_DEFAULT;
+    self->priv->request_timeout = REQUEST_TIMEOUT_DEFAULT;
+    self->priv->client_quotas = g_hash_table_new_full (g_direct_hash,
+                                                       g_direct_equal,
+                                                       NULL,
+                                                       (GDestroyNotify) client_quota_free);
+    self->priv->clients = g_hash_table_new_full (g_direct_hash,
+                                                 g_direct_equal,
+                                                 NULL,
+                                                 (GDestroyNotify) client_unref);
+    self->priv->workers = g_hash_table_new_full (g_str_hash,
+                                                 g_str_equal,
+                                                 NULL,
+                                                 (GDestroyNotify) device_worker_free);
+    self->priv->context = g_main_context_ref_thread_default ();
+    g_rec_mutex_init (&self->priv->lock);
+    g_mutex_init (&self->priv->tables_lock);
+}
+
+static void
+set_property (GObject      *object,
+              guint         prop_id,
+              const GValue *value,
+              GParamSpec   *pspec)
+{
+    MbimProxy *self = MBIM_PROXY (object);
+
+    switch (prop_id) {
+    case PROP_CLIENT_QUEUE_MAX_SIZE:
+        self->priv->client_queue_max_size = g_value_get_uint (value);
+        break;
+    case PROP_CLIENT_QUEUE_DROP_INDICATIONS:
+        self->priv->client_queue_drop_indications = g_value_get_boolean (value);
+        break;
+    case PROP_DEVICE_MAX_IN_FLIGHT:
+        self->priv->device_max_in_flight = g_value_get_uint (value);
+        break;
+    case PROP_QUERY_CACHE_TTL:
+        self->priv->query_cache_ttl = g_value_get_uint (value);
+        break;
+    case PROP_INDICATION_REPLAY:
+        self->priv->indication_replay = g_value_get_boolean (value);
+        break;
+    case PROP_REQUEST_TIMEOUT:
+        self->priv->request_timeout = g_value_get_uint (value);
+        break;
+    case PROP_DEVICE_THREADS:
+        self->priv->device_threads = g_value_get_boolean (value);
+        break;
+    case PROP_HANDOFF:
+        set_handoff (self, g_value_get_boolean (value));
+        break;
+    default:
+        G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+        break;
+    }
 }
 
 static void
@@ -1610,10 +4485,34 @@ get_property (GObject    *object,
 
     switch (prop_id) {
     case PROP_N_CLIENTS:
-        g_value_set_uint (value, g_list_length (self->priv->clients));
+        g_value_set_uint (value, mbim_proxy_get_n_clients (self));
         break;
     case PROP_N_DEVICES:
-        g_value_set_uint (value, g_list_length (self->priv->devices));
+        g_value_set_uint (value, mbim_proxy_get_n_devices (self));
+        break;
+    case PROP_CLIENT_QUEUE_MAX_SIZE:
+        g_value_set_uint (value, self->priv->client_queue_max_size);
+        break;
+    case PROP_CLIENT_QUEUE_DROP_INDICATIONS:
+        g_value_set_boolean (value, self->priv->client_queue_drop_indications);
+        break;
+    case PROP_DEVICE_MAX_IN_FLIGHT:
+        g_value_set_uint (value, self->priv->device_max_in_flight);
+        break;
+    case PROP_QUERY_CACHE_TTL:
+        g_value_set_uint (value, self->priv->query_cache_ttl);
+        break;
+    case PROP_INDICATION_REPLAY:
+        g_value_set_boolean (value, self->priv->indication_replay);
+        break;
+    case PROP_REQUEST_TIMEOUT:
+        g_value_set_uint (value, self->priv->request_timeout);
+        break;
+    case PROP_DEVICE_THREADS:
+        g_value_set_boolean (value, self->priv->device_threads);
+        break;
+    case PROP_HANDOFF:
+        g_value_set_boolean (value, self->priv->handoff);
         break;
     default:
         G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
@@ -1626,12 +4525,37 @@ dispose (GObject *object)
 {
     MbimProxyPrivate *priv = MBIM_PROXY (object)->priv;
 
+    /* Stop device threads first, the state below is no longer used by
+     * anyone else afterwards */
+    if (priv->workers) {
+        GHashTableIter iter;
+        gpointer       value;
+
+        g_hash_table_iter_init (&iter, priv->workers);
+        while (g_hash_table_iter_next (&iter, NULL, &value))
+            device_worker_stop ((DeviceWorker *) value);
+    }
+    g_list_free_full (g_steal_pointer (&priv->stopping_workers), (GDestroyNotify) device_worker_free);
+
     /* This list should always be empty when disposing */
     g_assert (priv->opening_devices == NULL);
 
     if (priv->clients) {
-        g_list_free_full (priv->clients, (GDestroyNotify) client_unref);
-        priv->clients = NULL;
+        GHashTableIter iter;
+        gpointer       value;
+
+        /* Pending deferred untracks hold a reference to the client */
+        g_hash_table_iter_init (&iter, priv->clients);
+        while (g_hash_table_iter_next (&iter, NULL, &value)) {
+            Client *client = value;
+
+            if (client->untrack_source) {
+                g_source_destroy (client->untrack_source);
+                g_clear_pointer (&client->untrack_source, g_source_unref);
+            }
+        }
+
+        g_clear_pointer (&priv->clients, g_hash_table_unref);
     }
 
     if (priv->devices) {
@@ -1639,10 +4563,21 @@ dispose (GObject *object)
         priv->devices = NULL;
     }
 
+    g_clear_pointer (&priv->client_quotas, g_hash_table_unref);
+    g_clear_pointer (&priv->workers, g_hash_table_unref);
+
+    if (priv->handoff_source) {
+        g_source_destroy (priv->handoff_source);
+        g_clear_pointer (&priv->handoff_source, g_source_unref);
+    }
+    g_clear_object (&priv->handoff_connection);
+    stop_handoff_service (MBIM_PROXY (object));
+
     if (priv->socket_service) {
         if (g_socket_service_is_active (priv->socket_service))
             g_socket_service_stop (priv->socket_service);
         g_clear_object (&priv->socket_service);
+        g_clear_object (&priv->socket);
         g_unlink (MBIM_PROXY_SOCKET_PATH);
         g_debug ("UNIX socket service at '%s' stopped", MBIM_PROXY_SOCKET_PATH);
     }
@@ -1650,6 +4585,18 @@ dispose (GObject *object)
     G_OBJECT_CLASS (mbim_proxy_parent_class)->dispose (object);
 }
 
+static void
+finalize (GObject *object)
+{
+    MbimProxyPrivate *priv = MBIM_PROXY (object)->priv;
+
+    g_rec_mutex_clear (&priv->lock);
+    g_mutex_clear (&priv->tables_lock);
+    g_main_context_unref (priv->context);
+
+    G_OBJECT_CLASS (mbim_proxy_parent_class)->finalize (object);
+}
+
 static void
 mbim_proxy_class_init (MbimProxyClass *proxy_class)
 {
@@ -1659,7 +4606,9 @@ mbim_proxy_class_init (MbimProxyClass *proxy_class)
 
     /* Virtual methods */
     object_class->get_property = get_property;
+    object_class->set_property = set_property;
     object_class->dispose = dispose;
+    object_class->finalize = finalize;
 
     /**
      * MbimProxy:mbim-proxy-n-clients
@@ -1690,4 +4639,137 @@ mbim_proxy_class_init (MbimProxyClass *proxy_class)
                            0,
                            G_PARAM_READABLE);
     g_object_class_install_property (object_class, PROP_N_DEVICES, properties[PROP_N_DEVICES]);
+
+    /**
+     * MbimProxy:mbim-proxy-client-queue-max-size
+     *
+     * Since: 1.30
+     */
+    properties[PROP_CLIENT_QUEUE_MAX_SIZE] =
+        g_param_spec_uint (MBIM_PROXY_CLIENT_QUEUE_MAX_SIZE,
+                           "Client queue maximum size",
+                           "Maximum number of bytes pending to be written to a client, or 0 for no limit",
+                           0,
+                           G_MAXUINT,
+                           CLIENT_QUEUE_MAX_SIZE_DEFAULT,
+                           G_PARAM_READWRITE);
+    g_object_class_install_property (object_class, PROP_CLIENT_QUEUE_MAX_SIZE, properties[PROP_CLIENT_QUEUE_MAX_SIZE]);
+
+    /**
+     * MbimProxy:mbim-proxy-client-queue-drop-indications
+     *
+     * Since: 1.30
+     */
+    properties[PROP_CLIENT_QUEUE_DROP_INDICATIONS] =
+        g_param_spec_boolean (MBIM_PROXY_CLIENT_QUEUE_DROP_INDICATIONS,
+                              "Client queue drop indications",
+                              "Whether indications are dropped instead of disconnecting the client when its output queue is full",
+                              FALSE,
+                              G_PARAM_READWRITE);
+    g_object_class_install_property (object_class, PROP_CLIENT_QUEUE_DROP_INDICATIONS, properties[PROP_CLIENT_QUEUE_DROP_INDICATIONS]);
+
+    /**
+     * MbimProxy:mbim-proxy-device-max-in-flight
+     *
+     * Since: 1.30
+     */
+    properties[PROP_DEVICE_MAX_IN_FLIGHT] =
+        g_param_spec_uint (MBIM_PROXY_DEVICE_MAX_IN_FLIGHT,
+                           "Device maximum in flight",
+                           "Maximum number of client requests forwarded to a device and not yet completed, or 0 for no limit",
+                           0,
+                           G_MAXUINT,
+                           DEVICE_MAX_IN_FLIGHT_DEFAULT,
+                           G_PARAM_READWRITE);
+    g_object_class_install_property (object_class, PROP_DEVICE_MAX_IN_FLIGHT, properties[PROP_DEVICE_MAX_IN_FLIGHT]);
+
+    /**
+     * MbimProxy:mbim-proxy-query-cache-ttl
+     *
+     * Since: 1.30
+     */
+    properties[PROP_QUERY_CACHE_TTL] =
+        g_param_spec_uint (MBIM_PROXY_QUERY_CACHE_TTL,
+                           "Query cache TTL",
+                           "Time in milliseconds query responses are cached and shared among clients, or 0 to disable the cache",
+                           0,
+                           G_MAXUINT,
+                           0,
+                           G_PARAM_READWRITE);
+    g_object_class_install_property (object_class, PROP_QUERY_CACHE_TTL, properties[PROP_QUERY_CACHE_TTL]);
+
+    /**
+     * MbimProxy:mbim-proxy-indication-replay
+     *
+     * Since: 1.30
+     */
+    properties[PROP_INDICATION_REPLAY] =
+        g_param_spec_boolean (MBIM_PROXY_INDICATION_REPLAY,
+                              "Indication replay",
+                              "Whether the last indications received are replayed to the clients subscribing to them",
+                              FALSE,
+                              G_PARAM_READWRITE);
+    g_object_class_install_property (object_class, PROP_INDICATION_REPLAY, properties[PROP_INDICATION_REPLAY]);
+
+    /**
+     * MbimProxy:mbim-proxy-request-timeout
+     *
+     * Since: 1.30
+     */
+    properties[PROP_REQUEST_TIMEOUT] =
+        g_param_spec_uint (MBIM_PROXY_REQUEST_TIMEOUT,
+                           "Request timeout",
+                           "Time in seconds client requests are kept in flight in the device, unless the client configured its own",
+                           1,
+                           G_MAXUINT,
+                           REQUEST_TIMEOUT_DEFAULT,
+                           G_PARAM_READWRITE);
+    g_object_class_install_property (object_class, PROP_REQUEST_TIMEOUT, properties[PROP_REQUEST_TIMEOUT]);
+
+    /**
+     * MbimProxy:mbim-proxy-device-threads
+     *
+     * Since: 1.30
+     */
+    properties[PROP_DEVICE_THREADS] =
+        g_param_spec_boolean (MBIM_PROXY_DEVICE_THREADS,
+                              "Device threads",
+                              "Whether each device and its clients are handled in a separate thread",
+                              FALSE,
+                              G_PARAM_READWRITE);
+    g_object_class_install_property (object_class, PROP_DEVICE_THREADS, properties[PROP_DEVICE_THREADS]);
+
+    /**
+     * MbimProxy:mbim-proxy-handoff
+     *
+     * Since: 1.30
+     */
+    properties[PROP_HANDOFF] =
+        g_param_spec_boolean (MBIM_PROXY_HANDOFF,
+                              "Handoff",
+                              "Whether devices and clients are handed off to a new proxy process requesting it",
+                              FALSE,
+                              G_PARAM_READWRITE);
+    g_object_class_install_property (object_class, PROP_HANDOFF, properties[PROP_HANDOFF]);
+
+    /**
+     * MbimProxy::mbim-proxy-handed-off:
+     * @self: the #MbimProxy
+     *
+     * The ::mbim-proxy-handed-off signal is emitted when all devices and
+     * clients have been handed off to a new proxy process, after which this
+     * proxy no longer accepts clients.
+     *
+     * Since: 1.30
+     */
+    signals[SIGNAL_HANDED_OFF] =
+        g_signal_new (MBIM_PROXY_SIGNAL_HANDED_OFF,
+                      G_OBJECT_CLASS_TYPE (G_OBJECT_CLASS (proxy_class)),
+                      G_SIGNAL_RUN_LAST,
+                      0,
+                      NULL,
+                      NULL,
+                      NULL,
+                      G_TYPE_NONE,
+                      0);
 }
@@ -71,6 +71,144 @@ typedef struct _MbimProxyPrivate MbimProxyPrivate;
  */
 #define MBIM_PROXY_N_DEVICES "mbim-proxy-n-devices"
 
+/**
+ * MBIM_PROXY_CLIENT_QUEUE_MAX_SIZE:
+ *
+ * Symbol defining the #MbimProxy:mbim-proxy-client-queue-max-size property.
+ *
+ * Messages to clients are queued and written whenever the client socket is
+ * writable, so that a slow client never blocks the proxy. Once the amount of
+ * bytes pending for a single client goes over this limit, the client is
+ * disconnected, or indications to it are dropped if
+ * #MbimProxy:mbim-proxy-client-queue-drop-indications is set.
+ *
+ * Since: 1.30
+ */
+#define MBIM_PROXY_CLIENT_QUEUE_MAX_SIZE "mbim-proxy-client-queue-max-size"
+
+/**
+ * MBIM_PROXY_CLIENT_QUEUE_DROP_INDICATIONS:
+ *
+ * Symbol defining the #MbimProxy:mbim-proxy-client-queue-drop-indications property.
+ *
+ * Since: 1.30
+ */
+#define MBIM_PROXY_CLIENT_QUEUE_DROP_INDICATIONS "mbim-proxy-client-queue-drop-indications"
+
+/**
+ * MBIM_PROXY_DEVICE_MAX_IN_FLIGHT:
+ *
+ * Symbol defining the #MbimProxy:mbim-proxy-device-max-in-flight property.
+ *
+ * If set, client requests are not forwarded to the device right away; they
+ * are queued per client and dispatched in round robin order among the clients
+ * with requests waiting, as long as the amount of requests already in flight
+ * in the device is below this limit. There is no limit by default.
+ *
+ * Since: 1.30
+ */
+#define MBIM_PROXY_DEVICE_MAX_IN_FLIGHT "mbim-proxy-device-max-in-flight"
+
+/**
+ * MBIM_PROXY_QUERY_CACHE_TTL:
+ *
+ * Symbol defining the #MbimProxy:mbim-proxy-query-cache-ttl property.
+ *
+ * If set, successful query responses are cached for the given amount of
+ * milliseconds and reused for the same query (same service, CID and payload)
+ * from any client, until an indication with the same service and CID is
+ * received or a set request with the same service and CID completes.
+ * Identical queries from different clients received while the first one is
+ * in flight are also coalesced into a single device transaction.
+ *
+ * Since: 1.30
+ */
+#define MBIM_PROXY_QUERY_CACHE_TTL "mbim-proxy-query-cache-ttl"
+
+/**
+ * MBIM_PROXY_INDICATION_REPLAY:
+ *
+ * Symbol defining the #MbimProxy:mbim-proxy-indication-replay property.
+ *
+ * If set, the last indication received for each service and CID in a device
+ * is kept, and sent to the clients right after they subscribe to it, so that
+ * they don't need to query the current state.
+ *
+ * Since: 1.30
+ */
+#define MBIM_PROXY_INDICATION_REPLAY "mbim-proxy-indication-replay"
+
+/**
+ * MBIM_PROXY_REQUEST_TIMEOUT:
+ *
+ * Symbol defining the #MbimProxy:mbim-proxy-request-timeout property.
+ *
+ * Client requests forwarded to the device wait for a response during the
+ * timeout the client reported in the proxy configuration request, or during
+ * this amount of seconds if the client didn't report any. Requests still in
+ * flight when the client disconnects are cancelled right away.
+ *
+ * Since: 1.30
+ */
+#define MBIM_PROXY_REQUEST_TIMEOUT "mbim-proxy-request-timeout"
+
+/**
+ * MBIM_PROXY_DEVICE_THREADS:
+ *
+ * Symbol defining the #MbimProxy:mbim-proxy-device-threads property.
+ *
+ * If set, each device is run in its own thread, and each client is handled
+ * in the thread of its device once it has configured the proxy, so that the
+ * traffic of one device doesn't delay the others. New clients are always
+ * accepted in the thread where the #MbimProxy was created, and the thread of
+ * a device is stopped once the device is gone. The #MbimProxy:mbim-proxy-n-clients
+ * and #MbimProxy:mbim-proxy-n-devices notifications may be emitted from any
+ * of these threads.
+ *
+ * This property must be set before any client is connected.
+ *
+ * Since: 1.30
+ */
+#define MBIM_PROXY_DEVICE_THREADS "mbim-proxy-device-threads"
+
+/**
+ * MBIM_PROXY_HANDOFF_SOCKET_PATH:
+ *
+ * Symbol defining the abstract socket name where a #MbimProxy listens for a
+ * new proxy process taking over its devices and clients.
+ *
+ * Since: 1.30
+ */
+#define MBIM_PROXY_HANDOFF_SOCKET_PATH "mbim-proxy-handoff"
+
+/**
+ * MBIM_PROXY_HANDOFF:
+ *
+ * Symbol defining the #MbimProxy:mbim-proxy-handoff property.
+ *
+ * If set, the #MbimProxy listens in %MBIM_PROXY_HANDOFF_SOCKET_PATH for a new
+ * proxy process created with mbim_proxy_new_from_handoff(), run by the same
+ * user. Once all devices are idle, the listening socket, the open devices,
+ * their session state, MBIMEx versions and merged service subscribe lists,
+ * and the connected clients are all transferred to the new proxy, so that
+ * neither the devices are reopened nor the clients disconnected. The
+ * #MbimProxy::mbim-proxy-handed-off signal is emitted afterwards.
+ *
+ * Handoff is not supported with #MbimProxy:mbim-proxy-device-threads.
+ *
+ * Since: 1.30
+ */
+#define MBIM_PROXY_HANDOFF "mbim-proxy-handoff"
+
+/**
+ * MBIM_PROXY_SIGNAL_HANDED_OFF:
+ *
+ * Symbol defining the #MbimProxy::mbim-proxy-handed-off signal.
+ *
+ * Since: 1.30
+ */
+#define MBIM_PROXY_SIGNAL_HANDED_OFF "mbim-proxy-handed-off"
+
 /**
  * MbimProxy:
  *
@@ -103,6 +241,24 @@ G_DEFINE_AUTOPTR_CLEANUP_FUNC (MbimProxy, g_object_unref)
  */
 MbimProxy *mbim_proxy_new (GError **error);
 
+/**
+ * mbim_proxy_new_from_handoff:
+ * @error: Return location for error or %NULL.
+ *
+ * Creates a #MbimProxy object taking over the listening socket, devices and
+ * clients of the running proxy, which must have the #MbimProxy:mbim-proxy-handoff
+ * property set.
+ *
+ * If the running proxy gives up waiting for this one to take over, it keeps
+ * on using its devices and clients, and this method fails without using any
+ * of them.
+ *
+ * Returns: (transfer full): a newly created #MbimProxy, or #NULL if @error is set.
+ *
+ * Since: 1.30
+ */
+MbimProxy *mbim_proxy_new_from_handoff (GError **error);
+
 /**
  * mbim_proxy_get_n_clients: (skip)
  * @self: a #MbimProxy.
@@ -127,6 +283,26 @@ guint mbim_proxy_get_n_clients (MbimProxy *self);
  */
 guint mbim_proxy_get_n_devices (MbimProxy *self);
 
+/**
+ * mbim_proxy_set_client_quota:
+ * @self: a #MbimProxy.
+ * @uid: the user id of the clients.
+ * @max_in_flight: maximum number of requests in flight per client, or 0 for no limit.
+ * @weight: number of requests a client may dispatch on each round robin turn.
+ *
+ * Configures the request scheduling quota of the clients connected by the
+ * user with the given @uid. Clients without a specific quota may have any
+ * number of requests in flight, and dispatch one request on each turn.
+ *
+ * The quota applies to the clients connected after this call.
+ *
+ * Since: 1.30
+ */
+void mbim_proxy_set_client_quota (MbimProxy *self,
+                                  guint      uid,
+                                  guint      max_in_flight,
+                                  guint      weight);
+
 G_END_DECLS
 
 #endif /* MBIM_PROXY_H */
@@ -0,0 +1,1255 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * libmbim-glib -- GLib/GIO based library to control MBIM devices
+ */
+
+#include <config.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include <glib.h>
+#include <glib-unix.h>
+
+#include "mbim-simulator.h"
+#include "mbim-message-private.h"
+#include "mbim-cid.h"
+#include "mbim-utils.h"
+#include "mbim-enum-types.h"
+#include "mbim-error-types.h"
+#include "mbim-basic-connect.h"
+
+/* Size of the chunks read from the pseudo-terminal */
+#define BUFFER_SIZE 4096
+
+/* Default maximum size of the messages sent to the host */
+#define MAX_FRAGMENT_SIZE_DEFAULT 4096
+
+/* Smallest message that can hold a fragment header and some payload */
+#define MAX_FRAGMENT_SIZE_MIN 64
+
+/* Highest CID looked up when resolving command names */
+#define MAX_CID_LOOKUP 64
+
+G_DEFINE_TYPE (MbimSimulator, mbim_simulator, G_TYPE_OBJECT)
+
+enum {
+    PROP_0,
+    PROP_RESPONSE_DELAY,
+    PROP_MAX_FRAGMENT_SIZE,
+    PROP_STALLED,
+    PROP_N_REQUESTS,
+    PROP_LAST
+};
+
+static GParamSpec *properties[PROP_LAST];
+
+struct _MbimSimulatorPrivate {
+    gint        master_fd;
+    gint        slave_fd;
+    gchar      *path;
+
+    /* I/O with the host */
+    GSource    *input_source;
+    GSource    *output_source;
+    GByteArray *input;
+    GByteArray *output;
+
+    /* Simulated function state */
+    gboolean     open;
+    guint32      host_max_control_transfer;
+    MbimMessage *fragments;
+    GList       *pending;
+
+    /* Configured behavior */
+    GHashTable *responses;
+    GPtrArray  *indications;
+    guint       response_delay;
+    guint       max_fragment_size;
+    gboolean    stalled;
+
+    guint       n_requests;
+};
+
+/*****************************************************************************/
+/* Configured responses and indications */
+
+typedef struct {
+    MbimUuid                uuid;
+    guint32                 cid;
+    MbimMessageCommandType  command_type;
+    MbimStatusError         status;
+    GBytes                 *information_buffer;
+} Response;
+
+static void
+response_free (Response *response)
+{
+    g_bytes_unref (response->information_buffer);
+    g_slice_free (Response, response);
+}
+
+static gchar *
+response_key (const MbimUuid         *uuid,
+              guint32                 cid,
+              MbimMessageCommandType  command_type)
+{
+    g_autofree gchar *printable = NULL;
+
+    printable = mbim_uuid_get_printable (uuid);
+    return g_strdup_printf ("%s/%u/%u", printable, cid, command_type);
+}
+
+typedef struct {
+    MbimService  service;
+    guint        cid;
+    GBytes      *information_buffer;
+    guint        count;
+    guint        interval;
+} Indication;
+
+static void
+indication_free (Indication *indication)
+{
+    g_bytes_unref (indication->information_buffer);
+    g_slice_free (Indication, indication);
+}
+
+/*****************************************************************************/
+/* Output to the host */
+
+static gboolean output_ready (gint           fd,
+                              GIOCondition   condition,
+                              MbimSimulator *self);
+
+static void
+output_flush (MbimSimulator *self)
+{
+    while (self->priv->output->len > 0) {
+        gssize written;
+
+        written = write (self->priv->master_fd, self->priv->output->data, self->priv->output->len);
+        if (written > 0) {
+            g_byte_array_remove_range (self->priv->output, 0, (guint) written);
+            continue;
+        }
+
+        if (written < 0 && errno == EINTR)
+            continue;
+
+        if (written < 0 && errno == EAGAIN) {
+            /* Wait until the host reads what was already written */
+            if (!self->priv->output_source) {
+                self->priv->output_source = g_unix_fd_source_new (self->priv->master_fd, G_IO_OUT);
+                g_source_set_callback (self->priv->output_source, (GSourceFunc) output_ready, self, NULL);
+                g_source_attach (self->priv->output_source, g_main_context_get_thread_default ());
+            }
+            return;
+        }
+
+        g_warning ("[%s] couldn't write to the host: %s", self->priv->path, g_strerror (errno));
+        g_byte_array_set_size (self->priv->output, 0);
+        break;
+    }
+
+    if (self->priv->output_source) {
+        g_source_destroy (self->priv->output_source);
+        g_clear_pointer (&self->priv->output_source, g_source_unref);
+    }
+}
+
+static gboolean
+output_ready (gint           fd,
+              GIOCondition   condition,
+              MbimSimulator *self)
+{
+    /* The source is destroyed by output_flush() once all is written */
+    output_flush (self);
+    return G_SOURCE_CONTINUE;
+}
+
+static void
+output_queue_message (MbimSimulator     *self,
+                      const MbimMessage *message)
+{
+    g_autofree struct fragment_info *fragments = NULL;
+    const guint8                    *raw;
+    guint32                          raw_len;
+    guint32                          max_size;
+    guint                            n_fragments;
+    guint                            i;
+
+    raw = mbim_message_get_raw (message, &raw_len, NULL);
+    g_assert (raw);
+
+    max_size = self->priv->max_fragment_size;
+    if (self->priv->host_max_control_transfer >= MAX_FRAGMENT_SIZE_MIN)
+        max_size = MIN (max_size, self->priv->host_max_control_transfer);
+
+    if (raw_len <= max_size || !_mbim_message_is_fragment (message)) {
+        g_byte_array_append (self->priv->output, raw, raw_len);
+    } else {
+        fragments = _mbim_message_split_fragments (message, max_size, &n_fragments);
+        for (i = 0; i < n_fragments; i++) {
+            g_byte_array_append (self->priv->output, (guint8 *) &fragments[i].header, sizeof (fragments[i].header));
+            g_byte_array_append (self->priv->output, (guint8 *) &fragments[i].fragment_header, sizeof (fragments[i].fragment_header));
+            g_byte_array_append (self->priv->output, fragments[i].data, fragments[i].data_length);
+        }
+    }
+
+    if (!self->priv->output_source)
+        output_flush (self);
+}
+
+/*****************************************************************************/
+/* Delayed responses and indications */
+
+typedef struct {
+    MbimSimulator *self;
+    MbimMessage   *message;
+    guint          remaining;
+    guint          interval;
+    GSource       *source;
+} PendingOutput;
+
+static void
+pending_output_free (PendingOutput *pending)
+{
+    if (pending->source) {
+        g_source_destroy (pending->source);
+        g_source_unref (pending->source);
+    }
+    mbim_message_unref (pending->message);
+    g_slice_free (PendingOutput, pending);
+}
+
+static void pending_output_schedule (PendingOutput *pending,
+                                     guint          delay);
+
+static void
+pending_output_run (PendingOutput *pending)
+{
+    MbimSimulator *self;
+
+    self = pending->self;
+    do {
+        output_queue_message (self, pending->message);
+        pending->remaining--;
+    } while (pending->remaining > 0 && pending->interval == 0);
+
+    if (pending->remaining > 0) {
+        pending_output_schedule (pending, pending->interval);
+        return;
+    }
+
+    self->priv->pending = g_list_remove (self->priv->pending, pending);
+    pending_output_free (pending);
+}
+
+static gboolean
+pending_output_cb (PendingOutput *pending)
+{
+    g_clear_pointer (&pending->source, g_source_unref);
+    pending_output_run (pending);
+    return G_SOURCE_REMOVE;
+}
+
+static void
+pending_output_schedule (PendingOutput *pending,
+                         guint          delay)
+{
+    g_assert (!pending->source);
+    pending->source = g_timeout_source_new (delay);
+    g_source_set_callback (pending->source, (GSourceFunc) pending_output_cb, pending, NULL);
+    g_source_attach (pending->source, g_main_context_get_thread_default ());
+}
+
+static void
+pending_output_add (MbimSimulator *self,
+                    MbimMessage   *message,
+                    guint          count,
+                    guint          interval,
+                    guint          delay)
+{
+    PendingOutput *pending;
+
+    if (!count)
+        return;
+
+    pending = g_slice_new0 (PendingOutput);
+    pending->self = self;
+    pending->message = mbim_message_ref (message);
+    pending->remaining = count;
+    pending->interval = interval;
+    self->priv->pending = g_list_append (self->priv->pending, pending);
+
+    if (delay)
+        pending_output_schedule (pending, delay);
+    else
+        pending_output_run (pending);
+}
+
+static void
+pending_output_clear (MbimSimulator *self)
+{
+    g_list_free_full (self->priv->pending, (GDestroyNotify) pending_output_free);
+    self->priv->pending = NULL;
+}
+
+static void
+send_response (MbimSimulator *self,
+               MbimMessage   *response)
+{
+    pending_output_add (self, response, 1, 0, self->priv->response_delay);
+}
+
+/*****************************************************************************/
+/* Message builders */
+
+static MbimMessage *
+command_done_new (const MbimMessage *request,
+                  MbimStatusError    status,
+                  const guint8      *buffer,
+                  guint32            buffer_len)
+{
+    MbimMessage                 *response;
+    struct command_done_message *command_done;
+
+    response = (MbimMessage *) _mbim_message_allocate (MBIM_MESSAGE_TYPE_COMMAND_DONE,
+                                                       mbim_message_get_transaction_id (request),
+                                                       sizeof (struct command_done_message) + buffer_len);
+    command_done = &(((struct full_message *)(response->data))->message.command_done);
+    command_done->fragment_header.total   = GUINT32_TO_LE (1);
+    command_done->fragment_header.current = 0;
+    memcpy (command_done->service_id, mbim_message_command_get_service_id (request), sizeof (MbimUuid));
+    command_done->command_id    = GUINT32_TO_LE (mbim_message_command_get_cid (request));
+    command_done->status_code   = GUINT32_TO_LE (status);
+    command_done->buffer_length = GUINT32_TO_LE (buffer_len);
+    if (buffer_len)
+        memcpy (&command_done->buffer[0], buffer, buffer_len);
+
+    return response;
+}
+
+static MbimMessage *
+indicate_status_new (MbimService   service,
+                     guint32       cid,
+                     const guint8 *buffer,
+                     guint32       buffer_len)
+{
+    MbimMessage                    *indication;
+    struct indicate_status_message *indicate_status;
+
+    indication = (MbimMessage *) _mbim_message_allocate (MBIM_MESSAGE_TYPE_INDICATE_STATUS,
+                                                         0,
+                                                         sizeof (struct indicate_status_message) + buffer_len);
+    indicate_status = &(((struct full_message *)(indication->data))->message.indicate_status);
+    indicate_status->fragment_header.total   = GUINT32_TO_LE (1);
+    indicate_status->fragment_header.current = 0;
+    memcpy (indicate_status->service_id, mbim_uuid_from_service (service), sizeof (MbimUuid));
+    indicate_status->command_id    = GUINT32_TO_LE (cid);
+    indicate_status->buffer_length = GUINT32_TO_LE (buffer_len);
+    if (buffer_len)
+        memcpy (&indicate_status->buffer[0], buffer, buffer_len);
+
+    return indication;
+}
+
+/*****************************************************************************/
+/* Built-in responses */
+
+typedef struct {
+    MbimUuid  uuid;
+    GArray   *cids;
+} DeviceService;
+
+static void
+device_service_free (DeviceService *device_service)
+{
+    g_array_unref (device_service->cids);
+    g_slice_free (DeviceService, device_service);
+}
+
+static void
+device_service_add_cid (GHashTable     *device_services,
+                        const MbimUuid *uuid,
+                        guint32         cid)
+{
+    g_autofree gchar *key = NULL;
+    DeviceService    *device_service;
+    guint             i;
+
+    key = mbim_uuid_get_printable (uuid);
+    device_service = g_hash_table_lookup (device_services, key);
+    if (!device_service) {
+        device_service = g_slice_new0 (DeviceService);
+        memcpy (&device_service->uuid, uuid, sizeof (MbimUuid));
+        device_service->cids = g_array_new (FALSE, FALSE, sizeof (guint32));
+        g_hash_table_insert (device_services, g_steal_pointer (&key), device_service);
+    }
+
+    for (i = 0; i < device_service->cids->len; i++) {
+        if (g_array_index (device_service->cids, guint32, i) == cid)
+            return;
+    }
+    g_array_append_val (device_service->cids, cid);
+}
+
+/* Basic Connect with all its known commands, plus all the services with
+ * configured responses */
+static GByteArray *
+device_services_build (MbimSimulator *self)
+{
+    g_autoptr(GHashTable)  device_services = NULL;
+    MbimStructBuilder     *builder;
+    GHashTableIter         iter;
+    gpointer               value;
+    guint32                cid;
+
+    device_services = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, (GDestroyNotify) device_service_free);
+
+    for (cid = 1; cid <= MAX_CID_LOOKUP; cid++) {
+        if (mbim_cid_get_printable (MBIM_SERVICE_BASIC_CONNECT, cid))
+            device_service_add_cid (device_services, MBIM_UUID_BASIC_CONNECT, cid);
+    }
+
+    g_hash_table_iter_init (&iter, self->priv->responses);
+    while (g_hash_table_iter_next (&iter, NULL, &value))
+        device_service_add_cid (device_services, &((Response *) value)->uuid, ((Response *) value)->cid);
+
+    builder = _mbim_struct_builder_new ();
+    _mbim_struct_builder_append_guint32 (builder, g_hash_table_size (device_services));
+    _mbim_struct_builder_append_guint32 (builder, 0); /* max dss sessions */
+
+    g_hash_table_iter_init (&iter, device_services);
+    while (g_hash_table_iter_next (&iter, NULL, &value)) {
+        DeviceService     *device_service = value;
+        MbimStructBuilder *element_builder;
+        GByteArray        *element;
+
+        element_builder = _mbim_struct_builder_new ();
+        _mbim_struct_builder_append_uuid (element_builder, &device_service->uuid);
+        _mbim_struct_builder_append_guint32 (element_builder, 0); /* dss payload */
+        _mbim_struct_builder_append_guint32 (element_builder, 0); /* max dss instances */
+        _mbim_struct_builder_append_guint32 (element_builder, device_service->cids->len);
+        _mbim_struct_builder_append_guint32_array (element_builder,
+                                                   (const guint32 *) device_service->cids->data,
+                                                   device_service->cids->len);
+        element = _mbim_struct_builder_complete (element_builder);
+        _mbim_struct_builder_append_byte_array (builder, TRUE, TRUE, FALSE, element->data, element->len, FALSE);
+        g_byte_array_unref (element);
+    }
+
+    return _mbim_struct_builder_complete (builder);
+}
+
+static MbimMessage *
+command_response_new (MbimSimulator     *self,
+                      const MbimMessage *request)
+{
+    const MbimUuid         *uuid;
+    guint32                 cid;
+    MbimMessageCommandType  command_type;
+    Response               *response;
+    g_autofree gchar       *key = NULL;
+
+    uuid = mbim_message_command_get_service_id (request);
+    cid = mbim_message_command_get_cid (request);
+    command_type = mbim_message_command_get_command_type (request);
+
+    key = response_key (uuid, cid, command_type);
+    response = g_hash_table_lookup (self->priv->responses, key);
+    if (!response) {
+        g_free (key);
+        key = response_key (uuid, cid, MBIM_MESSAGE_COMMAND_TYPE_UNKNOWN);
+        response = g_hash_table_lookup (self->priv->responses, key);
+    }
+
+    if (response) {
+        gconstpointer data;
+        gsize         size;
+
+        data = g_bytes_get_data (response->information_buffer, &size);
+        return command_done_new (request, response->status, data, (guint32) size);
+    }
+
+    if (mbim_uuid_cmp (uuid, MBIM_UUID_BASIC_CONNECT)) {
+        if (cid == MBIM_CID_BASIC_CONNECT_DEVICE_SERVICES && command_type == MBIM_MESSAGE_COMMAND_TYPE_QUERY) {
+            g_autoptr(GByteArray) device_services = NULL;
+
+            device_services = device_services_build (self);
+            return command_done_new (request, MBIM_STATUS_ERROR_NONE, device_services->data, device_services->len);
+        }
+
+        /* Accept whatever the host wants to subscribe to */
+        if (cid == MBIM_CID_BASIC_CONNECT_DEVICE_SERVICE_SUBSCRIBE_LIST && command_type == MBIM_MESSAGE_COMMAND_TYPE_SET) {
+            const guint8 *data;
+            guint32       size;
+
+            data = mbim_message_command_get_raw_information_buffer (request, &size);
+            return command_done_new (request, MBIM_STATUS_ERROR_NONE, data, size);
+        }
+    }
+
+    return command_done_new (request, MBIM_STATUS_ERROR_NO_DEVICE_SUPPORT, NULL, 0);
+}
+
+/*****************************************************************************/
+/* Input from the host */
+
+static void
+indications_start (MbimSimulator *self)
+{
+    guint i;
+
+    for (i = 0; i < self->priv->indications->len; i++) {
+        g_autoptr(MbimMessage)  message = NULL;
+        Indication             *indication;
+        gconstpointer           data;
+        gsize                   size;
+
+        indication = g_ptr_array_index (self->priv->indications, i);
+        data = g_bytes_get_data (indication->information_buffer, &size);
+        message = indicate_status_new (indication->service, indication->cid, data, (guint32) size);
+
+        /* Not before the response to the open request */
+        pending_output_add (self, message, indication->count, indication->interval, self->priv->response_delay);
+    }
+}
+
+static void
+process_command (MbimSimulator     *self,
+                 const MbimMessage *message)
+{
+    g_autoptr(MbimMessage) response = NULL;
+    g_autoptr(GError)      error = NULL;
+
+    /* Single fragment command */
+    if (_mbim_message_fragment_get_total (message) == 1) {
+        g_clear_pointer (&self->priv->fragments, mbim_message_unref);
+        response = command_response_new (self, message);
+        send_response (self, response);
+        return;
+    }
+
+    if (_mbim_message_fragment_get_current (message) == 0) {
+        g_clear_pointer (&self->priv->fragments, mbim_message_unref);
+        self->priv->fragments = _mbim_message_fragment_collector_init (message, &error);
+    } else if (self->priv->fragments)
+        _mbim_message_fragment_collector_add (self->priv->fragments, message, &error);
+    else
+        error = g_error_new (MBIM_PROTOCOL_ERROR, MBIM_PROTOCOL_ERROR_FRAGMENT_OUT_OF_SEQUENCE,
+                             "unexpected fragment");
+
+    if (error) {
+        g_debug ("[%s] invalid command fragment: %s", self->priv->path, error->message);
+        g_clear_pointer (&self->priv->fragments, mbim_message_unref);
+        response = mbim_message_function_error_new (mbim_message_get_transaction_id (message),
+                                                    (error->domain == MBIM_PROTOCOL_ERROR ?
+                                                     (MbimProtocolError) error->code :
+                                                     MBIM_PROTOCOL_ERROR_UNKNOWN));
+        send_response (self, response);
+        return;
+    }
+
+    if (!_mbim_message_fragment_collector_complete (self->priv->fragments))
+        return;
+
+    response = command_response_new (self, self->priv->fragments);
+    g_clear_pointer (&self->priv->fragments, mbim_message_unref);
+    send_response (self, response);
+}
+
+static void
+process_message (MbimSimulator     *self,
+                 const MbimMessage *message)
+{
+    g_autoptr(MbimMessage) response = NULL;
+
+    self->priv->n_requests++;
+    g_object_notify_by_pspec (G_OBJECT (self), properties[PROP_N_REQUESTS]);
+
+    if (self->priv->stalled)
+        return;
+
+    switch (mbim_message_get_message_type (message)) {
+    case MBIM_MESSAGE_TYPE_OPEN:
+        g_debug ("[%s] opened by the host", self->priv->path);
+        pending_output_clear (self);
+        g_clear_pointer (&self->priv->fragments, mbim_message_unref);
+        self->priv->open = TRUE;
+        self->priv->host_max_control_transfer = mbim_message_open_get_max_control_transfer (message);
+        response = mbim_message_open_done_new (mbim_message_get_transaction_id (message), MBIM_STATUS_ERROR_NONE);
+        send_response (self, response);
+        indications_start (self);
+        return;
+
+    case MBIM_MESSAGE_TYPE_CLOSE:
+        g_debug ("[%s] closed by the host", self->priv->path);
+        pending_output_clear (self);
+        g_clear_pointer (&self->priv->fragments, mbim_message_unref);
+        self->priv->open = FALSE;
+        response = mbim_message_close_done_new (mbim_message_get_transaction_id (message), MBIM_STATUS_ERROR_NONE);
+        send_response (self, response);
+        return;
+
+    case MBIM_MESSAGE_TYPE_COMMAND:
+        if (!self->priv->open) {
+            response = mbim_message_function_error_new (mbim_message_get_transaction_id (message),
+                                                        MBIM_PROTOCOL_ERROR_NOT_OPENED);
+            send_response (self, response);
+            return;
+        }
+        process_command (self, message);
+        return;
+
+    case MBIM_MESSAGE_TYPE_HOST_ERROR:
+        g_debug ("[%s] host reported error", self->priv->path);
+        g_clear_pointer (&self->priv->fragments, mbim_message_unref);
+        return;
+
+    case MBIM_MESSAGE_TYPE_INVALID:
+    case MBIM_MESSAGE_TYPE_OPEN_DONE:
+    case MBIM_MESSAGE_TYPE_CLOSE_DONE:
+    case MBIM_MESSAGE_TYPE_COMMAND_DONE:
+    case MBIM_MESSAGE_TYPE_FUNCTION_ERROR:
+    case MBIM_MESSAGE_TYPE_INDICATE_STATUS:
+    default:
+        g_debug ("[%s] unexpected message from the host: ignoring", self->priv->path);
+        return;
+    }
+}
+
+static void
+input_parse (MbimSimulator *self)
+{
+    while (self->priv->input->len >= sizeof (struct header)) {
+        g_autoptr(MbimMessage) message = NULL;
+        guint32                length;
+
+        length = MBIM_MESSAGE_GET_MESSAGE_LENGTH (((MbimMessage *) self->priv->input));
+        if (length < sizeof (struct header)) {
+            g_warning ("[%s] discarding %u bytes in stream: invalid message length",
+                       self->priv->path, self->priv->input->len);
+            g_byte_array_set_size (self->priv->input, 0);
+            return;
+        }
+
+        if (self->priv->input->len < length)
+            return;
+
+        message = mbim_message_new (self->priv->input->data, length);
+        g_byte_array_remove_range (self->priv->input, 0, length);
+        process_message (self, message);
+    }
+}
+
+static gboolean
+input_ready (gint           fd,
+             GIOCondition   condition,
+             MbimSimulator *self)
+{
+    guint8 buffer[BUFFER_SIZE];
+
+    while (TRUE) {
+        gssize n_read;
+
+        n_read = read (fd, buffer, sizeof (buffer));
+        if (n_read > 0) {
+            g_byte_array_append (self->priv->input, buffer, (guint) n_read);
+            continue;
+        }
+
+        if (n_read < 0 && errno == EINTR)
+            continue;
+
+        /* EAGAIN once all read; the simulator keeps the pseudo-terminal open
+         * itself, so there is no hangup when the host closes it */
+        if (n_read < 0 && errno != EAGAIN)
+            g_debug ("[%s] couldn't read from the host: %s", self->priv->path, g_strerror (errno));
+        break;
+    }
+
+    input_parse (self);
+    return G_SOURCE_CONTINUE;
+}
+
+/*****************************************************************************/
+/* Script */
+
+static gboolean
+parse_enum_nick (GType        type,
+                 const gchar *str,
+                 gint        *out)
+{
+    GEnumClass *enum_class;
+    GEnumValue *value;
+
+    enum_class = G_ENUM_CLASS (g_type_class_ref (type));
+    value = g_enum_get_value_by_nick (enum_class, str);
+    if (value)
+        *out = value->value;
+    g_type_class_unref (enum_class);
+    return !!value;
+}
+
+static gboolean
+parse_service (const gchar  *str,
+               MbimService  *out,
+               GError      **error)
+{
+    MbimUuid uuid;
+    guint64  num;
+    gint     value;
+
+    if (parse_enum_nick (MBIM_TYPE_SERVICE, str, &value)) {
+        *out = (MbimService) value;
+        return TRUE;
+    }
+
+    if (mbim_uuid_from_printable (str, &uuid)) {
+        *out = mbim_uuid_to_service (&uuid);
+        if (*out == MBIM_SERVICE_INVALID)
+            *out = (MbimService) mbim_register_custom_service (&uuid, str);
+        return TRUE;
+    }
+
+    if (g_ascii_string_to_unsigned (str, 10, 1, G_MAXUINT, &num, NULL)) {
+        *out = (MbimService) num;
+        return TRUE;
+    }
+
+    g_set_error (error, MBIM_CORE_ERROR, MBIM_CORE_ERROR_INVALID_ARGS,
+                 "invalid service: '%s'", str);
+    return FALSE;
+}
+
+static gboolean
+parse_cid (MbimService   service,
+           const gchar  *str,
+           guint        *out,
+           GError      **error)
+{
+    guint64 num;
+    guint   cid;
+
+    if (g_ascii_string_to_unsigned (str, 10, 1, G_MAXUINT32, &num, NULL)) {
+        *out = (guint) num;
+        return TRUE;
+    }
+
+    if (service > MBIM_SERVICE_INVALID && service < MBIM_SERVICE_LAST) {
+        for (cid = 1; cid <= MAX_CID_LOOKUP; cid++) {
+            if (g_strcmp0 (mbim_cid_get_printable (service, cid), str) == 0) {
+                *out = cid;
+                return TRUE;
+            }
+        }
+    }
+
+    g_set_error (error, MBIM_CORE_ERROR, MBIM_CORE_ERROR_INVALID_ARGS,
+                 "invalid command: '%s'", str);
+    return FALSE;
+}
+
+static GBytes *
+parse_information_buffer (GKeyFile     *key_file,
+                          const gchar  *group,
+                          GError      **error)
+{
+    g_autofree gchar      *str = NULL;
+    g_autoptr(GByteArray)  buffer = NULL;
+    const gchar           *p;
+
+    buffer = g_byte_array_new ();
+
+    str = g_key_file_get_string (key_file, group, "information-buffer", NULL);
+    if (!str)
+        return g_byte_array_free_to_bytes (g_steal_pointer (&buffer));
+
+    for (p = str; *p; ) {
+        gint   high;
+        gint   low;
+        guint8 byte;
+
+        /* Optional separators between bytes */
+        if (*p == ':' || *p == ' ' || *p == '-') {
+            p++;
+            continue;
+        }
+
+        high = g_ascii_xdigit_value (p[0]);
+        low = (high >= 0) ? g_ascii_xdigit_value (p[1]) : -1;
+        if (low < 0) {
+            g_set_error (error, MBIM_CORE_ERROR, MBIM_CORE_ERROR_INVALID_ARGS,
+                         "[%s] invalid information buffer", group);
+            return NULL;
+        }
+        byte = (guint8) ((high << 4) | low);
+        g_byte_array_append (buffer, &byte, 1);
+        p += 2;
+    }
+
+    return g_byte_array_free_to_bytes (g_steal_pointer (&buffer));
+}
+
+static gboolean
+load_response (MbimSimulator  *self,
+               GKeyFile       *key_file,
+               const gchar    *group,
+               GStrv           tokens,
+               GError        **error)
+{
+    g_autofree gchar       *status_str = NULL;
+    g_autoptr(GBytes)       information_buffer = NULL;
+    MbimService             service;
+    guint                   cid;
+    gint                    command_type = MBIM_MESSAGE_COMMAND_TYPE_UNKNOWN;
+    gint                    status = MBIM_STATUS_ERROR_NONE;
+    gconstpointer           data;
+    gsize                   size;
+
+    if (g_strv_length (tokens) < 3 || g_strv_length (tokens) > 4) {
+        g_set_error (error, MBIM_CORE_ERROR, MBIM_CORE_ERROR_INVALID_ARGS,
+                     "[%s] expected 'response SERVICE COMMAND [TYPE]'", group);
+        return FALSE;
+    }
+
+    if (!parse_service (tokens[1], &service, error) ||
+        !parse_cid (service, tokens[2], &cid, error))
+        return FALSE;
+
+    if (tokens[3] &&
+        (!parse_enum_nick (MBIM_TYPE_MESSAGE_COMMAND_TYPE, tokens[3], &command_type) ||
+         command_type == MBIM_MESSAGE_COMMAND_TYPE_UNKNOWN)) {
+        g_set_error (error, MBIM_CORE_ERROR, MBIM_CORE_ERROR_INVALID_ARGS,
+                     "[%s] invalid command type: '%s'", group, tokens[3]);
+        return FALSE;
+    }
+
+    status_str = g_key_file_get_string (key_file, group, "status", NULL);
+    if (status_str && !parse_enum_nick (MBIM_TYPE_STATUS_ERROR, status_str, &status)) {
+        g_set_error (error, MBIM_CORE_ERROR, MBIM_CORE_ERROR_INVALID_ARGS,
+                     "[%s] invalid status: '%s'", group, status_str);
+        return FALSE;
+    }
+
+    information_buffer = parse_information_buffer (key_file, group, error);
+    if (!information_buffer)
+        return FALSE;
+
+    data = g_bytes_get_data (information_buffer, &size);
+    mbim_simulator_set_response (self,
+                                 service,
+                                 cid,
+                                 (MbimMessageCommandType) command_type,
+                                 (MbimStatusError) status,
+                                 data,
+                                 (guint32) size);
+    return TRUE;
+}
+
+static gboolean
+load_indication (MbimSimulator  *self,
+                 GKeyFile       *key_file,
+                 const gchar    *group,
+                 GStrv           tokens,
+                 GError        **error)
+{
+    g_autoptr(GBytes)  information_buffer = NULL;
+    Indication        *indication;
+    MbimService        service;
+    guint              cid;
+    gint               count = 1;
+    gint               interval = 0;
+
+    if (g_strv_length (tokens) != 3) {
+        g_set_error (error, MBIM_CORE_ERROR, MBIM_CORE_ERROR_INVALID_ARGS,
+                     "[%s] expected 'indication SERVICE COMMAND'", group);
+        return FALSE;
+    }
+
+    if (!parse_service (tokens[1], &service, error) ||
+        !parse_cid (service, tokens[2], &cid, error))
+        return FALSE;
+
+    if (g_key_file_has_key (key_file, group, "count", NULL))
+        count = g_key_file_get_integer (key_file, group, "count", NULL);
+    if (g_key_file_has_key (key_file, group, "interval", NULL))
+        interval = g_key_file_get_integer (key_file, group, "interval", NULL);
+    if (count < 0 || interval < 0) {
+        g_set_error (error, MBIM_CORE_ERROR, MBIM_CORE_ERROR_INVALID_ARGS,
+                     "[%s] invalid count or interval", group);
+        return FALSE;
+    }
+
+    information_buffer = parse_information_buffer (key_file, group, error);
+    if (!information_buffer)
+        return FALSE;
+
+    indication = g_slice_new0 (Indication);
+    indication->service = service;
+    indication->cid = cid;
+    indication->information_buffer = g_steal_pointer (&information_buffer);
+    indication->count = (guint) count;
+    indication->interval = (guint) interval;
+    g_ptr_array_add (self->priv->indications, indication);
+    return TRUE;
+}
+
+gboolean
+mbim_simulator_load_script (MbimSimulator  *self,
+                            const gchar    *path,
+                            GError        **error)
+{
+    g_autoptr(GKeyFile)  key_file = NULL;
+    g_auto(GStrv)        groups = NULL;
+    guint                i;
+
+    g_return_val_if_fail (MBIM_IS_SIMULATOR (self), FALSE);
+    g_return_val_if_fail (path != NULL, FALSE);
+
+    key_file = g_key_file_new ();
+    if (!g_key_file_load_from_file (key_file, path, G_KEY_FILE_NONE, error))
+        return FALSE;
+
+    groups = g_key_file_get_groups (key_file, NULL);
+    for (i = 0; groups[i]; i++) {
+        g_auto(GStrv) tokens = NULL;
+        gboolean      loaded;
+
+        tokens = g_strsplit (groups[i], " ", -1);
+        if (g_strcmp0 (tokens[0], "response") == 0)
+            loaded = load_response (self, key_file, groups[i], tokens, error);
+        else if (g_strcmp0 (tokens[0], "indication") == 0)
+            loaded = load_indication (self, key_file, groups[i], tokens, error);
+        else {
+            g_set_error (error, MBIM_CORE_ERROR, MBIM_CORE_ERROR_INVALID_ARGS,
+                         "[%s] unknown group type", groups[i]);
+            loaded = FALSE;
+        }
+
+        if (!loaded) {
+            g_prefix_error (error, "%s: ", path);
+            return FALSE;
+        }
+    }
+
+    g_debug ("[%s] loaded script '%s': %u responses, %u indications",
+             self->priv->path, path,
+             g_hash_table_size (self->priv->responses),
+             self->priv->indications->len);
+    return TRUE;
+}
+
+/*****************************************************************************/
+
+void
+mbim_simulator_set_response (MbimSimulator          *self,
+                             MbimService             service,
+                             guint                   cid,
+                             MbimMessageCommandType  command_type,
+                             MbimStatusError         status,
+                             const guint8           *information_buffer,
+                             guint32                 information_buffer_size)
+{
+    Response *response;
+
+    g_return_if_fail (MBIM_IS_SIMULATOR (self));
+    g_return_if_fail (cid > 0);
+
+    response = g_slice_new0 (Response);
+    memcpy (&response->uuid, mbim_uuid_from_service (service), sizeof (MbimUuid));
+    response->cid = cid;
+    response->command_type = command_type;
+    response->status = status;
+    response->information_buffer = g_bytes_new (information_buffer, information_buffer_size);
+
+    g_hash_table_replace (self->priv->responses,
+                          response_key (&response->uuid, cid, command_type),
+                          response);
+}
+
+void
+mbim_simulator_emit_indications (MbimSimulator *self,
+                                 MbimService    service,
+                                 guint          cid,
+                                 const guint8  *information_buffer,
+                                 guint32        information_buffer_size,
+                                 guint          count,
+                                 guint          interval)
+{
+    g_autoptr(MbimMessage) message = NULL;
+
+    g_return_if_fail (MBIM_IS_SIMULATOR (self));
+    g_return_if_fail (cid > 0);
+
+    if (!self->priv->open || self->priv->stalled)
+        return;
+
+    message = indicate_status_new (service, cid, information_buffer, information_buffer_size);
+    pending_output_add (self, message, count, interval, 0);
+}
+
+void
+mbim_simulator_reset (MbimSimulator *self)
+{
+    g_return_if_fail (MBIM_IS_SIMULATOR (self));
+
+    g_debug ("[%s] reset", self->priv->path);
+    pending_output_clear (self);
+    g_clear_pointer (&self->priv->fragments, mbim_message_unref);
+    self->priv->open = FALSE;
+}
+
+const gchar *
+mbim_simulator_get_path (MbimSimulator *self)
+{
+    g_return_val_if_fail (MBIM_IS_SIMULATOR (self), NULL);
+
+    return self->priv->path;
+}
+
+guint
+mbim_simulator_get_n_requests (MbimSimulator *self)
+{
+    g_return_val_if_fail (MBIM_IS_SIMULATOR (self), 0);
+
+    return self->priv->n_requests;
+}
+
+/*****************************************************************************/
+
+static gboolean
+setup_pty (MbimSimulator  *self,
+           GError        **error)
+{
+    struct termios  tio;
+    const gchar    *name;
+
+    self->priv->master_fd = posix_openpt (O_RDWR | O_NOCTTY | O_CLOEXEC);
+    if (self->priv->master_fd < 0 ||
+        grantpt (self->priv->master_fd) < 0 ||
+        unlockpt (self->priv->master_fd) < 0 ||
+        !(name = ptsname (self->priv->master_fd))) {
+        g_set_error (error, MBIM_CORE_ERROR, MBIM_CORE_ERROR_FAILED,
+                     "couldn't create pseudo-terminal: %s", g_strerror (errno));
+        return FALSE;
+    }
+    self->priv->path = g_strdup (name);
+
+    /* The simulator keeps the port open itself, so that the host can close
+     * and open it again at any time. Raw mode, to pass messages as is. */
+    self->priv->slave_fd = open (self->priv->path, O_RDWR | O_NOCTTY | O_CLOEXEC);
+    if (self->priv->slave_fd < 0 || tcgetattr (self->priv->slave_fd, &tio) < 0) {
+        g_set_error (error, MBIM_CORE_ERROR, MBIM_CORE_ERROR_FAILED,
+                     "couldn't open pseudo-terminal '%s': %s", self->priv->path, g_strerror (errno));
+        return FALSE;
+    }
+    cfmakeraw (&tio);
+    if (tcsetattr (self->priv->slave_fd, TCSANOW, &tio) < 0 ||
+        !g_unix_set_fd_nonblocking (self->priv->master_fd, TRUE, NULL)) {
+        g_set_error (error, MBIM_CORE_ERROR, MBIM_CORE_ERROR_FAILED,
+                     "couldn't setup pseudo-terminal '%s': %s", self->priv->path, g_strerror (errno));
+        return FALSE;
+    }
+
+    self->priv->input_source = g_unix_fd_source_new (self->priv->master_fd, G_IO_IN);
+    g_source_set_callback (self->priv->input_source, (GSourceFunc) input_ready, self, NULL);
+    g_source_attach (self->priv->input_source, g_main_context_get_thread_default ());
+
+    g_debug ("[%s] simulated MBIM function ready", self->priv->path);
+    return TRUE;
+}
+
+MbimSimulator *
+mbim_simulator_new (GError **error)
+{
+    g_autoptr(MbimSimulator) self = NULL;
+
+    self = g_object_new (MBIM_TYPE_SIMULATOR, NULL);
+    if (!setup_pty (self, error))
+        return NULL;
+
+    return g_steal_pointer (&self);
+}
+
+static void
+mbim_simulator_init (MbimSimulator *self)
+{
+    self->priv = G_TYPE_INSTANCE_GET_PRIVATE (self, MBIM_TYPE_SIMULATOR, MbimSimulatorPrivate);
+    self->priv->master_fd = -1;
+    self->priv->slave_fd = -1;
+    self->priv->max_fragment_size = MAX_FRAGMENT_SIZE_DEFAULT;
+    self->priv->input = g_byte_array_sized_new (BUFFER_SIZE);
+    self->priv->output = g_byte_array_sized_new (BUFFER_SIZE);
+    self->priv->responses = g_hash_table_new_full (g_str_hash,
+                                                   g_str_equal,
+                                                   g_free,
+                                                   (GDestroyNotify) response_free);
+    self->priv->indications = g_ptr_array_new_with_free_func ((GDestroyNotify) indication_free);
+}
+
+static void
+set_property (GObject      *object,
+              guint         prop_id,
+              const GValue *value,
+              GParamSpec   *pspec)
+{
+    MbimSimulator *self = MBIM_SIMULATOR (object);
+
+    switch (prop_id) {
+    case PROP_RESPONSE_DELAY:
+        self->priv->response_delay = g_value_get_uint (value);
+        break;
+    case PROP_MAX_FRAGMENT_SIZE:
+        self->priv->max_fragment_size = g_value_get_uint (value);
+        break;
+    case PROP_STALLED:
+        self->priv->stalled = g_value_get_boolean (value);
+        break;
+    case PROP_N_REQUESTS:
+    default:
+        G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+        break;
+    }
+}
+
+static void
+get_property (GObject    *object,
+              guint       prop_id,
+              GValue     *value,
+              GParamSpec *pspec)
+{
+    MbimSimulator *self = MBIM_SIMULATOR (object);
+
+    switch (prop_id) {
+    case PROP_RESPONSE_DELAY:
+        g_value_set_uint (value, self->priv->response_delay);
+        break;
+    case PROP_MAX_FRAGMENT_SIZE:
+        g_value_set_uint (value, self->priv->max_fragment_size);
+        break;
+    case PROP_STALLED:
+        g_value_set_boolean (value, self->priv->stalled);
+        break;
+    case PROP_N_REQUESTS:
+        g_value_set_uint (value, self->priv->n_requests);
+        break;
+    default:
+        G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+        break;
+    }
+}
+
+static void
+dispose (GObject *object)
+{
+    MbimSimulatorPrivate *priv = MBIM_SIMULATOR (object)->priv;
+
+    pending_output_clear (MBIM_SIMULATOR (object));
+    g_clear_pointer (&priv->fragments, mbim_message_unref);
+
+    if (priv->input_source) {
+        g_source_destroy (priv->input_source);
+        g_clear_pointer (&priv->input_source, g_source_unref);
+    }
+    if (priv->output_source) {
+        g_source_destroy (priv->output_source);
+        g_clear_pointer (&priv->output_source, g_source_unref);
+    }
+
+    /* The host gets a hangup once both ends are closed */
+    if (priv->slave_fd >= 0) {
+        close (priv->slave_fd);
+        priv->slave_fd = -1;
+    }
+    if (priv->master_fd >= 0) {
+        close (priv->master_fd);
+        priv->master_fd = -1;
+    }
+
+    G_OBJECT_CLASS (mbim_simulator_parent_class)->dispose (object);
+}
+
+static void
+finalize (GObject *object)
+{
+    MbimSimulatorPrivate *priv = MBIM_SIMULATOR (object)->priv;
+
+    g_byte_array_unref (priv->input);
+    g_byte_array_unref (priv->output);
+    g_hash_table_unref (priv->responses);
+    g_ptr_array_unref (priv->indications);
+    g_free (priv->path);
+
+    G_OBJECT_CLASS (mbim_simulator_parent_class)->finalize (object);
+}
+
+static void
+mbim_simulator_class_init (MbimSimulatorClass *simulator_class)
+{
+    GObjectClass *object_class = G_OBJECT_CLASS (simulator_class);
+
+    g_type_class_add_private (object_class, sizeof (MbimSimulatorPrivate));
+
+    /* Virtual methods */
+    object_class->get_property = get_property;
+    object_class->set_property = set_property;
+    object_class->dispose = dispose;
+    object_class->finalize = finalize;
+
+    /*
+     * MbimSimulator:mbim-simulator-response-delay
+     */
+    properties[PROP_RESPONSE_DELAY] =
+        g_param_spec_uint (MBIM_SIMULATOR_RESPONSE_DELAY,
+                           "Response delay",
+                           "Time to wait before sending each response, in milliseconds",
+                           0,
+                           G_MAXUINT,
+                           0,
+                           G_PARAM_READWRITE);
+    g_object_class_install_property (object_class, PROP_RESPONSE_DELAY, properties[PROP_RESPONSE_DELAY]);
+
+    /*
+     * MbimSimulator:mbim-simulator-max-fragment-size
+     */
+    properties[PROP_MAX_FRAGMENT_SIZE] =
+        g_param_spec_uint (MBIM_SIMULATOR_MAX_FRAGMENT_SIZE,
+                           "Maximum fragment size",
+                           "Maximum size of the messages sent to the host",
+                           MAX_FRAGMENT_SIZE_MIN,
+                           G_MAXUINT32,
+                           MAX_FRAGMENT_SIZE_DEFAULT,
+                           G_PARAM_READWRITE);
+    g_object_class_install_property (object_class, PROP_MAX_FRAGMENT_SIZE, properties[PROP_MAX_FRAGMENT_SIZE]);
+
+    /*
+     * MbimSimulator:mbim-simulator-stalled
+     */
+    properties[PROP_STALLED] =
+        g_param_spec_boolean (MBIM_SIMULATOR_STALLED,
+                              "Stalled",
+                              "Whether messages from the host are discarded without response",
+                              FALSE,
+                              G_PARAM_READWRITE);
+    g_object_class_install_property (object_class, PROP_STALLED, properties[PROP_STALLED]);
+
+    /*
+     * MbimSimulator:mbim-simulator-n-requests
+     */
+    properties[PROP_N_REQUESTS] =
+        g_param_spec_uint (MBIM_SIMULATOR_N_REQUESTS,
+                           "Number of requests",
+                           "Number of messages received from the host",
+                           0,
+                           G_MAXUINT,
+                           0,
+                           G_PARAM_READABLE);
+    g_object_class_install_property (object_class, PROP_N_REQUESTS, properties[PROP_N_REQUESTS]);
+}
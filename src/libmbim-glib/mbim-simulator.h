@@ -0,0 +1,244 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/* SPDX-License-Identifier: LGPL-2.1-or-later */
+/*
+ * libmbim-glib -- GLib/GIO based library to control MBIM devices
+ *
+ * This is a private non-installed header, the simulator is only built for the
+ * tests and the mbim-simulator program
+ */
+
+#ifndef _LIBMBIM_GLIB_MBIM_SIMULATOR_H_
+#define _LIBMBIM_GLIB_MBIM_SIMULATOR_H_
+
+#if !defined (LIBMBIM_GLIB_COMPILATION)
+#error "This is a private header!!"
+#endif
+
+#include <glib-object.h>
+#include <gio/gio.h>
+
+#include "mbim-uuid.h"
+#include "mbim-message.h"
+#include "mbim-errors.h"
+
+G_BEGIN_DECLS
+
+/*
+ * The #MbimSimulator implements the device side of the MBIM control protocol
+ * behind a pseudo-terminal, so that a #MbimDevice, the mbim-proxy or mbimcli
+ * can open it with the path returned by mbim_simulator_get_path() as if it
+ * were a cdc-wdm port, without any real modem.
+ *
+ * The simulator answers OPEN and CLOSE requests, and replies to commands with
+ * the responses configured with mbim_simulator_set_response() or loaded with
+ * mbim_simulator_load_script(). Commands without a configured response are
+ * replied with %MBIM_STATUS_ERROR_NO_DEVICE_SUPPORT, except for the device
+ * services query, which reports the Basic Connect service and all the
+ * services with configured responses, and the device service subscribe list
+ * set, which is accepted as is.
+ *
+ * Responses larger than #MbimSimulator:mbim-simulator-max-fragment-size are
+ * sent in multiple fragments, and all of them may be delayed with
+ * #MbimSimulator:mbim-simulator-response-delay. Indications may be emitted at
+ * any time with mbim_simulator_emit_indications().
+ *
+ * The simulator runs in the thread-default main context of the thread where
+ * it was created.
+ */
+
+#define MBIM_TYPE_SIMULATOR            (mbim_simulator_get_type ())
+#define MBIM_SIMULATOR(obj)            (G_TYPE_CHECK_INSTANCE_CAST ((obj), MBIM_TYPE_SIMULATOR, MbimSimulator))
+#define MBIM_SIMULATOR_CLASS(klass)    (G_TYPE_CHECK_CLASS_CAST ((klass), MBIM_TYPE_SIMULATOR, MbimSimulatorClass))
+#define MBIM_IS_SIMULATOR(obj)         (G_TYPE_CHECK_INSTANCE_TYPE ((obj), MBIM_TYPE_SIMULATOR))
+#define MBIM_IS_SIMULATOR_CLASS(klass) (G_TYPE_CHECK_CLASS_TYPE ((obj), MBIM_TYPE_SIMULATOR))
+#define MBIM_SIMULATOR_GET_CLASS(obj)  (G_TYPE_INSTANCE_GET_CLASS ((obj), MBIM_TYPE_SIMULATOR, MbimSimulatorClass))
+
+typedef struct _MbimSimulator MbimSimulator;
+typedef struct _MbimSimulatorClass MbimSimulatorClass;
+typedef struct _MbimSimulatorPrivate MbimSimulatorPrivate;
+
+/*
+ * MBIM_SIMULATOR_RESPONSE_DELAY:
+ *
+ * Symbol defining the #MbimSimulator:mbim-simulator-response-delay property.
+ *
+ * The time, in milliseconds, the simulator waits before sending the response
+ * to each request. Responses are sent right away if set to 0 (default).
+ */
+#define MBIM_SIMULATOR_RESPONSE_DELAY "mbim-simulator-response-delay"
+
+/*
+ * MBIM_SIMULATOR_MAX_FRAGMENT_SIZE:
+ *
+ * Symbol defining the #MbimSimulator:mbim-simulator-max-fragment-size property.
+ *
+ * The maximum size of the messages sent by the simulator; larger ones are
+ * split in fragments. The maximum control transfer size requested by the host
+ * in the OPEN message is also honored.
+ */
+#define MBIM_SIMULATOR_MAX_FRAGMENT_SIZE "mbim-simulator-max-fragment-size"
+
+/*
+ * MBIM_SIMULATOR_STALLED:
+ *
+ * Symbol defining the #MbimSimulator:mbim-simulator-stalled property.
+ *
+ * If set, the simulator behaves as a device with stuck firmware: all
+ * messages sent by the host are discarded without any response.
+ */
+#define MBIM_SIMULATOR_STALLED "mbim-simulator-stalled"
+
+/*
+ * MBIM_SIMULATOR_N_REQUESTS:
+ *
+ * Symbol defining the #MbimSimulator:mbim-simulator-n-requests property.
+ *
+ * The number of messages received from the host, including the discarded
+ * ones.
+ */
+#define MBIM_SIMULATOR_N_REQUESTS "mbim-simulator-n-requests"
+
+/*
+ * MbimSimulator:
+ *
+ * The #MbimSimulator structure contains private data and should only be accessed
+ * using the provided API.
+ */
+struct _MbimSimulator {
+    GObject parent;
+    MbimSimulatorPrivate *priv;
+};
+
+struct _MbimSimulatorClass {
+    GObjectClass parent;
+};
+
+GType mbim_simulator_get_type (void);
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (MbimSimulator, g_object_unref)
+
+/*
+ * mbim_simulator_new:
+ * @error: Return location for error or %NULL.
+ *
+ * Creates a #MbimSimulator object, with a new pseudo-terminal.
+ *
+ * Returns: (transfer full): a newly created #MbimSimulator, or #NULL if @error is set.
+ */
+MbimSimulator *mbim_simulator_new (GError **error);
+
+/*
+ * mbim_simulator_get_path:
+ * @self: a #MbimSimulator.
+ *
+ * Gets the path of the pseudo-terminal to open with mbim_device_new().
+ *
+ * Returns: (transfer none): the path of the simulated port.
+ */
+const gchar *mbim_simulator_get_path (MbimSimulator *self);
+
+/*
+ * mbim_simulator_get_n_requests:
+ * @self: a #MbimSimulator.
+ *
+ * Gets the number of messages received from the host.
+ *
+ * Returns: a #guint.
+ */
+guint mbim_simulator_get_n_requests (MbimSimulator *self);
+
+/*
+ * mbim_simulator_set_response:
+ * @self: a #MbimSimulator.
+ * @service: a #MbimService.
+ * @cid: the command ID.
+ * @command_type: the #MbimMessageCommandType of the requests to reply, or
+ *  %MBIM_MESSAGE_COMMAND_TYPE_UNKNOWN to reply both queries and sets.
+ * @status: the #MbimStatusError to report in the response.
+ * @information_buffer: (array length=information_buffer_size) (nullable): the
+ *  raw information buffer of the response, or %NULL.
+ * @information_buffer_size: size of @information_buffer.
+ *
+ * Configures the response to the given command, replacing any previous one.
+ */
+void mbim_simulator_set_response (MbimSimulator          *self,
+                                  MbimService             service,
+                                  guint                   cid,
+                                  MbimMessageCommandType  command_type,
+                                  MbimStatusError         status,
+                                  const guint8           *information_buffer,
+                                  guint32                 information_buffer_size);
+
+/*
+ * mbim_simulator_load_script:
+ * @self: a #MbimSimulator.
+ * @path: path of the script file.
+ * @error: Return location for error or %NULL.
+ *
+ * Loads responses and indications from a script file, a #GKeyFile where
+ * each group configures either a response or an indication:
+ *
+ * |[
+ * [response basic-connect radio-state query]
+ * status=none
+ * information-buffer=01:00:00:00:01:00:00:00
+ *
+ * [indication basic-connect signal-state]
+ * information-buffer=0a:00:00:00:63:00:00:00:00:00:00:00:00:00:00:00:00:00:00:00
+ * count=1000
+ * interval=1
+ * ]|
+ *
+ * Services and commands are given with the same names used in the
+ * data/mbim-service-*.json definitions and in mbimcli, or with numbers. The
+ * service may also be given as a UUID. The command type, "query" or "set",
+ * may be omitted to reply both. The status is given as a #MbimStatusError
+ * nickname, and defaults to "none". The information buffer is given in
+ * hexadecimal, with or without separators.
+ *
+ * Indications are emitted every time the host opens the simulated function,
+ * @count times (1 by default) every @interval milliseconds (0 by default,
+ * i.e. all at once).
+ *
+ * Returns: %TRUE if the script was loaded, %FALSE if @error is set.
+ */
+gboolean mbim_simulator_load_script (MbimSimulator  *self,
+                                     const gchar    *path,
+                                     GError        **error);
+
+/*
+ * mbim_simulator_emit_indications:
+ * @self: a #MbimSimulator.
+ * @service: a #MbimService.
+ * @cid: the command ID.
+ * @information_buffer: (array length=information_buffer_size) (nullable): the
+ *  raw information buffer of the indication, or %NULL.
+ * @information_buffer_size: size of @information_buffer.
+ * @count: number of indications to emit.
+ * @interval: time between indications, in milliseconds, or 0 to emit all of
+ *  them at once.
+ *
+ * Emits indications to the host, e.g. to simulate indication storms. Nothing
+ * is emitted while the simulated function is not open.
+ */
+void mbim_simulator_emit_indications (MbimSimulator *self,
+                                      MbimService    service,
+                                      guint          cid,
+                                      const guint8  *information_buffer,
+                                      guint32        information_buffer_size,
+                                      guint          count,
+                                      guint          interval);
+
+/*
+ * mbim_simulator_reset:
+ * @self: a #MbimSimulator.
+ *
+ * Simulates a function reset: the simulated function is no longer open, and
+ * the pending responses and indications are dropped. The host requests are
+ * replied with a %MBIM_PROTOCOL_ERROR_NOT_OPENED error until the host opens
+ * the function again.
+ */
+void mbim_simulator_reset (MbimSimulator *self);
+
+G_END_DECLS
+
+#endif /* _LIBMBIM_GLIB_MBIM_SIMULATOR_H_ */
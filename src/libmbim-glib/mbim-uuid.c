@@ -11,6 +11,7 @@
 
 #include <config.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "mbim-uuid.h"
@@ -86,6 +87,68 @@ mbim_uuid_from_printable (const gchar *str,
     return TRUE;
 }
 
+/*****************************************************************************/
+/* UUID indices, sorted by UUID, used for reverse lookups */
+
+typedef struct {
+    const MbimUuid *uuid;
+    guint           value;
+} UuidIndexEntry;
+
+static gint
+uuid_index_entry_cmp (const UuidIndexEntry *a,
+                      const UuidIndexEntry *b)
+{
+    return memcmp (a->uuid, b->uuid, sizeof (MbimUuid));
+}
+
+/* Fills in the index from an array of UUIDs indexed by value, skipping the
+ * invalid one at index 0 */
+static void
+uuid_index_init (UuidIndexEntry        *index,
+                 const MbimUuid * const *uuids,
+                 guint                   n_uuids)
+{
+    guint i;
+
+    for (i = 1; i < n_uuids; i++) {
+        index[i - 1].uuid = uuids[i];
+        index[i - 1].value = i;
+    }
+    qsort (index, n_uuids - 1, sizeof (UuidIndexEntry), (GCompareFunc) uuid_index_entry_cmp);
+}
+
+static gboolean
+uuid_index_lookup (const UuidIndexEntry *index,
+                   guint                 n_entries,
+                   const MbimUuid       *uuid,
+                   guint                *value)
+{
+    UuidIndexEntry        key;
+    const UuidIndexEntry *found;
+
+    key.uuid = uuid;
+    found = bsearch (&key, index, n_entries, sizeof (UuidIndexEntry), (GCompareFunc) uuid_index_entry_cmp);
+    if (!found)
+        return FALSE;
+
+    *value = found->value;
+    return TRUE;
+}
+
+static guint
+uuid_hash (const MbimUuid *uuid)
+{
+    const guint8 *bytes = (const guint8 *) uuid;
+    guint32       hash = 2166136261u;
+    guint         i;
+
+    /* FNV-1a */
+    for (i = 0; i < sizeof (MbimUuid); i++)
+        hash = (hash ^ bytes[i]) * 16777619u;
+    return hash;
+}
+
 /*****************************************************************************/
 
 static const MbimUuid uuid_invalid = {
@@ -281,7 +344,46 @@ static const MbimUuid uuid_google = {
     .e = { 0xa8, 0x6a, 0xd9, 0xe1, 0x22, 0x45 }
 };
 
-static GList *mbim_custom_service_list = NULL;
+/* UUIDs of the known services, indexed by service */
+static const MbimUuid * const service_uuids[MBIM_SERVICE_LAST] = {
+    [MBIM_SERVICE_INVALID]                     = &uuid_invalid,
+    [MBIM_SERVICE_BASIC_CONNECT]               = &uuid_basic_connect,
+    [MBIM_SERVICE_SMS]                         = &uuid_sms,
+    [MBIM_SERVICE_USSD]                        = &uuid_ussd,
+    [MBIM_SERVICE_PHONEBOOK]                   = &uuid_phonebook,
+    [MBIM_SERVICE_STK]                         = &uuid_stk,
+    [MBIM_SERVICE_AUTH]                        = &uuid_auth,
+    [MBIM_SERVICE_DSS]                         = &uuid_dss,
+    [MBIM_SERVICE_MS_FIRMWARE_ID]              = &uuid_ms_firmware_id,
+    [MBIM_SERVICE_MS_HOST_SHUTDOWN]            = &uuid_ms_host_shutdown,
+    [MBIM_SERVICE_PROXY_CONTROL]               = &uuid_proxy_control,
+    [MBIM_SERVICE_QMI]                         = &uuid_qmi,
+    [MBIM_SERVICE_ATDS]                        = &uuid_atds,
+    [MBIM_SERVICE_INTEL_FIRMWARE_UPDATE]       = &uuid_intel_firmware_update,
+    [MBIM_SERVICE_MS_BASIC_CONNECT_EXTENSIONS] = &uuid_ms_basic_connect_extensions,
+    [MBIM_SERVICE_MS_SAR]                      = &uuid_ms_sar,
+    [MBIM_SERVICE_QDU]                         = &uuid_qdu,
+    [MBIM_SERVICE_MS_UICC_LOW_LEVEL_ACCESS]    = &uuid_ms_uicc_low_level_access,
+    [MBIM_SERVICE_QUECTEL]                     = &uuid_quectel,
+    [MBIM_SERVICE_INTEL_THERMAL_RF]            = &uuid_intel_thermal_rf,
+    [MBIM_SERVICE_MS_VOICE_EXTENSIONS]         = &uuid_ms_voice_extensions,
+    [MBIM_SERVICE_INTEL_MUTUAL_AUTHENTICATION] = &uuid_intel_mutual_authentication,
+    [MBIM_SERVICE_INTEL_TOOLS]                 = &uuid_intel_tools,
+    [MBIM_SERVICE_GOOGLE]                      = &uuid_google,
+};
+
+static const UuidIndexEntry *
+service_index_get (void)
+{
+    static UuidIndexEntry index[MBIM_SERVICE_LAST - 1];
+    static gsize          initialized = 0;
+
+    if (g_once_init_enter (&initialized)) {
+        uuid_index_init (index, service_uuids, MBIM_SERVICE_LAST);
+        g_once_init_leave (&initialized, 1);
+    }
+    return index;
+}
 
 typedef struct {
     guint service_id;
@@ -289,29 +391,60 @@ typedef struct {
     gchar *nickname;
 } MbimCustomService;
 
+/* Custom services, indexed by service id (owning the entries) and by UUID */
+static GHashTable *custom_services_by_id = NULL;
+static GHashTable *custom_services_by_uuid = NULL;
+
+static void
+custom_service_free (MbimCustomService *s)
+{
+    g_free (s->nickname);
+    g_slice_free (MbimCustomService, s);
+}
+
+static MbimCustomService *
+custom_service_lookup (guint service_id)
+{
+    if (!custom_services_by_id)
+        return NULL;
+    return g_hash_table_lookup (custom_services_by_id, GUINT_TO_POINTER (service_id));
+}
+
 guint
 mbim_register_custom_service (const MbimUuid *uuid,
                               const gchar *nickname)
 {
     MbimCustomService *s;
-    GList *l;
+    GHashTableIter iter;
+    gpointer key;
     guint service_id = 100;
 
-    for (l = mbim_custom_service_list; l != NULL; l = l->next) {
-        s = (MbimCustomService *)l->data;
-        if (mbim_uuid_cmp (&s->uuid, uuid))
-            return s->service_id;
-        else
-            service_id = MAX (service_id, s->service_id);
+    if (!custom_services_by_id) {
+        custom_services_by_id = g_hash_table_new_full (g_direct_hash,
+                                                       g_direct_equal,
+                                                       NULL,
+                                                       (GDestroyNotify) custom_service_free);
+        custom_services_by_uuid = g_hash_table_new ((GHashFunc) uuid_hash,
+                                                    (GEqualFunc) mbim_uuid_cmp);
     }
 
+    s = g_hash_table_lookup (custom_services_by_uuid, uuid);
+    if (s)
+        return s->service_id;
+
+    /* registering is rare, so just look for the greatest id in use */
+    g_hash_table_iter_init (&iter, custom_services_by_id);
+    while (g_hash_table_iter_next (&iter, &key, NULL))
+        service_id = MAX (service_id, GPOINTER_TO_UINT (key));
+
     /* create a new custom service */
     s = g_slice_new (MbimCustomService);
     s->service_id = service_id + 1;
     memcpy (&s->uuid, uuid, sizeof (MbimUuid));
     s->nickname = g_strdup (nickname);
 
-    mbim_custom_service_list = g_list_append (mbim_custom_service_list, s);
+    g_hash_table_insert (custom_services_by_uuid, &s->uuid, s);
+    g_hash_table_insert (custom_services_by_id, GUINT_TO_POINTER (s->service_id), s);
     return s->service_id;
 }
 
@@ -319,197 +452,65 @@ gboolean
 mbim_unregister_custom_service (const guint id)
 {
     MbimCustomService *s;
-    GList *l;
-
-    for (l = mbim_custom_service_list; l != NULL; l = l->next) {
-        s = (MbimCustomService *)l->data;
-        if (s->service_id == id) {
-            g_free (s->nickname);
-            g_slice_free (MbimCustomService, s);
-            mbim_custom_service_list = \
-                g_list_delete_link (mbim_custom_service_list, l);
-            return TRUE;
-        }
-    }
 
-    return FALSE;
+    s = custom_service_lookup (id);
+    if (!s)
+        return FALSE;
+
+    g_hash_table_remove (custom_services_by_uuid, &s->uuid);
+    g_hash_table_remove (custom_services_by_id, GUINT_TO_POINTER (id));
+    return TRUE;
 }
 
 gboolean
 mbim_service_id_is_custom (const guint id)
 {
-    GList *l;
-
     if (id < MBIM_SERVICE_LAST)
         return FALSE;
 
-    for (l = mbim_custom_service_list; l != NULL; l = l->next) {
-        if (((MbimCustomService *)l->data)->service_id == id)
-            return TRUE;
-    }
-
-    return FALSE;
+    return !!custom_service_lookup (id);
 }
 
 const gchar *
 mbim_service_lookup_name (guint service)
 {
-    GList *l;
+    MbimCustomService *s;
 
     if (service < MBIM_SERVICE_LAST)
         return mbim_service_get_string (service);
 
-    for (l = mbim_custom_service_list; l != NULL; l = l->next) {
-        if (service == ((MbimCustomService *)l->data)->service_id)
-            return ((MbimCustomService *)l->data)->nickname;
-    }
-    return NULL;
+    s = custom_service_lookup (service);
+    return s ? s->nickname : NULL;
 }
 
 const MbimUuid *
 mbim_uuid_from_service (MbimService service)
 {
-    GList *l;
+    MbimCustomService *s;
 
     g_return_val_if_fail (service < MBIM_SERVICE_LAST || mbim_service_id_is_custom (service), &uuid_invalid);
 
-    switch (service) {
-    case MBIM_SERVICE_INVALID:
-        return &uuid_invalid;
-    case MBIM_SERVICE_BASIC_CONNECT:
-        return &uuid_basic_connect;
-    case MBIM_SERVICE_SMS:
-        return &uuid_sms;
-    case MBIM_SERVICE_USSD:
-        return &uuid_ussd;
-    case MBIM_SERVICE_PHONEBOOK:
-        return &uuid_phonebook;
-    case MBIM_SERVICE_STK:
-        return &uuid_stk;
-    case MBIM_SERVICE_AUTH:
-        return &uuid_auth;
-    case MBIM_SERVICE_DSS:
-        return &uuid_dss;
-    case MBIM_SERVICE_MS_FIRMWARE_ID:
-        return &uuid_ms_firmware_id;
-    case MBIM_SERVICE_MS_HOST_SHUTDOWN:
-        return &uuid_ms_host_shutdown;
-    case MBIM_SERVICE_MS_SAR:
-        return &uuid_ms_sar;
-    case MBIM_SERVICE_PROXY_CONTROL:
-        return &uuid_proxy_control;
-    case MBIM_SERVICE_QMI:
-        return &uuid_qmi;
-    case MBIM_SERVICE_ATDS:
-        return &uuid_atds;
-    case MBIM_SERVICE_QDU:
-        return &uuid_qdu;
-    case MBIM_SERVICE_INTEL_FIRMWARE_UPDATE:
-        return &uuid_intel_firmware_update;
-    case MBIM_SERVICE_MS_BASIC_CONNECT_EXTENSIONS:
-        return &uuid_ms_basic_connect_extensions;
-    case MBIM_SERVICE_MS_UICC_LOW_LEVEL_ACCESS:
-        return &uuid_ms_uicc_low_level_access;
-    case MBIM_SERVICE_QUECTEL:
-        return &uuid_quectel;
-    case MBIM_SERVICE_INTEL_THERMAL_RF:
-        return &uuid_intel_thermal_rf;
-    case MBIM_SERVICE_MS_VOICE_EXTENSIONS:
-        return &uuid_ms_voice_extensions;
-    case MBIM_SERVICE_INTEL_MUTUAL_AUTHENTICATION:
-        return &uuid_intel_mutual_authentication;
-    case MBIM_SERVICE_INTEL_TOOLS:
-        return &uuid_intel_tools;
-    case MBIM_SERVICE_GOOGLE:
-        return &uuid_google;
-    case MBIM_SERVICE_LAST:
-        g_assert_not_reached ();
-    default:
-        for (l = mbim_custom_service_list; l != NULL; l = l->next) {
-            if (service == ((MbimCustomService *)l->data)->service_id)
-                return &((MbimCustomService *)l->data)->uuid;
-        }
-        g_return_val_if_reached (NULL);
-    }
+    if (service < MBIM_SERVICE_LAST)
+        return service_uuids[service];
+
+    s = custom_service_lookup (service);
+    g_return_val_if_fail (s, NULL);
+    return &s->uuid;
 }
 
 MbimService
 mbim_uuid_to_service (const MbimUuid *uuid)
 {
-    GList *l;
-
-    if (mbim_uuid_cmp (uuid, &uuid_basic_connect))
-        return MBIM_SERVICE_BASIC_CONNECT;
-
-    if (mbim_uuid_cmp (uuid, &uuid_sms))
-        return MBIM_SERVICE_SMS;
-
-    if (mbim_uuid_cmp (uuid, &uuid_ussd))
-        return MBIM_SERVICE_USSD;
-
-    if (mbim_uuid_cmp (uuid, &uuid_phonebook))
-        return MBIM_SERVICE_PHONEBOOK;
-
-    if (mbim_uuid_cmp (uuid, &uuid_stk))
-        return MBIM_SERVICE_STK;
-
-    if (mbim_uuid_cmp (uuid, &uuid_auth))
-        return MBIM_SERVICE_AUTH;
-
-    if (mbim_uuid_cmp (uuid, &uuid_dss))
-        return MBIM_SERVICE_DSS;
-
-    if (mbim_uuid_cmp (uuid, &uuid_ms_firmware_id))
-        return MBIM_SERVICE_MS_FIRMWARE_ID;
-
-    if (mbim_uuid_cmp (uuid, &uuid_ms_host_shutdown))
-        return MBIM_SERVICE_MS_HOST_SHUTDOWN;
-
-    if (mbim_uuid_cmp (uuid, &uuid_ms_sar))
-        return MBIM_SERVICE_MS_SAR;
-
-    if (mbim_uuid_cmp (uuid, &uuid_proxy_control))
-        return MBIM_SERVICE_PROXY_CONTROL;
-
-    if (mbim_uuid_cmp (uuid, &uuid_qmi))
-        return MBIM_SERVICE_QMI;
-
-    if (mbim_uuid_cmp (uuid, &uuid_atds))
-        return MBIM_SERVICE_ATDS;
-
-    if (mbim_uuid_cmp (uuid, &uuid_intel_firmware_update))
-        return MBIM_SERVICE_INTEL_FIRMWARE_UPDATE;
-
-    if (mbim_uuid_cmp (uuid, &uuid_qdu))
-        return MBIM_SERVICE_QDU;
-
-    if (mbim_uuid_cmp (uuid, &uuid_ms_basic_connect_extensions))
-        return MBIM_SERVICE_MS_BASIC_CONNECT_EXTENSIONS;
-
-    if (mbim_uuid_cmp (uuid, &uuid_ms_uicc_low_level_access))
-        return MBIM_SERVICE_MS_UICC_LOW_LEVEL_ACCESS;
-
-    if (mbim_uuid_cmp (uuid, &uuid_quectel))
-        return MBIM_SERVICE_QUECTEL;
-
-    if (mbim_uuid_cmp (uuid, &uuid_intel_thermal_rf))
-        return MBIM_SERVICE_INTEL_THERMAL_RF;
-
-    if (mbim_uuid_cmp (uuid, &uuid_ms_voice_extensions))
-        return MBIM_SERVICE_MS_VOICE_EXTENSIONS;
-
-    if (mbim_uuid_cmp (uuid, &uuid_intel_mutual_authentication))
-        return MBIM_SERVICE_INTEL_MUTUAL_AUTHENTICATION;
-
-    if (mbim_uuid_cmp (uuid, &uuid_intel_tools))
-        return MBIM_SERVICE_INTEL_TOOLS;
+    MbimCustomService *s;
+    guint              service;
 
-    if (mbim_uuid_cmp (uuid, &uuid_google))
-        return MBIM_SERVICE_GOOGLE;
+    if (uuid_index_lookup (service_index_get (), MBIM_SERVICE_LAST - 1, uuid, &service))
+        return (MbimService) service;
 
-    for (l = mbim_custom_service_list; l != NULL; l = l->next) {
-        if (mbim_uuid_cmp (&((MbimCustomService *)l->data)->uuid, uuid))
-            return ((MbimCustomService *)l->data)->service_id;
+    if (custom_services_by_uuid) {
+        s = g_hash_table_lookup (custom_services_by_uuid, uuid);
+        if (s)
+            return s->service_id;
     }
 
     return MBIM_SERVICE_INVALID;
@@ -629,91 +630,53 @@ static const MbimUuid uuid_context_type_emergency_calling = {
     .e = { 0xB3, 0xC9, 0x70, 0xE3, 0x60, 0xF2 }
 };
 
+/* UUIDs of the known context types, indexed by context type */
+static const MbimUuid * const context_type_uuids[MBIM_CONTEXT_TYPE_EMERGENCY_CALLING + 1] = {
+    [MBIM_CONTEXT_TYPE_INVALID]           = &uuid_invalid,
+    [MBIM_CONTEXT_TYPE_NONE]              = &uuid_context_type_none,
+    [MBIM_CONTEXT_TYPE_INTERNET]          = &uuid_context_type_internet,
+    [MBIM_CONTEXT_TYPE_VPN]               = &uuid_context_type_vpn,
+    [MBIM_CONTEXT_TYPE_VOICE]             = &uuid_context_type_voice,
+    [MBIM_CONTEXT_TYPE_VIDEO_SHARE]       = &uuid_context_type_video_share,
+    [MBIM_CONTEXT_TYPE_PURCHASE]          = &uuid_context_type_purchase,
+    [MBIM_CONTEXT_TYPE_IMS]               = &uuid_context_type_ims,
+    [MBIM_CONTEXT_TYPE_MMS]               = &uuid_context_type_mms,
+    [MBIM_CONTEXT_TYPE_LOCAL]             = &uuid_context_type_local,
+    [MBIM_CONTEXT_TYPE_ADMIN]             = &uuid_context_type_admin,
+    [MBIM_CONTEXT_TYPE_APP]               = &uuid_context_type_app,
+    [MBIM_CONTEXT_TYPE_XCAP]              = &uuid_context_type_xcap,
+    [MBIM_CONTEXT_TYPE_TETHERING]         = &uuid_context_type_tethering,
+    [MBIM_CONTEXT_TYPE_EMERGENCY_CALLING] = &uuid_context_type_emergency_calling,
+};
+
+static const UuidIndexEntry *
+context_type_index_get (void)
+{
+    static UuidIndexEntry index[G_N_ELEMENTS (context_type_uuids) - 1];
+    static gsize          initialized = 0;
+
+    if (g_once_init_enter (&initialized)) {
+        uuid_index_init (index, context_type_uuids, G_N_ELEMENTS (context_type_uuids));
+        g_once_init_leave (&initialized, 1);
+    }
+    return index;
+}
+
 const MbimUuid *
 mbim_uuid_from_context_type (MbimContextType context_type)
 {
     g_return_val_if_fail (context_type <= MBIM_CONTEXT_TYPE_EMERGENCY_CALLING, &uuid_invalid);
 
-    switch (context_type) {
-    case MBIM_CONTEXT_TYPE_INVALID:
-        return &uuid_invalid;
-    case MBIM_CONTEXT_TYPE_NONE:
-        return &uuid_context_type_none;
-    case MBIM_CONTEXT_TYPE_INTERNET:
-        return &uuid_context_type_internet;
-    case MBIM_CONTEXT_TYPE_VPN:
-        return &uuid_context_type_vpn;
-    case MBIM_CONTEXT_TYPE_VOICE:
-        return &uuid_context_type_none;
-    case MBIM_CONTEXT_TYPE_VIDEO_SHARE:
-        return &uuid_context_type_video_share;
-    case MBIM_CONTEXT_TYPE_PURCHASE:
-        return &uuid_context_type_purchase;
-    case MBIM_CONTEXT_TYPE_IMS:
-        return &uuid_context_type_ims;
-    case MBIM_CONTEXT_TYPE_MMS:
-        return &uuid_context_type_mms;
-    case MBIM_CONTEXT_TYPE_LOCAL:
-        return &uuid_context_type_local;
-    case MBIM_CONTEXT_TYPE_ADMIN:
-        return &uuid_context_type_admin;
-    case MBIM_CONTEXT_TYPE_APP:
-        return &uuid_context_type_app;
-    case MBIM_CONTEXT_TYPE_XCAP:
-        return &uuid_context_type_xcap;
-    case MBIM_CONTEXT_TYPE_TETHERING:
-        return &uuid_context_type_tethering;
-    case MBIM_CONTEXT_TYPE_EMERGENCY_CALLING:
-        return &uuid_context_type_emergency_calling;
-    default:
-        g_assert_not_reached ();
-    }
+    return context_type_uuids[context_type];
 }
 
 MbimContextType
 mbim_uuid_to_context_type (const MbimUuid *uuid)
 {
-    if (mbim_uuid_cmp (uuid, &uuid_context_type_none))
-        return MBIM_CONTEXT_TYPE_NONE;
-
-    if (mbim_uuid_cmp (uuid, &uuid_context_type_internet))
-        return MBIM_CONTEXT_TYPE_INTERNET;
-
-    if (mbim_uuid_cmp (uuid, &uuid_context_type_vpn))
-        return MBIM_CONTEXT_TYPE_VPN;
-
-    if (mbim_uuid_cmp (uuid, &uuid_context_type_voice))
-        return MBIM_CONTEXT_TYPE_VOICE;
-
-    if (mbim_uuid_cmp (uuid, &uuid_context_type_video_share))
-        return MBIM_CONTEXT_TYPE_VIDEO_SHARE;
-
-    if (mbim_uuid_cmp (uuid, &uuid_context_type_purchase))
-        return MBIM_CONTEXT_TYPE_PURCHASE;
-
-    if (mbim_uuid_cmp (uuid, &uuid_context_type_ims))
-        return MBIM_CONTEXT_TYPE_IMS;
-
-    if (mbim_uuid_cmp (uuid, &uuid_context_type_mms))
-        return MBIM_CONTEXT_TYPE_MMS;
-
-    if (mbim_uuid_cmp (uuid, &uuid_context_type_local))
-        return MBIM_CONTEXT_TYPE_LOCAL;
-
-    if (mbim_uuid_cmp (uuid, &uuid_context_type_admin))
-        return MBIM_CONTEXT_TYPE_ADMIN;
-
-    if (mbim_uuid_cmp (uuid, &uuid_context_type_app))
-        return MBIM_CONTEXT_TYPE_APP;
-
-    if (mbim_uuid_cmp (uuid, &uuid_context_type_xcap))
-        return MBIM_CONTEXT_TYPE_XCAP;
-
-    if (mbim_uuid_cmp (uuid, &uuid_context_type_tethering))
-        return MBIM_CONTEXT_TYPE_TETHERING;
+    guint context_type;
 
-    if (mbim_uuid_cmp (uuid, &uuid_context_type_emergency_calling))
-        return MBIM_CONTEXT_TYPE_EMERGENCY_CALLING;
+    if (uuid_index_lookup (context_type_index_get (), G_N_ELEMENTS (context_type_uuids) - 1, uuid, &context_type))
+        return (MbimContextType) context_type;
 
     return MBIM_CONTEXT_TYPE_INVALID;
 }
@@ -0,0 +1,173 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+
+#include <config.h>
+
+#include "mbim-enum-types.h"
+#include "mbim-flag-types.h"
+
+typedef const gchar *(* TestEnumGetString)    (gint  val);
+typedef gchar       *(* TestFlagsBuildString) (guint mask);
+
+typedef struct {
+    const gchar *name;
+    GType      (* get_type) (void);
+    gpointer     to_string;
+} TestEnumType;
+
+#define TEST_ENUM_STRING_FUNC(name)  (gpointer) name##_get_string
+#define TEST_FLAGS_STRING_FUNC(name) (gpointer) name##_build_string_from_mask
+
+/* Generated list of all enums and flags in the public headers */
+#include "test-enums-list.h"
+
+/*****************************************************************************/
+
+/* Reference implementation, scanning all values in declaration order */
+static gchar *
+reference_build_string_from_mask (GFlagsClass *klass,
+                                  guint        mask)
+{
+    GString *str = NULL;
+    guint    i;
+
+    for (i = 0; i < klass->n_values; i++) {
+        if (mask == klass->values[i].value) {
+            if (str)
+                g_string_free (str, TRUE);
+            return g_strdup (klass->values[i].value_nick);
+        }
+        if ((mask & klass->values[i].value) && (g_bit_nth_lsf (klass->values[i].value, -1) == g_bit_nth_msf (klass->values[i].value, -1))) {
+            if (!str)
+                str = g_string_new (klass->values[i].value_nick);
+            else
+                g_string_append_printf (str, ", %s", klass->values[i].value_nick);
+        }
+    }
+
+    return (str ? g_string_free (str, FALSE) : NULL);
+}
+
+static void
+test_enum_type (const TestEnumType *type)
+{
+    GEnumClass        *klass;
+    TestEnumGetString  get_string = (TestEnumGetString) type->to_string;
+    guint              i;
+
+    klass = g_type_class_ref (type->get_type ());
+
+    for (i = 0; i < klass->n_values; i++) {
+        gint value = klass->values[i].value;
+
+        /* g_enum_get_value() gives the first declared one on duplicates */
+        g_assert_cmpstr (get_string (value), ==, g_enum_get_value (klass, value)->value_nick);
+        if (!g_enum_get_value (klass, value - 1))
+            g_assert_null (get_string (value - 1));
+        if (!g_enum_get_value (klass, value + 1))
+            g_assert_null (get_string (value + 1));
+    }
+
+    g_type_class_unref (klass);
+}
+
+static void
+test_flags_type (const TestEnumType *type)
+{
+    GFlagsClass          *klass;
+    TestFlagsBuildString  build_string = (TestFlagsBuildString) type->to_string;
+    guint                 i;
+    guint                 j;
+
+    klass = g_type_class_ref (type->get_type ());
+
+    for (i = 0; i < klass->n_values; i++) {
+        for (j = i; j < klass->n_values; j++) {
+            guint             mask;
+            g_autofree gchar *str = NULL;
+            g_autofree gchar *expected = NULL;
+
+            mask = klass->values[i].value | klass->values[j].value;
+            str = build_string (mask);
+            expected = reference_build_string_from_mask (klass, mask);
+            g_assert_cmpstr (str, ==, expected);
+        }
+    }
+
+    g_type_class_unref (klass);
+}
+
+static void
+test_enums_strings (void)
+{
+    guint i;
+
+    for (i = 0; i < G_N_ELEMENTS (test_enum_types); i++) {
+        if (G_TYPE_IS_ENUM (test_enum_types[i].get_type ()))
+            test_enum_type (&test_enum_types[i]);
+        else
+            test_flags_type (&test_enum_types[i]);
+    }
+}
+
+/*****************************************************************************/
+
+#define BENCHMARK_ITERATIONS 1000
+
+static void
+test_enums_benchmark (void)
+{
+    guint   n_lookups = 0;
+    guint   iteration;
+    guint   i;
+    guint   j;
+    gdouble elapsed;
+
+    if (!g_test_perf ()) {
+        g_test_skip ("performance tests not requested");
+        return;
+    }
+
+    g_test_timer_start ();
+    for (iteration = 0; iteration < BENCHMARK_ITERATIONS; iteration++) {
+        for (i = 0; i < G_N_ELEMENTS (test_enum_types); i++) {
+            GType type;
+
+            type = test_enum_types[i].get_type ();
+            if (G_TYPE_IS_ENUM (type)) {
+                GEnumClass        *klass;
+                TestEnumGetString  get_string = (TestEnumGetString) test_enum_types[i].to_string;
+
+                klass = g_type_class_ref (type);
+                for (j = 0; j < klass->n_values; j++, n_lookups++)
+                    g_assert (get_string (klass->values[j].value));
+                g_type_class_unref (klass);
+            } else {
+                GFlagsClass          *klass;
+                TestFlagsBuildString  build_string = (TestFlagsBuildString) test_enum_types[i].to_string;
+
+                klass = g_type_class_ref (type);
+                for (j = 0; j < klass->n_values; j++, n_lookups++)
+                    g_free (build_string (klass->values[j].value));
+                g_type_class_unref (klass);
+            }
+        }
+    }
+    elapsed = g_test_timer_elapsed ();
+
+    g_test_maximized_result (n_lookups / elapsed,
+                             "%u enum and flags lookups in %.3f s (%.1f ns per lookup)",
+                             n_lookups, elapsed, (elapsed * 1e9) / n_lookups);
+}
+
+/*****************************************************************************/
+
+int main (int argc, char **argv)
+{
+    g_test_init (&argc, &argv, NULL);
+
+    g_test_add_func ("/libmbim-glib/enums/strings",   test_enums_strings);
+    g_test_add_func ("/libmbim-glib/enums/benchmark", test_enums_benchmark);
+
+    return g_test_run ();
+}
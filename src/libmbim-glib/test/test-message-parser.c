@@ -55,12 +55,73 @@ test_message_trace (const guint8 *computed,
     }
 }
 
+static gboolean
+test_message_printable_chunk (const gchar  *chunk,
+                              gsize         chunk_length,
+                              GString      *str,
+                              GError      **error)
+{
+    g_assert_cmpuint (chunk_length, >, 0);
+    g_string_append_len (str, chunk, chunk_length);
+    return TRUE;
+}
+
+static void
+test_json_well_formed (const gchar *json)
+{
+    g_autoptr(GString) nesting = NULL;
+    gboolean           in_string = FALSE;
+    const gchar       *p;
+
+    /* Not a full JSON parser, just check that strings are terminated and
+     * that objects and arrays are properly nested */
+    g_assert (json[0] == '{');
+    nesting = g_string_new ("");
+    for (p = json; *p; p++) {
+        if (in_string) {
+            g_assert_cmpint ((guchar) *p, >=, 0x20);
+            if (*p == '\\')
+                p++;
+            else if (*p == '"')
+                in_string = FALSE;
+            continue;
+        }
+        switch (*p) {
+        case '"':
+            in_string = TRUE;
+            break;
+        case '{':
+            g_string_append_c (nesting, '}');
+            break;
+        case '[':
+            g_string_append_c (nesting, ']');
+            break;
+        case '}':
+        case ']':
+            g_assert_cmpuint (nesting->len, >, 0);
+            g_assert_cmpint (nesting->str[nesting->len - 1], ==, *p);
+            g_string_truncate (nesting, nesting->len - 1);
+            /* only a single top level object */
+            if (nesting->len == 0)
+                g_assert (p[1] == '\0');
+            break;
+        default:
+            break;
+        }
+    }
+    g_assert (!in_string);
+    g_assert_cmpuint (nesting->len, ==, 0);
+}
+
 static void
 test_message_printable (MbimMessage *message,
                         guint8       mbimex_version_major,
                         guint8       mbimex_version_minor)
 {
-    g_autofree gchar *printable = NULL;
+    g_autofree gchar  *printable = NULL;
+    g_autofree gchar  *json = NULL;
+    g_autoptr(GString) streamed = NULL;
+    g_autoptr(GError)  error = NULL;
 
     printable = mbim_message_get_printable_full (message,
                                                  mbimex_version_major,
@@ -72,6 +133,39 @@ test_message_printable (MbimMessage *message,
              "Message printable:\n"
              "%s\n",
              printable);
+
+    /* The streamed printable must match the one built as a string */
+    streamed = g_string_new ("");
+    g_assert (mbim_message_write_printable (message,
+                                            mbimex_version_major,
+                                            mbimex_version_minor,
+                                            "---- ",
+                                            FALSE,
+                                            (MbimMessagePrintableFunc)test_message_printable_chunk,
+                                            streamed,
+                                            &error));
+    g_assert_no_error (error);
+    g_assert_cmpstr (streamed->str, ==, printable);
+    g_string_free (g_steal_pointer (&streamed), TRUE);
+
+    /* JSON built as a string and streamed must match as well */
+    json = mbim_message_get_json (message,
+                                  mbimex_version_major,
+                                  mbimex_version_minor,
+                                  &error);
+    g_assert_no_error (error);
+    g_assert (json);
+    test_json_well_formed (json);
+
+    streamed = g_string_new ("");
+    g_assert (mbim_message_write_json (message,
+                                       mbimex_version_major,
+                                       mbimex_version_minor,
+                                       (MbimMessagePrintableFunc)test_message_printable_chunk,
+                                       streamed,
+                                       &error));
+    g_assert_no_error (error);
+    g_assert_cmpstr (streamed->str, ==, json);
 }
 
 static void
@@ -3496,6 +3590,57 @@ test_google_carrier_lock_notification (void)
     g_assert_cmpuint (carrier_lock_cause, ==, MBIM_CARRIER_LOCK_CAUSE_NOT_APPLICABLE);
 }
 
+static void
+test_json_radio_state (void)
+{
+    g_autoptr(GError)      error = NULL;
+    g_autoptr(MbimMessage) message = NULL;
+    g_autofree gchar      *json = NULL;
+
+    message = mbim_message_radio_state_set_new (MBIM_RADIO_SWITCH_STATE_ON, &error);
+    g_assert_no_error (error);
+    g_assert (message);
+
+    json = mbim_message_get_json (message, 1, 0, &error);
+    g_assert_no_error (error);
+    g_assert_cmpstr (json, ==,
+                     "{\"header\":{\"type\":\"command\",\"length\":52,\"transaction\":0},"
+                     "\"fragment\":{\"total\":1,\"current\":0},"
+                     "\"contents\":{\"service\":\"basic-connect\","
+                     "\"service-id\":\"a289cc33-bcbb-8b4f-b6b0-133ec2aae6df\","
+                     "\"cid\":\"radio-state\","
+                     "\"command-type\":\"set\"},"
+                     "\"fields\":{\"RadioState\":\"on\"}}");
+}
+
+static void
+test_json_radio_state_truncated (void)
+{
+    g_autoptr(GError)      error = NULL;
+    g_autoptr(MbimMessage) message = NULL;
+    g_autofree gchar      *json = NULL;
+    const guint8           radio_state[] = { 0x01, 0x00 };
+
+    message = mbim_message_command_new (0,
+                                        MBIM_SERVICE_BASIC_CONNECT,
+                                        MBIM_CID_BASIC_CONNECT_RADIO_STATE,
+                                        MBIM_MESSAGE_COMMAND_TYPE_SET);
+    mbim_message_command_append (message, radio_state, sizeof (radio_state));
+
+    /* The field that cannot be read is null, and the error is given once */
+    json = mbim_message_get_json (message, 1, 0, &error);
+    g_assert_no_error (error);
+    g_assert_cmpstr (json, ==,
+                     "{\"header\":{\"type\":\"command\",\"length\":50,\"transaction\":0},"
+                     "\"fragment\":{\"total\":1,\"current\":0},"
+                     "\"contents\":{\"service\":\"basic-connect\","
+                     "\"service-id\":\"a289cc33-bcbb-8b4f-b6b0-133ec2aae6df\","
+                     "\"cid\":\"radio-state\","
+                     "\"command-type\":\"set\"},"
+                     "\"fields\":{\"RadioState\":null},"
+                     "\"fields-error\":\"cannot read 32bit unsigned integer (4 bytes) (50 < 52)\"}");
+}
+
 int main (int argc, char **argv)
 {
     g_test_init (&argc, &argv, NULL);
@@ -3540,6 +3685,8 @@ int main (int argc, char **argv)
     g_test_add_func (PREFIX "/ms-uicc-low-level-access/application-list", test_ms_uicc_low_level_access_application_list);
     g_test_add_func (PREFIX "/google/carrier-lock-response", test_google_carrier_lock);
     g_test_add_func (PREFIX "/google/carrier-lock-notify", test_google_carrier_lock_notification);
+    g_test_add_func (PREFIX "/json/radio-state", test_json_radio_state);
+    g_test_add_func (PREFIX "/json/radio-state/truncated", test_json_radio_state_truncated);
 
 #undef PREFIX
 
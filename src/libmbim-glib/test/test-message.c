@@ -475,6 +475,123 @@ test_message_invalid_type (void)
     g_assert_error (error, MBIM_CORE_ERROR, MBIM_CORE_ERROR_INVALID_MESSAGE);
 }
 
+static void
+test_message_new_take (void)
+{
+    g_autoptr(MbimMessage) message = NULL;
+    g_autoptr(GError)      error = NULL;
+    guint8                *data;
+    const guint8           buffer [] =  { 0x01, 0x00, 0x00, 0x80,
+                                          0x10, 0x00, 0x00, 0x00,
+                                          0x01, 0x00, 0x00, 0x00,
+                                          0x00, 0x00, 0x00, 0x00 };
+
+    data = g_malloc (sizeof (buffer));
+    memcpy (data, buffer, sizeof (buffer));
+    message = mbim_message_new_take (data, sizeof (buffer));
+    g_assert (message != NULL);
+
+    /* contents must have been adopted, not copied */
+    g_assert (((GByteArray *)message)->data == data);
+
+    g_assert (mbim_message_validate (message, &error));
+    g_assert_no_error (error);
+
+    g_assert_cmpuint (mbim_message_get_transaction_id        (message), ==, 1);
+    g_assert_cmpuint (mbim_message_get_message_type          (message), ==, MBIM_MESSAGE_TYPE_OPEN_DONE);
+    g_assert_cmpuint (mbim_message_get_message_length        (message), ==, 16);
+    g_assert_cmpuint (mbim_message_open_done_get_status_code (message), ==, MBIM_STATUS_ERROR_NONE);
+}
+
+static void
+test_message_bytes (void)
+{
+    g_autoptr(MbimMessage) message = NULL;
+    g_autoptr(MbimMessage) message_from_bytes = NULL;
+    g_autoptr(GBytes)      bytes = NULL;
+    const guint8          *raw;
+    guint32                raw_length = 0;
+    gsize                  bytes_length = 0;
+
+    message = mbim_message_open_new (12345, 4096);
+    raw = mbim_message_get_raw (message, &raw_length, NULL);
+    g_assert (raw != NULL);
+
+    /* the GBytes must point to the message contents */
+    bytes = mbim_message_get_bytes (message);
+    g_assert (bytes != NULL);
+    g_assert (g_bytes_get_data (bytes, &bytes_length) == raw);
+    g_assert_cmpuint (bytes_length, ==, raw_length);
+
+    /* the GBytes keeps the message alive */
+    g_clear_pointer (&message, mbim_message_unref);
+    g_assert_cmpuint (g_bytes_get_size (bytes), ==, 16);
+
+    /* a message built from shared bytes is a copy */
+    message_from_bytes = mbim_message_new_from_bytes (g_bytes_ref (bytes));
+    g_assert (message_from_bytes != NULL);
+    g_assert (((GByteArray *)message_from_bytes)->data != g_bytes_get_data (bytes, NULL));
+
+    g_assert_cmpuint (mbim_message_get_transaction_id            (message_from_bytes), ==, 12345);
+    g_assert_cmpuint (mbim_message_get_message_type              (message_from_bytes), ==, MBIM_MESSAGE_TYPE_OPEN);
+    g_assert_cmpuint (mbim_message_get_message_length            (message_from_bytes), ==, 16);
+    g_assert_cmpuint (mbim_message_open_get_max_control_transfer (message_from_bytes), ==, 4096);
+}
+
+static void
+test_message_bytes_take (void)
+{
+    g_autoptr(MbimMessage)  message = NULL;
+    GBytes                 *bytes;
+    guint8                 *data;
+    const guint8            buffer [] =  { 0x02, 0x00, 0x00, 0x00,
+                                           0x0C, 0x00, 0x00, 0x00,
+                                           0x05, 0x00, 0x00, 0x00 };
+
+    data = g_malloc (sizeof (buffer));
+    memcpy (data, buffer, sizeof (buffer));
+    bytes = g_bytes_new_take (data, sizeof (buffer));
+
+    /* the only reference to the GBytes is given, contents must be adopted */
+    message = mbim_message_new_from_bytes (bytes);
+    g_assert (message != NULL);
+    g_assert (((GByteArray *)message)->data == data);
+
+    g_assert_cmpuint (mbim_message_get_transaction_id (message), ==, 5);
+    g_assert_cmpuint (mbim_message_get_message_type   (message), ==, MBIM_MESSAGE_TYPE_CLOSE);
+    g_assert_cmpuint (mbim_message_get_message_length (message), ==, 12);
+}
+
+static gboolean
+printable_chunk_fail (const gchar  *chunk,
+                      gsize         chunk_length,
+                      guint        *n_calls,
+                      GError      **error)
+{
+    (*n_calls)++;
+    g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_NO_SPACE, "No space left");
+    return FALSE;
+}
+
+static void
+test_message_write_printable_error (void)
+{
+    g_autoptr(MbimMessage) message = NULL;
+    g_autoptr(GError)      error = NULL;
+    guint                  n_calls = 0;
+
+    message = mbim_message_open_new (12345, 4096);
+    g_assert (message != NULL);
+
+    /* the first failure aborts the whole operation */
+    g_assert (!mbim_message_write_printable (message, 1, 0, "", FALSE,
+                                             (MbimMessagePrintableFunc)printable_chunk_fail,
+                                             &n_calls,
+                                             &error));
+    g_assert_error (error, G_IO_ERROR, G_IO_ERROR_NO_SPACE);
+    g_assert_cmpuint (n_calls, ==, 1);
+}
+
 int main (int argc, char **argv)
 {
     g_test_init (&argc, &argv, NULL);
@@ -494,6 +611,10 @@ int main (int argc, char **argv)
     g_test_add_func ("/libmbim-glib/message/command-done/invalid-complete-fragment-current", test_message_command_done_invalid_complate_fragment_current);
     g_test_add_func ("/libmbim-glib/message/command-done/invalid-partial-fragment-current",  test_message_command_done_invalid_partial_fragment_current);
     g_test_add_func ("/libmbim-glib/message/invalid-type",                                   test_message_invalid_type);
+    g_test_add_func ("/libmbim-glib/message/new-take",                                       test_message_new_take);
+    g_test_add_func ("/libmbim-glib/message/bytes",                                          test_message_bytes);
+    g_test_add_func ("/libmbim-glib/message/bytes-take",                                     test_message_bytes_take);
+    g_test_add_func ("/libmbim-glib/message/write-printable/error",                          test_message_write_printable_error);
 
     return g_test_run ();
 }
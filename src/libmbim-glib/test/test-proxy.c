@@ -0,0 +1,1783 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+
+#include <config.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+
+#include <gio/gio.h>
+#include <gio/gunixsocketaddress.h>
+
+#include "mbim-proxy.h"
+#include "mbim-device.h"
+#include "mbim-device-private.h"
+#include "mbim-message.h"
+#include "mbim-simulator.h"
+#include "mbim-basic-connect.h"
+#include "mbim-proxy-control.h"
+
+/* Clients are connected in batches smaller than the default listen backlog,
+ * as connect() blocks once the backlog is full */
+#define CLIENTS_BATCH_SIZE 8
+
+/* Maximum time waiting for the proxy to process a batch */
+#define WAIT_TIMEOUT_SECS 30
+
+/* Requests sent back to back in the same write */
+#define REQUESTS_BATCH_SIZE 16
+
+/* Size of a COMMAND_DONE without information buffer */
+#define COMMAND_DONE_EMPTY_SIZE 48
+
+/* Timeout of each request sent to the devices behind the proxy */
+#define REQUEST_TIMEOUT_SECS 10
+
+/* Response delay of the simulator while requests are being queued; long
+ * enough to inspect the proxy state before the first response arrives */
+#define SCHEDULER_RESPONSE_DELAY_MS 500
+
+/* Output queue limit while a client doesn't read, and indications big enough
+ * to fill the socket buffers soon */
+#define STALLED_QUEUE_MAX_SIZE  (128 * 1024)
+#define STALLED_INDICATION_SIZE 16384
+#define STALLED_INDICATIONS     100
+
+/* Lifetime of the cached query responses expected to expire while the query
+ * cache is tested, and of those expected to outlive the test */
+#define QUERY_CACHE_SHORT_TTL_MS 10
+#define QUERY_CACHE_LONG_TTL_MS  (WAIT_TIMEOUT_SECS * 1000)
+
+/* Size of the responses of the busy device, and of its fragments */
+#define HEAVY_RESPONSE_SIZE     32768
+#define HEAVY_MAX_FRAGMENT_SIZE 64
+
+/* With device threads, latency to the idle device may grow by at most this
+ * factor, plus a fixed margin, while the other device is busy */
+#define ISOLATION_MAX_SLOWDOWN 4
+#define ISOLATION_MARGIN_MS    5
+
+/*****************************************************************************/
+
+static MbimProxy *
+test_proxy_new (void)
+{
+    g_autoptr(GError) error = NULL;
+    MbimProxy         *proxy;
+
+    if (getuid () != 0) {
+        g_test_skip ("proxy tests require running as root");
+        return NULL;
+    }
+
+    proxy = mbim_proxy_new (&error);
+    if (!proxy) {
+        g_autofree gchar *msg = NULL;
+
+        /* e.g. another proxy already listening */
+        msg = g_strdup_printf ("couldn't create proxy: %s", error->message);
+        g_test_skip (msg);
+        return NULL;
+    }
+
+    return proxy;
+}
+
+static void
+wait_n_clients (MbimProxy *proxy,
+                guint      n_clients)
+{
+    g_autoptr(GTimer) timer = NULL;
+
+    timer = g_timer_new ();
+    while (mbim_proxy_get_n_clients (proxy) != n_clients) {
+        if (!g_main_context_iteration (NULL, FALSE))
+            g_usleep (100);
+        g_assert_cmpfloat (g_timer_elapsed (timer, NULL), <, WAIT_TIMEOUT_SECS);
+    }
+}
+
+static GSocketConnection *
+client_connect (GSocketClient  *client,
+                GSocketAddress *address)
+{
+    g_autoptr(GError)  error = NULL;
+    GSocketConnection *connection;
+
+    connection = g_socket_client_connect (client, G_SOCKET_CONNECTABLE (address), NULL, &error);
+    g_assert_no_error (error);
+    g_assert (connection);
+    return connection;
+}
+
+static gsize
+get_rss (void)
+{
+    g_autofree gchar *contents = NULL;
+    gulong            size;
+    gulong            resident;
+
+    if (!g_file_get_contents ("/proc/self/statm", &contents, NULL, NULL) ||
+        sscanf (contents, "%lu %lu", &size, &resident) != 2)
+        return 0;
+
+    return (gsize) resident * sysconf (_SC_PAGESIZE);
+}
+
+/*****************************************************************************/
+
+static void
+test_proxy_clients_short_lived (void)
+{
+    g_autoptr(MbimProxy)      proxy = NULL;
+    g_autoptr(GSocketClient)  client = NULL;
+    g_autoptr(GSocketAddress) address = NULL;
+    g_autoptr(GTimer)         timer = NULL;
+    GSocketConnection        *connections[CLIENTS_BATCH_SIZE];
+    guint                     n_clients;
+    guint                     i;
+    guint                     j;
+    gdouble                   accept_time = 0.0;
+    gdouble                   teardown_time = 0.0;
+
+    proxy = test_proxy_new ();
+    if (!proxy)
+        return;
+
+    /* A few thousand short-lived clients, as per-request scripts do */
+    n_clients = g_test_perf () ? 5000 : 200;
+
+    client = g_socket_client_new ();
+    address = g_unix_socket_address_new_with_type (MBIM_PROXY_SOCKET_PATH, -1, G_UNIX_SOCKET_ADDRESS_ABSTRACT);
+    timer = g_timer_new ();
+
+    for (i = 0; i < n_clients; i += CLIENTS_BATCH_SIZE) {
+        g_timer_start (timer);
+        for (j = 0; j < CLIENTS_BATCH_SIZE; j++)
+            connections[j] = client_connect (client, address);
+        wait_n_clients (proxy, CLIENTS_BATCH_SIZE);
+        accept_time += g_timer_elapsed (timer, NULL);
+
+        g_timer_start (timer);
+        for (j = 0; j < CLIENTS_BATCH_SIZE; j++)
+            g_object_unref (connections[j]);
+        wait_n_clients (proxy, 0);
+        teardown_time += g_timer_elapsed (timer, NULL);
+    }
+
+    g_test_maximized_result (n_clients / accept_time, "clients accepted per second");
+    g_test_maximized_result (n_clients / teardown_time, "clients torn down per second");
+}
+
+static void
+test_proxy_clients_memory (void)
+{
+    g_autoptr(MbimProxy)      proxy = NULL;
+    g_autoptr(GSocketClient)  client = NULL;
+    g_autoptr(GSocketAddress) address = NULL;
+    g_autoptr(GPtrArray)      connections = NULL;
+    guint                     n_clients;
+    guint                     i;
+    gsize                     rss_before;
+    gsize                     rss_after;
+
+    proxy = test_proxy_new ();
+    if (!proxy)
+        return;
+
+    /* Both ends of each connection live in this process, keep the amount of
+     * open file descriptors well below the usual limit */
+    n_clients = g_test_perf () ? 400 : 64;
+
+    client = g_socket_client_new ();
+    address = g_unix_socket_address_new_with_type (MBIM_PROXY_SOCKET_PATH, -1, G_UNIX_SOCKET_ADDRESS_ABSTRACT);
+    connections = g_ptr_array_new_with_free_func (g_object_unref);
+
+    rss_before = get_rss ();
+    for (i = 0; i < n_clients; i++) {
+        g_ptr_array_add (connections, client_connect (client, address));
+        if ((i + 1) % CLIENTS_BATCH_SIZE == 0)
+            wait_n_clients (proxy, i + 1);
+    }
+    wait_n_clients (proxy, n_clients);
+    rss_after = get_rss ();
+
+    /* Includes the client side of each connection as well */
+    if (rss_before && rss_after > rss_before)
+        g_test_minimized_result ((gdouble) (rss_after - rss_before) / n_clients, "bytes per connected client");
+
+    g_ptr_array_set_size (connections, 0);
+    wait_n_clients (proxy, 0);
+}
+
+/* Receive from a non-blocking socket while the proxy runs in this same thread */
+static void
+socket_receive (GSocket    *socket,
+                GByteArray *buffer,
+                guint       size)
+{
+    g_autoptr(GTimer) timer = NULL;
+    guint             len;
+
+    timer = g_timer_new ();
+    len = buffer->len;
+    g_byte_array_set_size (buffer, len + size);
+    while (size > 0) {
+        g_autoptr(GError) error = NULL;
+        gssize            r;
+
+        r = g_socket_receive (socket, (gchar *) &buffer->data[len], size, NULL, &error);
+        if (r < 0) {
+            g_assert_error (error, G_IO_ERROR, G_IO_ERROR_WOULD_BLOCK);
+            g_main_context_iteration (NULL, TRUE);
+        } else {
+            g_assert_cmpint (r, >, 0);
+            len += r;
+            size -= r;
+        }
+        g_assert_cmpfloat (g_timer_elapsed (timer, NULL), <, WAIT_TIMEOUT_SECS);
+    }
+}
+
+static void
+socket_send_all (GSocket    *socket,
+                 GByteArray *buffer)
+{
+    g_autoptr(GError) error = NULL;
+
+    /* Always small enough to fit in the socket buffer */
+    g_assert_cmpint (g_socket_send (socket, (const gchar *) buffer->data, buffer->len, NULL, &error), ==, buffer->len);
+    g_assert_no_error (error);
+}
+
+/* Receive a whole message, without parsing it */
+static GByteArray *
+socket_receive_message (GSocket *socket)
+{
+    GByteArray *message;
+    guint32     length;
+
+    message = g_byte_array_new ();
+    socket_receive (socket, message, 12);
+    memcpy (&length, &message->data[4], sizeof (length));
+    socket_receive (socket, message, GUINT32_FROM_LE (length) - 12);
+    return message;
+}
+
+/* Statistics of the only client connected, as seen by the proxy */
+static MbimProxyClientStatistics **
+query_client_statistics (GSocket *socket)
+{
+    g_autoptr(GError)                         error = NULL;
+    g_autoptr(MbimMessage)                    request = NULL;
+    g_autoptr(GByteArray)                     response = NULL;
+    g_autoptr(MbimProxyDeviceStatisticsArray) devices = NULL;
+    MbimProxyClientStatistics               **clients = NULL;
+    g_autoptr(MbimProxyCidStatisticsArray)    cids = NULL;
+    g_autofree guint32                       *latency_bounds = NULL;
+    guint32                                   devices_count;
+    guint32                                   clients_count;
+    guint32                                   latency_bounds_count;
+    guint32                                   cids_count;
+    GByteArray                                raw;
+
+    request = mbim_message_proxy_control_statistics_query_new (NULL);
+    mbim_message_set_transaction_id (request, 1);
+    raw.data = (guint8 *) mbim_message_get_raw (request, &raw.len, &error);
+    g_assert_no_error (error);
+    socket_send_all (socket, &raw);
+
+    response = socket_receive_message (socket);
+    mbim_message_proxy_control_statistics_response_parse ((MbimMessage *) response,
+                                                          &devices_count, &devices,
+                                                          &clients_count, &clients,
+                                                          &latency_bounds_count, &latency_bounds,
+                                                          &cids_count, &cids,
+                                                          &error);
+    g_assert_no_error (error);
+    g_assert_cmpuint (clients_count, ==, 1);
+    return clients;
+}
+
+static guint64
+query_bytes_in_copied (GSocket *socket)
+{
+    g_autoptr(MbimProxyClientStatisticsArray) clients = NULL;
+
+    clients = query_client_statistics (socket);
+    return clients[0]->bytes_in_copied;
+}
+
+static void
+test_proxy_requests_input (void)
+{
+    g_autoptr(MbimProxy)         proxy = NULL;
+    g_autoptr(GSocketClient)     client = NULL;
+    g_autoptr(GSocketAddress)    address = NULL;
+    g_autoptr(GSocketConnection) connection = NULL;
+    g_autoptr(MbimMessage)       request = NULL;
+    g_autoptr(GByteArray)        single = NULL;
+    g_autoptr(GByteArray)        batch = NULL;
+    g_autoptr(GByteArray)        responses = NULL;
+    g_autoptr(GTimer)            timer = NULL;
+    g_autoptr(GError)            error = NULL;
+    GSocket                     *socket;
+    const guint8                *raw;
+    guint32                      raw_len;
+    guint64                      copied;
+    guint                        n_requests;
+    guint                        i;
+
+    proxy = test_proxy_new ();
+    if (!proxy)
+        return;
+
+    n_requests = g_test_perf () ? 100000 : 1024;
+
+    client = g_socket_client_new ();
+    address = g_unix_socket_address_new_with_type (MBIM_PROXY_SOCKET_PATH, -1, G_UNIX_SOCKET_ADDRESS_ABSTRACT);
+    connection = client_connect (client, address);
+    socket = g_socket_connection_get_socket (connection);
+    g_socket_set_blocking (socket, FALSE);
+
+    /* Requests answered by the proxy itself with an empty COMMAND_DONE */
+    request = mbim_message_command_new (1, MBIM_SERVICE_PROXY_CONTROL, MBIM_CID_PROXY_CONTROL_STATISTICS, MBIM_MESSAGE_COMMAND_TYPE_SET);
+    raw = mbim_message_get_raw (request, &raw_len, &error);
+    g_assert_no_error (error);
+
+    single = g_byte_array_new ();
+    g_byte_array_append (single, raw, raw_len);
+    batch = g_byte_array_new ();
+    for (i = 0; i < REQUESTS_BATCH_SIZE; i++)
+        g_byte_array_append (batch, raw, raw_len);
+    responses = g_byte_array_new ();
+    timer = g_timer_new ();
+
+    /* One request at a time */
+    for (i = 0; i < n_requests; i++) {
+        socket_send_all (socket, single);
+        socket_receive (socket, responses, COMMAND_DONE_EMPTY_SIZE);
+        g_byte_array_set_size (responses, 0);
+    }
+    g_test_maximized_result (n_requests / g_timer_elapsed (timer, NULL), "requests per second, one at a time");
+    copied = query_bytes_in_copied (socket);
+    g_test_minimized_result ((gdouble) copied / n_requests, "bytes copied per request, one at a time");
+
+    /* Requests back to back */
+    g_timer_start (timer);
+    for (i = 0; i < n_requests; i += REQUESTS_BATCH_SIZE) {
+        socket_send_all (socket, batch);
+        socket_receive (socket, responses, REQUESTS_BATCH_SIZE * COMMAND_DONE_EMPTY_SIZE);
+        g_byte_array_set_size (responses, 0);
+    }
+    g_test_maximized_result (n_requests / g_timer_elapsed (timer, NULL), "requests per second, back to back");
+    copied = query_bytes_in_copied (socket) - copied;
+    g_test_minimized_result ((gdouble) copied / n_requests, "bytes copied per request, back to back");
+}
+
+static gpointer
+handoff_thread (gpointer user_data)
+{
+    g_autoptr(GError)  error = NULL;
+    MbimProxy         *proxy;
+
+    /* Blocks until the running proxy in the main thread hands off */
+    proxy = mbim_proxy_new_from_handoff (&error);
+    g_assert_no_error (error);
+    return proxy;
+}
+
+static void
+handed_off_cb (MbimProxy *proxy,
+               gboolean  *handed_off)
+{
+    *handed_off = TRUE;
+}
+
+static void
+test_proxy_handoff (void)
+{
+    g_autoptr(MbimProxy)                      proxy = NULL;
+    g_autoptr(MbimProxy)                      new_proxy = NULL;
+    g_autoptr(GSocketClient)                  client = NULL;
+    g_autoptr(GSocketAddress)                 address = NULL;
+    g_autoptr(GSocketConnection)              connection = NULL;
+    g_autoptr(MbimProxyClientStatisticsArray) before = NULL;
+    g_autoptr(MbimProxyClientStatisticsArray) after = NULL;
+    g_autoptr(MbimMessage)                    request = NULL;
+    g_autoptr(GByteArray)                     response = NULL;
+    g_autoptr(GTimer)                         timer = NULL;
+    g_autoptr(GError)                         error = NULL;
+    GByteArray                                partial;
+    GThread                                  *thread;
+    GSocket                                  *socket;
+    const guint8                             *raw;
+    guint32                                   raw_len;
+    gboolean                                  handed_off = FALSE;
+
+    proxy = test_proxy_new ();
+    if (!proxy)
+        return;
+
+    g_object_set (proxy, MBIM_PROXY_HANDOFF, TRUE, NULL);
+    g_signal_connect (proxy, MBIM_PROXY_SIGNAL_HANDED_OFF, G_CALLBACK (handed_off_cb), &handed_off);
+
+    client = g_socket_client_new ();
+    address = g_unix_socket_address_new_with_type (MBIM_PROXY_SOCKET_PATH, -1, G_UNIX_SOCKET_ADDRESS_ABSTRACT);
+    connection = client_connect (client, address);
+    socket = g_socket_connection_get_socket (connection);
+    g_socket_set_blocking (socket, FALSE);
+    before = query_client_statistics (socket);
+
+    /* Part of a request is read by the proxy before the handoff */
+    request = mbim_message_command_new (2, MBIM_SERVICE_PROXY_CONTROL, MBIM_CID_PROXY_CONTROL_STATISTICS, MBIM_MESSAGE_COMMAND_TYPE_SET);
+    raw = mbim_message_get_raw (request, &raw_len, &error);
+    g_assert_no_error (error);
+    partial.data = (guint8 *) raw;
+    partial.len = raw_len / 2;
+    socket_send_all (socket, &partial);
+    while (g_main_context_iteration (NULL, FALSE));
+
+    timer = g_timer_new ();
+    thread = g_thread_new ("handoff", handoff_thread, NULL);
+    while (!handed_off) {
+        g_main_context_iteration (NULL, TRUE);
+        g_assert_cmpfloat (g_timer_elapsed (timer, NULL), <, WAIT_TIMEOUT_SECS);
+    }
+    new_proxy = g_thread_join (thread);
+    g_assert (new_proxy);
+    g_test_minimized_result (g_timer_elapsed (timer, NULL) * 1000.0, "ms to hand off");
+
+    g_assert_cmpuint (mbim_proxy_get_n_clients (proxy), ==, 0);
+    g_assert_cmpuint (mbim_proxy_get_n_clients (new_proxy), ==, 1);
+
+    /* The same connection keeps on working with the new proxy, which gets
+     * the rest of the request */
+    partial.data = (guint8 *) &raw[raw_len / 2];
+    partial.len = raw_len - raw_len / 2;
+    socket_send_all (socket, &partial);
+    response = g_byte_array_new ();
+    socket_receive (socket, response, COMMAND_DONE_EMPTY_SIZE);
+
+    after = query_client_statistics (socket);
+    g_assert_cmpuint (after[0]->client_id, ==, before[0]->client_id);
+
+    /* New clients are accepted by the new proxy */
+    g_clear_object (&connection);
+    wait_n_clients (new_proxy, 0);
+    connection = client_connect (client, address);
+    wait_n_clients (new_proxy, 1);
+}
+
+/*****************************************************************************/
+/* Devices behind the proxy, backed by simulators */
+
+/* Each simulator runs in its own thread, so that the proxy is the only
+ * shared component between the devices */
+typedef struct {
+    MbimSimulator *simulator;
+    GMainContext  *context;
+    GMainLoop     *loop;
+    GThread       *thread;
+} SimulatorThread;
+
+static gpointer
+simulator_thread_run (SimulatorThread *st)
+{
+    g_main_context_push_thread_default (st->context);
+    g_main_loop_run (st->loop);
+    g_main_context_pop_thread_default (st->context);
+    return NULL;
+}
+
+static SimulatorThread *
+simulator_thread_new (guint   max_fragment_size,
+                      guint32 response_size)
+{
+    g_autoptr(GError)  error = NULL;
+    g_autofree guint8 *response = NULL;
+    SimulatorThread   *st;
+
+    st = g_slice_new0 (SimulatorThread);
+    st->context = g_main_context_new ();
+    st->loop = g_main_loop_new (st->context, FALSE);
+
+    g_main_context_push_thread_default (st->context);
+    st->simulator = mbim_simulator_new (&error);
+    g_main_context_pop_thread_default (st->context);
+    g_assert_no_error (error);
+
+    g_object_set (st->simulator, MBIM_SIMULATOR_MAX_FRAGMENT_SIZE, max_fragment_size, NULL);
+    if (response_size) {
+        response = g_malloc0 (response_size);
+        mbim_simulator_set_response (st->simulator,
+                                     MBIM_SERVICE_BASIC_CONNECT,
+                                     MBIM_CID_BASIC_CONNECT_HOME_PROVIDER,
+                                     MBIM_MESSAGE_COMMAND_TYPE_QUERY,
+                                     MBIM_STATUS_ERROR_NONE,
+                                     response,
+                                     response_size);
+    }
+
+    st->thread = g_thread_new ("simulator", (GThreadFunc) simulator_thread_run, st);
+    return st;
+}
+
+static void
+simulator_thread_free (SimulatorThread *st)
+{
+    g_main_loop_quit (st->loop);
+    g_thread_join (st->thread);
+    g_object_unref (st->simulator);
+    g_main_loop_unref (st->loop);
+    g_main_context_unref (st->context);
+    g_slice_free (SimulatorThread, st);
+}
+
+/* Runs the function in the thread of the simulator, and waits for it */
+typedef struct {
+    GSourceFunc  func;
+    gpointer     user_data;
+    GMutex       mutex;
+    GCond        cond;
+    gboolean     done;
+} SimulatorCall;
+
+static gboolean
+simulator_call_cb (SimulatorCall *call)
+{
+    call->func (call->user_data);
+
+    g_mutex_lock (&call->mutex);
+    call->done = TRUE;
+    g_cond_signal (&call->cond);
+    g_mutex_unlock (&call->mutex);
+    return G_SOURCE_REMOVE;
+}
+
+static void
+simulator_thread_call (SimulatorThread *st,
+                       GSourceFunc      func,
+                       gpointer         user_data)
+{
+    SimulatorCall call = { 0 };
+
+    call.func = func;
+    call.user_data = user_data;
+    g_mutex_init (&call.mutex);
+    g_cond_init (&call.cond);
+
+    g_main_context_invoke (st->context, (GSourceFunc) simulator_call_cb, &call);
+    g_mutex_lock (&call.mutex);
+    while (!call.done)
+        g_cond_wait (&call.cond, &call.mutex);
+    g_mutex_unlock (&call.mutex);
+
+    g_mutex_clear (&call.mutex);
+    g_cond_clear (&call.cond);
+}
+
+typedef struct {
+    MbimSimulator *simulator;
+    guint          n_requests;
+} SimulatorRequests;
+
+static gboolean
+simulator_get_n_requests_cb (SimulatorRequests *requests)
+{
+    requests->n_requests = mbim_simulator_get_n_requests (requests->simulator);
+    return G_SOURCE_REMOVE;
+}
+
+static guint
+simulator_thread_get_n_requests (SimulatorThread *st)
+{
+    SimulatorRequests requests = { 0 };
+
+    requests.simulator = st->simulator;
+    simulator_thread_call (st, (GSourceFunc) simulator_get_n_requests_cb, &requests);
+    return requests.n_requests;
+}
+
+static gboolean
+simulator_reject_subscribe_list_cb (MbimSimulator *simulator)
+{
+    mbim_simulator_set_response (simulator,
+                                 MBIM_SERVICE_BASIC_CONNECT,
+                                 MBIM_CID_BASIC_CONNECT_DEVICE_SERVICE_SUBSCRIBE_LIST,
+                                 MBIM_MESSAGE_COMMAND_TYPE_SET,
+                                 MBIM_STATUS_ERROR_FAILURE,
+                                 NULL,
+                                 0);
+    return G_SOURCE_REMOVE;
+}
+
+/* A PCO indication, not in the standard subscribe list, followed by a signal
+ * state one, which is */
+static gboolean
+simulator_emit_indications_cb (MbimSimulator *simulator)
+{
+    static const guint8 buffer[20] = { 0 };
+
+    mbim_simulator_emit_indications (simulator,
+                                     MBIM_SERVICE_MS_BASIC_CONNECT_EXTENSIONS,
+                                     MBIM_CID_MS_BASIC_CONNECT_EXTENSIONS_PCO,
+                                     buffer, sizeof (buffer),
+                                     1, 0);
+    mbim_simulator_emit_indications (simulator,
+                                     MBIM_SERVICE_BASIC_CONNECT,
+                                     MBIM_CID_BASIC_CONNECT_SIGNAL_STATE,
+                                     buffer, sizeof (buffer),
+                                     1, 0);
+    return G_SOURCE_REMOVE;
+}
+
+static gboolean
+simulator_emit_stalled_indications_cb (MbimSimulator *simulator)
+{
+    g_autofree guint8 *buffer = NULL;
+
+    buffer = g_malloc0 (STALLED_INDICATION_SIZE);
+    mbim_simulator_emit_indications (simulator,
+                                     MBIM_SERVICE_BASIC_CONNECT,
+                                     MBIM_CID_BASIC_CONNECT_SIGNAL_STATE,
+                                     buffer, STALLED_INDICATION_SIZE,
+                                     STALLED_INDICATIONS, 0);
+    return G_SOURCE_REMOVE;
+}
+
+static void
+async_result_ready (GObject       *source,
+                    GAsyncResult  *res,
+                    GAsyncResult **out)
+{
+    *out = g_object_ref (res);
+}
+
+/* Run the proxy, which lives in this same thread, until the result is ready */
+static void
+async_result_wait (GAsyncResult **res)
+{
+    g_autoptr(GTimer) timer = NULL;
+
+    timer = g_timer_new ();
+    while (!*res) {
+        g_main_context_iteration (NULL, TRUE);
+        g_assert_cmpfloat (g_timer_elapsed (timer, NULL), <, WAIT_TIMEOUT_SECS);
+    }
+}
+
+/* Same sequence as mbimcli --device-open-proxy; the timeout is also the one
+ * reported to the proxy. If given, proxy_path is the program spawned if the
+ * proxy isn't running. */
+static MbimDevice *
+proxy_client_open_full (const gchar *path,
+                        guint        timeout,
+                        const gchar *proxy_path)
+{
+    g_autoptr(GError)       error = NULL;
+    g_autoptr(GFile)        file = NULL;
+    g_autoptr(GAsyncResult) res = NULL;
+    MbimDevice             *device;
+
+    file = g_file_new_for_path (path);
+    mbim_device_new (file, NULL, (GAsyncReadyCallback) async_result_ready, &res);
+    async_result_wait (&res);
+    device = mbim_device_new_finish (res, &error);
+    g_assert_no_error (error);
+    g_clear_object (&res);
+
+    if (proxy_path)
+        _mbim_device_set_proxy_path (device, proxy_path);
+    mbim_device_open_full (device, MBIM_DEVICE_OPEN_FLAGS_PROXY, timeout, NULL,
+                           (GAsyncReadyCallback) async_result_ready, &res);
+    async_result_wait (&res);
+    mbim_device_open_full_finish (device, res, &error);
+    g_assert_no_error (error);
+    return device;
+}
+
+static MbimDevice *
+proxy_client_open (const gchar *path)
+{
+    return proxy_client_open_full (path, REQUEST_TIMEOUT_SECS, NULL);
+}
+
+static void
+proxy_client_close (MbimDevice *device)
+{
+    g_autoptr(GError)       error = NULL;
+    g_autoptr(GAsyncResult) res = NULL;
+
+    mbim_device_close (device, REQUEST_TIMEOUT_SECS, NULL, (GAsyncReadyCallback) async_result_ready, &res);
+    async_result_wait (&res);
+    mbim_device_close_finish (device, res, &error);
+    g_assert_no_error (error);
+    g_object_unref (device);
+}
+
+static void
+proxy_client_command (MbimDevice  *device,
+                      MbimMessage *request)
+{
+    g_autoptr(GError)       error = NULL;
+    g_autoptr(GAsyncResult) res = NULL;
+    g_autoptr(MbimMessage)  response = NULL;
+
+    mbim_device_command (device, request, REQUEST_TIMEOUT_SECS, NULL, (GAsyncReadyCallback) async_result_ready, &res);
+    async_result_wait (&res);
+    response = mbim_device_command_finish (device, res, &error);
+    g_assert_no_error (error);
+    g_assert_cmpuint (mbim_message_get_message_type (response), ==, MBIM_MESSAGE_TYPE_COMMAND_DONE);
+}
+
+/* Replaces the subscribe list of the client with the given cid of the
+ * service, or all of them if 0; returns whether the device accepted it */
+static gboolean
+proxy_client_subscribe (MbimDevice  *device,
+                        MbimService  service,
+                        guint32      cid)
+{
+    g_autoptr(GError)       error = NULL;
+    g_autoptr(GAsyncResult) res = NULL;
+    g_autoptr(MbimMessage)  request = NULL;
+    g_autoptr(MbimMessage)  response = NULL;
+    MbimEventEntry          entry = { 0 };
+    const MbimEventEntry   *entries[] = { &entry };
+
+    memcpy (&entry.device_service_id, mbim_uuid_from_service (service), sizeof (MbimUuid));
+    if (cid) {
+        entry.cids_count = 1;
+        entry.cids = &cid;
+    }
+    request = mbim_message_device_service_subscribe_list_set_new (G_N_ELEMENTS (entries), entries, &error);
+    g_assert_no_error (error);
+
+    mbim_device_command (device, request, REQUEST_TIMEOUT_SECS, NULL, (GAsyncReadyCallback) async_result_ready, &res);
+    async_result_wait (&res);
+    response = mbim_device_command_finish (device, res, &error);
+    g_assert_no_error (error);
+    if (mbim_message_response_get_result (response, MBIM_MESSAGE_TYPE_COMMAND_DONE, &error))
+        return TRUE;
+    g_assert_error (error, MBIM_STATUS_ERROR, MBIM_STATUS_ERROR_FAILURE);
+    return FALSE;
+}
+
+/* Indications forwarded to the client before a request is received are
+ * received before its response */
+static void
+proxy_client_sync (MbimDevice *device)
+{
+    g_autoptr(MbimMessage) request = NULL;
+
+    request = mbim_message_device_services_query_new (NULL);
+    proxy_client_command (device, request);
+}
+
+/* Indications received by a client, of the ones emitted by
+ * simulator_emit_indications_cb() */
+typedef struct {
+    guint n_pco;
+    guint n_signal_state;
+} IndicationCount;
+
+static void
+indication_count_cb (MbimDevice      *device,
+                     MbimMessage     *message,
+                     IndicationCount *count)
+{
+    MbimService service;
+    guint       cid;
+
+    service = mbim_message_indicate_status_get_service (message);
+    cid = mbim_message_indicate_status_get_cid (message);
+    if (service == MBIM_SERVICE_MS_BASIC_CONNECT_EXTENSIONS && cid == MBIM_CID_MS_BASIC_CONNECT_EXTENSIONS_PCO)
+        count->n_pco++;
+    else if (service == MBIM_SERVICE_BASIC_CONNECT && cid == MBIM_CID_BASIC_CONNECT_SIGNAL_STATE)
+        count->n_signal_state++;
+}
+
+static void
+indication_count_wait (IndicationCount *count,
+                       guint            n_signal_state)
+{
+    g_autoptr(GTimer) timer = NULL;
+
+    timer = g_timer_new ();
+    while (count->n_signal_state < n_signal_state) {
+        g_main_context_iteration (NULL, TRUE);
+        g_assert_cmpfloat (g_timer_elapsed (timer, NULL), <, WAIT_TIMEOUT_SECS);
+    }
+}
+
+static void
+test_proxy_open_device (void)
+{
+    g_autoptr(MbimProxy)  proxy = NULL;
+    g_autoptr(GTimer)     timer = NULL;
+    SimulatorThread      *st;
+    MbimDevice           *first;
+    gdouble               cold_time;
+    gdouble               warm_time;
+    guint                 n_clients;
+    guint                 i;
+
+    proxy = test_proxy_new ();
+    if (!proxy)
+        return;
+
+    st = simulator_thread_new (4096, 0);
+
+    /* The first client makes the proxy open the device */
+    timer = g_timer_new ();
+    first = proxy_client_open (mbim_simulator_get_path (st->simulator));
+    cold_time = g_timer_elapsed (timer, NULL);
+
+    /* Further clients reuse the device already open in the proxy */
+    n_clients = g_test_perf () ? 1000 : 20;
+    g_timer_start (timer);
+    for (i = 0; i < n_clients; i++)
+        proxy_client_close (proxy_client_open (mbim_simulator_get_path (st->simulator)));
+    warm_time = g_timer_elapsed (timer, NULL) / n_clients;
+
+    proxy_client_close (first);
+    simulator_thread_free (st);
+
+    g_test_minimized_result (cold_time * 1000.0, "ms per cold --device-open-proxy open");
+    g_test_minimized_result (warm_time * 1000.0, "ms per warm --device-open-proxy open and close");
+}
+
+/* Same sequence as a cold --device-open-proxy open with no proxy running:
+ * MbimDevice spawns the proxy, waits for its ready notification and connects */
+static void
+test_proxy_open_latency (void)
+{
+    g_autoptr(GError)            error = NULL;
+    g_autoptr(GSocketClient)     client = NULL;
+    g_autoptr(GSocketAddress)    address = NULL;
+    g_autoptr(GSocketConnection) connection = NULL;
+    g_autoptr(GCredentials)      credentials = NULL;
+    g_autoptr(GTimer)            timer = NULL;
+    SimulatorThread             *st;
+    MbimDevice                  *first;
+    const gchar                 *proxy_path;
+    pid_t                        pid;
+    gdouble                      ready_time;
+    gdouble                      cold_time;
+    gdouble                      warm_time;
+    guint                        n_clients;
+    guint                        i;
+
+    proxy_path = g_getenv ("MBIM_TEST_PROXY_PATH");
+    if (!proxy_path || !g_file_test (proxy_path, G_FILE_TEST_IS_EXECUTABLE)) {
+        g_test_skip ("mbim-proxy program not available");
+        return;
+    }
+
+    if (getuid () != 0) {
+        g_test_skip ("proxy tests require running as root");
+        return;
+    }
+
+    client = g_socket_client_new ();
+    address = g_unix_socket_address_new_with_type (MBIM_PROXY_SOCKET_PATH, -1, G_UNIX_SOCKET_ADDRESS_ABSTRACT);
+    connection = g_socket_client_connect (client, G_SOCKET_CONNECTABLE (address), NULL, NULL);
+    if (connection) {
+        g_test_skip ("another proxy already listening");
+        return;
+    }
+
+    st = simulator_thread_new (4096, 0);
+
+    timer = g_timer_new ();
+    first = proxy_client_open_full (mbim_simulator_get_path (st->simulator), REQUEST_TIMEOUT_SECS, proxy_path);
+    cold_time = g_timer_elapsed (timer, NULL);
+    ready_time = mbim_device_get_open_step_time (first, MBIM_DEVICE_OPEN_STEP_CREATE_IOCHANNEL) / 1000.0;
+
+    /* Further clients connect to the running proxy */
+    n_clients = g_test_perf () ? 1000 : 20;
+    g_timer_start (timer);
+    for (i = 0; i < n_clients; i++)
+        proxy_client_close (proxy_client_open (mbim_simulator_get_path (st->simulator)));
+    warm_time = g_timer_elapsed (timer, NULL) / n_clients;
+
+    /* The spawned proxy isn't a child of this process, so it is found through
+     * the socket credentials */
+    connection = client_connect (client, address);
+    credentials = g_socket_get_credentials (g_socket_connection_get_socket (connection), &error);
+    g_assert_no_error (error);
+    pid = g_credentials_get_unix_pid (credentials, &error);
+    g_assert_no_error (error);
+    g_clear_object (&connection);
+
+    proxy_client_close (first);
+    simulator_thread_free (st);
+
+    /* Wait until the proxy no longer listens, so that the next tests can */
+    kill (pid, SIGTERM);
+    g_timer_start (timer);
+    while ((connection = g_socket_client_connect (client, G_SOCKET_CONNECTABLE (address), NULL, NULL)) != NULL) {
+        g_clear_object (&connection);
+        g_usleep (10000);
+        g_assert_cmpfloat (g_timer_elapsed (timer, NULL), <, WAIT_TIMEOUT_SECS);
+    }
+
+    g_test_minimized_result (ready_time, "ms until spawned proxy is ready");
+    g_test_minimized_result (cold_time * 1000.0, "ms per cold --device-open-proxy open, spawning the proxy");
+    g_test_minimized_result (warm_time * 1000.0, "ms per warm --device-open-proxy open and close, spawned proxy");
+}
+
+typedef struct {
+    MbimDevice *device;
+    gboolean    stop;
+    gboolean    pending;
+    guint       n_responses;
+} HeavyLoad;
+
+static void heavy_load_next (HeavyLoad *load);
+
+static void
+heavy_load_ready (MbimDevice   *device,
+                  GAsyncResult *res,
+                  HeavyLoad    *load)
+{
+    g_autoptr(GError)      error = NULL;
+    g_autoptr(MbimMessage) response = NULL;
+
+    response = mbim_device_command_finish (device, res, &error);
+    g_assert_no_error (error);
+    g_assert_cmpuint (mbim_message_get_message_type (response), ==, MBIM_MESSAGE_TYPE_COMMAND_DONE);
+
+    load->pending = FALSE;
+    load->n_responses++;
+    if (!load->stop)
+        heavy_load_next (load);
+}
+
+static void
+heavy_load_next (HeavyLoad *load)
+{
+    g_autoptr(MbimMessage) request = NULL;
+
+    request = mbim_message_home_provider_query_new (NULL);
+    load->pending = TRUE;
+    mbim_device_command (load->device, request, REQUEST_TIMEOUT_SECS, NULL, (GAsyncReadyCallback) heavy_load_ready, load);
+}
+
+static void
+test_proxy_devices_latency (gconstpointer data)
+{
+    g_autoptr(MbimProxy)  proxy = NULL;
+    g_autoptr(GTimer)     timer = NULL;
+    SimulatorThread      *heavy;
+    SimulatorThread      *light;
+    MbimDevice           *light_device;
+    HeavyLoad             load = { 0 };
+    gboolean              device_threads;
+    gdouble               idle_time;
+    gdouble               busy_time;
+    guint                 n_requests;
+    guint                 i;
+
+    proxy = test_proxy_new ();
+    if (!proxy)
+        return;
+
+    device_threads = GPOINTER_TO_UINT (data);
+    g_object_set (proxy, MBIM_PROXY_DEVICE_THREADS, device_threads, NULL);
+
+    heavy = simulator_thread_new (HEAVY_MAX_FRAGMENT_SIZE, HEAVY_RESPONSE_SIZE);
+    light = simulator_thread_new (4096, 0);
+    load.device = proxy_client_open (mbim_simulator_get_path (heavy->simulator));
+    light_device = proxy_client_open (mbim_simulator_get_path (light->simulator));
+
+    n_requests = g_test_perf () ? 1000 : 20;
+
+    /* Latency of small requests to one device... */
+    timer = g_timer_new ();
+    for (i = 0; i < n_requests; i++) {
+        g_autoptr(MbimMessage) request = NULL;
+
+        request = mbim_message_radio_state_query_new (NULL);
+        proxy_client_command (light_device, request);
+    }
+    idle_time = g_timer_elapsed (timer, NULL) / n_requests;
+
+    /* ...and the same while another device keeps on sending large
+     * fragmented responses */
+    heavy_load_next (&load);
+    g_timer_start (timer);
+    for (i = 0; i < n_requests; i++) {
+        g_autoptr(MbimMessage) request = NULL;
+
+        request = mbim_message_radio_state_query_new (NULL);
+        proxy_client_command (light_device, request);
+    }
+    busy_time = g_timer_elapsed (timer, NULL) / n_requests;
+
+    load.stop = TRUE;
+    while (load.pending)
+        g_main_context_iteration (NULL, TRUE);
+    g_assert_cmpuint (load.n_responses, >, 0);
+
+    proxy_client_close (light_device);
+    proxy_client_close (load.device);
+    simulator_thread_free (light);
+    simulator_thread_free (heavy);
+
+    g_test_message ("%u responses of %u bytes in %u-byte fragments from the busy device",
+                    load.n_responses, HEAVY_RESPONSE_SIZE, HEAVY_MAX_FRAGMENT_SIZE);
+    g_test_minimized_result (idle_time * 1000.0, "ms per request, %s, other device idle",
+                             device_threads ? "device threads" : "single thread");
+    g_test_minimized_result (busy_time * 1000.0, "ms per request, %s, other device busy",
+                             device_threads ? "device threads" : "single thread");
+
+    /* Requests to one device don't wait behind the responses of another one */
+    if (device_threads)
+        g_assert_cmpfloat (busy_time * 1000.0, <, idle_time * 1000.0 * ISOLATION_MAX_SLOWDOWN + ISOLATION_MARGIN_MS);
+}
+
+/* Number of requests the simulator got while running the given query */
+static guint
+query_cache_round_trip (SimulatorThread *st,
+                        MbimDevice      *device)
+{
+    g_autoptr(MbimMessage) request = NULL;
+    guint                  n_requests;
+
+    n_requests = mbim_simulator_get_n_requests (st->simulator);
+    request = mbim_message_radio_state_query_new (NULL);
+    proxy_client_command (device, request);
+    return mbim_simulator_get_n_requests (st->simulator) - n_requests;
+}
+
+/* Number of requests the simulator got while running the set, which drops
+ * the cached query response */
+static guint
+query_cache_invalidate (SimulatorThread *st,
+                        MbimDevice      *device)
+{
+    g_autoptr(MbimMessage) request = NULL;
+    g_autoptr(GError)      error = NULL;
+    guint                  n_requests;
+
+    n_requests = mbim_simulator_get_n_requests (st->simulator);
+    request = mbim_message_radio_state_set_new (MBIM_RADIO_SWITCH_STATE_ON, &error);
+    g_assert_no_error (error);
+    proxy_client_command (device, request);
+    return mbim_simulator_get_n_requests (st->simulator) - n_requests;
+}
+
+static void
+test_proxy_query_cache (void)
+{
+    g_autoptr(MbimProxy)     proxy = NULL;
+    g_autoptr(MbimMessage)   request = NULL;
+    g_autoptr(MbimMessage)   second_request = NULL;
+    g_autoptr(GAsyncResult)  first_res = NULL;
+    g_autoptr(GAsyncResult)  second_res = NULL;
+    g_autoptr(MbimMessage)   first_response = NULL;
+    g_autoptr(MbimMessage)   second_response = NULL;
+    g_autoptr(GError)        error = NULL;
+    const guint8             radio_state[] = { 0x01, 0x00, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00 };
+    SimulatorThread         *st;
+    MbimDevice              *first;
+    MbimDevice              *second;
+    guint                    n_requests;
+    gint64                   start;
+
+    proxy = test_proxy_new ();
+    if (!proxy)
+        return;
+
+    g_object_set (proxy, MBIM_PROXY_QUERY_CACHE_TTL, QUERY_CACHE_LONG_TTL_MS, NULL);
+    st = simulator_thread_new (4096, 0);
+    mbim_simulator_set_response (st->simulator,
+                                 MBIM_SERVICE_BASIC_CONNECT,
+                                 MBIM_CID_BASIC_CONNECT_RADIO_STATE,
+                                 MBIM_MESSAGE_COMMAND_TYPE_QUERY,
+                                 MBIM_STATUS_ERROR_NONE,
+                                 radio_state,
+                                 sizeof (radio_state));
+    /* So that queries sent back to back are in flight at the same time */
+    g_object_set (st->simulator, MBIM_SIMULATOR_RESPONSE_DELAY, 100, NULL);
+    first = proxy_client_open (mbim_simulator_get_path (st->simulator));
+    second = proxy_client_open (mbim_simulator_get_path (st->simulator));
+
+    /* Hit: the same query from any client is served from the cache */
+    g_assert_cmpuint (query_cache_round_trip (st, first),  ==, 1);
+    g_assert_cmpuint (query_cache_round_trip (st, first),  ==, 0);
+    g_assert_cmpuint (query_cache_round_trip (st, second), ==, 0);
+
+    /* Invalidation: a completed set drops the response, even if it failed */
+    g_assert_cmpuint (query_cache_invalidate (st, second), ==, 1);
+    g_assert_cmpuint (query_cache_round_trip (st, first), ==, 1);
+    g_assert_cmpuint (query_cache_round_trip (st, first), ==, 0);
+
+    /* TTL: a response cached with a short lifetime expires, the query is then
+     * sent to the device again and its response cached anew */
+    g_assert_cmpuint (query_cache_invalidate (st, second), ==, 1);
+    g_object_set (proxy, MBIM_PROXY_QUERY_CACHE_TTL, QUERY_CACHE_SHORT_TTL_MS, NULL);
+    g_assert_cmpuint (query_cache_round_trip (st, first), ==, 1);
+    g_object_set (proxy, MBIM_PROXY_QUERY_CACHE_TTL, QUERY_CACHE_LONG_TTL_MS, NULL);
+    start = g_get_monotonic_time ();
+    while (query_cache_round_trip (st, second) == 0)
+        g_assert_cmpint (g_get_monotonic_time () - start, <, WAIT_TIMEOUT_SECS * G_USEC_PER_SEC);
+    g_assert_cmpuint (query_cache_round_trip (st, first), ==, 0);
+
+    /* Coalescing: the same query from two clients while the first one is in
+     * flight is a single device transaction */
+    g_assert_cmpuint (query_cache_invalidate (st, second), ==, 1);
+    request = mbim_message_radio_state_query_new (NULL);
+    second_request = mbim_message_radio_state_query_new (NULL);
+    n_requests = mbim_simulator_get_n_requests (st->simulator);
+    mbim_device_command (first,  request,        REQUEST_TIMEOUT_SECS, NULL, (GAsyncReadyCallback) async_result_ready, &first_res);
+    mbim_device_command (second, second_request, REQUEST_TIMEOUT_SECS, NULL, (GAsyncReadyCallback) async_result_ready, &second_res);
+    async_result_wait (&first_res);
+    async_result_wait (&second_res);
+    first_response = mbim_device_command_finish (first, first_res, &error);
+    g_assert_no_error (error);
+    second_response = mbim_device_command_finish (second, second_res, &error);
+    g_assert_no_error (error);
+    g_assert (mbim_message_response_get_result (first_response, MBIM_MESSAGE_TYPE_COMMAND_DONE, NULL));
+    g_assert (mbim_message_response_get_result (second_response, MBIM_MESSAGE_TYPE_COMMAND_DONE, NULL));
+    g_assert_cmpuint (mbim_simulator_get_n_requests (st->simulator) - n_requests, ==, 1);
+
+    proxy_client_close (second);
+    proxy_client_close (first);
+    simulator_thread_free (st);
+}
+
+/* Statistics of the only device behind the proxy, and of the clients in
+ * connection order */
+static void
+query_statistics (MbimDevice                      *device,
+                  MbimProxyDeviceStatisticsArray **out_devices,
+                  MbimProxyClientStatisticsArray **out_clients)
+{
+    g_autoptr(GError)                         error = NULL;
+    g_autoptr(GAsyncResult)                   res = NULL;
+    g_autoptr(MbimMessage)                    request = NULL;
+    g_autoptr(MbimMessage)                    response = NULL;
+    g_autoptr(MbimProxyCidStatisticsArray)    cids = NULL;
+    g_autofree guint32                       *latency_bounds = NULL;
+    guint32                                   devices_count = 0;
+    guint32                                   clients_count;
+    guint32                                   latency_bounds_count;
+    guint32                                   cids_count;
+
+    request = mbim_message_proxy_control_statistics_query_new (NULL);
+    mbim_device_command (device, request, REQUEST_TIMEOUT_SECS, NULL, (GAsyncReadyCallback) async_result_ready, &res);
+    async_result_wait (&res);
+    response = mbim_device_command_finish (device, res, &error);
+    g_assert_no_error (error);
+    mbim_message_proxy_control_statistics_response_parse (response,
+                                                          &devices_count, out_devices,
+                                                          &clients_count, out_clients,
+                                                          &latency_bounds_count, &latency_bounds,
+                                                          &cids_count, &cids,
+                                                          &error);
+    g_assert_no_error (error);
+    g_assert_cmpuint (devices_count, ==, 1);
+}
+
+/* Requests of the device still in flight in the proxy */
+static guint
+query_device_requests_in_flight (MbimDevice *device)
+{
+    g_autoptr(MbimProxyDeviceStatisticsArray) devices = NULL;
+    g_autoptr(MbimProxyClientStatisticsArray) clients = NULL;
+
+    query_statistics (device, &devices, &clients);
+    return devices[0]->requests_in_flight;
+}
+
+/* Requests of the device waiting to be dispatched in the proxy */
+static guint
+query_device_requests_queued (MbimDevice *device)
+{
+    g_autoptr(MbimProxyDeviceStatisticsArray) devices = NULL;
+    g_autoptr(MbimProxyClientStatisticsArray) clients = NULL;
+
+    query_statistics (device, &devices, &clients);
+    return devices[0]->requests_queued;
+}
+
+static void
+test_proxy_request_timeout (void)
+{
+    g_autoptr(MbimProxy)     proxy = NULL;
+    g_autoptr(MbimMessage)   request = NULL;
+    g_autoptr(GCancellable)  cancellable = NULL;
+    g_autoptr(GAsyncResult)  res = NULL;
+    g_autoptr(GTimer)        timer = NULL;
+    g_autoptr(GError)        error = NULL;
+    SimulatorThread         *st;
+    MbimDevice              *device;
+
+    proxy = test_proxy_new ();
+    if (!proxy)
+        return;
+
+    /* The proxy default is much longer than the one of the client */
+    g_assert_cmpuint (REQUEST_TIMEOUT_SECS, <, 300);
+    st = simulator_thread_new (4096, 0);
+    device = proxy_client_open_full (mbim_simulator_get_path (st->simulator), 2, NULL);
+
+    /* A request the device never replies to is released once the timeout
+     * configured by the client expires */
+    g_object_set (st->simulator, MBIM_SIMULATOR_STALLED, TRUE, NULL);
+    cancellable = g_cancellable_new ();
+    request = mbim_message_radio_state_query_new (NULL);
+    mbim_device_command (device, request, REQUEST_TIMEOUT_SECS, cancellable, (GAsyncReadyCallback) async_result_ready, &res);
+    g_assert_cmpuint (query_device_requests_in_flight (device), ==, 1);
+
+    timer = g_timer_new ();
+    while (query_device_requests_in_flight (device) > 0) {
+        g_usleep (100 * 1000);
+        g_assert_cmpfloat (g_timer_elapsed (timer, NULL), <, REQUEST_TIMEOUT_SECS);
+    }
+
+    /* The client itself doesn't get any response */
+    g_assert (!res);
+    g_cancellable_cancel (cancellable);
+    async_result_wait (&res);
+    g_assert (!mbim_device_command_finish (device, res, &error));
+    g_assert_error (error, MBIM_CORE_ERROR, MBIM_CORE_ERROR_ABORTED);
+
+    g_object_set (st->simulator, MBIM_SIMULATOR_STALLED, FALSE, NULL);
+    proxy_client_close (device);
+    simulator_thread_free (st);
+}
+
+/* Order in which the requests of two clients complete */
+typedef struct {
+    MbimDevice *first;
+    GString    *order;
+    guint       pending;
+} CommandOrder;
+
+static void
+command_order_ready (MbimDevice   *device,
+                     GAsyncResult *res,
+                     CommandOrder *order)
+{
+    g_autoptr(GError)      error = NULL;
+    g_autoptr(MbimMessage) response = NULL;
+
+    response = mbim_device_command_finish (device, res, &error);
+    g_assert_no_error (error);
+    g_string_append_c (order->order, device == order->first ? 'a' : 'b');
+    order->pending--;
+}
+
+static void
+command_order_send (CommandOrder *order,
+                    MbimDevice   *device,
+                    guint         n_requests)
+{
+    guint i;
+
+    for (i = 0; i < n_requests; i++) {
+        g_autoptr(MbimMessage) request = NULL;
+
+        request = mbim_message_radio_state_query_new (NULL);
+        mbim_device_command (device, request, REQUEST_TIMEOUT_SECS, NULL, (GAsyncReadyCallback) command_order_ready, order);
+        order->pending++;
+    }
+}
+
+static void
+command_order_wait (CommandOrder *order)
+{
+    g_autoptr(GTimer) timer = NULL;
+
+    timer = g_timer_new ();
+    while (order->pending > 0) {
+        g_main_context_iteration (NULL, TRUE);
+        g_assert_cmpfloat (g_timer_elapsed (timer, NULL), <, WAIT_TIMEOUT_SECS);
+    }
+}
+
+static void
+wait_device_requests_queued (MbimDevice *device,
+                             guint       n_requests)
+{
+    g_autoptr(GTimer) timer = NULL;
+
+    timer = g_timer_new ();
+    while (query_device_requests_queued (device) != n_requests)
+        g_assert_cmpfloat (g_timer_elapsed (timer, NULL), <, WAIT_TIMEOUT_SECS);
+}
+
+static void
+test_proxy_scheduler (void)
+{
+    g_autoptr(MbimProxy) proxy = NULL;
+    g_autoptr(GTimer)    timer = NULL;
+    CommandOrder         order = { 0 };
+    SimulatorThread     *st;
+    MbimDevice          *first;
+    MbimDevice          *second;
+
+    proxy = test_proxy_new ();
+    if (!proxy)
+        return;
+
+    /* Without any limit, all requests are forwarded right away */
+    st = simulator_thread_new (4096, 0);
+    first = proxy_client_open (mbim_simulator_get_path (st->simulator));
+    g_object_set (st->simulator, MBIM_SIMULATOR_RESPONSE_DELAY, SCHEDULER_RESPONSE_DELAY_MS, NULL);
+    order.first = first;
+    order.order = g_string_new (NULL);
+    command_order_send (&order, first, 4);
+    timer = g_timer_new ();
+    while (query_device_requests_in_flight (first) != 4)
+        g_assert_cmpfloat (g_timer_elapsed (timer, NULL), <, WAIT_TIMEOUT_SECS);
+    g_assert_cmpuint (query_device_requests_queued (first), ==, 0);
+    command_order_wait (&order);
+    g_object_set (st->simulator, MBIM_SIMULATOR_RESPONSE_DELAY, 0, NULL);
+    proxy_client_close (first);
+
+    /* One request at a time in the device, the first client dispatching two
+     * on each round robin turn and the second one a single one */
+    g_object_set (proxy, MBIM_PROXY_DEVICE_MAX_IN_FLIGHT, 1, NULL);
+    mbim_proxy_set_client_quota (proxy, getuid (), 0, 2);
+    first = proxy_client_open (mbim_simulator_get_path (st->simulator));
+    mbim_proxy_set_client_quota (proxy, getuid (), 0, 1);
+    second = proxy_client_open (mbim_simulator_get_path (st->simulator));
+    g_object_set (st->simulator, MBIM_SIMULATOR_RESPONSE_DELAY, SCHEDULER_RESPONSE_DELAY_MS, NULL);
+    order.first = first;
+    g_string_truncate (order.order, 0);
+
+    /* Keep the device busy while the rest are queued */
+    command_order_send (&order, first, 1);
+    g_timer_start (timer);
+    while (query_device_requests_in_flight (first) != 1)
+        g_assert_cmpfloat (g_timer_elapsed (timer, NULL), <, WAIT_TIMEOUT_SECS);
+    command_order_send (&order, first, 4);
+    wait_device_requests_queued (first, 4);
+    command_order_send (&order, second, 3);
+    wait_device_requests_queued (first, 7);
+
+    command_order_wait (&order);
+    g_assert_cmpstr (order.order->str, ==, "aaabaabb");
+
+    g_string_free (order.order, TRUE);
+    proxy_client_close (second);
+    proxy_client_close (first);
+    simulator_thread_free (st);
+}
+
+static void
+test_proxy_client_quota (void)
+{
+    g_autoptr(MbimProxy)                      proxy = NULL;
+    g_autoptr(MbimProxyDeviceStatisticsArray) devices = NULL;
+    g_autoptr(MbimProxyClientStatisticsArray) clients = NULL;
+    g_autoptr(GTimer)                         timer = NULL;
+    CommandOrder                              order = { 0 };
+    SimulatorThread                          *st;
+    MbimDevice                               *unlimited;
+    MbimDevice                               *limited;
+
+    proxy = test_proxy_new ();
+    if (!proxy)
+        return;
+
+    st = simulator_thread_new (4096, 0);
+
+    /* The quota only applies to the clients connected afterwards */
+    unlimited = proxy_client_open (mbim_simulator_get_path (st->simulator));
+    mbim_proxy_set_client_quota (proxy, getuid (), 1, 1);
+    limited = proxy_client_open (mbim_simulator_get_path (st->simulator));
+    g_object_set (st->simulator, MBIM_SIMULATOR_RESPONSE_DELAY, SCHEDULER_RESPONSE_DELAY_MS, NULL);
+
+    order.first = unlimited;
+    order.order = g_string_new (NULL);
+    command_order_send (&order, unlimited, 3);
+    command_order_send (&order, limited, 3);
+
+    timer = g_timer_new ();
+    while (TRUE) {
+        g_clear_pointer (&devices, mbim_proxy_device_statistics_array_free);
+        g_clear_pointer (&clients, mbim_proxy_client_statistics_array_free);
+        query_statistics (limited, &devices, &clients);
+        if (devices[0]->requests_in_flight == 4 && devices[0]->requests_queued == 2)
+            break;
+        g_assert_cmpfloat (g_timer_elapsed (timer, NULL), <, WAIT_TIMEOUT_SECS);
+    }
+    g_assert_cmpuint (clients[0]->requests_in_flight, ==, 3);
+    g_assert_cmpuint (clients[0]->requests_queued,    ==, 0);
+    g_assert_cmpuint (clients[1]->requests_in_flight, ==, 1);
+    g_assert_cmpuint (clients[1]->requests_queued,    ==, 2);
+
+    /* The last requests of the limited client are only dispatched once the
+     * previous one completes */
+    command_order_wait (&order);
+    g_assert (g_str_has_suffix (order.order->str, "bb"));
+
+    g_string_free (order.order, TRUE);
+    proxy_client_close (limited);
+    proxy_client_close (unlimited);
+    simulator_thread_free (st);
+}
+
+static void
+test_proxy_handoff_device (void)
+{
+    g_autoptr(MbimProxy)  proxy = NULL;
+    g_autoptr(MbimProxy)  new_proxy = NULL;
+    g_autoptr(GTimer)     timer = NULL;
+    SimulatorThread      *st;
+    MbimDevice           *device;
+    GThread              *thread;
+    gboolean              handed_off = FALSE;
+    guint                 n_requests;
+    guint                 i;
+
+    proxy = test_proxy_new ();
+    if (!proxy)
+        return;
+
+    g_object_set (proxy, MBIM_PROXY_HANDOFF, TRUE, NULL);
+    g_signal_connect (proxy, MBIM_PROXY_SIGNAL_HANDED_OFF, G_CALLBACK (handed_off_cb), &handed_off);
+
+    st = simulator_thread_new (4096, 0);
+    device = proxy_client_open (mbim_simulator_get_path (st->simulator));
+    g_assert_cmpuint (query_cache_round_trip (st, device), ==, 1);
+    g_assert_cmpuint (mbim_proxy_get_n_devices (proxy), ==, 1);
+
+    n_requests = mbim_simulator_get_n_requests (st->simulator);
+    timer = g_timer_new ();
+    thread = g_thread_new ("handoff", handoff_thread, NULL);
+    while (!handed_off) {
+        g_main_context_iteration (NULL, TRUE);
+        g_assert_cmpfloat (g_timer_elapsed (timer, NULL), <, WAIT_TIMEOUT_SECS);
+    }
+    new_proxy = g_thread_join (thread);
+    g_assert (new_proxy);
+
+    g_assert_cmpuint (mbim_proxy_get_n_devices (proxy), ==, 0);
+    g_assert_cmpuint (mbim_proxy_get_n_clients (proxy), ==, 0);
+    g_assert_cmpuint (mbim_proxy_get_n_devices (new_proxy), ==, 1);
+    g_assert_cmpuint (mbim_proxy_get_n_clients (new_proxy), ==, 1);
+
+    /* The device was neither closed nor opened again */
+    g_assert_cmpuint (mbim_simulator_get_n_requests (st->simulator), ==, n_requests);
+
+    /* The same client keeps on talking to the same device, each request
+     * reaching it once through the new proxy */
+    for (i = 0; i < 5; i++)
+        g_assert_cmpuint (query_cache_round_trip (st, device), ==, 1);
+
+    proxy_client_close (device);
+    simulator_thread_free (st);
+}
+
+/*****************************************************************************/
+
+/* A client that stops reading doesn't block the proxy: its output is queued
+ * up to the limit, and then either its indications are dropped or it is
+ * disconnected */
+static void
+test_proxy_output_queue (gconstpointer data)
+{
+    g_autoptr(MbimProxy)                      proxy = NULL;
+    g_autoptr(GError)                         error = NULL;
+    g_autoptr(GSocketClient)                  client = NULL;
+    g_autoptr(GSocketAddress)                 address = NULL;
+    g_autoptr(GSocketConnection)              connection = NULL;
+    g_autoptr(MbimMessage)                    request = NULL;
+    g_autoptr(GByteArray)                     response = NULL;
+    g_autoptr(MbimProxyDeviceStatisticsArray) devices = NULL;
+    g_autoptr(MbimProxyClientStatisticsArray) clients = NULL;
+    gboolean                                  drop_indications;
+    SimulatorThread                          *st;
+    MbimDevice                               *device;
+    IndicationCount                           count = { 0 };
+    GSocket                                  *socket;
+    GByteArray                                raw;
+
+    drop_indications = GPOINTER_TO_UINT (data);
+
+    proxy = test_proxy_new ();
+    if (!proxy)
+        return;
+
+    g_object_set (proxy,
+                  MBIM_PROXY_CLIENT_QUEUE_MAX_SIZE,         STALLED_QUEUE_MAX_SIZE,
+                  MBIM_PROXY_CLIENT_QUEUE_DROP_INDICATIONS, drop_indications,
+                  NULL);
+
+    st = simulator_thread_new (4096, 0);
+    device = proxy_client_open (mbim_simulator_get_path (st->simulator));
+    g_signal_connect (device, MBIM_DEVICE_SIGNAL_INDICATE_STATUS, G_CALLBACK (indication_count_cb), &count);
+
+    /* Another client of the same device, which stops reading once configured */
+    client = g_socket_client_new ();
+    address = g_unix_socket_address_new_with_type (MBIM_PROXY_SOCKET_PATH, -1, G_UNIX_SOCKET_ADDRESS_ABSTRACT);
+    connection = client_connect (client, address);
+    socket = g_socket_connection_get_socket (connection);
+    g_socket_set_blocking (socket, FALSE);
+
+    request = mbim_message_proxy_control_configuration_set_new (mbim_simulator_get_path (st->simulator), REQUEST_TIMEOUT_SECS, &error);
+    g_assert_no_error (error);
+    mbim_message_set_transaction_id (request, 1);
+    raw.data = (guint8 *) mbim_message_get_raw (request, &raw.len, &error);
+    g_assert_no_error (error);
+    socket_send_all (socket, &raw);
+    response = socket_receive_message (socket);
+    g_assert_cmpuint (mbim_message_get_message_type ((MbimMessage *) response), ==, MBIM_MESSAGE_TYPE_COMMAND_DONE);
+
+    /* The first indication that doesn't fit makes the proxy give up on it */
+    if (!drop_indications)
+        g_test_expect_message ("Mbim", G_LOG_LEVEL_WARNING, "*couldn't forward indication*output queue full*");
+
+    simulator_thread_call (st, (GSourceFunc) simulator_emit_stalled_indications_cb, st->simulator);
+    indication_count_wait (&count, STALLED_INDICATIONS);
+    g_assert_cmpuint (count.n_signal_state, ==, STALLED_INDICATIONS);
+
+    if (drop_indications) {
+        /* Still connected, with its queue within the limit */
+        query_statistics (device, &devices, &clients);
+        g_assert (clients[0] && clients[1] && !clients[2]);
+        g_assert_cmpuint (clients[0]->indications, ==, STALLED_INDICATIONS);
+        g_assert_cmpuint (clients[0]->indications_dropped, ==, 0);
+        g_assert_cmpuint (clients[1]->indications_dropped, >, 0);
+        g_assert_cmpuint (clients[1]->indications + clients[1]->indications_dropped, ==, STALLED_INDICATIONS);
+        g_assert_cmpuint (clients[1]->output_queue_size, >, 0);
+        g_assert_cmpuint (clients[1]->output_queue_peak, <=, STALLED_QUEUE_MAX_SIZE);
+        g_clear_object (&connection);
+    } else
+        g_test_assert_expected_messages ();
+
+    wait_n_clients (proxy, 1);
+
+    proxy_client_close (device);
+    simulator_thread_free (st);
+}
+
+/*****************************************************************************/
+
+/* Each indication only reaches the clients of the device subscribed to it,
+ * following the changes in their subscribe lists */
+static void
+test_proxy_indication_routing (void)
+{
+    g_autoptr(MbimProxy)  proxy = NULL;
+    SimulatorThread      *st;
+    SimulatorThread      *other_st;
+    MbimDevice           *standard;
+    MbimDevice           *service;
+    MbimDevice           *cid;
+    MbimDevice           *other;
+    IndicationCount       standard_count = { 0 };
+    IndicationCount       service_count = { 0 };
+    IndicationCount       cid_count = { 0 };
+    IndicationCount       other_count = { 0 };
+
+    proxy = test_proxy_new ();
+    if (!proxy)
+        return;
+
+    st = simulator_thread_new (4096, 0);
+    other_st = simulator_thread_new (4096, 0);
+
+    /* Default standard subscribe list; all the cids of a service; another
+     * cid of the same service; and the standard list in another device */
+    standard = proxy_client_open (mbim_simulator_get_path (st->simulator));
+    service = proxy_client_open (mbim_simulator_get_path (st->simulator));
+    g_assert (proxy_client_subscribe (service, MBIM_SERVICE_MS_BASIC_CONNECT_EXTENSIONS, 0));
+    cid = proxy_client_open (mbim_simulator_get_path (st->simulator));
+    g_assert (proxy_client_subscribe (cid, MBIM_SERVICE_MS_BASIC_CONNECT_EXTENSIONS, MBIM_CID_MS_BASIC_CONNECT_EXTENSIONS_LTE_ATTACH_INFO));
+    other = proxy_client_open (mbim_simulator_get_path (other_st->simulator));
+
+    g_signal_connect (standard, MBIM_DEVICE_SIGNAL_INDICATE_STATUS, G_CALLBACK (indication_count_cb), &standard_count);
+    g_signal_connect (service,  MBIM_DEVICE_SIGNAL_INDICATE_STATUS, G_CALLBACK (indication_count_cb), &service_count);
+    g_signal_connect (cid,      MBIM_DEVICE_SIGNAL_INDICATE_STATUS, G_CALLBACK (indication_count_cb), &cid_count);
+    g_signal_connect (other,    MBIM_DEVICE_SIGNAL_INDICATE_STATUS, G_CALLBACK (indication_count_cb), &other_count);
+
+    /* Both indications are routed once the last one reaches a client */
+    simulator_thread_call (st, (GSourceFunc) simulator_emit_indications_cb, st->simulator);
+    indication_count_wait (&standard_count, 1);
+    proxy_client_sync (service);
+    proxy_client_sync (cid);
+    proxy_client_sync (other);
+    g_assert_cmpuint (standard_count.n_pco, ==, 0);
+    g_assert_cmpuint (service_count.n_pco, ==, 1);
+    g_assert_cmpuint (service_count.n_signal_state, ==, 0);
+    g_assert_cmpuint (cid_count.n_pco, ==, 0);
+    g_assert_cmpuint (cid_count.n_signal_state, ==, 0);
+    g_assert_cmpuint (other_count.n_pco, ==, 0);
+    g_assert_cmpuint (other_count.n_signal_state, ==, 0);
+
+    /* A new subscribe list replaces the previous one */
+    g_assert (proxy_client_subscribe (service, MBIM_SERVICE_BASIC_CONNECT, MBIM_CID_BASIC_CONNECT_SIGNAL_STATE));
+    g_assert (proxy_client_subscribe (cid, MBIM_SERVICE_MS_BASIC_CONNECT_EXTENSIONS, MBIM_CID_MS_BASIC_CONNECT_EXTENSIONS_PCO));
+
+    /* Disconnected clients are no longer routed */
+    g_signal_handlers_disconnect_by_func (standard, indication_count_cb, &standard_count);
+    proxy_client_close (standard);
+
+    simulator_thread_call (st, (GSourceFunc) simulator_emit_indications_cb, st->simulator);
+    indication_count_wait (&service_count, 1);
+    proxy_client_sync (cid);
+    proxy_client_sync (other);
+    g_assert_cmpuint (service_count.n_pco, ==, 1);
+    g_assert_cmpuint (cid_count.n_pco, ==, 1);
+    g_assert_cmpuint (cid_count.n_signal_state, ==, 0);
+    g_assert_cmpuint (other_count.n_pco, ==, 0);
+    g_assert_cmpuint (other_count.n_signal_state, ==, 0);
+
+    g_signal_handlers_disconnect_by_func (service, indication_count_cb, &service_count);
+    g_signal_handlers_disconnect_by_func (cid,     indication_count_cb, &cid_count);
+    g_signal_handlers_disconnect_by_func (other,   indication_count_cb, &other_count);
+    proxy_client_close (service);
+    proxy_client_close (cid);
+    proxy_client_close (other);
+    simulator_thread_free (st);
+    simulator_thread_free (other_st);
+}
+
+/*****************************************************************************/
+
+/* The device is only configured when the first client subscribes to a cid
+ * not in the standard list, or the last one unsubscribes; otherwise the proxy
+ * replies itself */
+static guint
+subscribe_list_run (SimulatorThread *st,
+                    MbimDevice      *device,
+                    MbimService      service,
+                    guint32          cid,
+                    gboolean         accepted)
+{
+    guint n_requests;
+
+    n_requests = simulator_thread_get_n_requests (st);
+    g_assert (proxy_client_subscribe (device, service, cid) == accepted);
+    return simulator_thread_get_n_requests (st) - n_requests;
+}
+
+static void
+test_proxy_subscribe_list (void)
+{
+    g_autoptr(MbimProxy)  proxy = NULL;
+    SimulatorThread      *st;
+    MbimDevice           *first;
+    MbimDevice           *second;
+
+    proxy = test_proxy_new ();
+    if (!proxy)
+        return;
+
+    st = simulator_thread_new (4096, 0);
+    first = proxy_client_open (mbim_simulator_get_path (st->simulator));
+    second = proxy_client_open (mbim_simulator_get_path (st->simulator));
+
+    /* Standard cids are always enabled in the device */
+    g_assert_cmpuint (subscribe_list_run (st, first, MBIM_SERVICE_BASIC_CONNECT, MBIM_CID_BASIC_CONNECT_SIGNAL_STATE, TRUE), ==, 0);
+
+    g_assert_cmpuint (subscribe_list_run (st, first,  MBIM_SERVICE_MS_BASIC_CONNECT_EXTENSIONS, MBIM_CID_MS_BASIC_CONNECT_EXTENSIONS_PCO, TRUE), ==, 1);
+    g_assert_cmpuint (subscribe_list_run (st, second, MBIM_SERVICE_MS_BASIC_CONNECT_EXTENSIONS, MBIM_CID_MS_BASIC_CONNECT_EXTENSIONS_PCO, TRUE), ==, 0);
+    g_assert_cmpuint (subscribe_list_run (st, first,  MBIM_SERVICE_BASIC_CONNECT, MBIM_CID_BASIC_CONNECT_SIGNAL_STATE, TRUE), ==, 0);
+    g_assert_cmpuint (subscribe_list_run (st, second, MBIM_SERVICE_BASIC_CONNECT, MBIM_CID_BASIC_CONNECT_SIGNAL_STATE, TRUE), ==, 1);
+
+    /* A failure to configure the device is reported to the client */
+    simulator_thread_call (st, (GSourceFunc) simulator_reject_subscribe_list_cb, st->simulator);
+    g_assert_cmpuint (subscribe_list_run (st, first, MBIM_SERVICE_MS_BASIC_CONNECT_EXTENSIONS, 0, FALSE), ==, 1);
+
+    proxy_client_close (first);
+    proxy_client_close (second);
+    simulator_thread_free (st);
+}
+
+/*****************************************************************************/
+
+/* The last indications are replayed to a client only once the device accepted
+ * its new subscribe list */
+static void
+indication_replay_run (SimulatorThread *st,
+                       gboolean         accepted)
+{
+    MbimDevice      *feeder;
+    MbimDevice      *subscriber;
+    IndicationCount  feeder_count = { 0 };
+    IndicationCount  subscriber_count = { 0 };
+
+    if (!accepted)
+        simulator_thread_call (st, (GSourceFunc) simulator_reject_subscribe_list_cb, st->simulator);
+
+    /* The signal state indication, in the standard subscribe list, arrives
+     * after the PCO one, so both have been seen by the proxy by then */
+    feeder = proxy_client_open (mbim_simulator_get_path (st->simulator));
+    g_signal_connect (feeder, MBIM_DEVICE_SIGNAL_INDICATE_STATUS, G_CALLBACK (indication_count_cb), &feeder_count);
+    simulator_thread_call (st, (GSourceFunc) simulator_emit_indications_cb, st->simulator);
+    indication_count_wait (&feeder_count, 1);
+    g_assert_cmpuint (feeder_count.n_pco, ==, 0);
+
+    subscriber = proxy_client_open (mbim_simulator_get_path (st->simulator));
+    g_signal_connect (subscriber, MBIM_DEVICE_SIGNAL_INDICATE_STATUS, G_CALLBACK (indication_count_cb), &subscriber_count);
+    g_assert (proxy_client_subscribe (subscriber, MBIM_SERVICE_MS_BASIC_CONNECT_EXTENSIONS, 0) == accepted);
+
+    /* Replayed indications are sent right after the subscribe list response */
+    proxy_client_sync (subscriber);
+    g_assert_cmpuint (subscriber_count.n_pco, ==, accepted ? 1 : 0);
+    g_assert_cmpuint (subscriber_count.n_signal_state, ==, 0);
+
+    g_signal_handlers_disconnect_by_func (subscriber, indication_count_cb, &subscriber_count);
+    g_signal_handlers_disconnect_by_func (feeder, indication_count_cb, &feeder_count);
+    proxy_client_close (subscriber);
+    proxy_client_close (feeder);
+}
+
+static void
+test_proxy_indication_replay (void)
+{
+    g_autoptr(MbimProxy)  proxy = NULL;
+    SimulatorThread      *accepting;
+    SimulatorThread      *rejecting;
+
+    proxy = test_proxy_new ();
+    if (!proxy)
+        return;
+
+    g_object_set (proxy, MBIM_PROXY_INDICATION_REPLAY, TRUE, NULL);
+
+    accepting = simulator_thread_new (4096, 0);
+    indication_replay_run (accepting, TRUE);
+    simulator_thread_free (accepting);
+
+    rejecting = simulator_thread_new (4096, 0);
+    indication_replay_run (rejecting, FALSE);
+    simulator_thread_free (rejecting);
+}
+
+/*****************************************************************************/
+
+int main (int argc, char **argv)
+{
+    g_test_init (&argc, &argv, NULL);
+
+    g_test_add_func ("/libmbim-glib/proxy/clients/short-lived", test_proxy_clients_short_lived);
+    g_test_add_func ("/libmbim-glib/proxy/clients/memory",      test_proxy_clients_memory);
+    g_test_add_func ("/libmbim-glib/proxy/requests/input",      test_proxy_requests_input);
+    g_test_add_func ("/libmbim-glib/proxy/open/latency",        test_proxy_open_latency);
+    g_test_add_func ("/libmbim-glib/proxy/handoff",             test_proxy_handoff);
+    g_test_add_func ("/libmbim-glib/proxy/open/device",         test_proxy_open_device);
+    g_test_add_data_func ("/libmbim-glib/proxy/devices/latency",         GUINT_TO_POINTER (FALSE), test_proxy_devices_latency);
+    g_test_add_data_func ("/libmbim-glib/proxy/devices/latency-threads", GUINT_TO_POINTER (TRUE),  test_proxy_devices_latency);
+    g_test_add_func ("/libmbim-glib/proxy/query-cache", test_proxy_query_cache);
+    g_test_add_func ("/libmbim-glib/proxy/request-timeout", test_proxy_request_timeout);
+    g_test_add_func ("/libmbim-glib/proxy/handoff/device", test_proxy_handoff_device);
+    g_test_add_func ("/libmbim-glib/proxy/scheduler", test_proxy_scheduler);
+    g_test_add_func ("/libmbim-glib/proxy/client-quota", test_proxy_client_quota);
+    g_test_add_data_func ("/libmbim-glib/proxy/output-queue/drop-indications", GUINT_TO_POINTER (TRUE),  test_proxy_output_queue);
+    g_test_add_data_func ("/libmbim-glib/proxy/output-queue/disconnect",       GUINT_TO_POINTER (FALSE), test_proxy_output_queue);
+    g_test_add_func ("/libmbim-glib/proxy/indication-routing", test_proxy_indication_routing);
+    g_test_add_func ("/libmbim-glib/proxy/subscribe-list", test_proxy_subscribe_list);
+    g_test_add_func ("/libmbim-glib/proxy/indication-replay", test_proxy_indication_replay);
+
+    return g_test_run ();
+}
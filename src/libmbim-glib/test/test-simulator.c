@@ -0,0 +1,891 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+
+#include <config.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <gio/gio.h>
+#include <glib/gstdio.h>
+
+#include "mbim-simulator.h"
+#include "mbim-device.h"
+#include "mbim-device-private.h"
+#include "mbim-message.h"
+#include "mbim-cid.h"
+#include "mbim-basic-connect.h"
+
+/* Maximum time waiting for the simulator to reply */
+#define WAIT_TIMEOUT_SECS 30
+
+/* Timeout of each request sent to the simulator */
+#define REQUEST_TIMEOUT_SECS 10
+
+/* Response delay of the simulator when timing the open sequence */
+#define OPEN_RESPONSE_DELAY_MS 100
+
+/*****************************************************************************/
+
+typedef struct {
+    GMainLoop     *loop;
+    MbimSimulator *simulator;
+    MbimDevice    *device;
+    MbimMessage   *response;
+    GError        *error;
+    guint          n_indications;
+    guint          n_reopened;
+    gboolean       healthy;
+    guint          n_health_changed;
+    const gchar   *profile_dir;
+    const gchar   *profile_identity;
+} TestContext;
+
+static TestContext *
+test_context_new (void)
+{
+    g_autoptr(GError)  error = NULL;
+    TestContext       *ctx;
+
+    ctx = g_slice_new0 (TestContext);
+    ctx->loop = g_main_loop_new (NULL, FALSE);
+    ctx->healthy = TRUE;
+    ctx->simulator = mbim_simulator_new (&error);
+    g_assert_no_error (error);
+    g_assert (ctx->simulator);
+    return ctx;
+}
+
+static void
+test_context_free (TestContext *ctx)
+{
+    g_assert (!ctx->response);
+    g_assert (!ctx->error);
+    g_clear_object (&ctx->device);
+    g_clear_object (&ctx->simulator);
+    g_main_loop_unref (ctx->loop);
+    g_slice_free (TestContext, ctx);
+}
+
+static gboolean
+loop_timeout_cb (TestContext *ctx)
+{
+    g_error ("timed out waiting for the simulator");
+    return G_SOURCE_REMOVE;
+}
+
+static void
+test_context_run (TestContext *ctx)
+{
+    guint id;
+
+    id = g_timeout_add_seconds (WAIT_TIMEOUT_SECS, (GSourceFunc) loop_timeout_cb, ctx);
+    g_main_loop_run (ctx->loop);
+    g_source_remove (id);
+}
+
+/*****************************************************************************/
+
+static void
+indicate_status_cb (MbimDevice  *device,
+                    MbimMessage *message,
+                    TestContext *ctx)
+{
+    ctx->n_indications++;
+}
+
+static void
+reopened_cb (MbimDevice  *device,
+             TestContext *ctx)
+{
+    ctx->n_reopened++;
+    g_main_loop_quit (ctx->loop);
+}
+
+static void
+health_changed_cb (MbimDevice  *device,
+                   gboolean     healthy,
+                   TestContext *ctx)
+{
+    ctx->healthy = healthy;
+    ctx->n_health_changed++;
+    g_main_loop_quit (ctx->loop);
+}
+
+static void
+device_new_ready (GObject      *source,
+                  GAsyncResult *res,
+                  TestContext  *ctx)
+{
+    ctx->device = mbim_device_new_finish (res, &ctx->error);
+    g_main_loop_quit (ctx->loop);
+}
+
+static void
+device_open_ready (MbimDevice   *device,
+                   GAsyncResult *res,
+                   TestContext  *ctx)
+{
+    mbim_device_open_full_finish (device, res, &ctx->error);
+    g_main_loop_quit (ctx->loop);
+}
+
+static void
+device_close_ready (MbimDevice   *device,
+                    GAsyncResult *res,
+                    TestContext  *ctx)
+{
+    mbim_device_close_finish (device, res, &ctx->error);
+    g_main_loop_quit (ctx->loop);
+}
+
+static void
+device_command_ready (MbimDevice   *device,
+                      GAsyncResult *res,
+                      TestContext  *ctx)
+{
+    ctx->response = mbim_device_command_finish (device, res, &ctx->error);
+    g_main_loop_quit (ctx->loop);
+}
+
+static void
+test_context_open (TestContext         *ctx,
+                   MbimDeviceOpenFlags  flags)
+{
+    g_autoptr(GFile) file = NULL;
+
+    file = g_file_new_for_path (mbim_simulator_get_path (ctx->simulator));
+    mbim_device_new (file, NULL, (GAsyncReadyCallback) device_new_ready, ctx);
+    test_context_run (ctx);
+    g_assert_no_error (ctx->error);
+    g_assert (ctx->device);
+
+    g_signal_connect (ctx->device, MBIM_DEVICE_SIGNAL_INDICATE_STATUS, G_CALLBACK (indicate_status_cb), ctx);
+    g_signal_connect (ctx->device, MBIM_DEVICE_SIGNAL_REOPENED,        G_CALLBACK (reopened_cb),        ctx);
+    g_signal_connect (ctx->device, MBIM_DEVICE_SIGNAL_HEALTH_CHANGED,  G_CALLBACK (health_changed_cb),  ctx);
+
+    if (ctx->profile_dir) {
+        g_object_set (ctx->device, MBIM_DEVICE_PROFILE_DIR, ctx->profile_dir, NULL);
+        _mbim_device_set_profile_identity (ctx->device, ctx->profile_identity);
+    }
+
+    mbim_device_open_full (ctx->device, flags, REQUEST_TIMEOUT_SECS, NULL, (GAsyncReadyCallback) device_open_ready, ctx);
+    test_context_run (ctx);
+    g_assert_no_error (ctx->error);
+    g_assert (mbim_device_is_open (ctx->device));
+}
+
+static void
+test_context_close (TestContext *ctx)
+{
+    mbim_device_close (ctx->device, REQUEST_TIMEOUT_SECS, NULL, (GAsyncReadyCallback) device_close_ready, ctx);
+    test_context_run (ctx);
+    g_assert_no_error (ctx->error);
+    g_assert (!mbim_device_is_open (ctx->device));
+}
+
+/* Takes ownership of the returned response, if any */
+static MbimMessage *
+test_context_command (TestContext *ctx,
+                      MbimMessage *request)
+{
+    mbim_device_command (ctx->device, request, REQUEST_TIMEOUT_SECS, NULL, (GAsyncReadyCallback) device_command_ready, ctx);
+    test_context_run (ctx);
+    return g_steal_pointer (&ctx->response);
+}
+
+/*****************************************************************************/
+
+static void
+test_simulator_open_close (void)
+{
+    TestContext *ctx;
+
+    ctx = test_context_new ();
+    test_context_open (ctx, MBIM_DEVICE_OPEN_FLAGS_NONE);
+    test_context_close (ctx);
+
+    /* Open and close requests */
+    g_assert_cmpuint (mbim_simulator_get_n_requests (ctx->simulator), ==, 2);
+
+    /* The simulated function may be opened again */
+    g_clear_object (&ctx->device);
+    test_context_open (ctx, MBIM_DEVICE_OPEN_FLAGS_NONE);
+    test_context_close (ctx);
+    test_context_free (ctx);
+}
+
+static void
+test_simulator_script (void)
+{
+    g_autoptr(GError)       error = NULL;
+    g_autoptr(MbimMessage)  request = NULL;
+    g_autoptr(MbimMessage)  response = NULL;
+    g_autofree gchar       *path = NULL;
+    TestContext            *ctx;
+    MbimRadioSwitchState    hw_radio_state;
+    MbimRadioSwitchState    sw_radio_state;
+    const gchar            *script =
+        "[response basic-connect radio-state query]\n"
+        "information-buffer=01:00:00:00:00:00:00:00\n"
+        "\n"
+        "[response basic-connect radio-state set]\n"
+        "status=failure\n";
+    gint                    fd;
+
+    fd = g_file_open_tmp ("test-simulator-XXXXXX", &path, &error);
+    g_assert_no_error (error);
+    close (fd);
+    g_file_set_contents (path, script, -1, &error);
+    g_assert_no_error (error);
+
+    ctx = test_context_new ();
+    mbim_simulator_load_script (ctx->simulator, path, &error);
+    g_assert_no_error (error);
+    g_unlink (path);
+    test_context_open (ctx, MBIM_DEVICE_OPEN_FLAGS_NONE);
+
+    /* Scripted query response */
+    request = mbim_message_radio_state_query_new (NULL);
+    response = test_context_command (ctx, request);
+    g_assert_no_error (ctx->error);
+    mbim_message_response_get_result (response, MBIM_MESSAGE_TYPE_COMMAND_DONE, &error);
+    g_assert_no_error (error);
+    mbim_message_radio_state_response_parse (response, &hw_radio_state, &sw_radio_state, &error);
+    g_assert_no_error (error);
+    g_assert_cmpuint (hw_radio_state, ==, MBIM_RADIO_SWITCH_STATE_ON);
+    g_assert_cmpuint (sw_radio_state, ==, MBIM_RADIO_SWITCH_STATE_OFF);
+    g_clear_pointer (&request, mbim_message_unref);
+    g_clear_pointer (&response, mbim_message_unref);
+
+    /* Scripted set status */
+    request = mbim_message_radio_state_set_new (MBIM_RADIO_SWITCH_STATE_ON, NULL);
+    response = test_context_command (ctx, request);
+    g_assert_no_error (ctx->error);
+    g_assert (!mbim_message_response_get_result (response, MBIM_MESSAGE_TYPE_COMMAND_DONE, &error));
+    g_assert_error (error, MBIM_STATUS_ERROR, MBIM_STATUS_ERROR_FAILURE);
+    g_clear_error (&error);
+    g_clear_pointer (&request, mbim_message_unref);
+    g_clear_pointer (&response, mbim_message_unref);
+
+    /* Not scripted */
+    request = mbim_message_pin_query_new (NULL);
+    response = test_context_command (ctx, request);
+    g_assert_no_error (ctx->error);
+    g_assert (!mbim_message_response_get_result (response, MBIM_MESSAGE_TYPE_COMMAND_DONE, &error));
+    g_assert_error (error, MBIM_STATUS_ERROR, MBIM_STATUS_ERROR_NO_DEVICE_SUPPORT);
+
+    test_context_close (ctx);
+    test_context_free (ctx);
+}
+
+static void
+test_simulator_fragments (void)
+{
+    g_autoptr(GError)        error = NULL;
+    g_autoptr(GByteArray)    buffer = NULL;
+    g_autoptr(GTimer)        timer = NULL;
+    TestContext             *ctx;
+    const guint8            *information_buffer;
+    guint32                  information_buffer_size;
+    guint                    n_requests;
+    guint                    i;
+
+    /* Large enough to need well over a hundred 64-byte fragments */
+    buffer = g_byte_array_sized_new (8192);
+    g_byte_array_set_size (buffer, 8192);
+    for (i = 0; i < buffer->len; i++)
+        buffer->data[i] = (guint8) i;
+
+    ctx = test_context_new ();
+    g_object_set (ctx->simulator, MBIM_SIMULATOR_MAX_FRAGMENT_SIZE, 64, NULL);
+    mbim_simulator_set_response (ctx->simulator,
+                                 MBIM_SERVICE_BASIC_CONNECT,
+                                 MBIM_CID_BASIC_CONNECT_HOME_PROVIDER,
+                                 MBIM_MESSAGE_COMMAND_TYPE_UNKNOWN,
+                                 MBIM_STATUS_ERROR_NONE,
+                                 buffer->data,
+                                 buffer->len);
+    test_context_open (ctx, MBIM_DEVICE_OPEN_FLAGS_NONE);
+
+    n_requests = g_test_perf () ? 1000 : 10;
+    timer = g_timer_new ();
+    for (i = 0; i < n_requests; i++) {
+        g_autoptr(MbimMessage) request = NULL;
+        g_autoptr(MbimMessage) response = NULL;
+
+        request = mbim_message_home_provider_query_new (NULL);
+        response = test_context_command (ctx, request);
+        g_assert_no_error (ctx->error);
+        mbim_message_response_get_result (response, MBIM_MESSAGE_TYPE_COMMAND_DONE, &error);
+        g_assert_no_error (error);
+
+        information_buffer = mbim_message_command_done_get_raw_information_buffer (response, &information_buffer_size);
+        g_assert_cmpuint (information_buffer_size, ==, buffer->len);
+        g_assert (memcmp (information_buffer, buffer->data, buffer->len) == 0);
+    }
+    g_test_minimized_result (g_timer_elapsed (timer, NULL) * 1000.0 / n_requests,
+                             "ms per %u-byte response in 64-byte fragments", buffer->len);
+
+    test_context_close (ctx);
+    test_context_free (ctx);
+}
+
+static void
+test_simulator_latency (void)
+{
+    g_autoptr(GError)  error = NULL;
+    g_autoptr(GTimer)  timer = NULL;
+    TestContext       *ctx;
+    guint              n_requests;
+    guint              i;
+
+    ctx = test_context_new ();
+    test_context_open (ctx, MBIM_DEVICE_OPEN_FLAGS_NONE);
+
+    n_requests = g_test_perf () ? 10000 : 100;
+    timer = g_timer_new ();
+    for (i = 0; i < n_requests; i++) {
+        g_autoptr(MbimMessage) request = NULL;
+        g_autoptr(MbimMessage) response = NULL;
+
+        request = mbim_message_device_services_query_new (NULL);
+        response = test_context_command (ctx, request);
+        g_assert_no_error (ctx->error);
+        mbim_message_response_get_result (response, MBIM_MESSAGE_TYPE_COMMAND_DONE, &error);
+        g_assert_no_error (error);
+    }
+    g_test_minimized_result (g_timer_elapsed (timer, NULL) * 1000.0 / n_requests,
+                             "ms per device services query");
+    g_assert_cmpuint (mbim_simulator_get_n_requests (ctx->simulator), ==, n_requests + 1);
+
+    test_context_close (ctx);
+    test_context_free (ctx);
+}
+
+static void
+test_simulator_indications (void)
+{
+    g_autoptr(GTimer)  timer = NULL;
+    TestContext       *ctx;
+    guint8             signal_state[20] = { 0 };
+    guint              n_indications;
+
+    ctx = test_context_new ();
+    test_context_open (ctx, MBIM_DEVICE_OPEN_FLAGS_NONE);
+
+    n_indications = g_test_perf () ? 100000 : 1000;
+    timer = g_timer_new ();
+    mbim_simulator_emit_indications (ctx->simulator,
+                                     MBIM_SERVICE_BASIC_CONNECT,
+                                     MBIM_CID_BASIC_CONNECT_SIGNAL_STATE,
+                                     signal_state, sizeof (signal_state),
+                                     n_indications, 0);
+    while (ctx->n_indications < n_indications) {
+        g_main_context_iteration (NULL, TRUE);
+        g_assert_cmpfloat (g_timer_elapsed (timer, NULL), <, WAIT_TIMEOUT_SECS);
+    }
+    g_test_maximized_result (n_indications / g_timer_elapsed (timer, NULL),
+                             "indications per second");
+
+    test_context_close (ctx);
+    test_context_free (ctx);
+}
+
+static void
+test_simulator_reopen (void)
+{
+    g_autoptr(GError)       error = NULL;
+    g_autoptr(MbimMessage)  request = NULL;
+    g_autoptr(MbimMessage)  response = NULL;
+    g_autoptr(GTimer)       timer = NULL;
+    TestContext            *ctx;
+
+    ctx = test_context_new ();
+    test_context_open (ctx, MBIM_DEVICE_OPEN_FLAGS_AUTO_REOPEN);
+
+    /* The next request gets a NotOpened error, and the device reopens the
+     * simulated function right away */
+    mbim_simulator_reset (ctx->simulator);
+    timer = g_timer_new ();
+    request = mbim_message_device_services_query_new (NULL);
+    response = test_context_command (ctx, request);
+    g_assert_no_error (ctx->error);
+    g_assert (!mbim_message_response_get_result (response, MBIM_MESSAGE_TYPE_COMMAND_DONE, &error));
+    g_assert_error (error, MBIM_PROTOCOL_ERROR, MBIM_PROTOCOL_ERROR_NOT_OPENED);
+    g_clear_error (&error);
+    g_clear_pointer (&request, mbim_message_unref);
+    g_clear_pointer (&response, mbim_message_unref);
+
+    if (!ctx->n_reopened)
+        test_context_run (ctx);
+    g_assert_cmpuint (ctx->n_reopened, ==, 1);
+    g_assert (mbim_device_is_open (ctx->device));
+    g_test_minimized_result (g_timer_elapsed (timer, NULL) * 1000.0, "ms to recover from a function reset");
+
+    request = mbim_message_device_services_query_new (NULL);
+    response = test_context_command (ctx, request);
+    g_assert_no_error (ctx->error);
+    mbim_message_response_get_result (response, MBIM_MESSAGE_TYPE_COMMAND_DONE, &error);
+    g_assert_no_error (error);
+
+    test_context_close (ctx);
+    test_context_free (ctx);
+}
+
+/* Requests received by the simulator while recovering from a function reset */
+static guint
+reopen_recover (TestContext *ctx)
+{
+    g_autoptr(GError)       error = NULL;
+    g_autoptr(MbimMessage)  request = NULL;
+    g_autoptr(MbimMessage)  response = NULL;
+    guint                   n_reopened;
+    guint                   n_requests;
+
+    n_reopened = ctx->n_reopened;
+    n_requests = mbim_simulator_get_n_requests (ctx->simulator);
+
+    mbim_simulator_reset (ctx->simulator);
+    request = mbim_message_device_services_query_new (NULL);
+    response = test_context_command (ctx, request);
+    g_assert_no_error (ctx->error);
+    g_assert (!mbim_message_response_get_result (response, MBIM_MESSAGE_TYPE_COMMAND_DONE, &error));
+    g_assert_error (error, MBIM_PROTOCOL_ERROR, MBIM_PROTOCOL_ERROR_NOT_OPENED);
+
+    if (ctx->n_reopened == n_reopened)
+        test_context_run (ctx);
+    g_assert_cmpuint (ctx->n_reopened, ==, n_reopened + 1);
+    return mbim_simulator_get_n_requests (ctx->simulator) - n_requests;
+}
+
+static gboolean
+subscribe_list_set (TestContext *ctx)
+{
+    g_autoptr(GError)       error = NULL;
+    g_autoptr(MbimMessage)  request = NULL;
+    g_autoptr(MbimMessage)  response = NULL;
+    MbimEventEntry          entry = { 0 };
+    const MbimEventEntry   *entries[] = { &entry };
+
+    memcpy (&entry.device_service_id, MBIM_UUID_BASIC_CONNECT, sizeof (MbimUuid));
+    request = mbim_message_device_service_subscribe_list_set_new (G_N_ELEMENTS (entries), entries, &error);
+    g_assert_no_error (error);
+    response = test_context_command (ctx, request);
+    g_assert_no_error (ctx->error);
+    return mbim_message_response_get_result (response, MBIM_MESSAGE_TYPE_COMMAND_DONE, NULL);
+}
+
+static void
+test_simulator_reopen_subscribe_list (void)
+{
+    TestContext *ctx;
+    guint        n_requests;
+
+    ctx = test_context_new ();
+    test_context_open (ctx, MBIM_DEVICE_OPEN_FLAGS_AUTO_REOPEN);
+    n_requests = reopen_recover (ctx);
+
+    /* A subscribe list the device rejected is not set again */
+    mbim_simulator_set_response (ctx->simulator,
+                                 MBIM_SERVICE_BASIC_CONNECT,
+                                 MBIM_CID_BASIC_CONNECT_DEVICE_SERVICE_SUBSCRIBE_LIST,
+                                 MBIM_MESSAGE_COMMAND_TYPE_SET,
+                                 MBIM_STATUS_ERROR_FAILURE,
+                                 NULL, 0);
+    g_assert (!subscribe_list_set (ctx));
+    g_assert_cmpuint (reopen_recover (ctx), ==, n_requests);
+
+    /* An accepted one is */
+    mbim_simulator_set_response (ctx->simulator,
+                                 MBIM_SERVICE_BASIC_CONNECT,
+                                 MBIM_CID_BASIC_CONNECT_DEVICE_SERVICE_SUBSCRIBE_LIST,
+                                 MBIM_MESSAGE_COMMAND_TYPE_SET,
+                                 MBIM_STATUS_ERROR_NONE,
+                                 NULL, 0);
+    g_assert (subscribe_list_set (ctx));
+    g_assert_cmpuint (reopen_recover (ctx), ==, n_requests + 1);
+
+    test_context_close (ctx);
+    test_context_free (ctx);
+}
+
+static void
+test_simulator_health (void)
+{
+    g_autoptr(GTimer)  timer = NULL;
+    TestContext       *ctx;
+
+    if (!g_test_slow ()) {
+        g_test_skip ("slow test, use -m slow to run it");
+        return;
+    }
+
+    ctx = test_context_new ();
+    test_context_open (ctx, MBIM_DEVICE_OPEN_FLAGS_NONE);
+    g_object_set (ctx->device, MBIM_DEVICE_HEALTH_PROBE_INTERVAL, 1, NULL);
+
+    /* Stuck firmware */
+    g_object_set (ctx->simulator, MBIM_SIMULATOR_STALLED, TRUE, NULL);
+    timer = g_timer_new ();
+    test_context_run (ctx);
+    g_assert_cmpuint (ctx->n_health_changed, ==, 1);
+    g_assert (!ctx->healthy);
+    g_test_minimized_result (g_timer_elapsed (timer, NULL) * 1000.0, "ms to detect stuck firmware");
+
+    /* Back to life */
+    g_object_set (ctx->simulator, MBIM_SIMULATOR_STALLED, FALSE, NULL);
+    test_context_run (ctx);
+    g_assert_cmpuint (ctx->n_health_changed, ==, 2);
+    g_assert (ctx->healthy);
+
+    g_object_set (ctx->device, MBIM_DEVICE_HEALTH_PROBE_INTERVAL, 0, NULL);
+    test_context_close (ctx);
+    test_context_free (ctx);
+}
+
+/*****************************************************************************/
+
+typedef struct {
+    TestContext *ctx;
+    MbimMessage *response;
+    GError      *error;
+    gboolean     received;
+    gint64       tx_time;
+    gint64       rx_time;
+} CommandTimestamps;
+
+static void
+command_timestamps_ready (MbimDevice        *device,
+                          GAsyncResult      *res,
+                          CommandTimestamps *ct)
+{
+    ct->response = mbim_device_command_finish (device, res, &ct->error);
+    ct->received = mbim_device_command_get_timestamps (device, res, &ct->tx_time, &ct->rx_time);
+    g_main_loop_quit (ct->ctx->loop);
+}
+
+static void
+command_timestamps_send (CommandTimestamps *ct)
+{
+    g_autoptr(MbimMessage) request = NULL;
+
+    request = mbim_message_device_services_query_new (NULL);
+    mbim_device_command (ct->ctx->device, request, REQUEST_TIMEOUT_SECS, NULL, (GAsyncReadyCallback) command_timestamps_ready, ct);
+}
+
+static void
+command_timestamps_wait (CommandTimestamps *ct)
+{
+    g_autoptr(GError) error = NULL;
+
+    while (!ct->response && !ct->error)
+        test_context_run (ct->ctx);
+    g_assert_no_error (ct->error);
+    mbim_message_response_get_result (ct->response, MBIM_MESSAGE_TYPE_COMMAND_DONE, &error);
+    g_assert_no_error (error);
+    g_clear_pointer (&ct->response, mbim_message_unref);
+    g_assert (ct->received);
+    g_assert_cmpint (ct->tx_time, >, 0);
+    g_assert_cmpint (ct->tx_time, <=, ct->rx_time);
+    g_assert_cmpint (ct->rx_time, <=, g_get_monotonic_time ());
+}
+
+static void
+indication_timestamp_cb (MbimDevice  *device,
+                         MbimMessage *message,
+                         gint64      *last_rx_time)
+{
+    gint64 rx_time;
+
+    rx_time = mbim_device_get_indication_timestamp (device);
+    g_assert_cmpint (rx_time, >, 0);
+    g_assert_cmpint (rx_time, >=, *last_rx_time);
+    g_assert_cmpint (rx_time, <=, g_get_monotonic_time ());
+    *last_rx_time = rx_time;
+}
+
+static void
+test_simulator_timestamps (void)
+{
+    g_autoptr(GError)       error = NULL;
+    g_autoptr(MbimMessage)  request = NULL;
+    g_autoptr(MbimMessage)  response = NULL;
+    TestContext            *ctx;
+    CommandTimestamps       first = { 0 };
+    CommandTimestamps       second = { 0 };
+    CommandTimestamps       pending = { 0 };
+    guint8                  signal_state[20] = { 0 };
+    gint64                  start;
+    gint64                  last_indication = 0;
+    gint64                  reset_time;
+    gint64                  original_tx_time;
+
+    ctx = test_context_new ();
+    test_context_open (ctx, MBIM_DEVICE_OPEN_FLAGS_AUTO_REOPEN);
+    first.ctx = second.ctx = pending.ctx = ctx;
+
+    /* Requests are sent after the call and answered after the response delay;
+     * consecutive requests are ordered */
+    g_object_set (ctx->simulator, MBIM_SIMULATOR_RESPONSE_DELAY, OPEN_RESPONSE_DELAY_MS, NULL);
+    start = g_get_monotonic_time ();
+    command_timestamps_send (&first);
+    command_timestamps_wait (&first);
+    g_assert_cmpint (first.tx_time, >=, start);
+    g_assert_cmpint (first.rx_time - first.tx_time, >=, OPEN_RESPONSE_DELAY_MS * 1000);
+
+    command_timestamps_send (&second);
+    command_timestamps_wait (&second);
+    g_assert_cmpint (second.tx_time, >=, first.rx_time);
+    g_assert_cmpint (second.rx_time - second.tx_time, >=, OPEN_RESPONSE_DELAY_MS * 1000);
+    g_object_set (ctx->simulator, MBIM_SIMULATOR_RESPONSE_DELAY, 0, NULL);
+
+    /* The indication timestamp is only available while it is being reported */
+    g_assert_cmpint (mbim_device_get_indication_timestamp (ctx->device), ==, 0);
+    g_signal_connect (ctx->device, MBIM_DEVICE_SIGNAL_INDICATE_STATUS, G_CALLBACK (indication_timestamp_cb), &last_indication);
+    start = g_get_monotonic_time ();
+    mbim_simulator_emit_indications (ctx->simulator,
+                                     MBIM_SERVICE_BASIC_CONNECT,
+                                     MBIM_CID_BASIC_CONNECT_SIGNAL_STATE,
+                                     signal_state, sizeof (signal_state),
+                                     10, 10);
+    while (ctx->n_indications < 10) {
+        g_main_context_iteration (NULL, TRUE);
+        g_assert_cmpint (g_get_monotonic_time () - start, <, WAIT_TIMEOUT_SECS * G_USEC_PER_SEC);
+    }
+    g_assert_cmpint (last_indication, >=, start);
+    g_assert_cmpint (mbim_device_get_indication_timestamp (ctx->device), ==, 0);
+    g_signal_handlers_disconnect_by_func (ctx->device, indication_timestamp_cb, &last_indication);
+
+    /* A query lost in a function reset is sent again once the device is
+     * reopened, and its send time is updated */
+    g_object_set (ctx->simulator, MBIM_SIMULATOR_STALLED, TRUE, NULL);
+    command_timestamps_send (&pending);
+    original_tx_time = g_get_monotonic_time ();
+    g_object_set (ctx->simulator, MBIM_SIMULATOR_STALLED, FALSE, NULL);
+
+    reset_time = g_get_monotonic_time ();
+    mbim_simulator_reset (ctx->simulator);
+    request = mbim_message_device_services_query_new (NULL);
+    response = test_context_command (ctx, request);
+    g_assert_no_error (ctx->error);
+    g_assert (!mbim_message_response_get_result (response, MBIM_MESSAGE_TYPE_COMMAND_DONE, &error));
+    g_assert_error (error, MBIM_PROTOCOL_ERROR, MBIM_PROTOCOL_ERROR_NOT_OPENED);
+
+    command_timestamps_wait (&pending);
+    g_assert_cmpuint (ctx->n_reopened, ==, 1);
+    g_assert_cmpint (original_tx_time, <, reset_time);
+    g_assert_cmpint (pending.tx_time, >, reset_time);
+
+    test_context_close (ctx);
+    test_context_free (ctx);
+}
+
+/*****************************************************************************/
+
+static guint
+open_pipeline_open (TestContext         *ctx,
+                    MbimDeviceOpenFlags  flags)
+{
+    guint n_requests;
+
+    g_clear_object (&ctx->device);
+    n_requests = mbim_simulator_get_n_requests (ctx->simulator);
+    test_context_open (ctx, flags);
+    n_requests = mbim_simulator_get_n_requests (ctx->simulator) - n_requests;
+
+    /* Never run when opening the simulated function directly */
+    g_assert_cmpuint (mbim_device_get_open_step_time (ctx->device, MBIM_DEVICE_OPEN_STEP_PROXY_CONFIG), ==, 0);
+    g_assert_cmpuint (mbim_device_get_open_step_time (ctx->device, MBIM_DEVICE_OPEN_STEP_CLOSE), ==, 0);
+    return n_requests;
+}
+
+static void
+test_simulator_open_pipeline (void)
+{
+    TestContext *ctx;
+    guint64      delay;
+
+    ctx = test_context_new ();
+    g_object_set (ctx->simulator, MBIM_SIMULATOR_RESPONSE_DELAY, OPEN_RESPONSE_DELAY_MS, NULL);
+    delay = OPEN_RESPONSE_DELAY_MS * 1000;
+    _mbim_device_info_cache_clear ();
+
+    /* Open and device services query, one after the other; the simulator
+     * doesn't support the version exchange, so it is skipped */
+    g_assert_cmpuint (open_pipeline_open (ctx, MBIM_DEVICE_OPEN_FLAGS_MS_MBIMEX_V2), ==, 2);
+    g_assert_cmpuint (mbim_device_get_open_step_time (ctx->device, MBIM_DEVICE_OPEN_STEP_OPEN), >=, delay);
+    g_assert_cmpuint (mbim_device_get_open_step_time (ctx->device, MBIM_DEVICE_OPEN_STEP_DEVICE_SERVICES), >=, delay);
+    g_assert_cmpuint (mbim_device_get_open_step_time (ctx->device, MBIM_DEVICE_OPEN_STEP_MS_MBIMEX_VERSION), ==, 0);
+    test_context_close (ctx);
+
+    /* Pipelined, the device services query and the version exchange are
+     * sent at once, so both complete after a single response delay */
+    _mbim_device_info_cache_clear ();
+    g_assert_cmpuint (open_pipeline_open (ctx, MBIM_DEVICE_OPEN_FLAGS_MS_MBIMEX_V2 | MBIM_DEVICE_OPEN_FLAGS_PIPELINE), ==, 3);
+    g_assert_cmpuint (mbim_device_get_open_step_time (ctx->device, MBIM_DEVICE_OPEN_STEP_OPEN), >=, delay);
+    g_assert_cmpuint (mbim_device_get_open_step_time (ctx->device, MBIM_DEVICE_OPEN_STEP_DEVICE_SERVICES), >=, delay);
+    g_assert_cmpuint (mbim_device_get_open_step_time (ctx->device, MBIM_DEVICE_OPEN_STEP_MS_MBIMEX_VERSION), >=, delay);
+    g_assert_cmpuint (mbim_device_get_open_step_time (ctx->device, MBIM_DEVICE_OPEN_STEP_MS_MBIMEX_VERSION), <, 2 * delay);
+    test_context_close (ctx);
+
+    /* Pipelined again in the same process, the device services learnt are
+     * reused and only the open request is sent */
+    g_assert_cmpuint (open_pipeline_open (ctx, MBIM_DEVICE_OPEN_FLAGS_MS_MBIMEX_V2 | MBIM_DEVICE_OPEN_FLAGS_PIPELINE), ==, 1);
+    g_assert_cmpuint (mbim_device_get_open_step_time (ctx->device, MBIM_DEVICE_OPEN_STEP_OPEN), >=, delay);
+    g_assert_cmpuint (mbim_device_get_open_step_time (ctx->device, MBIM_DEVICE_OPEN_STEP_DEVICE_SERVICES), ==, 0);
+    g_assert_cmpuint (mbim_device_get_open_step_time (ctx->device, MBIM_DEVICE_OPEN_STEP_MS_MBIMEX_VERSION), ==, 0);
+    test_context_close (ctx);
+
+    test_context_free (ctx);
+    _mbim_device_info_cache_clear ();
+}
+
+/* Device caps response information buffer with device ID "12345" */
+static const guint8 device_caps_buffer[] = {
+    0x01, 0x00, 0x00, 0x00, /* device type: embedded */
+    0x01, 0x00, 0x00, 0x00, /* cellular class: gsm */
+    0x01, 0x00, 0x00, 0x00, /* voice class: no voice */
+    0x01, 0x00, 0x00, 0x00, /* sim class: logical */
+    0x00, 0x00, 0x00, 0x00, /* data class */
+    0x00, 0x00, 0x00, 0x00, /* sms caps */
+    0x00, 0x00, 0x00, 0x00, /* control caps */
+    0x01, 0x00, 0x00, 0x00, /* max sessions */
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, /* custom data class */
+    0x40, 0x00, 0x00, 0x00, 0x0A, 0x00, 0x00, 0x00, /* device id */
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, /* firmware info */
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, /* hardware info */
+    0x31, 0x00, 0x32, 0x00, 0x33, 0x00, 0x34, 0x00,
+    0x35, 0x00, 0x00, 0x00
+};
+
+static gboolean
+profile_matches (const gchar *filename,
+                 const gchar *identity,
+                 const gchar *device_id)
+{
+    g_autoptr(GVariant)  profile = NULL;
+    g_autoptr(GBytes)    bytes = NULL;
+    gchar               *contents = NULL;
+    gsize                length = 0;
+    const gchar         *profile_identity = NULL;
+    const gchar         *profile_device_id = NULL;
+
+    if (!g_file_get_contents (filename, &contents, &length, NULL))
+        return FALSE;
+
+    bytes = g_bytes_new_take (contents, length);
+    profile = g_variant_ref_sink (g_variant_new_from_bytes (G_VARIANT_TYPE ("(ussqxaay)"), bytes, FALSE));
+    if (!g_variant_is_normal_form (profile))
+        return FALSE;
+
+    g_variant_get (profile, "(u&s&sqxaay)", NULL, &profile_identity, &profile_device_id, NULL, NULL, NULL);
+    return (g_strcmp0 (profile_identity, identity) == 0 && g_strcmp0 (profile_device_id, device_id) == 0);
+}
+
+/* The profile is stored again once the background refresh is done */
+static void
+wait_profile (const gchar *filename,
+              const gchar *identity,
+              const gchar *device_id)
+{
+    guint id;
+
+    id = g_timeout_add_seconds (WAIT_TIMEOUT_SECS, (GSourceFunc) loop_timeout_cb, NULL);
+    while (!profile_matches (filename, identity, device_id))
+        g_main_context_iteration (NULL, TRUE);
+    g_source_remove (id);
+}
+
+/* Opens and closes the simulated function as a new process would, with
+ * nothing cached in memory, and returns the number of requests sent */
+static guint
+profile_open_close (TestContext *ctx,
+                    const gchar *filename,
+                    gboolean     refresh)
+{
+    guint n_requests;
+
+    _mbim_device_info_cache_clear ();
+    g_clear_object (&ctx->device);
+
+    n_requests = mbim_simulator_get_n_requests (ctx->simulator);
+    test_context_open (ctx, MBIM_DEVICE_OPEN_FLAGS_MS_MBIMEX_V2);
+    if (refresh)
+        wait_profile (filename, ctx->profile_identity, "12345");
+    test_context_close (ctx);
+    return mbim_simulator_get_n_requests (ctx->simulator) - n_requests;
+}
+
+static void
+test_simulator_profile (void)
+{
+    g_autoptr(GError)  error = NULL;
+    g_autofree gchar  *profile_dir = NULL;
+    g_autofree gchar  *name = NULL;
+    g_autofree gchar  *filename = NULL;
+    TestContext       *ctx;
+
+    profile_dir = g_dir_make_tmp ("test-simulator-profile-XXXXXX", &error);
+    g_assert_no_error (error);
+
+    ctx = test_context_new ();
+    mbim_simulator_set_response (ctx->simulator,
+                                 MBIM_SERVICE_BASIC_CONNECT,
+                                 MBIM_CID_BASIC_CONNECT_DEVICE_CAPS,
+                                 MBIM_MESSAGE_COMMAND_TYPE_QUERY,
+                                 MBIM_STATUS_ERROR_NONE,
+                                 device_caps_buffer,
+                                 sizeof (device_caps_buffer));
+    ctx->profile_dir = profile_dir;
+    ctx->profile_identity = "identity";
+    name = g_strdelimit (g_strdup_printf ("%s.profile", mbim_simulator_get_path (ctx->simulator)), G_DIR_SEPARATOR_S, '_');
+    filename = g_build_filename (profile_dir, name, NULL);
+
+    /* No profile yet: open, device services, then the background refresh
+     * with device services and device caps, and close */
+    g_assert_cmpuint (profile_open_close (ctx, filename, TRUE), ==, 5);
+
+    /* The stored profile is reused: only open and close */
+    g_assert_cmpuint (profile_open_close (ctx, filename, FALSE), ==, 2);
+
+    /* A profile of a different device is ignored, and replaced */
+    ctx->profile_identity = "other-identity";
+    g_assert_cmpuint (profile_open_close (ctx, filename, TRUE), ==, 5);
+    g_assert_cmpuint (profile_open_close (ctx, filename, FALSE), ==, 2);
+
+    /* A corrupt profile is ignored, and replaced */
+    g_assert (g_file_set_contents (filename, "corrupt", -1, &error));
+    g_assert_no_error (error);
+    g_assert_cmpuint (profile_open_close (ctx, filename, TRUE), ==, 5);
+    g_assert_cmpuint (profile_open_close (ctx, filename, FALSE), ==, 2);
+
+    /* Without device identity, the profile is neither used nor stored */
+    ctx->profile_identity = NULL;
+    g_assert_cmpuint (profile_open_close (ctx, filename, FALSE), ==, 3);
+
+    test_context_free (ctx);
+    _mbim_device_info_cache_clear ();
+    g_unlink (filename);
+    g_rmdir (profile_dir);
+}
+
+/*****************************************************************************/
+
+int main (int argc, char **argv)
+{
+    g_test_init (&argc, &argv, NULL);
+
+    g_test_add_func ("/libmbim-glib/simulator/open-close",  test_simulator_open_close);
+    g_test_add_func ("/libmbim-glib/simulator/script",      test_simulator_script);
+    g_test_add_func ("/libmbim-glib/simulator/fragments",   test_simulator_fragments);
+    g_test_add_func ("/libmbim-glib/simulator/latency",     test_simulator_latency);
+    g_test_add_func ("/libmbim-glib/simulator/indications", test_simulator_indications);
+    g_test_add_func ("/libmbim-glib/simulator/reopen",      test_simulator_reopen);
+    g_test_add_func ("/libmbim-glib/simulator/reopen/subscribe-list", test_simulator_reopen_subscribe_list);
+    g_test_add_func ("/libmbim-glib/simulator/health",      test_simulator_health);
+    g_test_add_func ("/libmbim-glib/simulator/profile",     test_simulator_profile);
+    g_test_add_func ("/libmbim-glib/simulator/open/pipeline", test_simulator_open_pipeline);
+    g_test_add_func ("/libmbim-glib/simulator/timestamps",  test_simulator_timestamps);
+
+    return g_test_run ();
+}
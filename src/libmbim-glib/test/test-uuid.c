@@ -5,6 +5,7 @@
  */
 
 #include <config.h>
+#include <string.h>
 
 #include "mbim-uuid.h"
 
@@ -204,6 +205,116 @@ test_uuid_custom (void)
     g_assert (!mbim_service_id_is_custom (service));
 }
 
+static void
+test_uuid_custom_multiple (void)
+{
+    guint    services[8];
+    MbimUuid uuids[8];
+    guint    i;
+
+    for (i = 0; i < G_N_ELEMENTS (services); i++) {
+        g_autofree gchar *nick = NULL;
+
+        memset (&uuids[i], 0xc0 + i, sizeof (MbimUuid));
+        nick = g_strdup_printf ("custom-%u", i);
+        services[i] = mbim_register_custom_service (&uuids[i], nick);
+        g_assert (mbim_service_id_is_custom (services[i]));
+        /* registering the same UUID again gives the same id */
+        g_assert_cmpuint (mbim_register_custom_service (&uuids[i], nick), ==, services[i]);
+    }
+
+    for (i = 0; i < G_N_ELEMENTS (services); i++) {
+        g_autofree gchar *nick = NULL;
+
+        nick = g_strdup_printf ("custom-%u", i);
+        g_assert_cmpstr (mbim_service_lookup_name (services[i]), ==, nick);
+        g_assert_cmpuint (mbim_uuid_to_service (&uuids[i]), ==, services[i]);
+        g_assert (mbim_uuid_cmp (mbim_uuid_from_service (services[i]), &uuids[i]));
+    }
+
+    /* removing one doesn't affect the others */
+    g_assert (mbim_unregister_custom_service (services[3]));
+    g_assert (!mbim_unregister_custom_service (services[3]));
+    g_assert_cmpuint (mbim_uuid_to_service (&uuids[3]), ==, MBIM_SERVICE_INVALID);
+    g_assert_cmpuint (mbim_uuid_to_service (&uuids[4]), ==, services[4]);
+
+    for (i = 0; i < G_N_ELEMENTS (services); i++) {
+        if (i != 3)
+            g_assert (mbim_unregister_custom_service (services[i]));
+    }
+}
+
+/*****************************************************************************/
+
+static void
+test_uuid_service_roundtrip (void)
+{
+    guint service;
+
+    for (service = MBIM_SERVICE_BASIC_CONNECT; service < MBIM_SERVICE_LAST; service++)
+        g_assert_cmpuint (mbim_uuid_to_service (mbim_uuid_from_service (service)), ==, service);
+    g_assert_cmpuint (mbim_uuid_to_service (MBIM_UUID_INVALID), ==, MBIM_SERVICE_INVALID);
+}
+
+static void
+test_uuid_context_type_roundtrip (void)
+{
+    guint context_type;
+
+    for (context_type = MBIM_CONTEXT_TYPE_NONE; context_type <= MBIM_CONTEXT_TYPE_EMERGENCY_CALLING; context_type++)
+        g_assert_cmpuint (mbim_uuid_to_context_type (mbim_uuid_from_context_type (context_type)), ==, context_type);
+    g_assert_cmpuint (mbim_uuid_to_context_type (MBIM_UUID_INVALID), ==, MBIM_CONTEXT_TYPE_INVALID);
+}
+
+/*****************************************************************************/
+
+#define BENCHMARK_ITERATIONS     200000
+#define BENCHMARK_CUSTOM_SERVICES 50
+
+static void
+test_uuid_lookup_benchmark (void)
+{
+    guint    custom[BENCHMARK_CUSTOM_SERVICES];
+    MbimUuid custom_uuids[BENCHMARK_CUSTOM_SERVICES];
+    GTimer  *timer;
+    guint    i;
+    guint    j;
+    guint    n_lookups = 0;
+    gdouble  elapsed;
+
+    if (!g_test_perf ()) {
+        g_test_skip ("only run in performance mode");
+        return;
+    }
+
+    for (i = 0; i < BENCHMARK_CUSTOM_SERVICES; i++) {
+        memset (&custom_uuids[i], i + 1, sizeof (MbimUuid));
+        custom[i] = mbim_register_custom_service (&custom_uuids[i], "benchmark");
+    }
+
+    timer = g_timer_new ();
+    for (i = 0; i < BENCHMARK_ITERATIONS; i++) {
+        for (j = MBIM_SERVICE_BASIC_CONNECT; j < MBIM_SERVICE_LAST; j++, n_lookups++)
+            g_assert_cmpuint (mbim_uuid_to_service (mbim_uuid_from_service (j)), ==, j);
+        for (j = MBIM_CONTEXT_TYPE_NONE; j <= MBIM_CONTEXT_TYPE_EMERGENCY_CALLING; j++, n_lookups++)
+            g_assert_cmpuint (mbim_uuid_to_context_type (mbim_uuid_from_context_type (j)), ==, j);
+    }
+    elapsed = g_timer_elapsed (timer, NULL);
+    g_test_maximized_result (n_lookups / elapsed, "built-in UUID lookups per second");
+
+    g_timer_start (timer);
+    for (i = 0, n_lookups = 0; i < BENCHMARK_ITERATIONS / 10; i++) {
+        for (j = 0; j < BENCHMARK_CUSTOM_SERVICES; j++, n_lookups++)
+            g_assert_cmpuint (mbim_uuid_to_service (&custom_uuids[j]), ==, custom[j]);
+    }
+    elapsed = g_timer_elapsed (timer, NULL);
+    g_test_maximized_result (n_lookups / elapsed, "custom service UUID lookups per second");
+
+    g_timer_destroy (timer);
+    for (i = 0; i < BENCHMARK_CUSTOM_SERVICES; i++)
+        g_assert (mbim_unregister_custom_service (custom[i]));
+}
+
 /*****************************************************************************/
 
 int main (int argc, char **argv)
@@ -233,7 +344,13 @@ int main (int argc, char **argv)
     g_test_add_func ("/libmbim-glib/uuid/invalid/dashes", test_uuid_invalid_dashes);
     g_test_add_func ("/libmbim-glib/uuid/invalid/no-hex", test_uuid_invalid_no_hex);
 
-    g_test_add_func ("/libmbim-glib/uuid/custom", test_uuid_custom);
+    g_test_add_func ("/libmbim-glib/uuid/custom",          test_uuid_custom);
+    g_test_add_func ("/libmbim-glib/uuid/custom/multiple", test_uuid_custom_multiple);
+
+    g_test_add_func ("/libmbim-glib/uuid/roundtrip/service",      test_uuid_service_roundtrip);
+    g_test_add_func ("/libmbim-glib/uuid/roundtrip/context-type", test_uuid_context_type_roundtrip);
+
+    g_test_add_func ("/libmbim-glib/uuid/benchmark/lookup", test_uuid_lookup_benchmark);
 
     return g_test_run ();
 }
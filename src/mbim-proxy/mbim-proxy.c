@@ -13,6 +13,8 @@
 #include <stdlib.h>
 #include <locale.h>
 #include <string.h>
+#include <unistd.h>
+#include <errno.h>
 
 #include <glib.h>
 #include <glib/gprintf.h>
@@ -38,6 +40,16 @@ static gboolean verbose_full_flag;
 static gboolean version_flag;
 static gboolean no_exit_flag;
 static gint     empty_timeout = -1;
+static gint     client_queue_max_size = -1;
+static gboolean client_queue_drop_indications_flag;
+static gint     device_max_in_flight = -1;
+static gchar  **client_quota_strv;
+static gint     query_cache_ttl = -1;
+static gboolean indication_replay_flag;
+static gint     request_timeout = G_MININT;
+static gboolean device_threads_flag;
+static gint     ready_fd = -1;
+static gboolean handoff_flag;
 
 static GOptionEntry main_entries[] = {
     { "no-exit", 0, 0, G_OPTION_ARG_NONE, &no_exit_flag,
@@ -48,6 +60,46 @@ static GOptionEntry main_entries[] = {
       "If no clients/devices, exit after this timeout. If set to 0, equivalent to --no-exit.",
       "[SECS]"
     },
+    { "client-queue-max-size", 0, 0, G_OPTION_ARG_INT, &client_queue_max_size,
+      "Maximum number of bytes pending to be written to a single client. If set to 0, no limit.",
+      "[BYTES]"
+    },
+    { "client-queue-drop-indications", 0, 0, G_OPTION_ARG_NONE, &client_queue_drop_indications_flag,
+      "Drop indications instead of disconnecting clients with a full output queue",
+      NULL
+    },
+    { "device-max-in-flight", 0, 0, G_OPTION_ARG_INT, &device_max_in_flight,
+      "Maximum number of client requests in flight in a device. If set to 0, no limit.",
+      "[N]"
+    },
+    { "client-quota", 0, 0, G_OPTION_ARG_STRING_ARRAY, &client_quota_strv,
+      "Request quota for the clients of the given user: maximum requests in flight (0 for no limit) and round robin weight (1 by default). May be given multiple times.",
+      "[UID:MAX-IN-FLIGHT[:WEIGHT]]"
+    },
+    { "query-cache-ttl", 0, 0, G_OPTION_ARG_INT, &query_cache_ttl,
+      "Share query responses among clients during this time, and coalesce identical queries in flight. If set to 0, disabled (default).",
+      "[MSECS]"
+    },
+    { "indication-replay", 0, 0, G_OPTION_ARG_NONE, &indication_replay_flag,
+      "Replay the last indications received to the clients subscribing to them",
+      NULL
+    },
+    { "request-timeout", 0, 0, G_OPTION_ARG_INT, &request_timeout,
+      "Time client requests are kept in flight in the device, unless the client configured its own (300 by default).",
+      "[SECS]"
+    },
+    { "device-threads", 0, 0, G_OPTION_ARG_NONE, &device_threads_flag,
+      "Handle each device and its clients in a separate thread",
+      NULL
+    },
+    { "ready-fd", 0, 0, G_OPTION_ARG_INT, &ready_fd,
+      "Write a byte to this file descriptor and close it once the proxy accepts connections",
+      "[FD]"
+    },
+    { "handoff", 0, 0, G_OPTION_ARG_NONE, &handoff_flag,
+      "Take over the devices and clients of the running proxy, if any, and hand them off to the next one started with this option",
+      NULL
+    },
     { "verbose", 'v', 0, G_OPTION_ARG_NONE, &verbose_flag,
       "Run action with verbose logs, including the debug ones",
       NULL
@@ -154,20 +206,24 @@ stop_loop_cb (void)
     return FALSE;
 }
 
-static void
-proxy_n_clients_changed (MbimProxy *_proxy)
+/* The notifications may be emitted from the device threads, so the exit
+ * timeout is only updated from the main loop, with the current counts, which
+ * may have changed more than once meanwhile */
+
+static gboolean
+proxy_n_clients_changed (void)
 {
     /* once a client has connected only exit if there are no devices */
     if (client_connected_once)
-        return;
+        return G_SOURCE_REMOVE;
 
     if (mbim_proxy_get_n_clients (proxy) == 0) {
-        g_assert (timeout_id == 0);
         g_assert (empty_timeout > 0);
-        timeout_id = g_timeout_add_seconds (empty_timeout,
-                                            (GSourceFunc)stop_loop_cb,
-                                            NULL);
-        return;
+        if (!timeout_id)
+            timeout_id = g_timeout_add_seconds (empty_timeout,
+                                                (GSourceFunc)stop_loop_cb,
+                                                NULL);
+        return G_SOURCE_REMOVE;
     }
 
     /* At least one client, remove timeout if any */
@@ -177,18 +233,19 @@ proxy_n_clients_changed (MbimProxy *_proxy)
     }
 
     client_connected_once = TRUE;
+    return G_SOURCE_REMOVE;
 }
 
-static void
-proxy_n_devices_changed (MbimProxy *_proxy)
+static gboolean
+proxy_n_devices_changed (void)
 {
     if (mbim_proxy_get_n_devices (proxy) == 0) {
-        g_assert (timeout_id == 0);
         g_assert (empty_timeout > 0);
-        timeout_id = g_timeout_add_seconds (empty_timeout,
-                                            (GSourceFunc)stop_loop_cb,
-                                            NULL);
-        return;
+        if (!timeout_id)
+            timeout_id = g_timeout_add_seconds (empty_timeout,
+                                                (GSourceFunc)stop_loop_cb,
+                                                NULL);
+        return G_SOURCE_REMOVE;
     }
 
     /* At least one device, remove timeout if any */
@@ -196,6 +253,79 @@ proxy_n_devices_changed (MbimProxy *_proxy)
         g_source_remove (timeout_id);
         timeout_id = 0;
     }
+    return G_SOURCE_REMOVE;
+}
+
+static void
+proxy_n_clients_notify (MbimProxy *_proxy)
+{
+    g_idle_add ((GSourceFunc) proxy_n_clients_changed, NULL);
+}
+
+static void
+proxy_n_devices_notify (MbimProxy *_proxy)
+{
+    g_idle_add ((GSourceFunc) proxy_n_devices_changed, NULL);
+}
+
+static void
+proxy_handed_off (MbimProxy *_proxy)
+{
+    g_debug ("devices and clients handed off to the new proxy");
+    if (timeout_id) {
+        g_source_remove (timeout_id);
+        timeout_id = 0;
+    }
+    if (loop)
+        g_main_loop_quit (loop);
+}
+
+/*****************************************************************************/
+
+static gboolean
+parse_uint (const gchar *str,
+            guint       *out)
+{
+    guint64 num;
+
+    if (!g_ascii_string_to_unsigned (str, 10, 0, G_MAXUINT, &num, NULL))
+        return FALSE;
+    *out = (guint) num;
+    return TRUE;
+}
+
+static gboolean
+parse_client_quota (const gchar *str,
+                    guint       *uid,
+                    guint       *max_in_flight,
+                    guint       *weight)
+{
+    g_auto(GStrv) split = NULL;
+    guint         n;
+
+    split = g_strsplit (str, ":", -1);
+    n = g_strv_length (split);
+    if (n < 2 || n > 3)
+        return FALSE;
+
+    *weight = 1;
+    return (parse_uint (split[0], uid) &&
+            parse_uint (split[1], max_in_flight) &&
+            (n < 3 || (parse_uint (split[2], weight) && *weight > 0)));
+}
+
+/*****************************************************************************/
+
+static void
+notify_ready (void)
+{
+    if (ready_fd < 0)
+        return;
+
+    if (write (ready_fd, "1", 1) != 1)
+        g_warning ("couldn't notify proxy is ready: %s", g_strerror (errno));
+    close (ready_fd);
+    ready_fd = -1;
 }
 
 /*****************************************************************************/
@@ -240,28 +370,102 @@ int main (int argc, char **argv)
     if (empty_timeout < 0)
         empty_timeout = EMPTY_TIMEOUT_DEFAULT;
 
-    /* Setup proxy */
-    proxy = mbim_proxy_new (&error);
+    if (request_timeout != G_MININT && request_timeout <= 0) {
+        g_printerr ("error: invalid request timeout: %d\n", request_timeout);
+        exit (EXIT_FAILURE);
+    }
+
+    if (handoff_flag && device_threads_flag) {
+        g_printerr ("error: cannot specify --handoff and --device-threads at the same time\n");
+        exit (EXIT_FAILURE);
+    }
+
+    /* Setup proxy, taking over the running one if requested */
+    if (handoff_flag) {
+        proxy = mbim_proxy_new_from_handoff (&error);
+        if (!proxy) {
+            g_debug ("no proxy taken over: %s", error->message);
+            g_clear_error (&error);
+        }
+    }
+    if (!proxy)
+        proxy = mbim_proxy_new (&error);
     if (!proxy) {
         g_printerr ("error: %s\n", error->message);
         exit (EXIT_FAILURE);
     }
 
+    /* Setup client output queue limits */
+    if (client_queue_max_size >= 0)
+        g_object_set (proxy, MBIM_PROXY_CLIENT_QUEUE_MAX_SIZE, (guint) client_queue_max_size, NULL);
+    if (client_queue_drop_indications_flag)
+        g_object_set (proxy, MBIM_PROXY_CLIENT_QUEUE_DROP_INDICATIONS, TRUE, NULL);
+
+    /* Setup request scheduling */
+    if (device_max_in_flight >= 0)
+        g_object_set (proxy, MBIM_PROXY_DEVICE_MAX_IN_FLIGHT, (guint) device_max_in_flight, NULL);
+    if (client_quota_strv) {
+        guint i;
+
+        for (i = 0; client_quota_strv[i]; i++) {
+            guint uid;
+            guint max_in_flight;
+            guint weight;
+
+            if (!parse_client_quota (client_quota_strv[i], &uid, &max_in_flight, &weight)) {
+                g_printerr ("error: invalid client quota: '%s'\n", client_quota_strv[i]);
+                exit (EXIT_FAILURE);
+            }
+            mbim_proxy_set_client_quota (proxy, uid, max_in_flight, weight);
+        }
+    }
+
+    /* Setup query cache */
+    if (query_cache_ttl >= 0)
+        g_object_set (proxy, MBIM_PROXY_QUERY_CACHE_TTL, (guint) query_cache_ttl, NULL);
+
+    /* Setup indication replay */
+    if (indication_replay_flag)
+        g_object_set (proxy, MBIM_PROXY_INDICATION_REPLAY, TRUE, NULL);
+
+    /* Setup request timeout */
+    if (request_timeout != G_MININT)
+        g_object_set (proxy, MBIM_PROXY_REQUEST_TIMEOUT, (guint) request_timeout, NULL);
+
+    /* Setup device threads */
+    if (device_threads_flag)
+        g_object_set (proxy, MBIM_PROXY_DEVICE_THREADS, TRUE, NULL);
+
+    /* Setup handoff to the next proxy */
+    if (handoff_flag) {
+        /* Devices taken over keep the proxy running as if clients had used it */
+        if (mbim_proxy_get_n_devices (proxy) > 0)
+            client_connected_once = TRUE;
+        g_object_set (proxy, MBIM_PROXY_HANDOFF, TRUE, NULL);
+        g_signal_connect (proxy,
+                          MBIM_PROXY_SIGNAL_HANDED_OFF,
+                          G_CALLBACK (proxy_handed_off),
+                          NULL);
+    }
+
     /* Don't exit the proxy when no clients/devices are found */
     if (!no_exit_flag && empty_timeout != 0) {
         g_debug ("proxy will exit after %d secs if unused", empty_timeout);
-        proxy_n_clients_changed (proxy);
+        proxy_n_clients_changed ();
         g_signal_connect (proxy,
                           "notify::" MBIM_PROXY_N_CLIENTS,
-                          G_CALLBACK (proxy_n_clients_changed),
+                          G_CALLBACK (proxy_n_clients_notify),
                           NULL);
         g_signal_connect (proxy,
                           "notify::" MBIM_PROXY_N_DEVICES,
-                          G_CALLBACK (proxy_n_devices_changed),
+                          G_CALLBACK (proxy_n_devices_notify),
                           NULL);
     } else
         g_debug ("proxy will remain running if unused");
 
+    /* All setup done, the clients waiting for the proxy may connect */
+    notify_ready ();
+
     /* Loop */
     loop = g_main_loop_new (NULL, FALSE);
     g_main_loop_run (loop);
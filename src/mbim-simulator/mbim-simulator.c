@@ -0,0 +1,238 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * mbim-simulator -- A simulated MBIM function behind a pseudo-terminal
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <locale.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include <glib.h>
+#include <glib/gprintf.h>
+#include <glib/gstdio.h>
+#include <gio/gio.h>
+#include <glib-unix.h>
+
+#include "mbim-utils.h"
+#include "mbim-simulator.h"
+
+#define PROGRAM_NAME    "mbim-simulator"
+#define PROGRAM_VERSION PACKAGE_VERSION
+
+/* Globals */
+static GMainLoop     *loop;
+static MbimSimulator *simulator;
+
+/* Main options */
+static gchar    **script_strv;
+static gint       response_delay = -1;
+static gint       max_fragment_size = -1;
+static gchar     *link_str;
+static gboolean   verbose_flag;
+static gboolean   verbose_full_flag;
+static gboolean   version_flag;
+
+static GOptionEntry main_entries[] = {
+    { "script", 's', 0, G_OPTION_ARG_FILENAME_ARRAY, &script_strv,
+      "Load responses and indications from the given script. May be given multiple times.",
+      "[PATH]"
+    },
+    { "response-delay", 0, 0, G_OPTION_ARG_INT, &response_delay,
+      "Wait this time before sending each response",
+      "[MSECS]"
+    },
+    { "max-fragment-size", 0, 0, G_OPTION_ARG_INT, &max_fragment_size,
+      "Split larger messages in fragments of this size (4096 by default)",
+      "[BYTES]"
+    },
+    { "link", 'l', 0, G_OPTION_ARG_FILENAME, &link_str,
+      "Create a symlink to the simulated port at the given path, e.g. to use it like a cdc-wdm port",
+      "[PATH]"
+    },
+    { "verbose", 'v', 0, G_OPTION_ARG_NONE, &verbose_flag,
+      "Run action with verbose logs, including the debug ones",
+      NULL
+    },
+    { "verbose-full", 0, 0, G_OPTION_ARG_NONE, &verbose_full_flag,
+      "Run action with verbose logs, including the debug ones and personal info",
+      NULL
+    },
+    { "version", 'V', 0, G_OPTION_ARG_NONE, &version_flag,
+      "Print version",
+      NULL
+    },
+    { NULL, 0, 0, 0, NULL, NULL, NULL }
+};
+
+static gboolean
+quit_cb (gpointer user_data)
+{
+    if (loop) {
+        g_warning ("Caught signal, stopping the loop...");
+        g_idle_add ((GSourceFunc) g_main_loop_quit, loop);
+    }
+
+    return FALSE;
+}
+
+static void
+log_handler (const gchar    *log_domain,
+             GLogLevelFlags  log_level,
+             const gchar    *message,
+             gpointer        user_data)
+{
+    const gchar *log_level_str;
+    time_t       now;
+    gchar        time_str[64];
+    struct tm   *local_time;
+    gboolean     err = FALSE;
+
+    switch (log_level) {
+    case G_LOG_LEVEL_WARNING:
+        log_level_str = "-Warning **";
+        err = TRUE;
+        break;
+
+    case G_LOG_LEVEL_CRITICAL:
+    case G_LOG_FLAG_FATAL:
+    case G_LOG_LEVEL_ERROR:
+        log_level_str = "-Error **";
+        err = TRUE;
+        break;
+
+    case G_LOG_LEVEL_DEBUG:
+        log_level_str = "[Debug]";
+        break;
+
+    case G_LOG_LEVEL_MESSAGE:
+    case G_LOG_LEVEL_INFO:
+        log_level_str = "";
+        break;
+
+    case G_LOG_LEVEL_MASK:
+    case G_LOG_FLAG_RECURSION:
+    default:
+        g_assert_not_reached ();
+    }
+
+    if (!verbose_flag && !verbose_full_flag && !err)
+        return;
+
+    now = time ((time_t *) NULL);
+    local_time = localtime (&now);
+    strftime (time_str, 64, "%d %b %Y, %H:%M:%S", local_time);
+
+    /* stdout is reserved for the path of the simulated port */
+    g_fprintf (stderr,
+               "[%s] %s %s\n",
+               time_str,
+               log_level_str,
+               message);
+}
+
+G_GNUC_NORETURN
+static void
+print_version_and_exit (void)
+{
+    g_print ("\n"
+             PROGRAM_NAME " " PROGRAM_VERSION "\n"
+             "License GPLv2+: GNU GPL version 2 or later <http://gnu.org/licenses/gpl-2.0.html>\n"
+             "This is free software: you are free to change and redistribute it.\n"
+             "There is NO WARRANTY, to the extent permitted by law.\n"
+             "\n");
+    exit (EXIT_SUCCESS);
+}
+
+/*****************************************************************************/
+
+int main (int argc, char **argv)
+{
+    g_autoptr(GError)         error = NULL;
+    g_autoptr(GOptionContext) context = NULL;
+    guint                     i;
+
+    setlocale (LC_ALL, "");
+
+    /* Setup option context, process it and destroy it */
+    context = g_option_context_new ("- Simulated MBIM function");
+    g_option_context_add_main_entries (context, main_entries, NULL);
+    if (!g_option_context_parse (context, &argc, &argv, &error)) {
+        g_printerr ("error: %s\n", error->message);
+        exit (EXIT_FAILURE);
+    }
+
+    if (version_flag)
+        print_version_and_exit ();
+
+    g_log_set_handler (NULL,  G_LOG_LEVEL_MASK, log_handler, NULL);
+    g_log_set_handler ("Mbim", G_LOG_LEVEL_MASK, log_handler, NULL);
+    if (verbose_flag && verbose_full_flag) {
+        g_printerr ("error: cannot specify --verbose and --verbose-full at the same time\n");
+        exit (EXIT_FAILURE);
+    } else if (verbose_flag) {
+        mbim_utils_set_traces_enabled (TRUE);
+        mbim_utils_set_show_personal_info (FALSE);
+    } else if (verbose_full_flag) {
+        mbim_utils_set_traces_enabled (TRUE);
+        mbim_utils_set_show_personal_info (TRUE);
+    }
+
+    /* Setup signals */
+    g_unix_signal_add (SIGINT,  quit_cb, NULL);
+    g_unix_signal_add (SIGHUP,  quit_cb, NULL);
+    g_unix_signal_add (SIGTERM, quit_cb, NULL);
+
+    simulator = mbim_simulator_new (&error);
+    if (!simulator) {
+        g_printerr ("error: %s\n", error->message);
+        exit (EXIT_FAILURE);
+    }
+
+    for (i = 0; script_strv && script_strv[i]; i++) {
+        if (!mbim_simulator_load_script (simulator, script_strv[i], &error)) {
+            g_printerr ("error: couldn't load script: %s\n", error->message);
+            exit (EXIT_FAILURE);
+        }
+    }
+
+    if (response_delay >= 0)
+        g_object_set (simulator, MBIM_SIMULATOR_RESPONSE_DELAY, (guint) response_delay, NULL);
+    if (max_fragment_size >= 0) {
+        if (max_fragment_size < 64) {
+            g_printerr ("error: maximum fragment size must be at least 64 bytes\n");
+            exit (EXIT_FAILURE);
+        }
+        g_object_set (simulator, MBIM_SIMULATOR_MAX_FRAGMENT_SIZE, (guint) max_fragment_size, NULL);
+    }
+
+    if (link_str) {
+        g_unlink (link_str);
+        if (symlink (mbim_simulator_get_path (simulator), link_str) < 0) {
+            g_printerr ("error: couldn't create link '%s': %s\n", link_str, g_strerror (errno));
+            exit (EXIT_FAILURE);
+        }
+    }
+
+    /* Let whoever launched us know where to connect */
+    g_print ("%s\n", link_str ? link_str : mbim_simulator_get_path (simulator));
+    fflush (stdout);
+
+    /* Loop */
+    loop = g_main_loop_new (NULL, FALSE);
+    g_main_loop_run (loop);
+    g_main_loop_unref (loop);
+
+    if (link_str)
+        g_unlink (link_str);
+    g_object_unref (simulator);
+
+    g_debug ("exiting 'mbim-simulator'...");
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,289 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * mbimcli -- Command line interface to control MBIM devices
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <locale.h>
+#include <string.h>
+
+#include <glib.h>
+#include <gio/gio.h>
+
+#include <libmbim-glib.h>
+
+#include "mbimcli.h"
+
+/* Context */
+typedef struct {
+    MbimDevice *device;
+    GCancellable *cancellable;
+} Context;
+static Context *ctx;
+
+/* Options */
+static gboolean query_proxy_statistics_flag;
+
+static GOptionEntry entries[] = {
+    { "query-proxy-statistics", 0, 0, G_OPTION_ARG_NONE, &query_proxy_statistics_flag,
+      "Query proxy runtime statistics (requires --device-open-proxy)",
+      NULL
+    },
+    { NULL, 0, 0, 0, NULL, NULL, NULL }
+};
+
+GOptionGroup *
+mbimcli_proxy_control_get_option_group (void)
+{
+   GOptionGroup *group;
+
+   group = g_option_group_new ("proxy-control",
+                               "Proxy Control options:",
+                               "Show Proxy Control Service options",
+                               NULL,
+                               NULL);
+   g_option_group_add_entries (group, entries);
+
+   return group;
+}
+
+gboolean
+mbimcli_proxy_control_options_enabled (void)
+{
+    static guint n_actions = 0;
+    static gboolean checked = FALSE;
+
+    if (checked)
+        return !!n_actions;
+
+    n_actions = query_proxy_statistics_flag;
+
+    if (n_actions > 1) {
+        g_printerr ("error: too many Proxy Control actions requested\n");
+        exit (EXIT_FAILURE);
+    }
+
+    checked = TRUE;
+    return !!n_actions;
+}
+
+static void
+context_free (Context *context)
+{
+    if (!context)
+        return;
+
+    if (context->cancellable)
+        g_object_unref (context->cancellable);
+    if (context->device)
+        g_object_unref (context->device);
+    g_slice_free (Context, context);
+}
+
+static void
+shutdown (gboolean operation_status)
+{
+    /* Cleanup context and finish async operation */
+    context_free (ctx);
+    mbimcli_async_operation_done (operation_status);
+}
+
+static gchar *
+build_latency_histogram_string (const guint32 *bounds,
+                                guint32        bounds_count,
+                                const guint32 *histogram,
+                                guint32        histogram_count)
+{
+    GString *str;
+    guint32  i;
+
+    str = g_string_new ("");
+    for (i = 0; i < histogram_count; i++) {
+        if (i > 0)
+            g_string_append (str, ", ");
+        if (i < bounds_count && bounds[i] != G_MAXUINT32)
+            g_string_append_printf (str, "<=%ums: %u", bounds[i], histogram[i]);
+        else
+            g_string_append_printf (str, "more: %u", histogram[i]);
+    }
+    return g_string_free (str, FALSE);
+}
+
+static void
+query_proxy_statistics_ready (MbimDevice   *device,
+                              GAsyncResult *res)
+{
+    g_autoptr(MbimMessage)                    response = NULL;
+    g_autoptr(GError)                         error = NULL;
+    g_autoptr(MbimProxyDeviceStatisticsArray) devices = NULL;
+    g_autoptr(MbimProxyClientStatisticsArray) clients = NULL;
+    g_autoptr(MbimProxyCidStatisticsArray)    cids = NULL;
+    g_autofree guint32                       *latency_bounds = NULL;
+    guint32                                   devices_count;
+    guint32                                   clients_count;
+    guint32                                   latency_bounds_count;
+    guint32                                   cids_count;
+    guint32                                   i;
+
+    response = mbim_device_command_finish (device, res, &error);
+    if (!response || !mbim_message_response_get_result (response, MBIM_MESSAGE_TYPE_COMMAND_DONE, &error)) {
+        g_printerr ("error: operation failed: %s\n", error->message);
+        shutdown (FALSE);
+        return;
+    }
+
+    if (!mbim_message_proxy_control_statistics_response_parse (
+            response,
+            &devices_count,
+            &devices,
+            &clients_count,
+            &clients,
+            &latency_bounds_count,
+            &latency_bounds,
+            &cids_count,
+            &cids,
+            &error)) {
+        g_printerr ("error: couldn't parse response message: %s\n", error->message);
+        shutdown (FALSE);
+        return;
+    }
+
+    g_print ("[%s] Proxy statistics retrieved:\n",
+             mbim_device_get_path_display (device));
+
+    if (devices_count == 0)
+        g_print ("\t Devices: None\n");
+    else {
+        g_print ("\t Devices: (%u)\n", devices_count);
+        for (i = 0; i < devices_count; i++)
+            g_print ("\n"
+                     "\t\t              Path: '%s'\n"
+                     "\t\t           Clients: %u\n"
+                     "\t\t   Requests queued: %u\n"
+                     "\t\tRequests in flight: %u\n"
+                     "\t\t          Requests: %" G_GUINT64_FORMAT "\n"
+                     "\t\t         Responses: %" G_GUINT64_FORMAT "\n"
+                     "\t\t       Indications: %" G_GUINT64_FORMAT "\n"
+                     "\t\t  Query cache hits: %" G_GUINT64_FORMAT "\n"
+                     "\t\t Queries coalesced: %" G_GUINT64_FORMAT "\n",
+                     VALIDATE_UNKNOWN (devices[i]->device_path),
+                     devices[i]->clients,
+                     devices[i]->requests_queued,
+                     devices[i]->requests_in_flight,
+                     devices[i]->requests,
+                     devices[i]->responses,
+                     devices[i]->indications,
+                     devices[i]->query_cache_hits,
+                     devices[i]->queries_coalesced);
+    }
+
+    if (clients_count == 0)
+        g_print ("\t Clients: None\n");
+    else {
+        g_print ("\t Clients: (%u)\n", clients_count);
+        for (i = 0; i < clients_count; i++)
+            g_print ("\n"
+                     "\t\t                  ID: %" G_GUINT64_FORMAT "\n"
+                     "\t\t                 UID: %u\n"
+                     "\t\t              Device: '%s'\n"
+                     "\t\t            Requests: %" G_GUINT64_FORMAT "\n"
+                     "\t\t           Responses: %" G_GUINT64_FORMAT "\n"
+                     "\t\t         Indications: %" G_GUINT64_FORMAT "\n"
+                     "\t\t Indications dropped: %u\n"
+                     "\t\t            Bytes in: %" G_GUINT64_FORMAT "\n"
+                     "\t\t     Bytes in copied: %" G_GUINT64_FORMAT "\n"
+                     "\t\t           Bytes out: %" G_GUINT64_FORMAT "\n"
+                     "\t\t   Output queue size: %u\n"
+                     "\t\t   Output queue peak: %u\n"
+                     "\t\t     Requests queued: %u\n"
+                     "\t\t  Requests in flight: %u\n"
+                     "\t\tQueue wait (average): %u us\n"
+                     "\t\t    Queue wait (max): %u us\n",
+                     clients[i]->client_id,
+                     clients[i]->uid,
+                     VALIDATE_UNKNOWN (clients[i]->device_path),
+                     clients[i]->requests,
+                     clients[i]->responses,
+                     clients[i]->indications,
+                     clients[i]->indications_dropped,
+                     clients[i]->bytes_in,
+                     clients[i]->bytes_in_copied,
+                     clients[i]->bytes_out,
+                     clients[i]->output_queue_size,
+                     clients[i]->output_queue_peak,
+                     clients[i]->requests_queued,
+                     clients[i]->requests_in_flight,
+                     clients[i]->queue_wait_average,
+                     clients[i]->queue_wait_max);
+    }
+
+    if (cids_count == 0)
+        g_print ("\t    CIDs: None\n");
+    else {
+        g_print ("\t    CIDs: (%u)\n", cids_count);
+        for (i = 0; i < cids_count; i++) {
+            MbimService       service;
+            g_autofree gchar *uuid_str = NULL;
+            g_autofree gchar *histogram_str = NULL;
+
+            service = mbim_uuid_to_service (&cids[i]->service_id);
+            uuid_str = mbim_uuid_get_printable (&cids[i]->service_id);
+            histogram_str = build_latency_histogram_string (latency_bounds,
+                                                            latency_bounds_count,
+                                                            cids[i]->latency_histogram,
+                                                            cids[i]->latency_histogram_count);
+
+            g_print ("\n"
+                     "\t\t           Device: '%s'\n"
+                     "\t\t          Service: '%s'\n"
+                     "\t\t             UUID: [%s]\n"
+                     "\t\t              CID: '%s' (%u)\n"
+                     "\t\t        Responses: %u\n"
+                     "\t\tLatency (average): %u ms\n"
+                     "\t\t    Latency (max): %u ms\n"
+                     "\t\tLatency histogram: %s\n",
+                     VALIDATE_UNKNOWN (cids[i]->device_path),
+                     service == MBIM_SERVICE_INVALID ? "unknown" : mbim_service_get_string (service),
+                     uuid_str,
+                     VALIDATE_UNKNOWN (mbim_cid_get_printable (service, cids[i]->cid)),
+                     cids[i]->cid,
+                     cids[i]->responses,
+                     cids[i]->latency_average,
+                     cids[i]->latency_max,
+                     histogram_str);
+        }
+    }
+
+    shutdown (TRUE);
+}
+
+void
+mbimcli_proxy_control_run (MbimDevice   *device,
+                           GCancellable *cancellable)
+{
+    g_autoptr(MbimMessage) request = NULL;
+
+    /* Initialize context */
+    ctx = g_slice_new (Context);
+    ctx->device = g_object_ref (device);
+    ctx->cancellable = cancellable ? g_object_ref (cancellable) : NULL;
+
+    /* Request to query proxy statistics */
+    if (query_proxy_statistics_flag) {
+        g_debug ("Asynchronously querying proxy statistics...");
+        request = mbim_message_proxy_control_statistics_query_new (NULL);
+        mbim_device_command (ctx->device,
+                             request,
+                             10,
+                             ctx->cancellable,
+                             (GAsyncReadyCallback)query_proxy_statistics_ready,
+                             NULL);
+        return;
+    }
+
+    g_warn_if_reached ();
+}
@@ -40,6 +40,8 @@ static gchar *device_str;
 static gboolean device_open_proxy_flag;
 static gboolean device_open_ms_mbimex_v2_flag;
 static gboolean device_open_ms_mbimex_v3_flag;
+static gboolean device_open_pipeline_flag;
+static gchar *device_profile_dir_str;
 static gchar *no_open_str;
 static gboolean no_close_flag;
 static gboolean noop_flag;
@@ -66,6 +68,14 @@ static GOptionEntry main_entries[] = {
       "Request to enable Microsoft MBIMEx v3.0 support",
       NULL
     },
+    { "device-open-pipeline", 0, 0, G_OPTION_ARG_NONE, &device_open_pipeline_flag,
+      "Overlap the requests of the open sequence and reuse known device services",
+      NULL
+    },
+    { "device-profile-dir", 0, 0, G_OPTION_ARG_FILENAME, &device_profile_dir_str,
+      "Store and reuse the device profile in the given directory",
+      "[PATH]"
+    },
     { "no-open", 0, 0, G_OPTION_ARG_STRING, &no_open_str,
       "Do not explicitly open the MBIM device before running the command",
       "[Transaction ID]"
@@ -197,15 +207,27 @@ print_version_and_exit (void)
 
 /*****************************************************************************/
 
+static gboolean
+printable_chunk_print (const gchar  *chunk,
+                       gsize         chunk_length,
+                       gpointer      user_data,
+                       GError      **error)
+{
+    if (fwrite (chunk, 1, chunk_length, stdout) != chunk_length) {
+        g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_FAILED, "couldn't write to stdout");
+        return FALSE;
+    }
+    return TRUE;
+}
+
 G_GNUC_NORETURN
 static void
 print_printable_str_and_exit (const gchar *hex)
 {
-    g_autofree gchar       *printable = NULL;
     g_autoptr(MbimMessage)  message = NULL;
     g_autoptr(GError)       error = NULL;
     gsize                   data_size = 0;
-    g_autofree guint8      *data      = NULL;
+    guint8                 *data;
 
     data = mbimcli_read_buffer_from_string (hex, -1, &data_size, &error);
     if (!data) {
@@ -213,19 +235,20 @@ print_printable_str_and_exit (const gchar *hex)
         exit (EXIT_FAILURE);
     }
 
-    message = mbim_message_new (data, data_size);
+    message = mbim_message_new_take (data, data_size);
     if (!mbim_message_validate (message, &error)) {
         g_printerr ("error: message validation failed: %s\n", error->message);
         exit (EXIT_FAILURE);
     }
 
-    printable = mbim_message_get_printable_full (message, 1, 0, "---- ", FALSE, &error);
-    if (!printable) {
+    /* Stream the printable info, so that large messages don't need to be
+     * fully built in memory */
+    if (!mbim_message_write_printable (message, 1, 0, "---- ", FALSE, printable_chunk_print, NULL, &error)) {
         g_printerr ("error: printable info retrieval failed: %s\n", error->message);
         exit (EXIT_FAILURE);
     }
 
-    g_print ("%s\n", printable);
+    g_print ("\n");
     exit (EXIT_SUCCESS);
 }
 
@@ -357,11 +380,13 @@ device_open_ready (MbimDevice   *dev,
     case MBIM_SERVICE_GOOGLE:
         mbimcli_google_run (dev, cancellable);
         return;
+    case MBIM_SERVICE_PROXY_CONTROL:
+        mbimcli_proxy_control_run (dev, cancellable);
+        return;
     case MBIM_SERVICE_SMS:
     case MBIM_SERVICE_USSD:
     case MBIM_SERVICE_STK:
     case MBIM_SERVICE_AUTH:
-    case MBIM_SERVICE_PROXY_CONTROL:
     case MBIM_SERVICE_QMI:
     case MBIM_SERVICE_QDU:
     case MBIM_SERVICE_INTEL_TOOLS:
@@ -388,6 +413,12 @@ device_new_ready (GObject      *unused,
         exit (EXIT_FAILURE);
     }
 
+    /* Setup the device profile storage */
+    if (device_profile_dir_str)
+        g_object_set (device,
+                      MBIM_DEVICE_PROFILE_DIR, device_profile_dir_str,
+                      NULL);
+
     /* Set the in-session setup */
     if (no_open_str) {
         guint transaction_id;
@@ -411,6 +442,8 @@ device_new_ready (GObject      *unused,
         open_flags |= MBIM_DEVICE_OPEN_FLAGS_MS_MBIMEX_V2;
     if (device_open_ms_mbimex_v3_flag)
         open_flags |= MBIM_DEVICE_OPEN_FLAGS_MS_MBIMEX_V3;
+    if (device_open_pipeline_flag)
+        open_flags |= MBIM_DEVICE_OPEN_FLAGS_PIPELINE;
 
     /* Open the device */
     mbim_device_open_full (device,
@@ -511,6 +544,15 @@ parse_actions (void)
         actions_enabled++;
     }
 
+    if (mbimcli_proxy_control_options_enabled ()) {
+        if (!device_open_proxy_flag) {
+            g_printerr ("error: proxy control actions require --device-open-proxy\n");
+            exit (EXIT_FAILURE);
+        }
+        service = MBIM_SERVICE_PROXY_CONTROL;
+        actions_enabled++;
+    }
+
     /* Noop */
     if (noop_flag)
         actions_enabled++;
@@ -562,6 +604,7 @@ int main (int argc, char **argv)
     g_option_context_add_group (context, mbimcli_intel_mutual_authentication_get_option_group ());
     g_option_context_add_group (context, mbimcli_intel_tools_get_option_group ());
     g_option_context_add_group (context, mbimcli_google_get_option_group());
+    g_option_context_add_group (context, mbimcli_proxy_control_get_option_group ());
     g_option_context_add_main_entries (context, main_entries, NULL);
     if (!g_option_context_parse (context, &argc, &argv, &error)) {
         g_printerr ("error: %s\n", error->message);
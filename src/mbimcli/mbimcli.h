@@ -34,6 +34,7 @@ GOptionGroup *mbimcli_ms_uicc_low_level_access_get_option_group    (void);
 GOptionGroup *mbimcli_intel_mutual_authentication_get_option_group (void);
 GOptionGroup *mbimcli_intel_tools_get_option_group                 (void);
 GOptionGroup *mbimcli_google_get_option_group                      (void);
+GOptionGroup *mbimcli_proxy_control_get_option_group               (void);
 
 gboolean      mbimcli_basic_connect_options_enabled               (void);
 gboolean      mbimcli_phonebook_options_enabled                   (void);
@@ -51,6 +52,7 @@ gboolean      mbimcli_ms_uicc_low_level_access_options_enabled    (void);
 gboolean      mbimcli_intel_mutual_authentication_options_enabled (void);
 gboolean      mbimcli_intel_tools_options_enabled                 (void);
 gboolean      mbimcli_google_options_enabled                      (void);
+gboolean      mbimcli_proxy_control_options_enabled               (void);
 
 void          mbimcli_basic_connect_run                 (MbimDevice   *device,
                                                          GCancellable *cancellable);
@@ -84,6 +86,8 @@ void          mbimcli_intel_tools_run                   (MbimDevice   *device,
                                                          GCancellable *cancellable);
 void          mbimcli_google_run                        (MbimDevice   *device,
                                                          GCancellable *cancellable);
+void          mbimcli_proxy_control_run                 (MbimDevice   *device,
+                                                         GCancellable *cancellable);
 
 
 /* link management */